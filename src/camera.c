@@ -0,0 +1,374 @@
+#include "headers/camera.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/videodev2.h>
+#include <math.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+struct VtxCamera
+{
+  gchar *device;
+  gchar *card;
+  gint fd;
+  GHashTable *controls;  // v4l2-ctl style name -> control id, as enumerated from the device
+  guint sets;
+  guint failures;
+  gint64 last_set_us;
+  gint64 max_set_us;
+  gchar *last_error;
+};
+
+VtxCamera *g_camera = NULL;
+
+static const CameraControlAlias s_aliases[] = {
+    {"profile", V4L2_CID_MPEG_VIDEO_H264_PROFILE},         //
+    {"level", V4L2_CID_MPEG_VIDEO_H264_LEVEL},             //
+    {"bitrate", V4L2_CID_MPEG_VIDEO_BITRATE},              // bit/s
+    {"bitrate_mode", V4L2_CID_MPEG_VIDEO_BITRATE_MODE},    //
+    {"gop", V4L2_CID_MPEG_VIDEO_GOP_SIZE},                 //
+    {"i_period", V4L2_CID_MPEG_VIDEO_H264_I_PERIOD},       //
+    {"exposure_auto", V4L2_CID_EXPOSURE_AUTO},             //
+    {"exposure", V4L2_CID_EXPOSURE_ABSOLUTE},              // 100 us units
+    {"white_balance_auto", V4L2_CID_AUTO_WHITE_BALANCE},   //
+    {"white_balance", V4L2_CID_WHITE_BALANCE_TEMPERATURE}, // kelvin
+};
+
+// Retries an ioctl interrupted by a signal.
+static gint vtx_camera_ioctl(gint fd, gulong request, gpointer arg)
+{
+  gint ret;
+  do
+  {
+    ret = ioctl(fd, request, arg);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+// Turns a control or menu item name into the form v4l2-ctl prints: lower case, runs of other characters become one '_'.
+static gchar *vtx_camera_normalize(const gchar *name)
+{
+  GString *out = g_string_new(NULL);
+  for (const gchar *p = name; *p; p++)
+  {
+    if (g_ascii_isalnum(*p))
+    {
+      g_string_append_c(out, g_ascii_tolower(*p));
+    }
+    else if (out->len > 0 && out->str[out->len - 1] != '_')
+    {
+      g_string_append_c(out, '_');
+    }
+  }
+  if (out->len > 0 && out->str[out->len - 1] == '_') g_string_truncate(out, out->len - 1);
+  return g_string_free(out, FALSE);
+}
+
+// Iterator predicate matching V4L2 source elements: a source with a "device" string property naming a /dev/video node.
+static gint vtx_camera_compare_source(gconstpointer a, gconstpointer b)
+{
+  GstElement *element = g_value_get_object((const GValue *) a);
+  if (GST_IS_BIN(element) || !GST_OBJECT_FLAG_IS_SET(element, GST_ELEMENT_FLAG_SOURCE)) return 1;
+
+  GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), "device");
+  if (!pspec || G_PARAM_SPEC_VALUE_TYPE(pspec) != G_TYPE_STRING) return 1;
+
+  gchar *device = NULL;
+  g_object_get(element, "device", &device, NULL);
+  gboolean v4l2 = device && g_str_has_prefix(device, "/dev/video");
+  g_free(device);
+  return v4l2 ? 0 : 1;
+}
+
+// Returns the device node of the pipeline's V4L2 source, or NULL if it has none.
+static gchar *vtx_camera_find_device(GstElement *pipeline)
+{
+  gchar *device = NULL;
+  GValue item = G_VALUE_INIT;
+
+  GstIterator *it = gst_bin_iterate_recurse(GST_BIN(pipeline));
+  if (gst_iterator_find_custom(it, vtx_camera_compare_source, &item, NULL))
+  {
+    g_object_get(g_value_get_object(&item), "device", &device, NULL);
+    g_value_unset(&item);
+  }
+  gst_iterator_free(it);
+
+  return device;
+}
+
+// Enumerates the device's controls under their v4l2-ctl names.
+static void vtx_camera_enumerate(VtxCamera *camera)
+{
+  struct v4l2_queryctrl query = {.id = V4L2_CTRL_FLAG_NEXT_CTRL};
+  while (vtx_camera_ioctl(camera->fd, VIDIOC_QUERYCTRL, &query) == 0)
+  {
+    if (query.type != V4L2_CTRL_TYPE_CTRL_CLASS && !(query.flags & V4L2_CTRL_FLAG_DISABLED))
+    {
+      g_hash_table_insert(camera->controls, vtx_camera_normalize((const gchar *) query.name), GUINT_TO_POINTER(query.id));
+    }
+    query.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+  }
+}
+
+// Looks the control up by alias or device name and queries its type, range and flags. Rejects controls that cannot be set.
+static gboolean vtx_camera_query(VtxCamera *camera, const gchar *name, struct v4l2_queryctrl *query, gchar **error_msg)
+{
+  gchar *key = vtx_camera_normalize(name);
+  guint32 id = GPOINTER_TO_UINT(g_hash_table_lookup(camera->controls, key));
+  for (guint i = 0; i < G_N_ELEMENTS(s_aliases) && !id; i++)
+  {
+    if (g_strcmp0(s_aliases[i].name, key) == 0) id = s_aliases[i].id;
+  }
+  g_free(key);
+
+  memset(query, 0, sizeof(*query));
+  query->id = id;
+  if (!id || vtx_camera_ioctl(camera->fd, VIDIOC_QUERYCTRL, query) < 0 || (query->flags & V4L2_CTRL_FLAG_DISABLED))
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s has no control %s", camera->device, name);
+    return FALSE;
+  }
+  if (query->flags & V4L2_CTRL_FLAG_READ_ONLY)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s is read-only", name);
+    return FALSE;
+  }
+  if (query->flags & V4L2_CTRL_FLAG_GRABBED)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s cannot change while the camera is streaming", name);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Returns the index of the menu item with the given name, or -1.
+static gint64 vtx_camera_menu_index(VtxCamera *camera, const struct v4l2_queryctrl *query, const gchar *item)
+{
+  gint64 index = -1;
+  gchar *wanted = vtx_camera_normalize(item);
+  for (gint i = query->minimum; i <= query->maximum && index < 0; i++)
+  {
+    struct v4l2_querymenu menu = {.id = query->id, .index = (guint32) i};
+    if (vtx_camera_ioctl(camera->fd, VIDIOC_QUERYMENU, &menu) < 0) continue;
+
+    gchar *name = vtx_camera_normalize((const gchar *) menu.name);
+    if (g_strcmp0(name, wanted) == 0) index = i;
+    g_free(name);
+  }
+  g_free(wanted);
+  return index;
+}
+
+// Converts a JSON value to the control's value and checks it against the queried range, step and menu items.
+static gboolean vtx_camera_convert(VtxCamera *camera, const gchar *name, const struct v4l2_queryctrl *query, JsonNode *node, gint64 *value, gchar **error_msg)
+{
+  GType type = JSON_NODE_TYPE(node) == JSON_NODE_VALUE ? json_node_get_value_type(node) : G_TYPE_INVALID;
+  gboolean menu = query->type == V4L2_CTRL_TYPE_MENU || query->type == V4L2_CTRL_TYPE_INTEGER_MENU;
+
+  if (query->type != V4L2_CTRL_TYPE_INTEGER && query->type != V4L2_CTRL_TYPE_BOOLEAN && query->type != V4L2_CTRL_TYPE_INTEGER64 && !menu)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s is not an integer, boolean or menu control", name);
+    return FALSE;
+  }
+
+  if (type == G_TYPE_BOOLEAN)
+  {
+    *value = json_node_get_boolean(node);
+  }
+  else if (type == G_TYPE_INT64)
+  {
+    *value = json_node_get_int(node);
+  }
+  else if (type == G_TYPE_DOUBLE)
+  {
+    // Controls are integers: 1.5 is refused rather than truncated to 1
+    gdouble number = json_node_get_double(node);
+    if (number != floor(number) || number < (gdouble) G_MININT64 || number >= -(gdouble) G_MININT64)
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s=%g is not an integer", name, number);
+      return FALSE;
+    }
+    *value = (gint64) number;
+  }
+  else if (type == G_TYPE_STRING && query->type == V4L2_CTRL_TYPE_MENU)
+  {
+    *value = vtx_camera_menu_index(camera, query, json_node_get_string(node));
+    if (*value < 0)
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s has no item %s", name, json_node_get_string(node));
+      return FALSE;
+    }
+  }
+  else
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Invalid value for %s", name);
+    return FALSE;
+  }
+
+  // The 32-bit range of VIDIOC_QUERYCTRL does not describe 64-bit controls; the driver checks those
+  if (query->type == V4L2_CTRL_TYPE_INTEGER64) return TRUE;
+
+  gboolean in_range = *value >= query->minimum && *value <= query->maximum;
+  if (in_range && query->type == V4L2_CTRL_TYPE_INTEGER && query->step > 1) in_range = (*value - query->minimum) % query->step == 0;
+  if (in_range && menu)
+  {
+    struct v4l2_querymenu item = {.id = query->id, .index = (guint32) *value};
+    in_range = vtx_camera_ioctl(camera->fd, VIDIOC_QUERYMENU, &item) == 0;
+  }
+  if (!in_range)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s=%" G_GINT64_FORMAT " is outside %d..%d (step %d)", name, *value, query->minimum, query->maximum, query->step);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Validates every control, then sets them with one VIDIOC_S_EXT_CTRLS and reads back the values the driver kept into
+// applied (which may be NULL). Nothing is set if any control is invalid.
+gboolean vtx_camera_set_controls(VtxCamera *camera, JsonObject *controls, JsonObject *applied, gchar **error_msg)
+{
+  gint64 start_us = g_get_monotonic_time();
+  GList *names = json_object_get_members(controls);
+  guint count = g_list_length(names);
+  struct v4l2_ext_control *ctrls = g_new0(struct v4l2_ext_control, MAX(count, 1));
+  gboolean *is_64 = g_new0(gboolean, MAX(count, 1));
+  gchar *error = NULL;
+
+  guint i = 0;
+  for (GList *l = names; l && !error; l = l->next, i++)
+  {
+    struct v4l2_queryctrl query;
+    gint64 value = 0;
+    if (!vtx_camera_query(camera, l->data, &query, &error) || !vtx_camera_convert(camera, l->data, &query, json_object_get_member(controls, l->data), &value, &error)) break;
+
+    ctrls[i].id = query.id;
+    is_64[i] = query.type == V4L2_CTRL_TYPE_INTEGER64;
+    if (is_64[i])
+    {
+      ctrls[i].value64 = value;
+    }
+    else
+    {
+      ctrls[i].value = (gint32) value;
+    }
+  }
+
+  struct v4l2_ext_controls ext = {.which = V4L2_CTRL_WHICH_CUR_VAL, .count = count, .controls = ctrls};
+  if (!error && count > 0 && vtx_camera_ioctl(camera->fd, VIDIOC_S_EXT_CTRLS, &ext) < 0)
+  {
+    const gchar *failed = ext.error_idx < count ? g_list_nth_data(names, ext.error_idx) : "controls";
+    error = g_strdup_printf("Setting %s on %s failed: %s", failed, camera->device, g_strerror(errno));
+  }
+
+  // Drivers round to what the hardware supports, so the reply carries the values read back
+  if (!error && applied && vtx_camera_ioctl(camera->fd, VIDIOC_G_EXT_CTRLS, &ext) == 0)
+  {
+    i = 0;
+    for (GList *l = names; l; l = l->next, i++)
+    {
+      json_object_set_int_member(applied, l->data, is_64[i] ? ctrls[i].value64 : ctrls[i].value);
+    }
+  }
+  g_list_free(names);
+  g_free(ctrls);
+  g_free(is_64);
+
+  camera->last_set_us = g_get_monotonic_time() - start_us;
+  camera->max_set_us = MAX(camera->max_set_us, camera->last_set_us);
+  if (error)
+  {
+    camera->failures++;
+    g_free(camera->last_error);
+    camera->last_error = g_strdup(error);
+    if (error_msg)
+    {
+      *error_msg = error;
+    }
+    else
+    {
+      g_free(error);
+    }
+    return FALSE;
+  }
+
+  camera->sets++;
+  return TRUE;
+}
+
+// Opens the pipeline's V4L2 camera and applies the session's controls: the H264 profile the browser can decode, then the
+// camera_controls object. Returns NULL if the pipeline has no V4L2 source. Failed controls are logged, the session goes on.
+VtxCamera *vtx_camera_attach(GstElement *pipeline, const gchar *video_profile, JsonObject *controls)
+{
+  gchar *device = vtx_camera_find_device(pipeline);
+  if (!device) return NULL;
+
+  gint fd = open(device, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0)
+  {
+    gst_printerrln("Camera controls: cannot open %s: %s", device, g_strerror(errno));
+    g_free(device);
+    return NULL;
+  }
+
+  VtxCamera *camera = g_new0(VtxCamera, 1);
+  camera->device = device;
+  camera->fd = fd;
+  camera->controls = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  struct v4l2_capability cap = {0};
+  camera->card = g_strdup(vtx_camera_ioctl(fd, VIDIOC_QUERYCAP, &cap) == 0 ? (const gchar *) cap.card : "unknown");
+  vtx_camera_enumerate(camera);
+  gst_println("Camera controls: %s (%s), %u controls", camera->device, camera->card, g_hash_table_size(camera->controls));
+
+  gchar *error = NULL;
+  if (video_profile)
+  {
+    JsonObject *profile = json_object_new();
+    json_object_set_string_member(profile, "profile", video_profile);
+    if (!vtx_camera_set_controls(camera, profile, NULL, &error))
+    {
+      gst_printerrln("Camera controls: H264 profile %s: %s", video_profile, error);
+      g_clear_pointer(&error, g_free);
+    }
+    json_object_unref(profile);
+  }
+
+  if (controls && !vtx_camera_set_controls(camera, controls, NULL, &error))
+  {
+    gst_printerrln("Camera controls: %s", error);
+    g_free(error);
+  }
+
+  return camera;
+}
+
+// Closes the camera device and frees the control table.
+void vtx_camera_free(VtxCamera *camera)
+{
+  if (!camera) return;
+
+  close(camera->fd);
+  g_hash_table_destroy(camera->controls);
+  g_free(camera->device);
+  g_free(camera->card);
+  g_free(camera->last_error);
+  g_free(camera);
+}
+
+// Returns the device, the number of controls and the set count, failures and timing.
+JsonObject *vtx_camera_get_stats(VtxCamera *camera)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_string_member(stats, "device", camera->device);
+  json_object_set_string_member(stats, "card", camera->card);
+  json_object_set_int_member(stats, "controls", g_hash_table_size(camera->controls));
+  json_object_set_int_member(stats, "sets", camera->sets);
+  json_object_set_int_member(stats, "failures", camera->failures);
+  json_object_set_int_member(stats, "last_set_us", camera->last_set_us);
+  json_object_set_int_member(stats, "max_set_us", camera->max_set_us);
+  if (camera->last_error) json_object_set_string_member(stats, "last_error", camera->last_error);
+  return stats;
+}
@@ -285,3 +285,10 @@ JsonObject *vtx_supported_codec_inspection(void)
   json_object_set_array_member(codec_list, "audio", audio_codecs_array);
   return codec_list;
 }
+
+// Returns the NULL-terminated list of encoder names serviceable on this platform, initializing it on first use.
+const gchar **vtx_serviceable_codecs(void)
+{
+  if (!s_supported_codecs_initialized) vtx_platform_serviceable_codecs();
+  return s_platform_serviceable_codecs;
+}
@@ -0,0 +1,245 @@
+#include "headers/codec_branch.h"
+
+#include <gst/webrtc/webrtc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/inspection.h"
+#include "headers/rtp.h"
+
+// Codec families in offer order: the most bandwidth-efficient codec the viewer accepts wins.
+static const CodecFamily s_codec_families[CODEC_BRANCH_MAX] = {
+    {"AV1", "video/x-av1", "av1parse ! rtpav1pay", NULL},                                                                                                                                                 //
+    {"H265", "video/x-h265", "h265parse ! rtph265pay config-interval=-1", NULL},                                                                                                                          //
+    {"VP9", "video/x-vp9", "rtpvp9pay", NULL},                                                                                                                                                            //
+    {"H264", "video/x-h264", "h264parse ! rtph264pay config-interval=-1 aggregate-mode=zero-latency", "packetization-mode=(string)1,profile-level-id=(string)42e01f,level-asymmetry-allowed=(string)1"},  //
+    {"VP8", "video/x-vp8", "rtpvp8pay", NULL},                                                                                                                                                            //
+};
+
+static const EncoderTuning s_encoder_tunings[] = {
+    {"x264enc", "tune=zerolatency speed-preset=ultrafast"},  //
+    {"x265enc", "tune=zerolatency speed-preset=ultrafast"},  //
+    {"vp8enc", "deadline=1 cpu-used=8"},                     //
+    {"vp9enc", "deadline=1 cpu-used=8 row-mt=true"},         //
+    {"svtav1enc", "preset=12"},                              //
+};
+
+typedef struct
+{
+  const CodecFamily *family;
+  const gchar *factory;
+  guint payload_type;
+} CodecBranch;
+
+// Branches of the pipeline most recently described; index i feeds CODEC_BRANCH_SELECTOR.sink_<i>
+static CodecBranch s_branches[CODEC_BRANCH_MAX];
+static guint s_branch_count = 0;
+
+// Returns the codec family produced by the encoder factory (from its src pad template), or NULL if none matches.
+static const CodecFamily *vtx_codec_branch_family(GstElementFactory *factory)
+{
+  for (const GList *t = gst_element_factory_get_static_pad_templates(factory); t != NULL; t = t->next)
+  {
+    GstStaticPadTemplate *tpl = (GstStaticPadTemplate *) t->data;
+    if (tpl->direction != GST_PAD_SRC) continue;
+
+    GstCaps *caps = gst_static_pad_template_get_caps(tpl);
+    for (guint i = 0; i < gst_caps_get_size(caps); i++)
+    {
+      const gchar *name = gst_structure_get_name(gst_caps_get_structure(caps, i));
+      for (guint f = 0; f < G_N_ELEMENTS(s_codec_families); f++)
+      {
+        if (g_strcmp0(name, s_codec_families[f].media_type) == 0)
+        {
+          gst_caps_unref(caps);
+          return &s_codec_families[f];
+        }
+      }
+    }
+    gst_caps_unref(caps);
+  }
+  return NULL;
+}
+
+// Returns the low-latency properties for the given encoder, or an empty string.
+const gchar *vtx_codec_branch_tuning(const gchar *factory)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(s_encoder_tunings); i++)
+  {
+    if (g_strcmp0(factory, s_encoder_tunings[i].factory) == 0) return s_encoder_tunings[i].properties;
+  }
+  return "";
+}
+
+// Returns the payloader name for the given branch; the first branch keeps "videopay" so the media hooks add its header
+// extensions.
+static gchar *vtx_codec_branch_pay_name(guint index)
+{
+  return index == 0 ? g_strdup("videopay") : g_strdup_printf("videopay_%u", index);
+}
+
+// Builds a video pipeline description that feeds the raw source into one valve-gated encoder branch per codec family
+// available on this platform, all joined by an input-selector. Returns NULL if no video encoder is available.
+gchar *vtx_codec_branch_describe(const gchar *source_pipeline, guint video_payload_type, guint audio_payload_type)
+{
+  const gchar **codecs = vtx_serviceable_codecs();
+  guint pt = video_payload_type ? video_payload_type : CODEC_BRANCH_DEFAULT_PAYLOAD_TYPE;
+  guint32 ssrc = g_random_int();
+
+  s_branch_count = 0;
+
+  // Pick the first serviceable encoder of each family, in family order
+  for (guint f = 0; f < G_N_ELEMENTS(s_codec_families); f++)
+  {
+    for (guint i = 0; codecs[i] != NULL; i++)
+    {
+      GstElementFactory *factory = gst_element_factory_find(codecs[i]);
+      if (!factory) continue;
+
+      const CodecFamily *family = vtx_codec_branch_family(factory);
+      gst_object_unref(factory);
+      if (family != &s_codec_families[f]) continue;
+
+      if (pt == audio_payload_type) pt++;
+      s_branches[s_branch_count].family = family;
+      s_branches[s_branch_count].factory = codecs[i];
+      s_branches[s_branch_count].payload_type = pt++;
+      s_branch_count++;
+      break;
+    }
+  }
+
+  if (s_branch_count == 0)
+  {
+    gst_printerrln("No serviceable video encoder found for multi-codec offer");
+    return NULL;
+  }
+
+  GString *desc = g_string_new(NULL);
+  g_string_append_printf(desc, "%s ! tee name=" CODEC_BRANCH_SOURCE_TEE " allow-not-linked=true ", source_pipeline);
+
+  for (guint i = 0; i < s_branch_count; i++)
+  {
+    const CodecBranch *b = &s_branches[i];
+    gchar *pay_name = vtx_codec_branch_pay_name(i);
+    const gchar *convert = g_str_has_prefix(b->factory, "nvv4l2") ? "nvvidconv ! video/x-raw(memory:NVMM),format=NV12" : "videoconvert";
+
+    // All payloaders share one SSRC so the sender keeps a single RTP stream whichever branch is active
+    g_string_append_printf(desc, CODEC_BRANCH_SOURCE_TEE ". ! queue max-size-buffers=1 leaky=downstream ! valve name=vvalve%u drop=true ! %s ! %s %s ! %s name=%s pt=%u ssrc=%u ! " CODEC_BRANCH_SELECTOR ".sink_%u ", i, convert, b->factory, vtx_codec_branch_tuning(b->factory), b->family->parse_pay, pay_name, b->payload_type, ssrc, i);
+    gst_println("Codec branch %u: %s (%s, pt=%u)", i, b->family->encoding_name, b->factory, b->payload_type);
+    g_free(pay_name);
+  }
+
+  g_string_append(desc, "input-selector name=" CODEC_BRANCH_SELECTOR);
+  return g_string_free(desc, FALSE);
+}
+
+// Adds header extensions to the secondary payloaders and offers every branch codec on the video transceiver.
+void vtx_codec_branch_setup(GstElement *pipeline, GstElement *webrtc)
+{
+  // The primary "videopay" gets its extensions from vtx_pipeline_start
+  for (guint i = 1; i < s_branch_count; i++)
+  {
+    gchar *pay_name = vtx_codec_branch_pay_name(i);
+    GstElement *pay = gst_bin_get_by_name(GST_BIN(pipeline), pay_name);
+    if (pay) vtx_rtp_add_video_header_extensions(pay);
+    g_free(pay_name);
+  }
+
+  GstCaps *preferences = gst_caps_new_empty();
+  for (guint i = 0; i < s_branch_count; i++)
+  {
+    const CodecBranch *b = &s_branches[i];
+    GstStructure *s = gst_structure_new("application/x-rtp", "media", G_TYPE_STRING, "video", "encoding-name", G_TYPE_STRING, b->family->encoding_name, "payload", G_TYPE_INT, b->payload_type, "clock-rate", G_TYPE_INT, 90000, NULL);
+    if (b->family->fmtp)
+    {
+      gchar *caps_str = g_strdup_printf("application/x-rtp,%s", b->family->fmtp);
+      GstStructure *fmtp = gst_structure_from_string(caps_str, NULL);
+      if (fmtp)
+      {
+        for (gint f = 0; f < gst_structure_n_fields(fmtp); f++)
+        {
+          const gchar *field = gst_structure_nth_field_name(fmtp, f);
+          gst_structure_set_value(s, field, gst_structure_get_value(fmtp, field));
+        }
+        gst_structure_free(fmtp);
+      }
+      g_free(caps_str);
+    }
+    gst_caps_append_structure(preferences, s);
+  }
+
+  GArray *transceivers = NULL;
+  g_signal_emit_by_name(webrtc, "get-transceivers", &transceivers);
+  if (transceivers && transceivers->len > 0)
+  {
+    GstWebRTCRTPTransceiver *trans = g_array_index(transceivers, GstWebRTCRTPTransceiver *, 0);
+    g_object_set(trans, "codec-preferences", preferences, NULL);
+  }
+  if (transceivers) g_array_unref(transceivers);
+
+  gchar *caps_str = gst_caps_to_string(preferences);
+  gst_println("Video codec preferences: %s", caps_str);
+  g_free(caps_str);
+  gst_caps_unref(preferences);
+}
+
+// Returns the encoding name of the first (preferred) format of the answered video section, or NULL.
+static gchar *vtx_codec_branch_answered_encoding(const GstSDPMessage *answer)
+{
+  for (guint i = 0; i < gst_sdp_message_medias_len(answer); i++)
+  {
+    const GstSDPMedia *media = gst_sdp_message_get_media(answer, i);
+    if (g_strcmp0(gst_sdp_media_get_media(media), "video") != 0 || gst_sdp_media_get_port(media) == 0) continue;
+    if (gst_sdp_media_formats_len(media) == 0) return NULL;
+
+    gint pt = atoi(gst_sdp_media_get_format(media, 0));
+    GstCaps *caps = gst_sdp_media_get_caps_from_media(media, pt);
+    if (!caps) return NULL;
+
+    gchar *encoding_name = g_strdup(gst_structure_get_string(gst_caps_get_structure(caps, 0), "encoding-name"));
+    gst_caps_unref(caps);
+    return encoding_name;
+  }
+  return NULL;
+}
+
+// Opens the branch whose codec the viewer chose in the SDP answer and switches the selector to it. The other
+// encoders stay starved behind their valves, so only one encoder ever runs.
+gboolean vtx_codec_branch_select(GstElement *pipeline, const GstSDPMessage *answer)
+{
+  GstElement *selector = pipeline ? gst_bin_get_by_name(GST_BIN(pipeline), CODEC_BRANCH_SELECTOR) : NULL;
+  if (!selector) return FALSE;
+
+  gchar *encoding_name = vtx_codec_branch_answered_encoding(answer);
+  gboolean selected = FALSE;
+
+  for (guint i = 0; encoding_name && i < s_branch_count && !selected; i++)
+  {
+    if (g_ascii_strcasecmp(encoding_name, s_branches[i].family->encoding_name) != 0) continue;
+
+    gchar *pad_name = g_strdup_printf("sink_%u", i);
+    gchar *valve_name = g_strdup_printf("vvalve%u", i);
+    GstPad *pad = gst_element_get_static_pad(selector, pad_name);
+    GstElement *valve = gst_bin_get_by_name(GST_BIN(pipeline), valve_name);
+
+    if (pad && valve)
+    {
+      g_object_set(selector, "active-pad", pad, NULL);
+      g_object_set(valve, "drop", FALSE, NULL);
+      gst_println("Viewer selected %s, activating %s", encoding_name, s_branches[i].factory);
+      selected = TRUE;
+    }
+
+    if (pad) gst_object_unref(pad);
+    if (valve) gst_object_unref(valve);
+    g_free(pad_name);
+    g_free(valve_name);
+  }
+
+  if (!selected) gst_printerrln("No encoder branch matches the answered video codec %s", encoding_name ? encoding_name : "(none)");
+
+  g_free(encoding_name);
+  gst_object_unref(selector);
+  return selected;
+}
@@ -218,6 +218,16 @@ void vtx_dc_create_offer(GstElement *webrtc)
   }
 }
 
+// Creates the channels whose source only exists once a session has started (WPA_SUPPLICANT) on a webrtcbin whose offer was
+// created ahead of the session; they open over the already negotiated SCTP association.
+void vtx_dc_create_late_channels(GstElement *webrtc)
+{
+  if (g_wpa_supplicant && !dc_wpa_supplicant)
+  {
+    vtx_dc_create_wpa_channels(webrtc);
+  }
+}
+
 // Incoming open data channel (Do not use)
 
 // Logs a string message received on an incoming DataChannel (not currently used in production).
@@ -1,9 +1,301 @@
+#include "headers/camera.h"
 #include "headers/data_channel.h"
+#include "headers/dtls.h"
+#include "headers/dvr.h"
+#include "headers/fallback.h"
+#include "headers/graph.h"
+#include "headers/latency.h"
+#include "headers/netmon.h"
+#include "headers/pacer.h"
+#include "headers/reconfig.h"
+#include "headers/recorder.h"
+#include "headers/scene.h"
+#include "headers/spare.h"
+#include "headers/standby.h"
+#include "headers/svc.h"
+#include "headers/tap.h"
+#include "headers/tracks.h"
 #include "headers/utils.h"
+#include "headers/watchdog.h"
+#include "headers/webrtc.h"
+#include "headers/whip.h"
 
 // Global CMD data channel reference
 GObject *dc_cmd = NULL;
 
+// CPU usage in the stats reply covers the time since the previous request
+static CpuSample s_stats_cpu = {0};
+
+// Replies on the CMD channel with the current streaming statistics (pacer queue-delay histogram, temporal layers, encoder-to-packet latency, scene rate control, startup timing, per-viewer fan-out, pre-negotiated spare, ICE recovery, per-interface paths, DTLS certificate and handshake time, WHIP publishing, local tap readers, recording, DVR ring, live reconfiguration switch times, source fallback and encoder failover, branch watchdog restarts, graph build times, camera control timing, video track states, process CPU usage).
+static void vtx_dc_send_stats(GObject *dc)
+{
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", CMD_GET_STATS);
+  if (g_pacer)
+  {
+    json_object_set_object_member(reply, "pacer", vtx_pacer_get_stats(g_pacer));
+  }
+  if (g_svc)
+  {
+    json_object_set_object_member(reply, "svc", vtx_svc_get_stats(g_svc));
+  }
+  if (g_latency)
+  {
+    json_object_set_object_member(reply, "latency", vtx_latency_get_stats(g_latency));
+  }
+  if (g_scene)
+  {
+    json_object_set_object_member(reply, "scene", vtx_scene_get_stats(g_scene));
+  }
+  if (g_tap)
+  {
+    json_object_set_object_member(reply, "tap", vtx_tap_get_stats(g_tap));
+  }
+  if (g_recorder)
+  {
+    json_object_set_object_member(reply, "recording", vtx_recorder_get_stats(g_recorder));
+  }
+  if (g_dvr)
+  {
+    json_object_set_object_member(reply, "dvr", vtx_dvr_get_stats(g_dvr));
+  }
+  if (g_reconfig)
+  {
+    json_object_set_object_member(reply, "reconfig", vtx_reconfig_get_stats(g_reconfig));
+  }
+  if (g_fallback)
+  {
+    json_object_set_object_member(reply, "fallback", vtx_fallback_get_stats(g_fallback));
+  }
+  if (g_watchdog)
+  {
+    json_object_set_object_member(reply, "watchdog", vtx_watchdog_get_stats(g_watchdog));
+  }
+  if (g_graph)
+  {
+    json_object_set_object_member(reply, "graph", vtx_graph_get_stats(g_graph));
+  }
+  if (g_camera)
+  {
+    json_object_set_object_member(reply, "camera", vtx_camera_get_stats(g_camera));
+  }
+  if (g_tracks)
+  {
+    json_object_set_array_member(reply, "tracks", vtx_tracks_get_stats(g_tracks));
+  }
+  json_object_set_object_member(reply, "startup", vtx_standby_get_stats());
+  json_object_set_array_member(reply, "viewers", vtx_standby_get_viewer_stats());
+  json_object_set_object_member(reply, "spare", vtx_spare_get_stats());
+  json_object_set_object_member(reply, "ice_recovery", vtx_netmon_get_stats());
+  json_object_set_object_member(reply, "dtls", vtx_dtls_get_stats());
+  json_object_set_double_member(reply, "cpu_percent", vtx_cpu_percent_since(&s_stats_cpu));
+  if (g_whip) json_object_set_object_member(reply, "whip", vtx_whip_get_stats());
+  CustomICEAgent *ice_agent = webrtc ? g_object_get_data(G_OBJECT(webrtc), "custom-ice-agent") : NULL;
+  if (ice_agent)
+  {
+    json_object_set_object_member(reply, "paths", customice_agent_get_path_stats(ice_agent));
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  json_node_free(node);
+}
+
+// Starts or stops local recording and replies with the resulting recording state, plus the reason when the request failed.
+static void vtx_dc_record(GObject *dc, guint cmd)
+{
+  gchar *error = NULL;
+  if (!g_recorder)
+  {
+    error = g_strdup("Recording is not configured (record_dir)");
+  }
+  else if (cmd == CMD_RECORD_START)
+  {
+    vtx_recorder_start(g_recorder, &error);
+  }
+  else if (!vtx_recorder_stop(g_recorder))
+  {
+    error = g_strdup("Not recording");
+  }
+
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", cmd);
+  json_object_set_boolean_member(reply, "recording", g_recorder && vtx_recorder_is_recording(g_recorder));
+  if (error)
+  {
+    gst_printerrln("Recording: %s", error);
+    json_object_set_string_member(reply, "error", error);
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  g_free(error);
+  json_node_free(node);
+}
+
+// Flushes the DVR ring to a file and replies with its path, or with the reason nothing was written.
+static void vtx_dc_dvr_flush(GObject *dc)
+{
+  gchar *error = NULL;
+  gchar *path = g_dvr ? vtx_dvr_flush(g_dvr, "command", &error) : NULL;
+  if (!g_dvr) error = g_strdup("DVR is not configured (dvr_seconds)");
+
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", CMD_DVR_FLUSH);
+  if (path) json_object_set_string_member(reply, "location", path);
+  if (error)
+  {
+    gst_printerrln("DVR: %s", error);
+    json_object_set_string_member(reply, "error", error);
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  g_free(path);
+  g_free(error);
+  json_node_free(node);
+}
+
+// Applies a bitrate, frame-rate or resolution change to the running pipeline and replies with the requested values, plus
+// the reason when the change was rejected.
+static void vtx_dc_reconfigure(GObject *dc, guint cmd, JsonObject *object)
+{
+  gchar *error = NULL;
+  gint64 bitrate_kbps = json_object_has_member(object, "bitrate_kbps") ? json_object_get_int_member(object, "bitrate_kbps") : 0;
+  gint64 framerate = json_object_has_member(object, "framerate") ? json_object_get_int_member(object, "framerate") : 0;
+  gint64 width = json_object_has_member(object, "width") ? json_object_get_int_member(object, "width") : 0;
+  gint64 height = json_object_has_member(object, "height") ? json_object_get_int_member(object, "height") : 0;
+
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", cmd);
+  // Checked here so a negative or oversized value cannot wrap into a valid guint
+  gboolean valid = bitrate_kbps >= 0 && bitrate_kbps <= G_MAXINT && framerate >= 0 && framerate <= G_MAXINT && width >= 0 && width <= G_MAXINT && height >= 0 && height <= G_MAXINT;
+  if (!g_reconfig)
+  {
+    error = g_strdup("No media pipeline running");
+  }
+  else if (!valid)
+  {
+    error = g_strdup("Invalid bitrate_kbps, framerate, width or height");
+  }
+  else if (cmd == CMD_SET_BITRATE)
+  {
+    json_object_set_int_member(reply, "bitrate_kbps", bitrate_kbps);
+    vtx_reconfig_set_bitrate(g_reconfig, (guint) bitrate_kbps, &error);
+  }
+  else if (cmd == CMD_SET_FRAMERATE)
+  {
+    json_object_set_int_member(reply, "framerate", framerate);
+    vtx_reconfig_set_framerate(g_reconfig, (guint) framerate, &error);
+  }
+  else
+  {
+    json_object_set_int_member(reply, "width", width);
+    json_object_set_int_member(reply, "height", height);
+    vtx_reconfig_set_resolution(g_reconfig, (guint) width, (guint) height, &error);
+  }
+  json_object_set_boolean_member(reply, "applied", error == NULL);
+  if (error)
+  {
+    gst_printerrln("Reconfiguration: %s", error);
+    json_object_set_string_member(reply, "error", error);
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  g_free(error);
+  json_node_free(node);
+}
+
+// Sets V4L2 camera controls ({"controls": {"exposure": 200, ...}}) and replies with the values the driver applied.
+static void vtx_dc_set_camera_control(GObject *dc, JsonObject *object)
+{
+  gchar *error = NULL;
+  JsonObject *controls = json_object_has_member(object, "controls") ? json_object_get_object_member(object, "controls") : NULL;
+  JsonObject *applied = json_object_new();
+
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", CMD_SET_CAMERA_CONTROL);
+  if (!g_camera)
+  {
+    error = g_strdup("No V4L2 camera in the media pipeline");
+  }
+  else if (!controls || json_object_get_size(controls) == 0)
+  {
+    error = g_strdup("No controls given");
+  }
+  else
+  {
+    vtx_camera_set_controls(g_camera, controls, applied, &error);
+  }
+  json_object_set_boolean_member(reply, "applied", error == NULL);
+  json_object_set_object_member(reply, "controls", applied);
+  if (error)
+  {
+    gst_printerrln("Camera controls: %s", error);
+    json_object_set_string_member(reply, "error", error);
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  g_free(error);
+  json_node_free(node);
+}
+
+// Pauses or resumes a video track ({"track": "hd"}) and replies with the track and whether the change was applied.
+static void vtx_dc_set_track_paused(GObject *dc, guint cmd, JsonObject *object)
+{
+  gchar *error = NULL;
+  const gchar *name = json_object_has_member(object, "track") ? json_object_get_string_member(object, "track") : NULL;
+
+  JsonObject *reply = json_object_new();
+  json_object_set_int_member(reply, "cmd", cmd);
+  if (name) json_object_set_string_member(reply, "track", name);
+  if (!g_tracks)
+  {
+    error = g_strdup("No additional video tracks");
+  }
+  else
+  {
+    vtx_tracks_set_paused(g_tracks, name, cmd == CMD_TRACK_PAUSE, &error);
+  }
+  json_object_set_boolean_member(reply, "applied", error == NULL);
+  if (error)
+  {
+    gst_printerrln("Video tracks: %s", error);
+    json_object_set_string_member(reply, "error", error);
+  }
+
+  JsonNode *node = json_node_new(JSON_NODE_OBJECT);
+  json_node_take_object(node, reply);
+  gchar *message = json_to_string(node, FALSE);
+  g_signal_emit_by_name(dc, "send-string", message);
+
+  g_free(message);
+  g_free(error);
+  json_node_free(node);
+}
+
 // Parses a JSON command message received on the CMD DataChannel and dispatches the appropriate action (hang-up, pong, or error handling).
 void vtx_dc_on_message_command(GObject *dc, gchar *str, gpointer user_data)
 {
@@ -27,7 +319,6 @@ void vtx_dc_on_message_command(GObject *dc, gchar *str, gpointer user_data)
 
   JsonObject *object = json_node_get_object(root);
   guint cmd = json_object_get_int_member(object, "cmd");
-  g_object_unref(parser);
 
   switch (cmd)
   {
@@ -57,8 +348,42 @@ void vtx_dc_on_message_command(GObject *dc, gchar *str, gpointer user_data)
       gst_println("Received: ERROR");
       break;
 
+    case CMD_GET_STATS:
+      vtx_dc_send_stats(dc);
+      break;
+
+    case CMD_RECORD_START:
+    case CMD_RECORD_STOP:
+      gst_println("Received: %s", cmd == CMD_RECORD_START ? "RECORD_START" : "RECORD_STOP");
+      vtx_dc_record(dc, cmd);
+      break;
+
+    case CMD_DVR_FLUSH:
+      gst_println("Received: DVR_FLUSH");
+      vtx_dc_dvr_flush(dc);
+      break;
+
+    case CMD_SET_BITRATE:
+    case CMD_SET_FRAMERATE:
+    case CMD_SET_RESOLUTION:
+      gst_println("Received: %s", cmd == CMD_SET_BITRATE ? "SET_BITRATE" : cmd == CMD_SET_FRAMERATE ? "SET_FRAMERATE" : "SET_RESOLUTION");
+      vtx_dc_reconfigure(dc, cmd, object);
+      break;
+
+    case CMD_SET_CAMERA_CONTROL:
+      gst_println("Received: SET_CAMERA_CONTROL");
+      vtx_dc_set_camera_control(dc, object);
+      break;
+
+    case CMD_TRACK_PAUSE:
+    case CMD_TRACK_RESUME:
+      gst_println("Received: %s", cmd == CMD_TRACK_PAUSE ? "TRACK_PAUSE" : "TRACK_RESUME");
+      vtx_dc_set_track_paused(dc, cmd, object);
+      break;
+
     default:
       gst_println("Received: UNKNOWN COMMAND (%d)", cmd);
       break;
   }
+  g_object_unref(parser);
 }
@@ -0,0 +1,309 @@
+#include "headers/dtls.h"
+
+#include <gst/webrtc/webrtc.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+
+#include "headers/webrtc.h"
+
+// Per-webrtcbin handshake timing, from ICE connected to the peer connection being connected (DTLS done).
+typedef struct
+{
+  gint64 ice_connected_us;
+  gboolean reported;
+} DtlsTiming;
+
+struct VtxDtls
+{
+  gchar *path;
+  gchar *pem;        // current certificate and key, NULL until loaded or generated
+  GThread *worker;   // last load/generate thread, joined by the next check
+  gint worker_done;  // atomic, set when the worker has finished
+  guint check_id;
+  GMutex lock;
+};
+
+VtxDtls *g_dtls = NULL;
+
+static guint s_rotations = 0;
+static guint s_handshakes = 0;
+static gint64 s_last_handshake_us = -1;
+static gint64 s_max_handshake_us = -1;
+static gint64 s_cert_not_before = 0;  // unix seconds
+
+#define DTLS_TIMING_KEY "vtx-dtls-timing"
+
+// Returns the certificate age in days, or -1 if the PEM does not hold a certificate followed by a private key.
+static gint vtx_dtls_pem_age_days(const gchar *pem, gint64 *not_before)
+{
+  BIO *bio = BIO_new_mem_buf(pem, -1);
+  X509 *x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+  EVP_PKEY *pkey = x509 ? PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL) : NULL;
+  gint age = -1;
+
+  if (pkey)
+  {
+    gint days = 0;
+    gint secs = 0;
+    if (ASN1_TIME_diff(&days, &secs, X509_get0_notBefore(x509), NULL)) age = days;
+    if (not_before) *not_before = g_get_real_time() / G_USEC_PER_SEC - ((gint64) days * 86400 + secs);
+  }
+
+  EVP_PKEY_free(pkey);
+  X509_free(x509);
+  BIO_free(bio);
+  return age;
+}
+
+// Generates a self-signed ECDSA P-256 certificate and returns it followed by its key as PEM.
+static gchar *vtx_dtls_generate(void)
+{
+  EVP_PKEY *pkey = NULL;
+  X509 *x509 = NULL;
+  BIO *bio = NULL;
+  gchar *pem = NULL;
+
+  EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  if (!ctx || EVP_PKEY_keygen_init(ctx) <= 0 || EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, NID_X9_62_prime256v1) <= 0 || EVP_PKEY_keygen(ctx, &pkey) <= 0)
+  {
+    gst_printerrln("[DTLS] ECDSA P-256 key generation failed");
+    goto out;
+  }
+
+  x509 = X509_new();
+  X509_set_version(x509, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(x509), g_random_int_range(1, G_MAXINT32));
+  // Back-dated a day so receivers with a slightly wrong clock still accept it
+  X509_gmtime_adj(X509_getm_notBefore(x509), -86400L);
+  X509_gmtime_adj(X509_getm_notAfter(x509), (long) DTLS_CERT_VALID_DAYS * 86400L);
+  X509_set_pubkey(x509, pkey);
+  X509_NAME *name = X509_get_subject_name(x509);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *) "vtx", -1, -1, 0);
+  X509_set_issuer_name(x509, name);
+  if (!X509_sign(x509, pkey, EVP_sha256()))
+  {
+    gst_printerrln("[DTLS] Certificate signing failed");
+    goto out;
+  }
+
+  // GstDtlsCertificate reads the certificate first, then the key
+  bio = BIO_new(BIO_s_mem());
+  if (PEM_write_bio_X509(bio, x509) && PEM_write_bio_PrivateKey(bio, pkey, NULL, NULL, 0, NULL, NULL))
+  {
+    char *data = NULL;
+    long len = BIO_get_mem_data(bio, &data);
+    pem = g_strndup(data, len);
+  }
+
+out:
+  BIO_free(bio);
+  X509_free(x509);
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_CTX_free(ctx);
+  return pem;
+}
+
+// Loads the persisted certificate, replacing it when missing, unreadable or due for rotation (runs on a worker thread).
+static gpointer vtx_dtls_refresh(gpointer user_data)
+{
+  VtxDtls *dtls = user_data;
+  gchar *pem = NULL;
+  gint64 not_before = 0;
+
+  // dtlsdec generates GStreamer's own fallback certificate the first time one is created; do that here rather than in the first session
+  GstElement *warm = gst_element_factory_make("dtlsdec", NULL);
+  if (warm) gst_object_unref(warm);
+
+  if (g_file_get_contents(dtls->path, &pem, NULL, NULL))
+  {
+    gint age = vtx_dtls_pem_age_days(pem, &not_before);
+    if (age < 0 || age >= DTLS_CERT_ROTATE_DAYS)
+    {
+      gst_println("[DTLS] %s certificate %s", age < 0 ? "Unusable" : "Rotating", dtls->path);
+      g_clear_pointer(&pem, g_free);
+    }
+  }
+
+  if (!pem)
+  {
+    gint64 start_us = g_get_monotonic_time();
+    pem = vtx_dtls_generate();
+    if (!pem)
+    {
+      g_atomic_int_set(&dtls->worker_done, 1);
+      return NULL;
+    }
+    vtx_dtls_pem_age_days(pem, &not_before);
+    gst_println("[DTLS] Generated ECDSA P-256 certificate in %.1f ms", (g_get_monotonic_time() - start_us) / 1000.0);
+
+    gchar *dir = g_path_get_dirname(dtls->path);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+
+    GError *error = NULL;
+    // Created with 0600 so the private key is never readable by other users, not even before a chmod
+    if (!g_file_set_contents_full(dtls->path, pem, -1, G_FILE_SET_CONTENTS_CONSISTENT, 0600, &error))
+    {
+      gst_printerrln("[DTLS] Cannot persist certificate to %s: %s", dtls->path, error->message);
+      g_clear_error(&error);
+    }
+  }
+
+  g_mutex_lock(&dtls->lock);
+  // Sessions already running keep the certificate they negotiated with; only new webrtcbins pick this one up
+  if (dtls->pem && g_strcmp0(dtls->pem, pem) != 0) s_rotations++;
+  g_free(dtls->pem);
+  dtls->pem = pem;
+  s_cert_not_before = not_before;
+  g_mutex_unlock(&dtls->lock);
+
+  g_atomic_int_set(&dtls->worker_done, 1);
+  return NULL;
+}
+
+// Joins a finished worker and starts a new refresh unless one is still running.
+static void vtx_dtls_schedule_refresh(VtxDtls *dtls)
+{
+  if (dtls->worker)
+  {
+    if (!g_atomic_int_get(&dtls->worker_done)) return;
+    g_thread_join(dtls->worker);
+  }
+  g_atomic_int_set(&dtls->worker_done, 0);
+  dtls->worker = g_thread_new("vtx-dtls", vtx_dtls_refresh, dtls);
+}
+
+// Re-checks the certificate age periodically so a long-running vtx rotates it.
+static gboolean vtx_dtls_on_check(gpointer user_data)
+{
+  VtxDtls *dtls = user_data;
+  vtx_dtls_schedule_refresh(dtls);
+  return G_SOURCE_CONTINUE;
+}
+
+// Loads or generates the DTLS certificate in the background and keeps it rotated.
+VtxDtls *vtx_dtls_start(void)
+{
+  VtxDtls *dtls = g_new0(VtxDtls, 1);
+  g_mutex_init(&dtls->lock);
+
+  const gchar *file = g_getenv(DTLS_CERT_FILE_ENV);
+  if (!file || !*file) file = DTLS_CERT_DEFAULT_FILE;
+  dtls->path = g_path_is_absolute(file) ? g_strdup(file) : g_build_filename(g_get_user_cache_dir(), file, NULL);
+  gst_println("[DTLS] Certificate file: %s", dtls->path);
+
+  vtx_dtls_schedule_refresh(dtls);
+  dtls->check_id = g_timeout_add_seconds(DTLS_CERT_CHECK_INTERVAL_S, vtx_dtls_on_check, dtls);
+  return dtls;
+}
+
+// Stops rotation and waits for a pending load or generation.
+void vtx_dtls_free(VtxDtls *dtls)
+{
+  if (!dtls) return;
+  if (dtls->check_id) g_source_remove(dtls->check_id);
+  if (dtls->worker) g_thread_join(dtls->worker);
+  g_free(dtls->pem);
+  g_free(dtls->path);
+  g_mutex_clear(&dtls->lock);
+  g_free(dtls);
+}
+
+// Hands the shared certificate to a DTLS decoder of webrtcbin; the encoder and the SDP fingerprint take it from there.
+static void vtx_dtls_set_pem(GstElement *element)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  if (!factory || g_strcmp0(GST_OBJECT_NAME(factory), "dtlssrtpdec") != 0 || !g_dtls) return;
+
+  g_mutex_lock(&g_dtls->lock);
+  gchar *pem = g_strdup(g_dtls->pem);
+  g_mutex_unlock(&g_dtls->lock);
+
+  // Not ready yet: webrtcbin falls back to the certificate GStreamer generates itself
+  if (pem) g_object_set(element, "pem", pem, NULL);
+  g_free(pem);
+}
+
+// Sets the certificate on every DTLS decoder webrtcbin adds for a new transport.
+static void vtx_dtls_on_deep_element_added(GstBin *bin, GstBin *sub_bin, GstElement *element, gpointer user_data)
+{
+  vtx_dtls_set_pem(element);
+}
+
+// Sets the certificate on a DTLS decoder webrtcbin created before vtx_dtls_apply was called.
+static void vtx_dtls_set_pem_foreach(const GValue *item, gpointer user_data)
+{
+  vtx_dtls_set_pem(GST_ELEMENT(g_value_get_object(item)));
+}
+
+// Starts the handshake clock once ICE has a working pair.
+static void vtx_dtls_on_ice_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data)
+{
+  GstWebRTCICEConnectionState state;
+  g_object_get(webrtc, "ice-connection-state", &state, NULL);
+  if (state != GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED && state != GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED) return;
+
+  DtlsTiming *timing = g_object_get_data(G_OBJECT(webrtc), DTLS_TIMING_KEY);
+  if (timing && !timing->ice_connected_us) timing->ice_connected_us = g_get_monotonic_time();
+}
+
+// Logs the DTLS handshake time when the peer connection becomes connected.
+static void vtx_dtls_on_connection_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data)
+{
+  GstWebRTCPeerConnectionState state;
+  g_object_get(webrtc, "connection-state", &state, NULL);
+  DtlsTiming *timing = g_object_get_data(G_OBJECT(webrtc), DTLS_TIMING_KEY);
+  if (state != GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED || !timing || timing->reported || !timing->ice_connected_us) return;
+
+  timing->reported = TRUE;
+  gint64 elapsed = g_get_monotonic_time() - timing->ice_connected_us;
+  gst_println("[DTLS] Handshake for %s took %.1f ms", vtx_webrtc_peer_id(webrtc), elapsed / 1000.0);
+
+  if (!g_dtls) return;
+  g_mutex_lock(&g_dtls->lock);
+  s_handshakes++;
+  s_last_handshake_us = elapsed;
+  if (elapsed > s_max_handshake_us) s_max_handshake_us = elapsed;
+  g_mutex_unlock(&g_dtls->lock);
+}
+
+// Makes a new webrtcbin use the shared certificate and report its DTLS handshake time. Call before negotiation starts.
+void vtx_dtls_apply(GstElement *webrtc)
+{
+  g_object_set_data_full(G_OBJECT(webrtc), DTLS_TIMING_KEY, g_new0(DtlsTiming, 1), g_free);
+  g_signal_connect(webrtc, "deep-element-added", G_CALLBACK(vtx_dtls_on_deep_element_added), NULL);
+
+  GstIterator *it = gst_bin_iterate_recurse(GST_BIN(webrtc));
+  gst_iterator_foreach(it, vtx_dtls_set_pem_foreach, NULL);
+  gst_iterator_free(it);
+
+  g_signal_connect(webrtc, "notify::ice-connection-state", G_CALLBACK(vtx_dtls_on_ice_state), NULL);
+  g_signal_connect(webrtc, "notify::connection-state", G_CALLBACK(vtx_dtls_on_connection_state), NULL);
+}
+
+// Returns certificate age and rotation count with the last and worst DTLS handshake times.
+JsonObject *vtx_dtls_get_stats(void)
+{
+  JsonObject *o = json_object_new();
+  if (!g_dtls) return o;
+
+  g_mutex_lock(&g_dtls->lock);
+  json_object_set_boolean_member(o, "certificate_ready", g_dtls->pem != NULL);
+  json_object_set_int_member(o, "certificate_age_s", g_dtls->pem ? g_get_real_time() / G_USEC_PER_SEC - s_cert_not_before : 0);
+  json_object_set_int_member(o, "rotations", s_rotations);
+  json_object_set_int_member(o, "handshakes", s_handshakes);
+  if (s_last_handshake_us >= 0)
+  {
+    json_object_set_double_member(o, "last_handshake_ms", s_last_handshake_us / 1000.0);
+    json_object_set_double_member(o, "max_handshake_ms", s_max_handshake_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "last_handshake_ms");
+    json_object_set_null_member(o, "max_handshake_ms");
+  }
+  g_mutex_unlock(&g_dtls->lock);
+
+  return o;
+}
@@ -0,0 +1,531 @@
+#include "headers/dvr.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <gst/video/video.h>
+
+#include "headers/data_channel.h"
+
+// MSP messages recorded next to the video besides MSP_STATUS_EX.
+static const guint16 s_dvr_telemetry_cmds[] = {MSP_ATTITUDE, MSP_ALTITUDE, MSP_RAW_GPS, MSP_ANALOG};
+
+typedef struct
+{
+  GstBuffer *buffer;
+  gint64 arrival_us;
+} DvrFrame;
+
+// Frames from one keyframe up to the next, the unit of eviction.
+typedef struct
+{
+  GQueue frames;
+  gint64 start_us;
+  gsize bytes;
+  gboolean keyframe_requested;
+} DvrGop;
+
+typedef struct
+{
+  gint64 arrival_us;
+  guint16 cmd;
+  GBytes *data;  // raw payload; NULL for MSP_STATUS_EX, which keeps the decoded flags
+  guint32 flag;
+  guint32 arming_disable_flags;
+} DvrTelemetry;
+
+// What one flush writes, taken from the ring under the lock so the ring keeps running while the file is written.
+typedef struct
+{
+  VtxDvr *dvr;
+  GPtrArray *buffers;  // GstBuffer references
+  GPtrArray *telemetry;  // DvrTelemetry, data referenced
+  GstCaps *caps;
+  gint64 first_us;
+  gchar *path;
+} DvrFlush;
+
+struct VtxDvr
+{
+  gchar *dir;
+  gint64 window_us;
+  gsize budget;
+  guint32 trigger_flags;
+  gboolean flush_on_disarm;
+  GstPad *pad;
+  gulong probe_id;
+  guint msp_timeout_id;
+
+  GMutex lock;
+  GQueue gops;  // DvrGop, oldest first
+  GQueue telemetry;
+  gsize bytes;
+  guint frames;
+  GstCaps *caps;
+  guint64 copied;     // pool-backed frames copied instead of referenced
+  guint64 overflows;  // ring emptied because a single GOP exceeded the budget
+
+  gboolean msp_seen;
+  guint32 last_flag;
+  guint32 last_arming_disable_flags;
+
+  GThread *flush_thread;
+  gint flushing;  // atomic
+  guint flushes;
+  gchar *last_flush;
+};
+
+VtxDvr *g_dvr = NULL;
+
+// Frees a GOP and its buffer references.
+static void vtx_dvr_gop_free(DvrGop *gop)
+{
+  DvrFrame *frame;
+  while ((frame = g_queue_pop_head(&gop->frames)))
+  {
+    gst_buffer_unref(frame->buffer);
+    g_free(frame);
+  }
+  g_free(gop);
+}
+
+// Frees one telemetry sample.
+static void vtx_dvr_telemetry_free(gpointer data)
+{
+  DvrTelemetry *sample = data;
+  if (sample->data) g_bytes_unref(sample->data);
+  g_free(sample);
+}
+
+// Drops the oldest GOP. Must be called with the lock held.
+static void vtx_dvr_evict_gop(VtxDvr *dvr)
+{
+  DvrGop *gop = g_queue_pop_head(&dvr->gops);
+  dvr->bytes -= gop->bytes;
+  dvr->frames -= g_queue_get_length(&gop->frames);
+  vtx_dvr_gop_free(gop);
+}
+
+// Drops whole GOPs from the front while the rest still covers the window, or while the ring is over budget, and telemetry
+// older than the oldest frame. Must be called with the lock held.
+static void vtx_dvr_trim(VtxDvr *dvr, gint64 now_us)
+{
+  while (g_queue_get_length(&dvr->gops) >= 2)
+  {
+    DvrGop *second = g_queue_peek_nth(&dvr->gops, 1);
+    if (now_us - second->start_us < dvr->window_us && dvr->bytes <= dvr->budget) break;
+    vtx_dvr_evict_gop(dvr);
+  }
+
+  // A single GOP over budget cannot be trimmed GOP-aligned: start over from the next keyframe
+  if (dvr->bytes > dvr->budget)
+  {
+    while (!g_queue_is_empty(&dvr->gops)) vtx_dvr_evict_gop(dvr);
+    dvr->overflows++;
+  }
+
+  DvrGop *oldest = g_queue_peek_head(&dvr->gops);
+  gint64 horizon_us = oldest ? oldest->start_us : now_us - dvr->window_us;
+  DvrTelemetry *sample;
+  while ((sample = g_queue_peek_head(&dvr->telemetry)) && sample->arrival_us < horizon_us)
+  {
+    vtx_dvr_telemetry_free(g_queue_pop_head(&dvr->telemetry));
+  }
+}
+
+// Pad probe adding each encoded frame to the ring. Frames are referenced, not copied, unless they belong to a buffer pool
+// (encoder output pools, e.g. v4l2, would otherwise run dry or be overwritten while the ring holds them).
+static GstPadProbeReturn vtx_dvr_on_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxDvr *dvr = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+    {
+      GstCaps *caps = NULL;
+      gst_event_parse_caps(event, &caps);
+      g_mutex_lock(&dvr->lock);
+      gst_caps_replace(&dvr->caps, caps);
+      g_mutex_unlock(&dvr->lock);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+  gboolean key = !GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT);
+  gint64 now_us = g_get_monotonic_time();
+  gboolean request_keyframe = FALSE;
+
+  g_mutex_lock(&dvr->lock);
+  DvrGop *gop = g_queue_peek_tail(&dvr->gops);
+  if (key)
+  {
+    gop = g_new0(DvrGop, 1);
+    gop->start_us = now_us;
+    g_queue_push_tail(&dvr->gops, gop);
+  }
+
+  if (gop)
+  {
+    DvrFrame *frame = g_new0(DvrFrame, 1);
+    if (buf->pool)
+    {
+      frame->buffer = gst_buffer_copy_deep(buf);
+      dvr->copied++;
+    }
+    else
+    {
+      frame->buffer = gst_buffer_ref(buf);
+    }
+    frame->arrival_us = now_us;
+    g_queue_push_tail(&gop->frames, frame);
+
+    gsize size = gst_buffer_get_size(buf);
+    gop->bytes += size;
+    dvr->bytes += size;
+    dvr->frames++;
+
+    if (!gop->keyframe_requested && now_us - gop->start_us > dvr->window_us / DVR_MAX_GOP_DIVISOR)
+    {
+      gop->keyframe_requested = TRUE;
+      request_keyframe = TRUE;
+    }
+    vtx_dvr_trim(dvr, now_us);
+  }
+  g_mutex_unlock(&dvr->lock);
+
+  if (request_keyframe)
+  {
+    gst_pad_push_event(pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Adds one telemetry sample to the ring (trimmed here too, in case no video is flowing).
+static void vtx_dvr_add_telemetry(VtxDvr *dvr, DvrTelemetry *sample)
+{
+  g_mutex_lock(&dvr->lock);
+  g_queue_push_tail(&dvr->telemetry, sample);
+  vtx_dvr_trim(dvr, sample->arrival_us);
+  g_mutex_unlock(&dvr->lock);
+}
+
+// Polls the flight controller: records the telemetry messages and MSP_STATUS_EX, and flushes on a trigger flag rising or
+// (when enabled) on disarming.
+static gboolean vtx_dvr_on_msp_timeout(gpointer user_data)
+{
+  VtxDvr *dvr = user_data;
+  if (!g_msp) return G_SOURCE_CONTINUE;
+
+  gint64 now_us = g_get_monotonic_time();
+  for (guint i = 0; i < G_N_ELEMENTS(s_dvr_telemetry_cmds); i++)
+  {
+    uint8_t response[64];
+    int size = msp_request_raw(g_msp, s_dvr_telemetry_cmds[i], response, sizeof(response));
+    if (size <= 0) continue;
+
+    DvrTelemetry *sample = g_new0(DvrTelemetry, 1);
+    sample->arrival_us = now_us;
+    sample->cmd = s_dvr_telemetry_cmds[i];
+    sample->data = g_bytes_new(response, size);
+    vtx_dvr_add_telemetry(dvr, sample);
+  }
+
+  MspStatusExData status;
+  if (!vtx_msp_get_status_ex(g_msp, &status)) return G_SOURCE_CONTINUE;
+
+  DvrTelemetry *sample = g_new0(DvrTelemetry, 1);
+  sample->arrival_us = now_us;
+  sample->cmd = MSP_STATUS_EX;
+  sample->flag = status.flag;
+  sample->arming_disable_flags = status.arming_disable_flags;
+  vtx_dvr_add_telemetry(dvr, sample);
+
+  const gchar *reason = NULL;
+  if (dvr->msp_seen)
+  {
+    guint32 raised = status.arming_disable_flags & ~dvr->last_arming_disable_flags & dvr->trigger_flags;
+    if (raised & DVR_MSP_ARMING_DISABLED_CRASH_DETECTED)
+      reason = "crash";
+    else if (raised)
+      reason = "failsafe";
+    else if (dvr->flush_on_disarm && (dvr->last_flag & DVR_MSP_MODE_ARMED) && !(status.flag & DVR_MSP_MODE_ARMED))
+      reason = "disarm";
+  }
+  dvr->msp_seen = TRUE;
+  dvr->last_flag = status.flag;
+  dvr->last_arming_disable_flags = status.arming_disable_flags;
+
+  if (reason)
+  {
+    gchar *error = NULL;
+    gchar *path = vtx_dvr_flush(dvr, reason, &error);
+    if (!path) gst_printerrln("DVR: %s flush skipped: %s", reason, error);
+    g_free(path);
+    g_free(error);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Writes the telemetry of a flush as JSON lines: time relative to the first frame, MSP command and payload.
+static void vtx_dvr_write_telemetry(DvrFlush *flush)
+{
+  GString *out = g_string_new(NULL);
+  for (guint i = 0; i < flush->telemetry->len; i++)
+  {
+    DvrTelemetry *sample = g_ptr_array_index(flush->telemetry, i);
+    gdouble t_ms = (sample->arrival_us - flush->first_us) / 1000.0;
+    if (sample->data)
+    {
+      gchar *data = g_base64_encode(g_bytes_get_data(sample->data, NULL), g_bytes_get_size(sample->data));
+      g_string_append_printf(out, "{\"t_ms\":%.1f,\"cmd\":%u,\"data\":\"%s\"}\n", t_ms, sample->cmd, data);
+      g_free(data);
+    }
+    else
+    {
+      g_string_append_printf(out, "{\"t_ms\":%.1f,\"cmd\":%u,\"flag\":%u,\"arming_disable_flags\":%u}\n", t_ms, sample->cmd, sample->flag, sample->arming_disable_flags);
+    }
+  }
+
+  gchar *path = g_strconcat(flush->path, ".msp.jsonl", NULL);
+  GError *error = NULL;
+  if (!g_file_set_contents(path, out->str, out->len, &error))
+  {
+    gst_printerrln("DVR: cannot write %s: %s", path, error->message);
+    g_clear_error(&error);
+  }
+  g_free(path);
+  g_string_free(out, TRUE);
+}
+
+// Muxes the snapshot into Matroska through a private appsrc pipeline. Timestamps are rebased on shallow copies, so the
+// payload memory is never copied.
+static gboolean vtx_dvr_write_video(DvrFlush *flush, const gchar *part)
+{
+  const gchar *name = gst_structure_get_name(gst_caps_get_structure(flush->caps, 0));
+  const gchar *parser_name = g_strcmp0(name, "video/x-h264") == 0 ? "h264parse" : g_strcmp0(name, "video/x-h265") == 0 ? "h265parse" : NULL;
+
+  GstElement *writer = gst_pipeline_new("dvr-writer");
+  GstElement *src = gst_element_factory_make_full("appsrc", "caps", flush->caps, "format", GST_FORMAT_TIME, NULL);
+  GstElement *parser = parser_name ? gst_element_factory_make(parser_name, NULL) : gst_element_factory_make("identity", NULL);
+  GstElement *mux = gst_element_factory_make("matroskamux", NULL);
+  GstElement *sink = gst_element_factory_make_full("filesink", "location", part, NULL);
+  gst_bin_add_many(GST_BIN(writer), src, parser, mux, sink, NULL);
+  if (!gst_element_link_many(src, parser, mux, sink, NULL) || gst_element_set_state(writer, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+  {
+    gst_object_unref(writer);
+    return FALSE;
+  }
+
+  GstBuffer *first = g_ptr_array_index(flush->buffers, 0);
+  GstClockTime base = GST_BUFFER_DTS_IS_VALID(first) ? GST_BUFFER_DTS(first) : GST_BUFFER_PTS(first);
+  for (guint i = 0; i < flush->buffers->len; i++)
+  {
+    GstBuffer *buf = gst_buffer_copy(g_ptr_array_index(flush->buffers, i));
+    if (GST_BUFFER_PTS_IS_VALID(buf)) GST_BUFFER_PTS(buf) = GST_BUFFER_PTS(buf) > base ? GST_BUFFER_PTS(buf) - base : 0;
+    if (GST_BUFFER_DTS_IS_VALID(buf)) GST_BUFFER_DTS(buf) = GST_BUFFER_DTS(buf) > base ? GST_BUFFER_DTS(buf) - base : 0;
+
+    GstFlowReturn ret;
+    g_signal_emit_by_name(src, "push-buffer", buf, &ret);
+    gst_buffer_unref(buf);
+    if (ret != GST_FLOW_OK) break;
+  }
+  GstFlowReturn ret;
+  g_signal_emit_by_name(src, "end-of-stream", &ret);
+
+  GstBus *bus = gst_element_get_bus(writer);
+  GstMessage *msg = gst_bus_timed_pop_filtered(bus, DVR_FLUSH_TIMEOUT_S * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gboolean ok = msg && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+  if (msg && !ok)
+  {
+    GError *err = NULL;
+    gst_message_parse_error(msg, &err, NULL);
+    gst_printerrln("DVR: writing %s failed: %s", part, err->message);
+    g_error_free(err);
+  }
+  if (msg) gst_message_unref(msg);
+  gst_object_unref(bus);
+
+  gst_element_set_state(writer, GST_STATE_NULL);
+  gst_object_unref(writer);
+  return ok;
+}
+
+// Flush thread: writes the snapshot to a temporary file and renames it into place, so a file under its final name is
+// always complete.
+static gpointer vtx_dvr_flush_thread(gpointer data)
+{
+  DvrFlush *flush = data;
+  gint64 start_us = g_get_monotonic_time();
+
+  gchar *part = g_strconcat(flush->path, ".part", NULL);
+  gboolean ok = vtx_dvr_write_video(flush, part);
+  if (ok && g_rename(part, flush->path) < 0)
+  {
+    gst_printerrln("DVR: cannot rename %s: %s", part, g_strerror(errno));
+    ok = FALSE;
+  }
+  if (!ok) g_unlink(part);
+  g_free(part);
+
+  if (ok)
+  {
+    vtx_dvr_write_telemetry(flush);
+    gst_println("DVR: wrote %u frames and %u telemetry samples to %s in %.0f ms", flush->buffers->len, flush->telemetry->len, flush->path, (g_get_monotonic_time() - start_us) / 1000.0);
+  }
+
+  g_ptr_array_free(flush->buffers, TRUE);
+  g_ptr_array_free(flush->telemetry, TRUE);
+  gst_caps_unref(flush->caps);
+  g_free(flush->path);
+  g_atomic_int_set(&flush->dvr->flushing, FALSE);
+  g_free(flush);
+  return NULL;
+}
+
+// Snapshots the ring and writes it in the background to <dir>/dvr-<time>-<reason>.mkv. Returns the file path, or NULL
+// with error_msg set when the ring is empty or a flush is still being written.
+gchar *vtx_dvr_flush(VtxDvr *dvr, const gchar *reason, gchar **error_msg)
+{
+  if (!g_atomic_int_compare_and_exchange(&dvr->flushing, FALSE, TRUE))
+  {
+    *error_msg = g_strdup("A flush is still being written");
+    return NULL;
+  }
+  if (dvr->flush_thread)
+  {
+    g_thread_join(dvr->flush_thread);
+    dvr->flush_thread = NULL;
+  }
+  if (g_mkdir_with_parents(dvr->dir, 0755) < 0)
+  {
+    *error_msg = g_strdup_printf("Cannot create %s: %s", dvr->dir, g_strerror(errno));
+    g_atomic_int_set(&dvr->flushing, FALSE);
+    return NULL;
+  }
+
+  DvrFlush *flush = g_new0(DvrFlush, 1);
+  flush->dvr = dvr;
+  flush->buffers = g_ptr_array_new_with_free_func((GDestroyNotify) gst_buffer_unref);
+  flush->telemetry = g_ptr_array_new_with_free_func(vtx_dvr_telemetry_free);
+
+  g_mutex_lock(&dvr->lock);
+  for (GList *g = dvr->gops.head; g; g = g->next)
+  {
+    DvrGop *gop = g->data;
+    for (GList *f = gop->frames.head; f; f = f->next)
+    {
+      DvrFrame *frame = f->data;
+      if (!flush->first_us) flush->first_us = frame->arrival_us;
+      g_ptr_array_add(flush->buffers, gst_buffer_ref(frame->buffer));
+    }
+  }
+  for (GList *t = dvr->telemetry.head; t; t = t->next)
+  {
+    DvrTelemetry *sample = g_new(DvrTelemetry, 1);
+    *sample = *(DvrTelemetry *) t->data;
+    if (sample->data) g_bytes_ref(sample->data);
+    g_ptr_array_add(flush->telemetry, sample);
+  }
+  flush->caps = dvr->caps ? gst_caps_ref(dvr->caps) : NULL;
+  g_mutex_unlock(&dvr->lock);
+
+  if (flush->buffers->len == 0 || !flush->caps)
+  {
+    *error_msg = g_strdup("The DVR ring is empty");
+    g_ptr_array_free(flush->buffers, TRUE);
+    g_ptr_array_free(flush->telemetry, TRUE);
+    if (flush->caps) gst_caps_unref(flush->caps);
+    g_free(flush);
+    g_atomic_int_set(&dvr->flushing, FALSE);
+    return NULL;
+  }
+
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  gchar *name = g_strdup_printf("dvr-%s-%s.mkv", stamp, reason);
+  flush->path = g_build_filename(dvr->dir, name, NULL);
+  g_date_time_unref(now);
+  g_free(stamp);
+  g_free(name);
+
+  dvr->flushes++;
+  g_free(dvr->last_flush);
+  dvr->last_flush = g_strdup(flush->path);
+  gst_println("DVR: flushing %u frames (%s) to %s", flush->buffers->len, reason, flush->path);
+
+  dvr->flush_thread = g_thread_new("dvr-flush", vtx_dvr_flush_thread, flush);
+  return g_strdup(dvr->last_flush);
+}
+
+// Starts keeping the last seconds of the encoded video (videopay input) and, while a flight controller is connected, its
+// telemetry in RAM.
+VtxDvr *vtx_dvr_attach(GstElement *pipeline, const gchar *dir, guint seconds, guint memory_mb, guint32 trigger_flags, gboolean flush_on_disarm)
+{
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (!videopay)
+  {
+    gst_printerrln("DVR: videopay not found");
+    return NULL;
+  }
+
+  VtxDvr *dvr = g_new0(VtxDvr, 1);
+  g_mutex_init(&dvr->lock);
+  g_queue_init(&dvr->gops);
+  g_queue_init(&dvr->telemetry);
+  dvr->dir = g_strdup(dir);
+  dvr->window_us = (gint64) seconds * G_USEC_PER_SEC;
+  dvr->budget = (gsize) memory_mb * 1024 * 1024;
+  dvr->trigger_flags = trigger_flags;
+  dvr->flush_on_disarm = flush_on_disarm;
+
+  dvr->pad = gst_element_get_static_pad(videopay, "sink");
+  dvr->probe_id = gst_pad_add_probe(dvr->pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_dvr_on_buffer, dvr, NULL);
+  dvr->msp_timeout_id = g_timeout_add(DVR_MSP_INTERVAL_MS, vtx_dvr_on_msp_timeout, dvr);
+  gst_object_unref(videopay);
+
+  gst_println("DVR: keeping the last %u s of video (up to %u MB) for %s", seconds, memory_mb, dir);
+  return dvr;
+}
+
+// Waits for a flush being written, then releases the ring. The pipeline must already be stopped.
+void vtx_dvr_free(VtxDvr *dvr)
+{
+  if (!dvr) return;
+
+  if (dvr->msp_timeout_id) g_source_remove(dvr->msp_timeout_id);
+  gst_pad_remove_probe(dvr->pad, dvr->probe_id);
+  gst_object_unref(dvr->pad);
+  if (dvr->flush_thread) g_thread_join(dvr->flush_thread);
+
+  while (!g_queue_is_empty(&dvr->gops)) vtx_dvr_gop_free(g_queue_pop_head(&dvr->gops));
+  g_queue_clear_full(&dvr->telemetry, vtx_dvr_telemetry_free);
+  if (dvr->caps) gst_caps_unref(dvr->caps);
+  g_free(dvr->dir);
+  g_free(dvr->last_flush);
+  g_mutex_clear(&dvr->lock);
+  g_free(dvr);
+}
+
+// Returns the ring fill (seconds, bytes, GOPs, frames, telemetry samples) and the flush history.
+JsonObject *vtx_dvr_get_stats(VtxDvr *dvr)
+{
+  JsonObject *stats = json_object_new();
+
+  g_mutex_lock(&dvr->lock);
+  DvrGop *oldest = g_queue_peek_head(&dvr->gops);
+  json_object_set_double_member(stats, "seconds", oldest ? (g_get_monotonic_time() - oldest->start_us) / (gdouble) G_USEC_PER_SEC : 0.0);
+  json_object_set_int_member(stats, "bytes", dvr->bytes);
+  json_object_set_int_member(stats, "gops", g_queue_get_length(&dvr->gops));
+  json_object_set_int_member(stats, "frames", dvr->frames);
+  json_object_set_int_member(stats, "copied_frames", dvr->copied);
+  json_object_set_int_member(stats, "overflows", dvr->overflows);
+  json_object_set_int_member(stats, "telemetry_samples", g_queue_get_length(&dvr->telemetry));
+  g_mutex_unlock(&dvr->lock);
+
+  json_object_set_int_member(stats, "flushes", dvr->flushes);
+  json_object_set_boolean_member(stats, "flushing", g_atomic_int_get(&dvr->flushing));
+  if (dvr->last_flush) json_object_set_string_member(stats, "last_flush", dvr->last_flush);
+  return stats;
+}
@@ -0,0 +1,191 @@
+#include "headers/encoder.h"
+
+#include <string.h>
+
+// Bitrate properties of the encoders listed in codec.c. The units differ between plugins.
+static const EncoderBitrateProperty s_encoder_bitrate_properties[] = {
+    {"x264enc", "bitrate", 1000},           //
+    {"x265enc", "bitrate", 1000},           //
+    {"openh264enc", "bitrate", 1},          //
+    {"vp8enc", "target-bitrate", 1},        //
+    {"vp9enc", "target-bitrate", 1},        //
+    {"svtav1enc", "target-bitrate", 1000},  //
+    {"vtenc_h264_hw", "bitrate", 1000},     //
+    {"vtenc_h265_hw", "bitrate", 1000},     //
+    {"nvh264enc", "bitrate", 1000},         //
+    {"nvh265enc", "bitrate", 1000},         //
+    {"nvav1enc", "bitrate", 1000},          //
+    {"amfh264enc", "bitrate", 1000},        //
+    {"amfh265enc", "bitrate", 1000},        //
+    {"amfav1enc", "bitrate", 1000},         //
+    {"vah264enc", "bitrate", 1000},         //
+    {"vah264lpenc", "bitrate", 1000},       //
+    {"vah265enc", "bitrate", 1000},         //
+    {"vah265lpenc", "bitrate", 1000},       //
+    {"vaav1enc", "bitrate", 1000},          //
+    {"nvv4l2h264enc", "bitrate", 1},        //
+    {"nvv4l2h265enc", "bitrate", 1},        //
+    {"nvv4l2vp8enc", "bitrate", 1},         //
+    {"nvv4l2vp9enc", "bitrate", 1},         //
+    {"mpph264enc", "bps", 1},               //
+    {"mpph265enc", "bps", 1},               //
+    {"mppvp8enc", "bps", 1},                //
+};
+
+// Multi-slice settings. x264enc sliced-threads encodes the slices of one frame in parallel instead of pipelining
+// whole frames across threads, which removes the frame-threading delay.
+static const EncoderSliceProperty s_encoder_slice_properties[] = {
+    {"openh264enc", "slice-mode", "n-slices"},  //
+    {"openh264enc", "num-slices", "%u"},        //
+    {"x264enc", "sliced-threads", "true"},      //
+    {"x264enc", "threads", "%u"},               //
+    {"vah264enc", "num-slices", "%u"},          //
+    {"vah264lpenc", "num-slices", "%u"},        //
+    {"vah265enc", "num-slices", "%u"},          //
+    {"vah265lpenc", "num-slices", "%u"},        //
+};
+
+// v4l2h264enc (Raspberry Pi 4) has no bitrate property; the rate is passed through extra-controls in bit/s.
+#define V4L2_EXTRA_CONTROLS_BITRATE "video_bitrate"
+
+// Returns the factory name of the given element, or NULL if it has none.
+static const gchar *vtx_encoder_factory_name(GstElement *element)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  return factory ? gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)) : NULL;
+}
+
+// Returns the bitrate property entry for the given encoder factory, or NULL if the encoder is unknown.
+static const EncoderBitrateProperty *vtx_encoder_bitrate_property(GstElement *encoder)
+{
+  const gchar *name = vtx_encoder_factory_name(encoder);
+  if (!name) return NULL;
+
+  for (guint i = 0; i < G_N_ELEMENTS(s_encoder_bitrate_properties); i++)
+  {
+    if (g_strcmp0(name, s_encoder_bitrate_properties[i].factory) == 0) return &s_encoder_bitrate_properties[i];
+  }
+  return NULL;
+}
+
+// Returns TRUE if the element's factory classification is a video encoder.
+gboolean vtx_encoder_is_video_encoder(GstElement *element)
+{
+  GstElementFactory *factory = gst_element_get_factory(element);
+  if (!factory) return FALSE;
+
+  const gchar *klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+  return klass && strstr(klass, "Encoder") && strstr(klass, "Video");
+}
+
+// Iterator predicate matching video encoders.
+static gint vtx_encoder_compare_klass(gconstpointer a, gconstpointer b)
+{
+  return vtx_encoder_is_video_encoder(g_value_get_object((const GValue *) a)) ? 0 : 1;
+}
+
+// Returns a new reference to the first video encoder found in the bin (recursively), or NULL if there is none.
+GstElement *vtx_encoder_find(GstBin *bin)
+{
+  GstElement *encoder = NULL;
+  GValue item = G_VALUE_INIT;
+
+  GstIterator *it = gst_bin_iterate_recurse(bin);
+  if (gst_iterator_find_custom(it, vtx_encoder_compare_klass, &item, NULL))
+  {
+    encoder = g_value_dup_object(&item);
+    g_value_unset(&item);
+  }
+  gst_iterator_free(it);
+
+  return encoder;
+}
+
+// Returns the configured target bitrate of the encoder in kbit/s, or 0 if it cannot be determined.
+guint vtx_encoder_get_bitrate_kbps(GstElement *encoder)
+{
+  if (!encoder) return 0;
+
+  if (g_strcmp0(vtx_encoder_factory_name(encoder), "v4l2h264enc") == 0)
+  {
+    GstStructure *controls = NULL;
+    gint bps = 0;
+    g_object_get(encoder, "extra-controls", &controls, NULL);
+    if (controls)
+    {
+      gst_structure_get_int(controls, V4L2_EXTRA_CONTROLS_BITRATE, &bps);
+      gst_structure_free(controls);
+    }
+    return bps > 0 ? (guint) (bps / 1000) : 0;
+  }
+
+  const EncoderBitrateProperty *prop = vtx_encoder_bitrate_property(encoder);
+  if (!prop) return 0;
+
+  GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), prop->property);
+  if (!pspec) return 0;
+
+  GValue value = G_VALUE_INIT;
+  GValue converted = G_VALUE_INIT;
+  g_value_init(&value, pspec->value_type);
+  g_value_init(&converted, G_TYPE_UINT64);
+  g_object_get_property(G_OBJECT(encoder), prop->property, &value);
+
+  guint64 raw = 0;
+  if (g_value_transform(&value, &converted)) raw = g_value_get_uint64(&converted);
+  g_value_unset(&value);
+  g_value_unset(&converted);
+
+  return (guint) (raw * prop->bits_per_unit / 1000);
+}
+
+// Sets the target bitrate of the encoder in kbit/s, converting to the unit of its bitrate property.
+gboolean vtx_encoder_set_bitrate_kbps(GstElement *encoder, guint kbps)
+{
+  if (!encoder || kbps == 0) return FALSE;
+
+  if (g_strcmp0(vtx_encoder_factory_name(encoder), "v4l2h264enc") == 0)
+  {
+    GstStructure *controls = NULL;
+    g_object_get(encoder, "extra-controls", &controls, NULL);
+    if (!controls) controls = gst_structure_new_empty("controls");
+    gst_structure_set(controls, V4L2_EXTRA_CONTROLS_BITRATE, G_TYPE_INT, (gint) (kbps * 1000), NULL);
+    g_object_set(encoder, "extra-controls", controls, NULL);
+    gst_structure_free(controls);
+    return TRUE;
+  }
+
+  const EncoderBitrateProperty *prop = vtx_encoder_bitrate_property(encoder);
+  if (!prop || !g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), prop->property)) return FALSE;
+
+  GValue value = G_VALUE_INIT;
+  g_value_init(&value, G_TYPE_UINT64);
+  g_value_set_uint64(&value, (guint64) kbps * 1000 / prop->bits_per_unit);
+  g_object_set_property(G_OBJECT(encoder), prop->property, &value);
+  g_value_unset(&value);
+
+  return TRUE;
+}
+
+// Configures the encoder to split every frame into the given number of slices. Returns the number of properties set,
+// 0 if the encoder has no slice settings.
+guint vtx_encoder_set_slices(GstElement *encoder, guint slices)
+{
+  const gchar *name = encoder ? vtx_encoder_factory_name(encoder) : NULL;
+  guint applied = 0;
+  if (!name || slices < 2) return 0;
+
+  for (guint i = 0; i < G_N_ELEMENTS(s_encoder_slice_properties); i++)
+  {
+    const EncoderSliceProperty *prop = &s_encoder_slice_properties[i];
+    if (g_strcmp0(name, prop->factory) != 0 || !g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), prop->property)) continue;
+
+    gchar *value = g_strdup_printf(prop->value, slices);
+    gst_util_set_object_arg(G_OBJECT(encoder), prop->property, value);
+    g_free(value);
+    applied++;
+  }
+
+  if (applied == 0) gst_printerrln("%s has no slice settings, encoding whole frames", name);
+  return applied;
+}
@@ -0,0 +1,552 @@
+#include "headers/fallback.h"
+
+#include "headers/codec_branch.h"
+#include "headers/encoder.h"
+#include "headers/latency.h"
+#include "headers/scene.h"
+#include "headers/watchdog.h"
+
+// Software encoders per codec, in order of preference.
+static const FallbackEncoder s_software_encoders[] = {
+    {"video/x-h264", "x264enc"},      //
+    {"video/x-h264", "openh264enc"},  //
+    {"video/x-h265", "x265enc"},      //
+    {"video/x-vp8", "vp8enc"},        //
+    {"video/x-vp9", "vp9enc"},        //
+    {"video/x-av1", "svtav1enc"},     //
+    {"video/x-av1", "av1enc"},        //
+};
+
+// Fields of the failed encoder's output caps the software encoder must keep, so the payloader and the viewer's decoder
+// see the same stream.
+static const gchar *s_failover_caps_fields[] = {"profile", "stream-format", "alignment"};
+
+struct VtxFallback
+{
+  GstElement *pipeline;
+  FallbackSource source;
+  guint timeout_ms;
+  gboolean encoder_failover;
+
+  GstElement *selector;  // NULL when the source fallback is off
+  GstPad *live_pad;      // selector pad fed by the source
+  gulong live_probe;
+  GstElement *filler;    // pattern bin or appsrc, while active
+  GstPad *filler_pad;    // selector pad fed by the filler, while active
+  guint check_id;
+  guint push_id;
+
+  // guarded by lock
+  GMutex lock;
+  GstCaps *caps;  // caps of the source
+  gint64 frame_us;
+  gint64 last_buffer_us;
+  gboolean eos;
+  GstBuffer *last_frame;  // freeze mode only
+
+  // main thread only
+  gboolean active;
+  gint64 active_since_us;
+  guint activations;
+  gint64 total_active_us;
+  gdouble last_active_ms;
+
+  GPtrArray *failed_encoders;  // replaced encoders, kept so their late errors are recognised
+  guint failovers;
+  gchar *failover_from;
+  gchar *failover_to;
+  gchar *failover_error;
+};
+
+VtxFallback *g_fallback = NULL;
+
+// Maps the "fallback_source" media param to a fallback source; a missing value turns the source fallback off.
+FallbackSource vtx_fallback_parse_source(const gchar *name)
+{
+  if (g_strcmp0(name, "pattern") == 0) return FALLBACK_SOURCE_PATTERN;
+  if (g_strcmp0(name, "freeze") == 0) return FALLBACK_SOURCE_FREEZE;
+  if (name && g_strcmp0(name, "none") != 0) gst_printerrln("Unknown fallback source %s, fallback off", name);
+  return FALLBACK_SOURCE_NONE;
+}
+
+// Returns the name of a fallback source for logs and stats.
+static const gchar *vtx_fallback_source_to_string(FallbackSource source)
+{
+  switch (source)
+  {
+    case FALLBACK_SOURCE_PATTERN:
+      return "pattern";
+    case FALLBACK_SOURCE_FREEZE:
+      return "freeze";
+    default:
+      return "none";
+  }
+}
+
+// Returns TRUE if the caps describe frames in plain system memory (not NVMM, DMABuf or GL memory).
+static gboolean vtx_fallback_is_system_memory(GstCaps *caps)
+{
+  GstCapsFeatures *features = gst_caps_get_features(caps, 0);
+  return !features || gst_caps_features_is_any(features) || gst_caps_features_contains(features, GST_CAPS_FEATURE_MEMORY_SYSTEM_MEMORY);
+}
+
+// Tracks the caps, frame rate and last buffer of the source; an EOS is held back and treated as a stall.
+static GstPadProbeReturn vtx_fallback_on_live_pad(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxFallback *fallback = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+    {
+      GstCaps *caps = NULL;
+      gint num = 0, den = 0;
+      gst_event_parse_caps(event, &caps);
+      g_mutex_lock(&fallback->lock);
+      gst_caps_replace(&fallback->caps, caps);
+      if (gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &num, &den) && num > 0 && den > 0)
+      {
+        fallback->frame_us = gst_util_uint64_scale(den, G_USEC_PER_SEC, num);
+      }
+      g_mutex_unlock(&fallback->lock);
+    }
+    else if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+    {
+      g_mutex_lock(&fallback->lock);
+      fallback->eos = TRUE;
+      g_mutex_unlock(&fallback->lock);
+      return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock(&fallback->lock);
+  fallback->last_buffer_us = g_get_monotonic_time();
+  fallback->eos = FALSE;
+  if (fallback->source == FALLBACK_SOURCE_FREEZE) gst_buffer_replace(&fallback->last_frame, GST_PAD_PROBE_INFO_BUFFER(info));
+  g_mutex_unlock(&fallback->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+// Pushes the last source frame again (freeze mode); appsrc timestamps it with the current running time.
+static gboolean vtx_fallback_on_push(gpointer user_data)
+{
+  VtxFallback *fallback = user_data;
+
+  g_mutex_lock(&fallback->lock);
+  GstBuffer *frame = fallback->last_frame ? gst_buffer_copy(fallback->last_frame) : NULL;
+  g_mutex_unlock(&fallback->lock);
+  if (!frame) return G_SOURCE_CONTINUE;
+
+  GST_BUFFER_PTS(frame) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DTS(frame) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DURATION(frame) = GST_CLOCK_TIME_NONE;
+  GstFlowReturn ret;
+  g_signal_emit_by_name(fallback->filler, "push-buffer", frame, &ret);
+  gst_buffer_unref(frame);
+  return G_SOURCE_CONTINUE;
+}
+
+// Creates the element feeding the selector while the source is stalled: a test pattern scaled to the source caps, or an
+// appsrc repeating the last frame. Returns NULL if neither fits the source caps.
+static GstElement *vtx_fallback_make_filler(VtxFallback *fallback, GstCaps *caps, FallbackSource *source)
+{
+  gboolean system_memory = vtx_fallback_is_system_memory(caps);
+  g_mutex_lock(&fallback->lock);
+  gboolean have_frame = fallback->last_frame != NULL;
+  g_mutex_unlock(&fallback->lock);
+
+  // videotestsrc only produces system memory; the last frame works in any memory
+  *source = fallback->source;
+  if (*source == FALLBACK_SOURCE_PATTERN && !system_memory) *source = FALLBACK_SOURCE_FREEZE;
+  if (*source == FALLBACK_SOURCE_FREEZE && !have_frame) *source = FALLBACK_SOURCE_PATTERN;
+  if (*source == FALLBACK_SOURCE_PATTERN && !system_memory) return NULL;
+
+  if (*source == FALLBACK_SOURCE_FREEZE)
+  {
+    return gst_element_factory_make_full("appsrc", "name", FALLBACK_SELECTOR "src", "is-live", TRUE, "format", GST_FORMAT_TIME, "do-timestamp", TRUE, "caps", caps, NULL);
+  }
+
+  GError *error = NULL;
+  gchar *desc = g_strdup_printf("%s ! capsfilter name=" FALLBACK_SELECTOR "caps", FALLBACK_PATTERN_PIPELINE);
+  GstElement *bin = gst_parse_bin_from_description(desc, TRUE, &error);
+  g_free(desc);
+  if (!bin)
+  {
+    gst_printerrln("Fallback: pattern source failed: %s", error ? error->message : "unknown");
+    g_clear_error(&error);
+    return NULL;
+  }
+  gst_object_set_name(GST_OBJECT(bin), FALLBACK_SELECTOR "src");
+
+  // A variable frame rate (0/1) would make videotestsrc produce a single frame
+  GstCaps *pattern_caps = gst_caps_copy(caps);
+  gint num = 0, den = 0;
+  GstStructure *s = gst_caps_get_structure(pattern_caps, 0);
+  if (!gst_structure_get_fraction(s, "framerate", &num, &den) || num == 0)
+  {
+    gst_structure_set(s, "framerate", GST_TYPE_FRACTION, 1000, FALLBACK_DEFAULT_FRAME_MS, NULL);
+  }
+  GstElement *capsfilter = gst_bin_get_by_name(GST_BIN(bin), FALLBACK_SELECTOR "caps");
+  g_object_set(capsfilter, "caps", pattern_caps, NULL);
+  gst_object_unref(capsfilter);
+  gst_caps_unref(pattern_caps);
+  return bin;
+}
+
+// Switches the selector to the filler while the source is stalled.
+static void vtx_fallback_activate(VtxFallback *fallback)
+{
+  g_mutex_lock(&fallback->lock);
+  GstCaps *caps = fallback->caps ? gst_caps_ref(fallback->caps) : NULL;
+  gint64 frame_us = fallback->frame_us ? fallback->frame_us : FALLBACK_DEFAULT_FRAME_MS * 1000;
+  g_mutex_unlock(&fallback->lock);
+  if (!caps) return;
+
+  FallbackSource source;
+  GstElement *filler = vtx_fallback_make_filler(fallback, caps, &source);
+  gst_caps_unref(caps);
+  if (!filler) return;
+
+  GstElement *bin = GST_ELEMENT_PARENT(fallback->selector);
+  gst_bin_add(GST_BIN(bin), filler);
+  fallback->filler = gst_object_ref(filler);
+  fallback->filler_pad = gst_element_request_pad_simple(fallback->selector, "sink_%u");
+  GstPad *filler_src = gst_element_get_static_pad(filler, "src");
+  gst_pad_link(filler_src, fallback->filler_pad);
+  gst_object_unref(filler_src);
+  gst_element_sync_state_with_parent(filler);
+  g_object_set(fallback->selector, "active-pad", fallback->filler_pad, NULL);
+
+  if (source == FALLBACK_SOURCE_FREEZE) fallback->push_id = g_timeout_add(MAX(frame_us / 1000, 1), vtx_fallback_on_push, fallback);
+
+  fallback->active = TRUE;
+  fallback->active_since_us = g_get_monotonic_time();
+  fallback->activations++;
+  gst_printerrln("Fallback: source stalled, switched to %s", vtx_fallback_source_to_string(source));
+}
+
+// Switches the selector back to the source and removes the filler.
+static void vtx_fallback_deactivate(VtxFallback *fallback)
+{
+  g_object_set(fallback->selector, "active-pad", fallback->live_pad, NULL);
+  if (fallback->push_id)
+  {
+    g_source_remove(fallback->push_id);
+    fallback->push_id = 0;
+  }
+
+  gst_element_set_state(fallback->filler, GST_STATE_NULL);
+  gst_element_release_request_pad(fallback->selector, fallback->filler_pad);
+  gst_object_unref(fallback->filler_pad);
+  fallback->filler_pad = NULL;
+  gst_bin_remove(GST_BIN(GST_ELEMENT_PARENT(fallback->filler)), fallback->filler);
+  gst_object_unref(fallback->filler);
+  fallback->filler = NULL;
+
+  gint64 active_us = g_get_monotonic_time() - fallback->active_since_us;
+  fallback->active = FALSE;
+  fallback->total_active_us += active_us;
+  fallback->last_active_ms = active_us / 1000.0;
+  gst_println("Fallback: source back after %.0f ms", fallback->last_active_ms);
+}
+
+// Switches to the filler once the source has stalled for the timeout, and back on its first new frame.
+static gboolean vtx_fallback_on_check(gpointer user_data)
+{
+  VtxFallback *fallback = user_data;
+  gint64 now_us = g_get_monotonic_time();
+
+  g_mutex_lock(&fallback->lock);
+  gint64 last_buffer_us = fallback->last_buffer_us;
+  gboolean eos = fallback->eos;
+  g_mutex_unlock(&fallback->lock);
+
+  if (!fallback->active)
+  {
+    if (last_buffer_us && (eos || now_us - last_buffer_us > (gint64) fallback->timeout_ms * 1000)) vtx_fallback_activate(fallback);
+  }
+  else if (!eos && last_buffer_us > fallback->active_since_us)
+  {
+    vtx_fallback_deactivate(fallback);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+// Inserts the fallback selector ahead of the multi-codec source tee, or ahead of the video encoder.
+static gboolean vtx_fallback_insert_selector(VtxFallback *fallback)
+{
+  GstElement *target = gst_bin_get_by_name(GST_BIN(fallback->pipeline), CODEC_BRANCH_SOURCE_TEE);
+  if (!target) target = vtx_encoder_find(GST_BIN(fallback->pipeline));
+  if (!target)
+  {
+    gst_printerrln("Fallback: no video encoder found");
+    return FALSE;
+  }
+
+  GstPad *target_pad = gst_element_get_static_pad(target, "sink");
+  GstPad *peer = target_pad ? gst_pad_get_peer(target_pad) : NULL;
+  GstObject *bin = gst_object_get_parent(GST_OBJECT(target));
+  gboolean linked = FALSE;
+
+  if (peer && bin)
+  {
+    fallback->selector = gst_element_factory_make_full("input-selector", "name", FALLBACK_SELECTOR, "sync-streams", FALSE, NULL);
+    gst_bin_add(GST_BIN(bin), fallback->selector);
+    gst_object_ref(fallback->selector);
+    gst_pad_unlink(peer, target_pad);
+
+    fallback->live_pad = gst_element_request_pad_simple(fallback->selector, "sink_%u");
+    GstPad *selector_src = gst_element_get_static_pad(fallback->selector, "src");
+    linked = gst_pad_link_maybe_ghosting(peer, fallback->live_pad) && gst_pad_link(selector_src, target_pad) == GST_PAD_LINK_OK;
+    gst_object_unref(selector_src);
+    g_object_set(fallback->selector, "active-pad", fallback->live_pad, NULL);
+  }
+  if (!linked) gst_printerrln("Fallback: failed to insert the selector ahead of %s", GST_OBJECT_NAME(target));
+
+  if (bin) gst_object_unref(bin);
+  if (peer) gst_object_unref(peer);
+  if (target_pad) gst_object_unref(target_pad);
+  gst_object_unref(target);
+  return linked;
+}
+
+// Sets up the source fallback (unless source is FALLBACK_SOURCE_NONE) and encoder failover on a pipeline that has not
+// been started yet.
+VtxFallback *vtx_fallback_attach(GstElement *pipeline, FallbackSource source, guint timeout_ms, gboolean encoder_failover)
+{
+  VtxFallback *fallback = g_new0(VtxFallback, 1);
+  g_mutex_init(&fallback->lock);
+  fallback->pipeline = gst_object_ref(pipeline);
+  fallback->source = source;
+  fallback->timeout_ms = timeout_ms;
+  fallback->encoder_failover = encoder_failover;
+  fallback->failed_encoders = g_ptr_array_new_with_free_func(gst_object_unref);
+
+  if (source != FALLBACK_SOURCE_NONE && vtx_fallback_insert_selector(fallback))
+  {
+    fallback->live_probe = gst_pad_add_probe(fallback->live_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_fallback_on_live_pad, fallback, NULL);
+    fallback->check_id = g_timeout_add(FALLBACK_CHECK_INTERVAL_MS, vtx_fallback_on_check, fallback);
+    gst_println("Fallback: %s after %u ms without source frames", vtx_fallback_source_to_string(source), timeout_ms);
+  }
+  return fallback;
+}
+
+// Frees the fallback. The pipeline must already be stopped.
+void vtx_fallback_free(VtxFallback *fallback)
+{
+  if (!fallback) return;
+
+  if (fallback->check_id) g_source_remove(fallback->check_id);
+  if (fallback->push_id) g_source_remove(fallback->push_id);
+  if (fallback->live_pad)
+  {
+    gst_pad_remove_probe(fallback->live_pad, fallback->live_probe);
+    gst_object_unref(fallback->live_pad);
+  }
+  if (fallback->filler_pad) gst_object_unref(fallback->filler_pad);
+  if (fallback->filler) gst_object_unref(fallback->filler);
+  if (fallback->selector) gst_object_unref(fallback->selector);
+  gst_buffer_replace(&fallback->last_frame, NULL);
+  gst_caps_replace(&fallback->caps, NULL);
+  g_ptr_array_free(fallback->failed_encoders, TRUE);
+  g_free(fallback->failover_from);
+  g_free(fallback->failover_to);
+  g_free(fallback->failover_error);
+  gst_object_unref(fallback->pipeline);
+  g_mutex_clear(&fallback->lock);
+  g_free(fallback);
+}
+
+// Returns the software encoder factory for the media type, or NULL if this is already one or none is installed.
+static const gchar *vtx_fallback_software_encoder(const gchar *media_type, const gchar *failed_factory)
+{
+  for (guint i = 0; i < G_N_ELEMENTS(s_software_encoders); i++)
+  {
+    if (g_strcmp0(failed_factory, s_software_encoders[i].factory) == 0) return NULL;
+  }
+  for (guint i = 0; i < G_N_ELEMENTS(s_software_encoders); i++)
+  {
+    if (g_strcmp0(media_type, s_software_encoders[i].media_type) != 0) continue;
+
+    GstElementFactory *factory = gst_element_factory_find(s_software_encoders[i].factory);
+    if (!factory) continue;
+    gst_object_unref(factory);
+    return s_software_encoders[i].factory;
+  }
+  return NULL;
+}
+
+// Drops buffers heading into an encoder that is being replaced, so upstream sees no not-linked flow.
+static GstPadProbeReturn vtx_fallback_on_swap(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  return GST_PAD_PROBE_DROP;
+}
+
+// Builds the replacement: videoconvert, the software encoder with its low-latency tuning, and a capsfilter holding the
+// failed encoder's output format.
+static GstElement *vtx_fallback_make_encoder_bin(const gchar *factory, GstCaps *output_caps)
+{
+  GError *error = NULL;
+  gchar *desc = g_strdup_printf("videoconvert ! %s %s ! capsfilter name=failovercaps", factory, vtx_codec_branch_tuning(factory));
+  GstElement *bin = gst_parse_bin_from_description(desc, TRUE, &error);
+  g_free(desc);
+  if (!bin)
+  {
+    gst_printerrln("Failover: %s", error ? error->message : "unknown");
+    g_clear_error(&error);
+    return NULL;
+  }
+
+  const GstStructure *produced = gst_caps_get_structure(output_caps, 0);
+  GstStructure *kept = gst_structure_new_empty(gst_structure_get_name(produced));
+  for (guint i = 0; i < G_N_ELEMENTS(s_failover_caps_fields); i++)
+  {
+    const GValue *value = gst_structure_get_value(produced, s_failover_caps_fields[i]);
+    if (value) gst_structure_set_value(kept, s_failover_caps_fields[i], value);
+  }
+  GstCaps *caps = gst_caps_new_full(kept, NULL);
+  GstElement *capsfilter = gst_bin_get_by_name(GST_BIN(bin), "failovercaps");
+  g_object_set(capsfilter, "caps", caps, NULL);
+  gst_object_unref(capsfilter);
+  gst_caps_unref(caps);
+  return bin;
+}
+
+// Replaces a failed encoder by a software encoder between the same neighbours. Upstream buffers are dropped while the
+// elements are swapped; the payloader downstream keeps its SSRC and payload type.
+static gboolean vtx_fallback_failover(VtxFallback *fallback, GstElement *encoder, const gchar *reason)
+{
+  GstPad *sink = gst_element_get_static_pad(encoder, "sink");
+  GstPad *src = gst_element_get_static_pad(encoder, "src");
+  GstPad *up = sink ? gst_pad_get_peer(sink) : NULL;
+  GstPad *down = src ? gst_pad_get_peer(src) : NULL;
+  GstCaps *input_caps = sink ? gst_pad_get_current_caps(sink) : NULL;
+  GstCaps *output_caps = src ? gst_pad_get_current_caps(src) : NULL;
+  GstObject *bin = gst_object_get_parent(GST_OBJECT(encoder));
+  const gchar *failed_factory = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(gst_element_get_factory(encoder)));
+  const gchar *factory = output_caps ? vtx_fallback_software_encoder(gst_structure_get_name(gst_caps_get_structure(output_caps, 0)), failed_factory) : NULL;
+  GstElement *replacement = NULL;
+
+  if (!up || !down || !bin || !factory)
+  {
+    gst_printerrln("Failover: no software replacement for %s", failed_factory);
+  }
+  else if (input_caps && !vtx_fallback_is_system_memory(input_caps))
+  {
+    gst_printerrln("Failover: %s input is not in system memory", failed_factory);
+  }
+  else
+  {
+    replacement = vtx_fallback_make_encoder_bin(factory, output_caps);
+  }
+
+  if (replacement)
+  {
+    guint kbps = vtx_encoder_get_bitrate_kbps(encoder);
+    gulong probe = gst_pad_add_probe(up, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, vtx_fallback_on_swap, NULL, NULL);
+
+    gst_element_set_locked_state(encoder, TRUE);
+    gst_element_set_state(encoder, GST_STATE_NULL);
+    gst_pad_unlink(up, sink);
+    gst_pad_unlink(src, down);
+    g_ptr_array_add(fallback->failed_encoders, gst_object_ref(encoder));
+    gst_bin_remove(GST_BIN(bin), encoder);
+
+    gst_bin_add(GST_BIN(bin), replacement);
+    GstPad *replacement_sink = gst_element_get_static_pad(replacement, "sink");
+    GstPad *replacement_src = gst_element_get_static_pad(replacement, "src");
+    gboolean linked = gst_pad_link(up, replacement_sink) == GST_PAD_LINK_OK && gst_pad_link(replacement_src, down) == GST_PAD_LINK_OK;
+    gst_object_unref(replacement_sink);
+    gst_object_unref(replacement_src);
+
+    GstElement *software = vtx_encoder_find(GST_BIN(replacement));
+    if (software && kbps) vtx_encoder_set_bitrate_kbps(software, kbps);
+
+    // Hooks bound to the failed encoder follow it to the replacement before it starts
+    if (linked && software)
+    {
+      if (g_scene) vtx_scene_replace_encoder(g_scene, encoder, software);
+      if (g_latency) vtx_latency_replace_encoder(g_latency, encoder, software);
+    }
+    if (linked && g_watchdog) vtx_watchdog_replace_element(g_watchdog, encoder, replacement);
+    if (software) gst_object_unref(software);
+
+    gst_element_sync_state_with_parent(replacement);
+    gst_pad_remove_probe(up, probe);
+
+    if (linked)
+    {
+      fallback->failovers++;
+      g_free(fallback->failover_from);
+      g_free(fallback->failover_to);
+      g_free(fallback->failover_error);
+      fallback->failover_from = g_strdup(failed_factory);
+      fallback->failover_to = g_strdup(factory);
+      fallback->failover_error = g_strdup(reason);
+      gst_printerrln("Failover: %s failed (%s), encoding with %s at %u kbps", failed_factory, reason, factory, kbps);
+    }
+    else
+    {
+      gst_printerrln("Failover: failed to link %s", factory);
+      replacement = NULL;
+    }
+  }
+
+  if (bin) gst_object_unref(bin);
+  if (input_caps) gst_caps_unref(input_caps);
+  if (output_caps) gst_caps_unref(output_caps);
+  if (up) gst_object_unref(up);
+  if (down) gst_object_unref(down);
+  if (sink) gst_object_unref(sink);
+  if (src) gst_object_unref(src);
+  return replacement != NULL;
+}
+
+// Fails a video encoder that posted an error over to a software encoder instead of ending the session. Returns FALSE
+// for messages the fallback does not handle, including errors it could not recover from.
+gboolean vtx_fallback_handle_message(VtxFallback *fallback, GstMessage *msg)
+{
+  if (!fallback->encoder_failover || GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ERROR) return FALSE;
+
+  GstObject *object = GST_MESSAGE_SRC(msg);
+  while (object && !(GST_IS_ELEMENT(object) && vtx_encoder_is_video_encoder(GST_ELEMENT(object)))) object = GST_OBJECT_PARENT(object);
+  if (!object) return FALSE;
+
+  // A replaced encoder may still have errors queued on the bus
+  if (g_ptr_array_find(fallback->failed_encoders, object, NULL)) return TRUE;
+
+  GError *err = NULL;
+  gst_message_parse_error(msg, &err, NULL);
+  gboolean handled = vtx_fallback_failover(fallback, GST_ELEMENT(object), err->message);
+  g_error_free(err);
+  return handled;
+}
+
+// Returns source fallback activations and time, and the last encoder failover.
+JsonObject *vtx_fallback_get_stats(VtxFallback *fallback)
+{
+  JsonObject *stats = json_object_new();
+  if (fallback->selector)
+  {
+    gint64 active_us = fallback->total_active_us + (fallback->active ? g_get_monotonic_time() - fallback->active_since_us : 0);
+    JsonObject *source = json_object_new();
+    json_object_set_string_member(source, "mode", vtx_fallback_source_to_string(fallback->source));
+    json_object_set_boolean_member(source, "active", fallback->active);
+    json_object_set_int_member(source, "activations", fallback->activations);
+    json_object_set_double_member(source, "active_ms", active_us / 1000.0);
+    json_object_set_double_member(source, "last_active_ms", fallback->last_active_ms);
+    json_object_set_object_member(stats, "source", source);
+  }
+  if (fallback->encoder_failover)
+  {
+    JsonObject *encoder = json_object_new();
+    json_object_set_int_member(encoder, "failovers", fallback->failovers);
+    if (fallback->failover_from) json_object_set_string_member(encoder, "from", fallback->failover_from);
+    if (fallback->failover_to) json_object_set_string_member(encoder, "to", fallback->failover_to);
+    if (fallback->failover_error) json_object_set_string_member(encoder, "error", fallback->failover_error);
+    json_object_set_object_member(stats, "encoder", encoder);
+  }
+  return stats;
+}
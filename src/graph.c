@@ -0,0 +1,365 @@
+#include "headers/graph.h"
+
+// A factory resolved once per process: loaded plugin feature and element class for property validation.
+typedef struct
+{
+  GstElementFactory *factory;
+  GObjectClass *klass;
+} GraphFactory;
+
+// One validated element of a chain: its factory and the properties to construct it with (including "name").
+typedef struct
+{
+  GraphFactory *factory;
+  gchar *name;
+  GPtrArray *property_names;
+  GArray *property_values;
+} GraphNode;
+
+struct VtxGraph
+{
+  GPtrArray *video;  // GraphNode, in link order
+  GPtrArray *audio;
+  GPtrArray *elements;  // every created element, in creation order
+  GHashTable *named;    // element name -> element (borrowed from elements)
+  gint64 parse_us;
+  gint64 build_us;
+};
+
+VtxGraph *g_graph = NULL;
+
+// Factory cache shared by all sessions of the process
+static GHashTable *s_factories = NULL;
+static guint s_factory_hits = 0;
+static guint s_factory_misses = 0;
+
+// Returns the cached factory, resolving and loading it on first use. Returns NULL if no such element is installed.
+static GraphFactory *vtx_graph_lookup_factory(const gchar *name)
+{
+  if (!s_factories) s_factories = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  GraphFactory *entry = g_hash_table_lookup(s_factories, name);
+  if (entry)
+  {
+    s_factory_hits++;
+    return entry;
+  }
+
+  GstElementFactory *factory = gst_element_factory_find(name);
+  if (!factory) return NULL;
+  GstPluginFeature *loaded = gst_plugin_feature_load(GST_PLUGIN_FEATURE(factory));
+  gst_object_unref(factory);
+  if (!loaded) return NULL;
+
+  entry = g_new0(GraphFactory, 1);
+  entry->factory = GST_ELEMENT_FACTORY(loaded);
+  entry->klass = g_type_class_ref(gst_element_factory_get_element_type(entry->factory));
+  g_hash_table_insert(s_factories, g_strdup(name), entry);
+  s_factory_misses++;
+  return entry;
+}
+
+// Frees a chain node.
+static void vtx_graph_node_free(gpointer data)
+{
+  GraphNode *node = data;
+  g_free(node->name);
+  g_ptr_array_free(node->property_names, TRUE);
+  g_array_free(node->property_values, TRUE);
+  g_free(node);
+}
+
+// Returns TRUE if a JSON integer fits the range of an integer property before it is narrowed to the property's type.
+// Non-integer properties are left to the transform and g_param_value_validate.
+static gboolean vtx_graph_int_in_range(GParamSpec *pspec, gint64 number)
+{
+  if (G_IS_PARAM_SPEC_INT(pspec)) return number >= G_PARAM_SPEC_INT(pspec)->minimum && number <= G_PARAM_SPEC_INT(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_UINT(pspec)) return number >= 0 && (guint64) number >= G_PARAM_SPEC_UINT(pspec)->minimum && (guint64) number <= G_PARAM_SPEC_UINT(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_LONG(pspec)) return number >= G_PARAM_SPEC_LONG(pspec)->minimum && number <= G_PARAM_SPEC_LONG(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_ULONG(pspec)) return number >= 0 && (guint64) number >= G_PARAM_SPEC_ULONG(pspec)->minimum && (guint64) number <= G_PARAM_SPEC_ULONG(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_INT64(pspec)) return number >= G_PARAM_SPEC_INT64(pspec)->minimum && number <= G_PARAM_SPEC_INT64(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_UINT64(pspec)) return number >= 0 && (guint64) number >= G_PARAM_SPEC_UINT64(pspec)->minimum && (guint64) number <= G_PARAM_SPEC_UINT64(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_CHAR(pspec)) return number >= G_PARAM_SPEC_CHAR(pspec)->minimum && number <= G_PARAM_SPEC_CHAR(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_UCHAR(pspec)) return number >= G_PARAM_SPEC_UCHAR(pspec)->minimum && number <= G_PARAM_SPEC_UCHAR(pspec)->maximum;
+  if (G_IS_PARAM_SPEC_ENUM(pspec)) return number >= G_MININT && number <= G_MAXINT;
+  return TRUE;
+}
+
+// Converts a JSON property value to the property's type: strings are deserialized (enum nicks, flags, fractions, caps),
+// numbers and booleans are transformed. Values outside the property's range are rejected rather than clamped.
+static gboolean vtx_graph_convert_value(GParamSpec *pspec, JsonNode *node, GValue *value)
+{
+  GType type = G_PARAM_SPEC_VALUE_TYPE(pspec);
+  if (JSON_NODE_TYPE(node) != JSON_NODE_VALUE) return FALSE;
+
+  GType json_type = json_node_get_value_type(node);
+  if (json_type == G_TYPE_INT64 && !vtx_graph_int_in_range(pspec, json_node_get_int(node))) return FALSE;
+
+  g_value_init(value, type);
+  gboolean converted = FALSE;
+
+  if (json_type == G_TYPE_STRING && type == G_TYPE_STRING)
+  {
+    g_value_set_string(value, json_node_get_string(node));
+    converted = TRUE;
+  }
+  else if (json_type == G_TYPE_STRING)
+  {
+    converted = gst_value_deserialize(value, json_node_get_string(node));
+  }
+  else if (json_type == G_TYPE_INT64 && G_TYPE_IS_ENUM(type))
+  {
+    GEnumClass *enum_class = g_type_class_ref(type);
+    gint64 number = json_node_get_int(node);
+    converted = g_enum_get_value(enum_class, (gint) number) != NULL;
+    if (converted) g_value_set_enum(value, (gint) number);
+    g_type_class_unref(enum_class);
+  }
+  else
+  {
+    GValue json_value = G_VALUE_INIT;
+    json_node_get_value(node, &json_value);
+    converted = g_value_type_transformable(json_type, type) && g_value_transform(&json_value, value);
+    g_value_unset(&json_value);
+  }
+
+  // g_param_value_validate returns TRUE when it had to modify the value to fit the property
+  return converted && !g_param_value_validate(pspec, value);
+}
+
+// Validates one element description and resolves its factory and property values.
+static GraphNode *vtx_graph_parse_node(JsonNode *json, const gchar *media, guint index, gchar **error_msg)
+{
+  JsonObject *o = JSON_NODE_HOLDS_OBJECT(json) ? json_node_get_object(json) : NULL;
+  const gchar *caps_str = o && json_object_has_member(o, "caps") ? json_object_get_string_member(o, "caps") : NULL;
+  const gchar *factory_name = caps_str ? "capsfilter" : o && json_object_has_member(o, "factory") ? json_object_get_string_member(o, "factory") : NULL;
+
+  if (!factory_name)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: needs \"factory\" or \"caps\"", media, index);
+    return NULL;
+  }
+  GraphFactory *factory = vtx_graph_lookup_factory(factory_name);
+  if (!factory)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: no element \"%s\"", media, index, factory_name);
+    return NULL;
+  }
+
+  GraphNode *node = g_new0(GraphNode, 1);
+  node->factory = factory;
+  node->name = json_object_has_member(o, "name") ? g_strdup(json_object_get_string_member(o, "name")) : NULL;
+  node->property_names = g_ptr_array_new_with_free_func(g_free);
+  node->property_values = g_array_new(FALSE, TRUE, sizeof(GValue));
+  g_array_set_clear_func(node->property_values, (GDestroyNotify) g_value_unset);
+
+  if (node->name)
+  {
+    GValue value = G_VALUE_INIT;
+    g_value_init(&value, G_TYPE_STRING);
+    g_value_set_string(&value, node->name);
+    g_ptr_array_add(node->property_names, g_strdup("name"));
+    g_array_append_val(node->property_values, value);
+  }
+
+  if (caps_str)
+  {
+    GstCaps *caps = gst_caps_from_string(caps_str);
+    if (!caps)
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: invalid caps \"%s\"", media, index, caps_str);
+      vtx_graph_node_free(node);
+      return NULL;
+    }
+    GValue value = G_VALUE_INIT;
+    g_value_init(&value, GST_TYPE_CAPS);
+    gst_value_set_caps(&value, caps);
+    gst_caps_unref(caps);
+    g_ptr_array_add(node->property_names, g_strdup("caps"));
+    g_array_append_val(node->property_values, value);
+  }
+
+  JsonObject *properties = json_object_has_member(o, "properties") ? json_object_get_object_member(o, "properties") : NULL;
+  GList *members = properties ? json_object_get_members(properties) : NULL;
+  for (GList *m = members; m != NULL; m = m->next)
+  {
+    const gchar *property = m->data;
+    GParamSpec *pspec = g_object_class_find_property(factory->klass, property);
+    GValue value = G_VALUE_INIT;
+
+    if (!pspec || !(pspec->flags & G_PARAM_WRITABLE))
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: %s has no writable property \"%s\"", media, index, factory_name, property);
+    }
+    else if (!vtx_graph_convert_value(pspec, json_object_get_member(properties, property), &value))
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: invalid or out-of-range value for %s.%s", media, index, factory_name, property);
+    }
+    else
+    {
+      g_ptr_array_add(node->property_names, g_strdup(property));
+      g_array_append_val(node->property_values, value);
+      continue;
+    }
+
+    if (G_IS_VALUE(&value)) g_value_unset(&value);
+    g_list_free(members);
+    vtx_graph_node_free(node);
+    return NULL;
+  }
+  g_list_free(members);
+  return node;
+}
+
+// Validates a media chain (a JSON array of element descriptions). A NULL node is an absent chain.
+static gboolean vtx_graph_parse_chain(JsonNode *json, const gchar *media, GPtrArray *nodes, gchar **error_msg)
+{
+  if (!json) return TRUE;
+
+  JsonArray *array = JSON_NODE_HOLDS_ARRAY(json) ? json_node_get_array(json) : NULL;
+  if (!array || json_array_get_length(array) == 0)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%s_graph must be a non-empty array of elements", media);
+    return FALSE;
+  }
+
+  for (guint i = 0; i < json_array_get_length(array); i++)
+  {
+    GraphNode *node = vtx_graph_parse_node(json_array_get_element(array, i), media, i, error_msg);
+    if (!node) return FALSE;
+    g_ptr_array_add(nodes, node);
+  }
+  return TRUE;
+}
+
+// Rejects element names used twice across the video and audio chains, which the bin would refuse to add.
+static gboolean vtx_graph_check_names(VtxGraph *graph, gchar **error_msg)
+{
+  GPtrArray *chains[] = {graph->video, graph->audio};
+  GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+  gboolean unique = TRUE;
+
+  for (guint c = 0; c < G_N_ELEMENTS(chains) && unique; c++)
+  {
+    for (guint i = 0; i < chains[c]->len && unique; i++)
+    {
+      GraphNode *node = g_ptr_array_index(chains[c], i);
+      if (!node->name) continue;
+      unique = g_hash_table_add(names, node->name);
+      if (!unique && error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: duplicate element name \"%s\"", c == 0 ? "video" : "audio", i, node->name);
+    }
+  }
+
+  g_hash_table_destroy(names);
+  return unique;
+}
+
+// Validates the video and audio chains. Returns NULL (with error_msg set) on the first invalid element, property or caps.
+VtxGraph *vtx_graph_parse(JsonNode *video, JsonNode *audio, gchar **error_msg)
+{
+  gint64 start_us = g_get_monotonic_time();
+  VtxGraph *graph = g_new0(VtxGraph, 1);
+  graph->video = g_ptr_array_new_with_free_func(vtx_graph_node_free);
+  graph->audio = g_ptr_array_new_with_free_func(vtx_graph_node_free);
+  graph->elements = g_ptr_array_new_with_free_func(gst_object_unref);
+  graph->named = g_hash_table_new(g_str_hash, g_str_equal);
+
+  if (!vtx_graph_parse_chain(video, "video", graph->video, error_msg) || !vtx_graph_parse_chain(audio, "audio", graph->audio, error_msg) || !vtx_graph_check_names(graph, error_msg))
+  {
+    vtx_graph_free(graph);
+    return NULL;
+  }
+
+  graph->parse_us = g_get_monotonic_time() - start_us;
+  return graph;
+}
+
+// Creates the elements of a chain in the bin and links them in order. Returns the last element, or NULL on failure.
+static GstElement *vtx_graph_build_chain(VtxGraph *graph, GPtrArray *nodes, GstBin *bin, const gchar *media, gchar **error_msg)
+{
+  GstElement *previous = NULL;
+  GString *log = g_string_new(NULL);
+
+  for (guint i = 0; i < nodes->len; i++)
+  {
+    GraphNode *node = g_ptr_array_index(nodes, i);
+    GstElement *element = gst_element_factory_create_with_properties(node->factory->factory, node->property_names->len, (const gchar **) node->property_names->pdata, (const GValue *) node->property_values->data);
+    if (!element)
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: failed to create %s", media, i, gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(node->factory->factory)));
+      g_string_free(log, TRUE);
+      return NULL;
+    }
+
+    // Hold our own reference so a refused element is released here whether or not the bin sank it.
+    gst_object_ref_sink(element);
+    if (!gst_bin_add(bin, element))
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: the pipeline already has an element named %s", media, i, GST_OBJECT_NAME(element));
+      gst_object_unref(element);
+      g_string_free(log, TRUE);
+      return NULL;
+    }
+    g_ptr_array_add(graph->elements, element);
+    g_hash_table_insert(graph->named, GST_OBJECT_NAME(element), element);
+    g_string_append_printf(log, "%s%s", i ? " ! " : "", GST_OBJECT_NAME(element));
+
+    if (previous && !gst_element_link(previous, element))
+    {
+      if (error_msg) *error_msg = g_strdup_printf("%s_graph[%u]: cannot link %s to %s", media, i, GST_OBJECT_NAME(previous), GST_OBJECT_NAME(element));
+      g_string_free(log, TRUE);
+      return NULL;
+    }
+    previous = element;
+  }
+
+  gst_println("Graph %s: %s", media, log->str);
+  g_string_free(log, TRUE);
+  return previous;
+}
+
+// Instantiates the validated chains into the bin. The tails (the payloaders) are returned for linking to the sink side.
+gboolean vtx_graph_build(VtxGraph *graph, GstBin *bin, GstElement **video_tail, GstElement **audio_tail, gchar **error_msg)
+{
+  gint64 start_us = g_get_monotonic_time();
+
+  *video_tail = NULL;
+  *audio_tail = NULL;
+  if (graph->video->len > 0 && !(*video_tail = vtx_graph_build_chain(graph, graph->video, bin, "video", error_msg))) return FALSE;
+  if (graph->audio->len > 0 && !(*audio_tail = vtx_graph_build_chain(graph, graph->audio, bin, "audio", error_msg))) return FALSE;
+
+  graph->build_us = g_get_monotonic_time() - start_us;
+  gst_println("Graph: %u elements, parsed in %" G_GINT64_FORMAT " us, built in %" G_GINT64_FORMAT " us", graph->elements->len, graph->parse_us, graph->build_us);
+  return TRUE;
+}
+
+// Returns the element created under the name (borrowed, valid while the graph lives), or NULL.
+GstElement *vtx_graph_get_element(VtxGraph *graph, const gchar *name)
+{
+  return g_hash_table_lookup(graph->named, name);
+}
+
+// Frees the graph and its element handles.
+void vtx_graph_free(VtxGraph *graph)
+{
+  if (!graph) return;
+
+  g_hash_table_destroy(graph->named);
+  g_ptr_array_free(graph->elements, TRUE);
+  g_ptr_array_free(graph->video, TRUE);
+  g_ptr_array_free(graph->audio, TRUE);
+  g_free(graph);
+}
+
+// Returns the parse and build times, the element count and the factory cache counters.
+JsonObject *vtx_graph_get_stats(VtxGraph *graph)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_int_member(stats, "elements", graph->elements->len);
+  json_object_set_int_member(stats, "parse_us", graph->parse_us);
+  json_object_set_int_member(stats, "build_us", graph->build_us);
+  json_object_set_int_member(stats, "factory_cache_entries", s_factories ? g_hash_table_size(s_factories) : 0);
+  json_object_set_int_member(stats, "factory_cache_hits", s_factory_hits);
+  json_object_set_int_member(stats, "factory_cache_misses", s_factory_misses);
+  return stats;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// In-process V4L2 controls on the camera the pipeline actually opens (the "device" of its V4L2 source element). Controls
+// are named as v4l2-ctl lists them ("h264_profile", "video_bitrate", "exposure_time_absolute", ...) or by a short alias
+// ("profile", "bitrate", "gop", "exposure", "white_balance", ...). They are validated with VIDIOC_QUERYCTRL, then one
+// VIDIOC_S_EXT_CTRLS sets them together. Menu controls also take the item name ("high", "constrained-baseline").
+
+// Short names for the controls vrx uses most; the V4L2 control ids are resolved in camera.c.
+typedef struct
+{
+  const gchar *name;
+  guint32 id;
+} CameraControlAlias;
+
+typedef struct VtxCamera VtxCamera;
+
+extern VtxCamera *g_camera;
+
+VtxCamera *vtx_camera_attach(GstElement *pipeline, const gchar *video_profile, JsonObject *controls);
+
+gboolean vtx_camera_set_controls(VtxCamera *camera, JsonObject *controls, JsonObject *applied, gchar **error_msg);
+
+void vtx_camera_free(VtxCamera *camera);
+
+JsonObject *vtx_camera_get_stats(VtxCamera *camera);
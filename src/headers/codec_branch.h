@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/sdp/sdp.h>
+
+// One encoder branch per codec family (AV1, H265, VP9, H264, VP8)
+#define CODEC_BRANCH_MAX 5
+
+#define CODEC_BRANCH_DEFAULT_PAYLOAD_TYPE 96
+
+#define CODEC_BRANCH_SELECTOR "vselector"
+#define CODEC_BRANCH_SOURCE_TEE "vtee"
+
+typedef struct
+{
+  const gchar *encoding_name;  // RTP encoding name in the SDP rtpmap
+  const gchar *media_type;     // caps name on the encoder src pad
+  const gchar *parse_pay;      // parser and payloader description
+  const gchar *fmtp;           // extra codec-preferences fields, or NULL
+} CodecFamily;
+
+typedef struct
+{
+  const gchar *factory;
+  const gchar *properties;  // low-latency properties appended to the encoder
+} EncoderTuning;
+
+const gchar *vtx_codec_branch_tuning(const gchar *factory);
+
+gchar *vtx_codec_branch_describe(const gchar *source_pipeline, guint video_payload_type, guint audio_payload_type);
+
+void vtx_codec_branch_setup(GstElement *pipeline, GstElement *webrtc);
+
+gboolean vtx_codec_branch_select(GstElement *pipeline, const GstSDPMessage *answer);
@@ -21,13 +21,25 @@ typedef enum
   CMD_PONG = 2,
   // CMD_SEND_KEYFRAME_REQUEST = 3,
   // CMD_SPS_PPS = 4,
-  CMD_ERROR = 9
+  CMD_ERROR = 9,
+  CMD_GET_STATS = 10,
+  CMD_RECORD_START = 11,
+  CMD_RECORD_STOP = 12,
+  CMD_DVR_FLUSH = 13,
+  CMD_SET_BITRATE = 14,
+  CMD_SET_FRAMERATE = 15,
+  CMD_SET_RESOLUTION = 16,
+  CMD_SET_CAMERA_CONTROL = 17,
+  CMD_TRACK_PAUSE = 18,
+  CMD_TRACK_RESUME = 19
 } CommandType;
 
 void vtx_webrtc_on_data_channel(GstElement *webrtc, GObject *data_channel, gpointer user_data);
 
 void vtx_dc_create_offer(GstElement *webrtc);
 
+void vtx_dc_create_late_channels(GstElement *webrtc);
+
 #define CHANNEL_TYPE_CMD "CMD"
 
 extern GObject *dc_cmd;
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// PEM file (certificate followed by its key) reused across sessions and restarts; relative paths are under the user cache dir.
+#define DTLS_CERT_FILE_ENV "VTX_DTLS_CERT"
+#define DTLS_CERT_DEFAULT_FILE "vtx/dtls-cert.pem"
+
+// A certificate older than the rotation age is replaced in the background; it stays valid a while longer for running sessions.
+#define DTLS_CERT_ROTATE_DAYS 30
+#define DTLS_CERT_VALID_DAYS 60
+#define DTLS_CERT_CHECK_INTERVAL_S 3600
+
+typedef struct VtxDtls VtxDtls;
+
+extern VtxDtls *g_dtls;
+
+VtxDtls *vtx_dtls_start(void);
+
+void vtx_dtls_free(VtxDtls *dtls);
+
+void vtx_dtls_apply(GstElement *webrtc);
+
+JsonObject *vtx_dtls_get_stats(void);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Pre-event DVR: the last dvr_seconds of encoded video (whole GOPs, held as buffer references) and MSP telemetry are kept in
+// RAM within a fixed budget, and written to a Matroska file plus a telemetry sidecar on request or on an FC event.
+#define DVR_DEFAULT_MEMORY_MB 48
+#define DVR_DEFAULT_DIR "/var/lib/vtx/dvr"
+
+// A keyframe is requested when a GOP grows longer than this fraction of the window, so eviction stays GOP-aligned.
+#define DVR_MAX_GOP_DIVISOR 2
+
+// MSP telemetry sampling period while a flight controller is connected.
+#define DVR_MSP_INTERVAL_MS 200
+
+// Betaflight/INAV MSP_STATUS_EX bits: box mode bit 0 is ARM; arming-disable flags raised by a crash or failsafe.
+#define DVR_MSP_MODE_ARMED (1u << 0)
+#define DVR_MSP_ARMING_DISABLED_FAILSAFE (1u << 1)
+#define DVR_MSP_ARMING_DISABLED_CRASH_DETECTED (1u << 6)
+#define DVR_DEFAULT_TRIGGER_FLAGS (DVR_MSP_ARMING_DISABLED_FAILSAFE | DVR_MSP_ARMING_DISABLED_CRASH_DETECTED)
+
+// Upper bound for writing one flush.
+#define DVR_FLUSH_TIMEOUT_S 30
+
+typedef struct VtxDvr VtxDvr;
+
+extern VtxDvr *g_dvr;
+
+VtxDvr *vtx_dvr_attach(GstElement *pipeline, const gchar *dir, guint seconds, guint memory_mb, guint32 trigger_flags, gboolean flush_on_disarm);
+
+void vtx_dvr_free(VtxDvr *dvr);
+
+gchar *vtx_dvr_flush(VtxDvr *dvr, const gchar *reason, gchar **error_msg);
+
+JsonObject *vtx_dvr_get_stats(VtxDvr *dvr);
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <gst/gst.h>
+
+// Bitrate property of a video encoder factory and its unit.
+typedef struct
+{
+  const gchar *factory;
+  const gchar *property;
+  guint bits_per_unit;  // 1000 for kbit/s properties, 1 for bit/s properties
+} EncoderBitrateProperty;
+
+// Property that splits each frame into slices; the value may contain one %u for the slice count.
+typedef struct
+{
+  const gchar *factory;
+  const gchar *property;
+  const gchar *value;
+} EncoderSliceProperty;
+
+gboolean vtx_encoder_is_video_encoder(GstElement *element);
+
+GstElement *vtx_encoder_find(GstBin *bin);
+
+guint vtx_encoder_get_bitrate_kbps(GstElement *encoder);
+
+gboolean vtx_encoder_set_bitrate_kbps(GstElement *encoder, guint kbps);
+
+guint vtx_encoder_set_slices(GstElement *encoder, guint slices);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Source fallback: an input-selector ahead of the encoder (or the multi-codec source tee) switches to a test pattern or a
+// repeat of the last frame while the source stalls, and back on its next frame. The encoder keeps running, so the RTP
+// stream, SSRC and payload type are unchanged.
+#define FALLBACK_SELECTOR "vfallback"
+#define FALLBACK_DEFAULT_TIMEOUT_MS 500
+#define FALLBACK_CHECK_INTERVAL_MS 50
+#define FALLBACK_DEFAULT_FRAME_MS 33
+#define FALLBACK_PATTERN_PIPELINE "videotestsrc is-live=true pattern=smpte ! videoconvert ! videoscale"
+
+typedef enum
+{
+  FALLBACK_SOURCE_NONE,
+  FALLBACK_SOURCE_PATTERN,  // videotestsrc scaled to the source caps (system-memory caps only)
+  FALLBACK_SOURCE_FREEZE,   // the last source frame, repeated at the source frame rate
+} FallbackSource;
+
+// Encoder failover: a hardware encoder that posts an error is replaced in place by a software encoder of the same
+// codec, constrained to the caps (profile, stream-format) the hardware encoder produced. The payloader stays.
+typedef struct
+{
+  const gchar *media_type;
+  const gchar *factory;
+} FallbackEncoder;
+
+typedef struct VtxFallback VtxFallback;
+
+extern VtxFallback *g_fallback;
+
+FallbackSource vtx_fallback_parse_source(const gchar *name);
+
+VtxFallback *vtx_fallback_attach(GstElement *pipeline, FallbackSource source, guint timeout_ms, gboolean encoder_failover);
+
+void vtx_fallback_free(VtxFallback *fallback);
+
+gboolean vtx_fallback_handle_message(VtxFallback *fallback, GstMessage *msg);
+
+JsonObject *vtx_fallback_get_stats(VtxFallback *fallback);
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Structured pipeline graph: vrx sends each media chain as a JSON array instead of a gst-launch string, e.g.
+//   [{"factory": "v4l2src", "properties": {"device": "/dev/video0"}},
+//    {"caps": "video/x-raw,width=1280,height=720,framerate=30/1"},
+//    {"factory": "x264enc", "properties": {"bitrate": 2500, "tune": "zerolatency"}},
+//    {"factory": "rtph264pay", "name": "videopay", "properties": {"pt": 96}}]
+// Factories, property names and values, and caps are validated before any element is created; elements are then
+// created with their properties and linked in order, and the graph keeps a handle to each of them.
+
+typedef struct VtxGraph VtxGraph;
+
+extern VtxGraph *g_graph;
+
+VtxGraph *vtx_graph_parse(JsonNode *video, JsonNode *audio, gchar **error_msg);
+
+gboolean vtx_graph_build(VtxGraph *graph, GstBin *bin, GstElement **video_tail, GstElement **audio_tail, gchar **error_msg);
+
+GstElement *vtx_graph_get_element(VtxGraph *graph, const gchar *name);
+
+void vtx_graph_free(VtxGraph *graph);
+
+JsonObject *vtx_graph_get_stats(VtxGraph *graph);
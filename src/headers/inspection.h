@@ -16,6 +16,10 @@ JsonArray *vtx_device_load_launch_entries();
 
 JsonArray *vtx_nic_inspection(void);
 
+gboolean vtx_nic_should_skip_interface(const gchar *ifname);
+
 #define MAX_ALLOWED_CODECS 16
 
 JsonObject *vtx_supported_codec_inspection(void);
+
+const gchar **vtx_serviceable_codecs(void);
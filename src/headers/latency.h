@@ -0,0 +1,19 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Frames in flight between the encoder input and the payloader output that can be matched by PTS.
+#define LATENCY_RING_SIZE 64
+
+typedef struct VtxLatency VtxLatency;
+
+extern VtxLatency *g_latency;
+
+VtxLatency *vtx_latency_attach(GstElement *pipeline, guint slices);
+
+void vtx_latency_replace_encoder(VtxLatency *latency, GstElement *old, GstElement *encoder);
+
+void vtx_latency_free(VtxLatency *latency);
+
+JsonObject *vtx_latency_get_stats(VtxLatency *latency);
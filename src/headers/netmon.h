@@ -0,0 +1,29 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/webrtc/webrtc.h>
+#include <json-glib/json-glib.h>
+
+// Address/route/link changes within this window trigger a single ICE restart.
+#define NETMON_DEBOUNCE_MS 500
+
+// ICE "disconnected" often recovers on its own (consent freshness); restart only if it lasts this long.
+#define NETMON_DISCONNECTED_GRACE_MS 2000
+
+// Interval between restart attempts while a peer has not recovered, and attempts before giving up.
+#define NETMON_RETRY_MS 3000
+#define NETMON_MAX_RESTARTS 5
+
+typedef struct VtxNetmon VtxNetmon;
+
+extern VtxNetmon *g_netmon;
+
+VtxNetmon *vtx_netmon_start(void);
+
+void vtx_netmon_free(VtxNetmon *netmon);
+
+void vtx_netmon_on_ice_state(GstElement *webrtc, GstWebRTCICEConnectionState state);
+
+void vtx_netmon_on_path_restart(GObject *agent, gpointer user_data);
+
+JsonObject *vtx_netmon_get_stats(void);
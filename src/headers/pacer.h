@@ -0,0 +1,22 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#define PACER_DEFAULT_HEADROOM_PERCENT 25
+#define PACER_DEFAULT_MAX_DELAY_MS 40
+
+// Upper bounds (ms) of the queue-delay histogram buckets; the last bucket is open-ended.
+#define PACER_HISTOGRAM_BUCKETS 8
+
+typedef struct VtxPacer VtxPacer;
+
+extern VtxPacer *g_pacer;
+
+VtxPacer *vtx_pacer_insert(GstElement *pipeline, guint headroom_percent, guint max_delay_ms);
+
+void vtx_pacer_set_bitrate_kbps(VtxPacer *pacer, guint bitrate_kbps);
+
+void vtx_pacer_free(VtxPacer *pacer);
+
+JsonObject *vtx_pacer_get_stats(VtxPacer *pacer);
@@ -3,27 +3,112 @@
 #include <gst/gst.h>
 #include <json-glib/json-glib.h>
 
+#include "fallback.h"
+#include "tracks.h"
 #include "utils.h"
 #include "webrtc.h"
 
 #define STUN_SERVER "stun://stun.l.google.com:19302"
 
+// Transceivers of a session in link order: video, audio, then the additional video tracks.
+#define PIPELINE_MAX_TRANSCEIVERS (2 + TRACKS_MAX)
+
+// Direct output (no webrtcbin or signaling negotiation): RTP video on the port, its RTCP on port + 1, audio on port + 2 and + 3.
+#define OUTPUT_DEFAULT_PORT 5000
+#define OUTPUT_SRT_DEFAULT_LATENCY_MS 120
+#define OUTPUT_SRTP_KEY_HEX_LENGTH 60  // AES-128 key and 112-bit salt
+#define OUTPUT_REPORT_INTERVAL_S 5
+
+typedef enum
+{
+  OUTPUT_WEBRTC,
+  OUTPUT_RTP,  // plain RTP/RTCP over UDP, SRTP when srtp_key is set
+  OUTPUT_SRT   // RTP packets as SRT messages, caller or listener
+} OutputMode;
+
 typedef struct
 {
   const gchar *video_pipeline;
+  const gchar *video_source_pipeline;  // raw video source; when set, every serviceable codec is offered
   const gchar *audio_pipeline;
+  JsonNode *video_graph;  // structured element chains (see graph.h); when either is set, the pipeline strings are ignored
+  JsonNode *audio_graph;
   const gchar *video_priority;
   const gchar *audio_priority;
+  VideoTrack video_tracks[TRACKS_MAX];  // additional video tracks, each with its own encoder and transceiver
+  guint n_video_tracks;
+  guint main_bitrate_share;  // percent of the session bitrate left to the main video track
   guint video_payload_type;
   guint audio_payload_type;
   PlatformType platform;
   const gchar *network_interface;
-  const gchar *video_profile;
+  const gchar *video_profile;   // H264 profile set on a V4L2 camera that encodes
+  JsonObject *camera_controls;  // V4L2 controls set on the camera at session start (see camera.h)
   const gchar *flight_controller;
+  gboolean pacing;
+  guint pacing_headroom_percent;
+  guint pacing_max_delay_ms;
+  guint temporal_layers;
+  guint slices;
+  gboolean scene_rate_control;
+  guint max_bitrate_kbps;
+  guint min_bitrate_percent;
+  gboolean warm_standby;  // keep the shared capture/encode pipeline running when no viewer is attached
+  guint ice_batch_ms;     // coalesce local candidates into RECEIVER_ICE batches over this window; 0 = one message per candidate
+  OutputMode output;
+  const gchar *output_host;  // RTP destination or SRT peer; the SRT listener's bind address
+  guint output_port;
+  const gchar *srtp_key;     // hex; static pre-shared SRTP key for OUTPUT_RTP
+  const gchar *srt_mode;     // "caller" (default) or "listener"
+  guint srt_latency_ms;
+  const gchar *srt_passphrase;
+  const gchar *tap_dir;    // expose the encoded stream to local readers through sockets in this directory
+  gboolean tap_raw;        // also expose the raw frames entering the encoder
+  guint tap_queue_frames;  // per-reader announcement queue
+  const gchar *record_dir;     // make local recording available (started over the CMD channel) into this directory
+  const gchar *record_format;  // "mp4" or "mkv"
+  guint record_segment_s;      // 0 = no time-based split
+  guint record_segment_mb;     // 0 = no size-based split
+  const gchar *record_encoder; // second encoder fed with the raw frames, e.g. "x264enc bitrate=8000 ! h264parse"; NULL records the live stream
+  guint dvr_seconds;            // pre-event window kept in RAM; 0 = DVR off
+  guint dvr_memory_mb;
+  const gchar *dvr_dir;
+  guint32 dvr_trigger_flags;    // MSP_STATUS_EX arming-disable flags that flush the DVR when raised
+  gboolean dvr_flush_on_disarm;
+  FallbackSource fallback_source;  // filler while the source stalls
+  guint fallback_timeout_ms;
+  gboolean encoder_failover;  // replace a failing hardware encoder by a software one
+  guint watchdog_stall_frames;  // frame times without buffers before a branch is restarted; 0 = watchdog off
 } MediaParams;
 
 gboolean vtx_pipeline_parse_media_params(JsonObject *root_obj, MediaParams *mediaParams);
 
 GstElement *vtx_pipeline_build(const MediaParams *params, gchar **error_msg);
 
+GstElement *vtx_pipeline_build_standby(const MediaParams *params, gchar **error_msg);
+
+GstElement *vtx_pipeline_build_direct(const MediaParams *params, gchar **error_msg);
+
+GstElement *vtx_pipeline_make_webrtcbin(const MediaParams *params, gchar **error_msg);
+
+guint vtx_pipeline_get_transceiver_priorities(const MediaParams *params, const gchar **priorities);
+
+gboolean vtx_pipeline_add_standby_tee(GstBin *bin, GstElement *tail, const gchar *tee_name);
+
 gboolean vtx_pipeline_start(const MediaParams *params, gchar **error_msg);
+
+gboolean vtx_pipeline_prewarm(const MediaParams *params, gchar **error_msg);
+
+void vtx_pipeline_stop_standby(void);
+
+void vtx_pipeline_release_standby(void);
+
+gboolean vtx_pipeline_is_shared(void);
+
+gboolean vtx_pipeline_is_direct(void);
+
+GstElement *vtx_pipeline_find_viewer(const gchar *viewer_id);
+
+gboolean vtx_pipeline_add_viewer(const gchar *viewer_id, const MediaParams *params, gchar **error_msg);
+
+void vtx_pipeline_remove_viewer(const gchar *viewer_id);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Live reconfiguration over the CMD channel. Bitrate goes to the encoder (and the pacer and scene ceiling). Frame rate and
+// resolution change the nearest capsfilter upstream of the encoder that sets them: behind videorate/videoscale that is a
+// conversion, right after the camera a camera mode switch. Caps renegotiate on the running pipeline.
+#define RECONFIG_MIN_BITRATE_KBPS 100
+
+// Time allowed from the command to the first encoded frame in the new format.
+#define RECONFIG_SWITCH_TIMEOUT_MS 5000
+
+// H.264 level limits (ITU-T H.264 Table A-1) applied to the profile-level-id the viewer answered with.
+typedef struct
+{
+  guint level_idc;
+  guint max_mbps;  // macroblocks per second
+  guint max_fs;    // macroblocks per frame
+} ReconfigH264Level;
+
+typedef struct VtxReconfig VtxReconfig;
+
+extern VtxReconfig *g_reconfig;
+
+VtxReconfig *vtx_reconfig_attach(GstElement *pipeline);
+
+void vtx_reconfig_free(VtxReconfig *reconfig);
+
+gboolean vtx_reconfig_set_bitrate(VtxReconfig *reconfig, guint total_kbps, gchar **error_msg);
+
+gboolean vtx_reconfig_set_framerate(VtxReconfig *reconfig, guint fps, gchar **error_msg);
+
+gboolean vtx_reconfig_set_resolution(VtxReconfig *reconfig, guint width, guint height, gchar **error_msg);
+
+JsonObject *vtx_reconfig_get_stats(VtxReconfig *reconfig);
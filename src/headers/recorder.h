@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Local recording: tees ahead of videopay and audiopay (or ahead of the live encoder when a second encoder is configured)
+// feed a leaky queue into splitmuxsink, so a stalled disk drops recorded buffers instead of delaying the live path.
+#define RECORD_DEFAULT_FORMAT "mp4"
+#define RECORD_DEFAULT_SEGMENT_S 60
+#define RECORD_QUEUE_MS 2000
+
+// MP4 segments are written as fragmented MP4 with this fragment length, so a segment cut short by power loss still plays.
+#define RECORD_MP4_FRAGMENT_MS 1000
+
+// The last segment is finalised before the branch is removed, waiting at most this long.
+#define RECORD_STOP_TIMEOUT_MS 3000
+
+typedef struct VtxRecorder VtxRecorder;
+
+extern VtxRecorder *g_recorder;
+
+VtxRecorder *vtx_recorder_attach(GstElement *pipeline, const gchar *dir, const gchar *format, guint segment_s, guint segment_mb, const gchar *encoder);
+
+void vtx_recorder_free(VtxRecorder *recorder);
+
+gboolean vtx_recorder_start(VtxRecorder *recorder, gchar **error_msg);
+
+gboolean vtx_recorder_stop(VtxRecorder *recorder);
+
+gboolean vtx_recorder_is_recording(VtxRecorder *recorder);
+
+gboolean vtx_recorder_handle_message(VtxRecorder *recorder, GstMessage *msg);
+
+JsonObject *vtx_recorder_get_stats(VtxRecorder *recorder);
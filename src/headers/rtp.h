@@ -6,4 +6,8 @@ void vtx_rtp_add_video_header_extensions(GstElement* videopay);
 
 void vtx_rtp_add_audio_header_extensions(GstElement* audiopay);
 
-void vtx_rtp_set_transceiver_priority(GArray* transceivers, const gchar* video_priority, const gchar* audio_priority);
+void vtx_rtp_set_transceiver_priority(GArray* transceivers, const gchar* const* priorities, guint n_priorities);
+
+typedef void (*VtxRtpRemoteInboundFunc)(gboolean found, gdouble fraction_lost, gdouble round_trip_time, gpointer user_data);
+
+void vtx_rtp_request_remote_inbound_stats(GstElement* webrtc, VtxRtpRemoteInboundFunc func, gpointer user_data, GDestroyNotify notify);
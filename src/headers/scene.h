@@ -0,0 +1,33 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#define SCENE_DEFAULT_MIN_BITRATE_PERCENT 30
+
+// Only every Nth luma row is analysed; motion is measured against the same rows of the previous frame.
+#define SCENE_ROW_STEP 4
+
+// Mean absolute luma difference and luma standard deviation that count as fully complex.
+#define SCENE_MOTION_HIGH 20.0
+#define SCENE_SPATIAL_HIGH 64.0
+#define SCENE_EMA_ALPHA 0.2
+
+// Frames between bitrate updates when raising (dives) and lowering (hover), and the change that triggers one.
+#define SCENE_RAISE_INTERVAL_FRAMES 5
+#define SCENE_LOWER_INTERVAL_FRAMES 30
+#define SCENE_MIN_CHANGE_PERCENT 10
+
+typedef struct VtxScene VtxScene;
+
+extern VtxScene *g_scene;
+
+VtxScene *vtx_scene_attach(GstElement *pipeline, guint max_bitrate_kbps, guint min_bitrate_percent);
+
+void vtx_scene_set_ceiling_kbps(VtxScene *scene, guint ceiling_kbps);
+
+void vtx_scene_replace_encoder(VtxScene *scene, GstElement *old, GstElement *encoder);
+
+void vtx_scene_free(VtxScene *scene);
+
+JsonObject *vtx_scene_get_stats(VtxScene *scene);
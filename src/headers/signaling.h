@@ -6,6 +6,15 @@
 
 #define DEFAULT_SERVER_CERTIFICATE_AUTHORITY "server-ca-cert.pem"
 
+// Reconnect backoff: the delay doubles per failed attempt up to the maximum, and a random part of it is dropped (jitter).
+#define SIGNALING_RECONNECT_MIN_MS 500
+#define SIGNALING_RECONNECT_MAX_MS 30000
+
+// Request header carrying the previous sender session ID on reconnect.
+#define SIGNALING_RESUME_HEADER "X-Resume-Session-Id"
+
+SoupSession* vtx_soup_session_new(void);
+
 void vtx_soup_session_websocket_connect_async(void);
 
 void vtx_soup_on_message(SoupWebsocketConnection* conn, SoupWebsocketDataType type, GBytes* message, gpointer user_data);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+
+// WebSocket subprotocols: JSON text frames, or CBOR binary frames when the server selects the CBOR variant.
+#define SIGNALING_PROTOCOL "sender"
+#define SIGNALING_PROTOCOL_CBOR "sender.cbor"
+
+// Set to 1 to offer SIGNALING_PROTOCOL_CBOR in the handshake (servers that match the protocol header exactly would reject it).
+#define SIGNALING_CBOR_ENV "SIGNALING_CBOR"
+
+// Nesting limit of the writer and the CBOR decoder.
+#define SIGNALING_CODEC_MAX_DEPTH 32
+
+typedef enum
+{
+  VTX_SIGNALING_JSON,
+  VTX_SIGNALING_CBOR
+} VtxSignalingEncoding;
+
+// Streaming encoder writing compact JSON or CBOR straight into a buffer. vtx_signaling_writer_acquire hands out one
+// writer per thread whose buffer is reused for every message.
+typedef struct
+{
+  GString *buf;
+  VtxSignalingEncoding encoding;
+  guint depth;
+  guint32 has_items;  // per nesting level: a value was written there (JSON separators)
+  gboolean after_key;
+} VtxSignalingWriter;
+
+VtxSignalingEncoding vtx_signaling_encoding(SoupWebsocketConnection *conn);
+
+VtxSignalingWriter *vtx_signaling_writer_acquire(VtxSignalingEncoding encoding);
+
+void vtx_signaling_writer_begin_object(VtxSignalingWriter *w);
+
+void vtx_signaling_writer_end_object(VtxSignalingWriter *w);
+
+void vtx_signaling_writer_begin_array(VtxSignalingWriter *w);
+
+void vtx_signaling_writer_end_array(VtxSignalingWriter *w);
+
+void vtx_signaling_writer_key(VtxSignalingWriter *w, const gchar *key);
+
+void vtx_signaling_writer_string(VtxSignalingWriter *w, const gchar *value);
+
+void vtx_signaling_writer_int(VtxSignalingWriter *w, gint64 value);
+
+void vtx_signaling_writer_double(VtxSignalingWriter *w, gdouble value);
+
+void vtx_signaling_writer_boolean(VtxSignalingWriter *w, gboolean value);
+
+void vtx_signaling_writer_null(VtxSignalingWriter *w);
+
+void vtx_signaling_writer_node(VtxSignalingWriter *w, JsonNode *node);
+
+void vtx_signaling_writer_members(VtxSignalingWriter *w, JsonObject *object);
+
+void vtx_signaling_writer_send(VtxSignalingWriter *w, SoupWebsocketConnection *conn);
+
+JsonNode *vtx_signaling_decode(GBytes *message, VtxSignalingEncoding encoding, GError **error);
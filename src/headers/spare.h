@@ -0,0 +1,21 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include "pipeline.h"
+#include "standby.h"
+
+void vtx_spare_remember(const MediaParams *params);
+
+void vtx_spare_prepare(VtxStandby *standby);
+
+GstElement *vtx_spare_take(const MediaParams *params);
+
+void vtx_spare_send_offer(GstElement *webrtc);
+
+void vtx_spare_discard(void);
+
+gboolean vtx_spare_is_pending(GstElement *webrtc);
+
+JsonObject *vtx_spare_get_stats(void);
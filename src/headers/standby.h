@@ -0,0 +1,55 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+#include "pipeline.h"
+
+// Tees that split the shared media into the idle fakesink and one webrtcbin branch per viewer.
+#define STANDBY_VIDEO_TEE "vstandby"
+#define STANDBY_AUDIO_TEE "astandby"
+
+// How long a detached session's tee branches may take to go idle before they are unlinked anyway. Detaching does not wait.
+#define STANDBY_DETACH_TIMEOUT_MS 1000
+
+// Media a viewer may fall behind before its leaky queue drops the oldest packets.
+#define STANDBY_PEER_QUEUE_MS 200
+
+// JSON file with MediaParams members used to prewarm the standby pipeline at startup.
+#define STANDBY_MEDIA_PARAMS_ENV "VTX_MEDIA_PARAMS"
+
+typedef struct VtxStandby VtxStandby;
+
+extern VtxStandby *g_standby;
+
+VtxStandby *vtx_standby_new(const MediaParams *params, gchar **error_msg);
+
+void vtx_standby_free(VtxStandby *standby);
+
+GstElement *vtx_standby_get_pipeline(VtxStandby *standby);
+
+gboolean vtx_standby_matches(VtxStandby *standby, const MediaParams *params);
+
+void vtx_standby_set_keep_warm(VtxStandby *standby, gboolean keep_warm);
+
+gboolean vtx_standby_is_idle(VtxStandby *standby);
+
+GstElement *vtx_standby_find_viewer(VtxStandby *standby, const gchar *viewer_id);
+
+void vtx_standby_foreach_peer(VtxStandby *standby, GFunc func, gpointer user_data);
+
+gboolean vtx_standby_attach(VtxStandby *standby, GstElement *webrtc, const gchar *viewer_id);
+
+void vtx_standby_preroll(VtxStandby *standby, GstElement *webrtc);
+
+void vtx_standby_activate(VtxStandby *standby, GstElement *webrtc);
+
+void vtx_standby_detach(VtxStandby *standby, GstElement *webrtc);
+
+void vtx_standby_prewarm_from_env(void);
+
+void vtx_standby_watch_first_frame(GstPad *pad, gint64 start_us, gboolean warm);
+
+JsonObject *vtx_standby_get_stats(void);
+
+JsonArray *vtx_standby_get_viewer_stats(void);
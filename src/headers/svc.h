@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <gst/rtp/rtp.h>
+#include <json-glib/json-glib.h>
+
+#ifndef __VTX_FRAME_MARKING_H__
+#define __VTX_FRAME_MARKING_H__
+
+G_BEGIN_DECLS
+#define VTX_TYPE_FRAME_MARKING (vtx_frame_marking_get_type())
+G_DECLARE_FINAL_TYPE(VtxFrameMarking, vtx_frame_marking, VTX, FRAME_MARKING, GstRTPHeaderExtension)
+G_END_DECLS
+
+#endif /* __VTX_FRAME_MARKING_H__ */
+
+#define RTP_HDREXT_FRAME_MARKING_URI "urn:ietf:params:rtp-hdrext:framemarking"
+
+// Custom meta attached to encoded frames at the payloader input, carrying the temporal layer ID
+#define SVC_TEMPORAL_LAYER_META "VtxTemporalLayerMeta"
+
+#define SVC_MAX_TEMPORAL_LAYERS 3
+
+// Congestion thresholds on the remote-inbound-rtp stats of webrtcbin
+#define SVC_CONGESTION_LOSS 0.10
+#define SVC_CONGESTION_RTT_S 0.300
+#define SVC_RECOVERY_LOSS 0.02
+#define SVC_RECOVERY_RTT_S 0.150
+#define SVC_RECOVERY_INTERVALS 3
+#define SVC_STATS_INTERVAL_MS 1000
+
+typedef struct VtxSvc VtxSvc;
+
+extern VtxSvc *g_svc;
+
+guint vtx_svc_parse_scalability_mode(const gchar *mode);
+
+VtxSvc *vtx_svc_setup(GstElement *pipeline, guint layers);
+
+void vtx_svc_free(VtxSvc *svc);
+
+JsonObject *vtx_svc_get_stats(VtxSvc *svc);
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Local tap: the encoded elementary stream (videopay input) and optionally the raw frames (encoder input) are copied into
+// shared-memory rings and announced to local readers over SOCK_SEQPACKET unix sockets in tap_dir. The writer never waits
+// for a reader: a reader whose announcement queue is full misses frames (counted per reader), and a reader that falls a
+// whole ring behind finds the data overwritten.
+//
+// Protocol, all integers host-endian:
+//  - on connect the reader receives one TapRecord of type TAP_RECORD_HELLO with the ring memfd attached (SCM_RIGHTS),
+//    followed in the same message by the current caps string (may be empty). The memfd holds a TapRingHeader followed by
+//    ring_size data bytes and is mapped read-only.
+//  - TAP_RECORD_CAPS (caps string after the record) is sent whenever the stream caps change.
+//  - TAP_RECORD_FRAME announces one frame at data offset `offset`. The frame is intact if, after copying it out,
+//    TapRingHeader.head - (position - size) <= ring_size, where head is read with acquire ordering.
+#define TAP_ENCODED_SOCKET "encoded.sock"
+#define TAP_RAW_SOCKET "raw.sock"
+#define TAP_MAGIC 0x54585456u  // "VTXT"
+#define TAP_VERSION 1
+
+#define TAP_ENCODED_RING_BYTES (8 * 1024 * 1024)
+#define TAP_RAW_RING_BYTES (64 * 1024 * 1024)
+#define TAP_MAX_READERS 8
+
+// Frames announced to a reader but not yet read before further frames are dropped for it (bounds the reader's socket
+// send buffer, so the limit is approximate).
+#define TAP_DEFAULT_QUEUE_FRAMES 30
+#define TAP_MAX_QUEUE_FRAMES 65536
+
+typedef enum
+{
+  TAP_RECORD_HELLO = 1,
+  TAP_RECORD_CAPS = 2,
+  TAP_RECORD_FRAME = 3
+} TapRecordType;
+
+typedef enum
+{
+  TAP_FRAME_KEY = 1 << 0,
+  TAP_FRAME_DISCONT = 1 << 1
+} TapFrameFlags;
+
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint64 ring_size;
+  guint64 head;  // bytes ever written to the ring; the ring holds data for positions (head - ring_size, head]
+} TapRingHeader;
+
+typedef struct
+{
+  guint32 type;  // TapRecordType
+  guint32 flags; // TapFrameFlags
+  guint64 seq;   // frame number, gaps mean frames this reader missed
+  guint64 offset;
+  guint64 position;  // ring position just past the frame
+  guint32 size;
+  guint32 dropped;  // frames dropped for this reader so far
+  gint64 pts;       // GST_CLOCK_TIME_NONE (-1) when unknown
+  gint64 dts;
+} TapRecord;
+
+typedef struct VtxTap VtxTap;
+
+extern VtxTap *g_tap;
+
+VtxTap *vtx_tap_attach(GstElement *pipeline, const gchar *dir, gboolean raw, guint queue_frames);
+
+void vtx_tap_free(VtxTap *tap);
+
+JsonObject *vtx_tap_get_stats(VtxTap *tap);
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Additional video tracks of a session (e.g. an HD gimbal camera next to the FPV camera). The main track is the usual
+// video_pipeline with all media hooks; each additional track is its own capture/encode/payload description, linked to its
+// own webrtcbin transceiver after video and audio (or through its own tee on the shared pipeline). The session bitrate is
+// split between the running tracks by their configured shares, and a track can be paused to give its share to the others.
+#define TRACKS_MAX 4
+#define TRACKS_MAIN_NAME "main"
+
+// Tees the shared pipeline fans additional tracks out from: TRACKS_TEE_PREFIX "1" ... TRACKS_TEE_PREFIX "<TRACKS_MAX>".
+#define TRACKS_TEE_PREFIX "vtrack"
+
+typedef struct
+{
+  const gchar *name;
+  const gchar *pipeline;  // ends in its RTP payloader, with a payload type of its own
+  const gchar *priority;  // DSCP priority of the track's transceiver
+  guint bitrate_share;    // percent of the session bitrate
+} VideoTrack;
+
+typedef struct VtxTracks VtxTracks;
+
+extern VtxTracks *g_tracks;
+
+gboolean vtx_tracks_parse(JsonArray *array, VideoTrack *tracks, guint *n_tracks, guint *main_share, gchar **error_msg);
+
+gchar *vtx_tracks_describe(const VideoTrack *tracks, guint n_tracks);
+
+VtxTracks *vtx_tracks_attach(GstElement *pipeline, const VideoTrack *tracks, guint n_tracks, guint main_share, gchar **error_msg);
+
+gboolean vtx_tracks_owns(VtxTracks *tracks, GstElement *element);
+
+guint vtx_tracks_split_bitrate(VtxTracks *tracks, guint total_kbps);
+
+gboolean vtx_tracks_set_paused(VtxTracks *tracks, const gchar *name, gboolean paused, gchar **error_msg);
+
+void vtx_tracks_free(VtxTracks *tracks);
+
+JsonArray *vtx_tracks_get_stats(VtxTracks *tracks);
@@ -2,6 +2,13 @@
 
 #include "common.h"
 
+// Process CPU time at a wall-clock instant, the reference point of vtx_cpu_percent_since.
+typedef struct
+{
+  gint64 wall_us;
+  gint64 cpu_us;
+} CpuSample;
+
 gchar *vtx_platform_to_string(PlatformType platform);
 
 gchar *vtx_gpu_vendor_to_string(GpuVendor vendor);
@@ -14,10 +21,14 @@ gboolean vtx_cleanup_and_quit_loop(const gchar *msg, AppState state);
 
 gboolean vtx_cleanup_connection(const gchar *msg);
 
+void vtx_cleanup_media_hooks(void);
+
 void vtx_ws_send(SoupWebsocketConnection *conn, int type, const gchar *ws1Id, const gchar *ws2Id, JsonObject *data);
 
 gboolean vtx_check_gst_plugins(void);
 
+gdouble vtx_cpu_percent_since(CpuSample *last);
+
 void print_json_object(JsonObject *obj);
 
 void print_json_array(JsonArray *array);
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+
+// Media watchdog: buffer flow into each payloader (or the multi-codec source tee) is watched with a pad probe. A stall of
+// stall_frames frame times, an EOS or an error from that branch restarts only the elements upstream of the watched pad;
+// payloaders, webrtcbin and the data channels stay up.
+#define WATCHDOG_DEFAULT_STALL_FRAMES 15
+#define WATCHDOG_CHECK_INTERVAL_MS 50
+#define WATCHDOG_MIN_STALL_MS 200
+#define WATCHDOG_DEFAULT_FRAME_MS 33
+
+// A restart that produces no buffer within this time counts as failed and is retried.
+#define WATCHDOG_RESTART_GRACE_MS 3000
+
+// More restarts than this within the window give up and end the session as before.
+#define WATCHDOG_MAX_RESTARTS 5
+#define WATCHDOG_RESTART_WINDOW_S 60
+
+typedef struct VtxWatchdog VtxWatchdog;
+
+extern VtxWatchdog *g_watchdog;
+
+VtxWatchdog *vtx_watchdog_attach(GstElement *pipeline, guint stall_frames);
+
+void vtx_watchdog_free(VtxWatchdog *watchdog);
+
+void vtx_watchdog_replace_element(VtxWatchdog *watchdog, GstElement *old, GstElement *replacement);
+
+gboolean vtx_watchdog_handle_message(VtxWatchdog *watchdog, GstMessage *msg);
+
+JsonObject *vtx_watchdog_get_stats(VtxWatchdog *watchdog);
@@ -2,22 +2,55 @@
 
 #include <gst/gst.h>
 #include <gst/webrtc/ice.h>
+#include <gst/webrtc/webrtc.h>
+#include <json-glib/json-glib.h>
 
 #ifndef __CUSTOM_AGENT_H__
 #define __CUSTOM_AGENT_H__
 
+// Object data key holding the ws2Id of an additional viewer's webrtcbin; the primary session's webrtcbin has none.
+#define VTX_WEBRTC_VIEWER_ID "vtx-viewer-id"
+
+// Upper bound of the candidate batching window requested by vrx (ice_batch_ms).
+#define ICE_BATCH_MAX_MS 500
+
+// With several interfaces in network_interface, each one is probed with a STUN binding request per interval.
+#define ICE_PATH_PROBE_INTERVAL_MS 1000
+#define ICE_PATH_PROBE_SERVER "stun://stun.l.google.com:19302"
+#define ICE_PATH_EMA_ALPHA 0.3
+
+// Loss at which a path counts as degraded, and how much RTT one point of loss is worth when ranking paths.
+#define ICE_PATH_LOSS_DEGRADED 0.2
+#define ICE_PATH_LOSS_PENALTY_MS 500.0
+
+// A path must beat the selected one by this margin for this many consecutive intervals before the pair is switched.
+#define ICE_PATH_RTT_MARGIN_MS 30.0
+#define ICE_PATH_SWITCH_INTERVALS 3
+
 G_BEGIN_DECLS
 #define CUSTOMICE_TYPE_AGENT (customice_agent_get_type())
 G_DECLARE_FINAL_TYPE(CustomICEAgent, customice_agent, CUSTOMICE, AGENT, GstWebRTCICE)
 CustomICEAgent *customice_agent_new(const gchar *name, const gchar *network_interface);
 
+JsonObject *customice_agent_get_path_stats(CustomICEAgent *agent);
+
+const gchar *vtx_webrtc_peer_id(GstElement *webrtc);
+
+void vtx_webrtc_send_sdp_offer(GstElement *element, GstWebRTCSessionDescription *desc);
+
+void vtx_webrtc_batch_ice_candidates(GstElement *webrtc, guint window_ms);
+
 void vtx_webrtc_on_ice_candidate(GstElement *webrtc, guint mlineindex, gchar *candidate, gpointer user_data);
 
+void vtx_webrtc_end_of_candidates(GstElement *webrtc);
+
 void vtx_webrtc_notify_ice_gathering_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data);
 
 void vtx_webrtc_notify_ice_connection_state(GstElement *webrtc, GParamSpec *pspec, gpointer user_data);
 
 void vtx_webrtc_on_negotiation_needed(GstElement *element, gpointer user_data);
 
+gboolean vtx_webrtc_restart_ice(GstElement *element);
+
 G_END_DECLS
 #endif /* __CUSTOM_AGENT_H__ */
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <gst/gst.h>
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+
+// WHIP (RFC 9725) ingest: when the endpoint is set, the session is published with one HTTP POST instead of the WebSocket
+// signaling exchange. The media params come from the STANDBY_MEDIA_PARAMS_ENV file.
+#define WHIP_ENDPOINT_ENV "WHIP_ENDPOINT"
+#define WHIP_TOKEN_ENV "WHIP_TOKEN"
+
+// The offer waits for ICE gathering to complete so it carries every candidate, at most this long.
+#define WHIP_GATHER_TIMEOUT_MS 1000
+
+typedef struct VtxWhip VtxWhip;
+
+extern VtxWhip *g_whip;
+
+// Result of one offer/answer exchange. On success answer is the SDP answer and resource the absolute session URL.
+typedef void (*VtxWhipAnswerFunc)(const gchar *answer, const gchar *resource, const GError *error, gpointer user_data);
+
+VtxWhip *vtx_whip_start(const gchar *endpoint);
+
+void vtx_whip_free(VtxWhip *whip);
+
+void vtx_whip_exchange(SoupSession *session, const gchar *endpoint, const gchar *token, const gchar *offer, VtxWhipAnswerFunc func, gpointer user_data);
+
+void vtx_whip_on_offer(VtxWhip *whip, GstElement *element);
+
+void vtx_whip_on_gathering_complete(VtxWhip *whip, GstElement *element);
+
+void vtx_whip_on_session_closed(VtxWhip *whip);
+
+JsonObject *vtx_whip_get_stats(void);
@@ -1,12 +1,76 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
 #include <gst/webrtc/nice/nice.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include "webrtc.h"
 
+// RFC 5389 binding request/response types and magic cookie used by the path probes.
+#define STUN_BINDING_REQUEST 0x0001
+#define STUN_BINDING_RESPONSE 0x0101
+#define STUN_MAGIC_COOKIE 0x2112A442
+#define STUN_HEADER_SIZE 20
+#define STUN_DEFAULT_PORT 3478
+
+// One network interface from the ordered network_interface list and the quality measured on it.
+typedef struct
+{
+  gchar *name;           // interface name, e.g. "wlan0"
+  gchar *address;        // pinned address from "interface:ip", or NULL to use every address of the interface
+  guint preference;      // position in the list, 0 = most preferred
+  gint probe_fd;         // UDP socket bound to the interface, -1 when probing is unavailable
+  guint probe_watch_id;  // g_unix_fd_add source reading probe responses
+  guint8 txid[12];       // transaction ID of the outstanding probe
+  gint64 sent_us;        // when the outstanding probe was sent, 0 when none is outstanding
+  gboolean probed;       // a probe went out in the last interval and its outcome is not yet counted
+  gdouble rtt_ms;        // EMA of probe round-trip time, negative until the first answer
+  gdouble loss;          // EMA of probe loss, 0..1
+  guint64 probes_sent;
+  guint64 probes_answered;
+  guint better_intervals;  // consecutive intervals this path has beaten the selected one
+  gboolean up;             // interface currently holds an address
+  GMutex *lock;            // the owning agent's lock
+} IcePath;
+
+// A candidate pair libnice selected for a stream, which it only does once a connectivity check on it succeeded.
+typedef struct
+{
+  guint stream_id;
+  NiceCandidate *local;
+  NiceCandidate *remote;
+} IceCheckedPair;
+
+enum
+{
+  SIGNAL_PATH_RESTART,
+  N_SIGNALS
+};
+
+static guint s_signals[N_SIGNALS];
+
 struct _CustomICEAgent
 {
   GstWebRTCICE parent;
   GstWebRTCNice *nice_agent;
   gchar *network_interface;
+  GPtrArray *paths;  // IcePath*, in preference order
+  GArray *stream_ids;
+  guint monitor_id;
+  struct sockaddr_in stun_addr;
+  guint stun_port;
+  gboolean stun_resolved;
+  gint selected;  // index of the path carrying the selected pair, -1 when unknown
+  guint64 switches;
+  guint64 restarts;  // ICE restarts requested because no checked pair led onto the target path
+  GPtrArray *checked;  // IceCheckedPair*, the only pairs a path switch may move media onto
+  GMutex lock;  // guards path quality read by customice_agent_get_path_stats, and checked (written from libnice's thread)
 };
 
 /* *INDENT-OFF* */
@@ -23,7 +87,14 @@ GstWebRTCICEStream *customice_agent_add_stream(GstWebRTCICE *ice, guint session_
     return NULL;
   }
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
-  return gst_webrtc_ice_add_stream(c_ice, session_id);
+  GstWebRTCICEStream *stream = gst_webrtc_ice_add_stream(c_ice, session_id);
+  if (stream)
+  {
+    guint stream_id = 0;
+    g_object_get(stream, "stream-id", &stream_id, NULL);
+    g_array_append_val(agent->stream_ids, stream_id);
+  }
+  return stream;
 }
 
 // Delegates ICE transport lookup for a given stream and component to the internal GstWebRTCNice agent.
@@ -79,7 +150,20 @@ gboolean customice_agent_add_turn_server(GstWebRTCICE *ice, const gchar *uri)
 // Sets the local ICE credentials (ufrag and password) on the underlying nice agent for the given stream.
 gboolean customice_agent_set_local_credentials(GstWebRTCICE *ice, GstWebRTCICEStream *stream, const gchar *ufrag, const gchar *pwd)
 {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  guint stream_id = 0;
+  g_object_get(stream, "stream-id", &stream_id, NULL);
+
+  // New credentials restart ICE, so the pairs checked so far are no longer valid
+  g_mutex_lock(&agent->lock);
+  for (guint i = agent->checked->len; i > 0; i--)
+  {
+    IceCheckedPair *pair = g_ptr_array_index(agent->checked, i - 1);
+    if (pair->stream_id == stream_id) g_ptr_array_remove_index(agent->checked, i - 1);
+  }
+  g_mutex_unlock(&agent->lock);
+
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
   return gst_webrtc_ice_set_local_credentials(c_ice, stream, ufrag, pwd);
 }
 
@@ -125,11 +209,63 @@ void customice_agent_set_on_ice_candidate(GstWebRTCICE *ice, GstWebRTCICEOnCandi
   gst_webrtc_ice_set_on_ice_candidate(c_ice, func, user_data, notify);
 }
 
-// Sets the STUN server URI on the underlying nice agent.
+// Stores the resolved IPv4 address of the STUN server as the target of the per-path probes.
+static void customice_agent_on_stun_resolved(GObject *source, GAsyncResult *result, gpointer user_data)
+{
+  CustomICEAgent *agent = CUSTOMICE_AGENT(user_data);
+  guint port = agent->stun_port;
+  GList *addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, NULL);
+
+  for (GList *l = addresses; l; l = l->next)
+  {
+    GInetAddress *inet = G_INET_ADDRESS(l->data);
+    if (g_inet_address_get_family(inet) != G_SOCKET_FAMILY_IPV4) continue;
+
+    memset(&agent->stun_addr, 0, sizeof(agent->stun_addr));
+    agent->stun_addr.sin_family = AF_INET;
+    agent->stun_addr.sin_port = htons(port);
+    memcpy(&agent->stun_addr.sin_addr, g_inet_address_to_bytes(inet), sizeof(agent->stun_addr.sin_addr));
+    agent->stun_resolved = TRUE;
+    gchar *text = g_inet_address_to_string(inet);
+    gst_println("CustomICEAgent: Probing paths against STUN server %s:%u", text, port);
+    g_free(text);
+    break;
+  }
+
+  g_resolver_free_addresses(addresses);
+  g_object_unref(agent);
+}
+
+// Resolves "stun://host:port" asynchronously as the target of the per-path probes.
+static void customice_agent_resolve_probe_server(CustomICEAgent *agent, const gchar *uri_s)
+{
+  agent->stun_resolved = FALSE;
+
+  const gchar *host_start = g_str_has_prefix(uri_s, "stun://") ? uri_s + strlen("stun://") : uri_s;
+  gchar *host = g_strdup(host_start);
+  guint port = STUN_DEFAULT_PORT;
+  gchar *colon = strrchr(host, ':');
+  if (colon)
+  {
+    *colon = '\0';
+    port = (guint) g_ascii_strtoull(colon + 1, NULL, 10);
+  }
+
+  agent->stun_port = port;
+  GResolver *resolver = g_resolver_get_default();
+  g_resolver_lookup_by_name_async(resolver, host, NULL, customice_agent_on_stun_resolved, g_object_ref(agent));
+  g_object_unref(resolver);
+  g_free(host);
+}
+
+// Sets the STUN server URI on the underlying nice agent and, when monitoring several paths, probes against it instead of the default.
 void customice_agent_set_stun_server(GstWebRTCICE *ice, const gchar *uri_s)
 {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
   gst_webrtc_ice_set_stun_server(c_ice, uri_s);
+
+  if (uri_s && agent->monitor_id) customice_agent_resolve_probe_server(agent, uri_s);
 }
 
 // Returns the STUN server URI currently configured on the underlying nice agent.
@@ -153,10 +289,400 @@ gchar *customice_agent_get_turn_server(GstWebRTCICE *ice)
   return gst_webrtc_ice_get_turn_server(c_ice);
 }
 
-// Releases the network_interface string and the internal nice agent reference when the object is destroyed.
+// Closes the probe socket of a path and frees it.
+static void ice_path_free(gpointer data)
+{
+  IcePath *path = data;
+  if (path->probe_watch_id) g_source_remove(path->probe_watch_id);
+  if (path->probe_fd >= 0) close(path->probe_fd);
+  g_free(path->name);
+  g_free(path->address);
+  g_free(path);
+}
+
+// Returns the first IPv4 address of the path as a socket address, preferring its pinned address.
+static gboolean ice_path_ipv4(IcePath *path, struct ifaddrs *ifs, struct in_addr *out)
+{
+  if (path->address) return inet_pton(AF_INET, path->address, out) == 1;
+
+  for (struct ifaddrs *ifa = ifs; ifa; ifa = ifa->ifa_next)
+  {
+    if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_INET || g_strcmp0(ifa->ifa_name, path->name) != 0) continue;
+    *out = ((struct sockaddr_in *) ifa->ifa_addr)->sin_addr;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Reads a STUN binding response on a path's probe socket and folds its round-trip time into the path RTT.
+static gboolean ice_path_on_probe_readable(gint fd, GIOCondition condition, gpointer user_data)
+{
+  IcePath *path = user_data;
+  guint8 buf[512];
+
+  for (;;)
+  {
+    ssize_t n = recv(fd, buf, sizeof(buf), 0);
+    if (n < 0) break;
+    if (n < STUN_HEADER_SIZE || !path->sent_us) continue;
+
+    guint16 type = (guint16) (buf[0] << 8 | buf[1]);
+    guint32 cookie = (guint32) buf[4] << 24 | (guint32) buf[5] << 16 | (guint32) buf[6] << 8 | buf[7];
+    if (type != STUN_BINDING_RESPONSE || cookie != STUN_MAGIC_COOKIE || memcmp(buf + 8, path->txid, sizeof(path->txid)) != 0) continue;
+
+    gdouble rtt_ms = (g_get_monotonic_time() - path->sent_us) / 1000.0;
+    g_mutex_lock(path->lock);
+    path->rtt_ms = path->rtt_ms < 0 ? rtt_ms : path->rtt_ms + ICE_PATH_EMA_ALPHA * (rtt_ms - path->rtt_ms);
+    path->probes_answered++;
+    path->sent_us = 0;
+    g_mutex_unlock(path->lock);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+// Opens a non-blocking UDP socket that sends through the path's interface, used for the path's STUN probes.
+static void ice_path_open_probe(IcePath *path, struct ifaddrs *ifs)
+{
+  gint fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return;
+
+  gboolean bound = FALSE;
+#ifdef SO_BINDTODEVICE
+  // Needs CAP_NET_RAW; binding the interface address below covers the common source-routed setups without it.
+  bound = setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, path->name, strlen(path->name)) == 0;
+#endif
+
+  struct sockaddr_in local = {0};
+  local.sin_family = AF_INET;
+  if (ice_path_ipv4(path, ifs, &local.sin_addr) && bind(fd, (struct sockaddr *) &local, sizeof(local)) == 0) bound = TRUE;
+
+  if (!bound)
+  {
+    gst_printerrln("CustomICEAgent: Cannot bind probe socket to %s: %s", path->name, g_strerror(errno));
+    close(fd);
+    return;
+  }
+
+  path->probe_fd = fd;
+  path->probe_watch_id = g_unix_fd_add(fd, G_IO_IN, ice_path_on_probe_readable, path);
+}
+
+// Sends a STUN binding request to the STUN server over the path, counting the previous probe as lost if it went unanswered.
+static void ice_path_send_probe(IcePath *path, const struct sockaddr_in *stun_addr)
+{
+  g_mutex_lock(path->lock);
+  if (path->probed) path->loss += ICE_PATH_EMA_ALPHA * ((path->sent_us ? 1.0 : 0.0) - path->loss);
+  path->probed = FALSE;
+  g_mutex_unlock(path->lock);
+
+  if (!path->up)
+  {
+    path->sent_us = 0;
+    return;
+  }
+
+  guint8 request[STUN_HEADER_SIZE] = {0};
+  request[0] = STUN_BINDING_REQUEST >> 8;
+  request[1] = STUN_BINDING_REQUEST & 0xff;
+  request[4] = (STUN_MAGIC_COOKIE >> 24) & 0xff;
+  request[5] = (STUN_MAGIC_COOKIE >> 16) & 0xff;
+  request[6] = (STUN_MAGIC_COOKIE >> 8) & 0xff;
+  request[7] = STUN_MAGIC_COOKIE & 0xff;
+  for (gsize i = 0; i < sizeof(path->txid); i++) path->txid[i] = (guint8) g_random_int_range(0, 256);
+  memcpy(request + 8, path->txid, sizeof(path->txid));
+
+  path->sent_us = g_get_monotonic_time();
+  path->probed = TRUE;
+  path->probes_sent++;
+  if (sendto(path->probe_fd, request, sizeof(request), 0, (const struct sockaddr *) stun_addr, sizeof(*stun_addr)) < 0)
+  {
+    // Counts as lost at the next interval, e.g. ENETUNREACH while the link is re-associating
+    gst_printerrln("CustomICEAgent: Probe on %s failed: %s", path->name, g_strerror(errno));
+  }
+}
+
+// Returns the index of the path whose interface owns the given local address, or -1.
+static gint customice_agent_path_for_address(CustomICEAgent *agent, struct ifaddrs *ifs, const NiceAddress *addr)
+{
+  gchar wanted[NICE_ADDRESS_STRING_LEN];
+  nice_address_to_string(addr, wanted);
+
+  for (struct ifaddrs *ifa = ifs; ifa; ifa = ifa->ifa_next)
+  {
+    if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET && ifa->ifa_addr->sa_family != AF_INET6)) continue;
+
+    NiceAddress candidate;
+    nice_address_set_from_sockaddr(&candidate, ifa->ifa_addr);
+    gchar text[NICE_ADDRESS_STRING_LEN];
+    nice_address_to_string(&candidate, text);
+    if (g_strcmp0(text, wanted) != 0) continue;
+
+    for (guint i = 0; i < agent->paths->len; i++)
+    {
+      IcePath *path = g_ptr_array_index(agent->paths, i);
+      if (g_strcmp0(path->name, ifa->ifa_name) == 0) return (gint) i;
+    }
+  }
+  return -1;
+}
+
+// Marks each path up when its interface is running and holds an address (its pinned one, if given).
+static void customice_agent_refresh_links(CustomICEAgent *agent, struct ifaddrs *ifs)
+{
+  for (guint i = 0; i < agent->paths->len; i++)
+  {
+    IcePath *path = g_ptr_array_index(agent->paths, i);
+    gboolean up = FALSE;
+    for (struct ifaddrs *ifa = ifs; ifa && !up; ifa = ifa->ifa_next)
+    {
+      if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET && ifa->ifa_addr->sa_family != AF_INET6)) continue;
+      if (g_strcmp0(ifa->ifa_name, path->name) != 0 || !(ifa->ifa_flags & IFF_UP) || !(ifa->ifa_flags & IFF_RUNNING)) continue;
+      if (path->address)
+      {
+        NiceAddress have, pinned;
+        nice_address_set_from_sockaddr(&have, ifa->ifa_addr);
+        up = nice_address_set_from_string(&pinned, path->address) && nice_address_equal_no_port(&have, &pinned);
+      }
+      else
+      {
+        up = TRUE;
+      }
+    }
+    if (path->up != up) gst_println("CustomICEAgent: Interface %s is %s", path->name, up ? "up" : "down");
+    path->up = up;
+  }
+}
+
+// Frees a checked pair.
+static void ice_checked_pair_free(gpointer data)
+{
+  IceCheckedPair *pair = data;
+  nice_candidate_free(pair->local);
+  nice_candidate_free(pair->remote);
+  g_free(pair);
+}
+
+// Remembers each pair libnice selects: selection follows a successful connectivity check, so the pair is safe to move media
+// back onto later. Runs on libnice's thread.
+static void customice_agent_on_selected_pair(NiceAgent *nice, guint stream_id, guint component_id, NiceCandidate *local, NiceCandidate *remote, gpointer user_data)
+{
+  CustomICEAgent *agent = CUSTOMICE_AGENT(user_data);
+  if (component_id != NICE_COMPONENT_TYPE_RTP) return;
+
+  g_mutex_lock(&agent->lock);
+  gboolean known = FALSE;
+  for (guint i = 0; i < agent->checked->len && !known; i++)
+  {
+    IceCheckedPair *pair = g_ptr_array_index(agent->checked, i);
+    known = pair->stream_id == stream_id && g_strcmp0(pair->local->foundation, local->foundation) == 0 && g_strcmp0(pair->remote->foundation, remote->foundation) == 0;
+  }
+  if (!known)
+  {
+    IceCheckedPair *pair = g_new0(IceCheckedPair, 1);
+    pair->stream_id = stream_id;
+    pair->local = nice_candidate_copy(local);
+    pair->remote = nice_candidate_copy(remote);
+    g_ptr_array_add(agent->checked, pair);
+  }
+  g_mutex_unlock(&agent->lock);
+}
+
+// Moves the selected pair of every stream onto the target path, using only pairs whose connectivity check succeeded (a
+// forced pair that was never checked may be dropped by the remote side). Returns FALSE if no stream could be switched.
+static gboolean customice_agent_switch_path(CustomICEAgent *agent, NiceAgent *nice, struct ifaddrs *ifs, guint target)
+{
+  gboolean switched = FALSE;
+
+  for (guint s = 0; s < agent->stream_ids->len; s++)
+  {
+    guint stream_id = g_array_index(agent->stream_ids, guint, s);
+    gchar *local_foundation = NULL;
+    gchar *remote_foundation = NULL;
+    guint32 best_priority = 0;
+
+    g_mutex_lock(&agent->lock);
+    for (guint i = 0; i < agent->checked->len; i++)
+    {
+      IceCheckedPair *pair = g_ptr_array_index(agent->checked, i);
+      NiceCandidate *c = pair->local;
+      if (pair->stream_id != stream_id || c->type == NICE_CANDIDATE_TYPE_RELAYED) continue;
+      const NiceAddress *base = c->type == NICE_CANDIDATE_TYPE_HOST ? &c->addr : &c->base_addr;
+      if (customice_agent_path_for_address(agent, ifs, base) != (gint) target) continue;
+      if (local_foundation && c->priority <= best_priority) continue;
+
+      g_free(local_foundation);
+      g_free(remote_foundation);
+      local_foundation = g_strdup(c->foundation);
+      remote_foundation = g_strdup(pair->remote->foundation);
+      best_priority = c->priority;
+    }
+    g_mutex_unlock(&agent->lock);
+
+    if (local_foundation && nice_agent_set_selected_pair(nice, stream_id, NICE_COMPONENT_TYPE_RTP, local_foundation, remote_foundation))
+    {
+      switched = TRUE;
+    }
+    g_free(local_foundation);
+    g_free(remote_foundation);
+  }
+
+  return switched;
+}
+
+// Scores a path by RTT with loss weighted in; lower is better.
+static gdouble ice_path_score(const IcePath *path)
+{
+  return path->rtt_ms + path->loss * ICE_PATH_LOSS_PENALTY_MS;
+}
+
+// Returns whether a path has fresh enough probe results to be switched onto.
+static gboolean ice_path_usable(const IcePath *path)
+{
+  return path->up && path->rtt_ms >= 0 && path->loss < ICE_PATH_LOSS_DEGRADED;
+}
+
+// Probes every path, then moves the selected pair off the current path when it went down, degraded, or is clearly beaten.
+static gboolean customice_agent_on_monitor(gpointer user_data)
+{
+  CustomICEAgent *agent = CUSTOMICE_AGENT(user_data);
+  GObject *nice_agent_obj = NULL;
+  g_object_get(agent->nice_agent, "agent", &nice_agent_obj, NULL);
+  if (!nice_agent_obj) return G_SOURCE_CONTINUE;
+  NiceAgent *nice = NICE_AGENT(nice_agent_obj);
+
+  struct ifaddrs *ifs = NULL;
+  if (getifaddrs(&ifs) != 0)
+  {
+    g_object_unref(nice_agent_obj);
+    return G_SOURCE_CONTINUE;
+  }
+
+  customice_agent_refresh_links(agent, ifs);
+  for (guint i = 0; i < agent->paths->len; i++)
+  {
+    IcePath *path = g_ptr_array_index(agent->paths, i);
+    if (path->probe_fd < 0 && path->up) ice_path_open_probe(path, ifs);
+    if (path->probe_fd >= 0 && agent->stun_resolved) ice_path_send_probe(path, &agent->stun_addr);
+  }
+
+  // All streams are bundled, so the first one tells which path carries the media
+  gint selected = -1;
+  NiceCandidate *local = NULL;
+  NiceCandidate *remote = NULL;
+  if (agent->stream_ids->len > 0 && nice_agent_get_selected_pair(nice, g_array_index(agent->stream_ids, guint, 0), NICE_COMPONENT_TYPE_RTP, &local, &remote))
+  {
+    selected = customice_agent_path_for_address(agent, ifs, local->type == NICE_CANDIDATE_TYPE_HOST ? &local->addr : &local->base_addr);
+  }
+
+  g_mutex_lock(&agent->lock);
+  agent->selected = selected;
+  g_mutex_unlock(&agent->lock);
+
+  if (selected >= 0)
+  {
+    IcePath *current = g_ptr_array_index(agent->paths, selected);
+
+    // Earlier paths in the list win ties, so a later path has to beat the best one by the margin
+    gint best = -1;
+    for (guint i = 0; i < agent->paths->len; i++)
+    {
+      IcePath *path = g_ptr_array_index(agent->paths, i);
+      if (!ice_path_usable(path)) continue;
+      if (best < 0 || ice_path_score(path) + ICE_PATH_RTT_MARGIN_MS < ice_path_score(g_ptr_array_index(agent->paths, best))) best = (gint) i;
+    }
+
+    gint target = -1;
+    if (!current->up)
+    {
+      // Link gone: take the best measured path, or the most preferred one still up
+      target = best;
+      for (guint i = 0; target < 0 && i < agent->paths->len; i++)
+      {
+        if (((IcePath *) g_ptr_array_index(agent->paths, i))->up) target = (gint) i;
+      }
+    }
+    else if (best >= 0 && best != selected)
+    {
+      IcePath *candidate = g_ptr_array_index(agent->paths, best);
+      gboolean degraded = current->loss >= ICE_PATH_LOSS_DEGRADED || (current->rtt_ms < 0 && current->probes_sent >= ICE_PATH_SWITCH_INTERVALS);
+      gboolean beaten = current->rtt_ms >= 0 && ice_path_score(candidate) + ICE_PATH_RTT_MARGIN_MS < ice_path_score(current);
+      if (degraded || beaten)
+      {
+        candidate->better_intervals++;
+        if (candidate->better_intervals >= ICE_PATH_SWITCH_INTERVALS) target = best;
+      }
+      else
+      {
+        candidate->better_intervals = 0;
+      }
+    }
+
+    if (target >= 0 && target != selected)
+    {
+      IcePath *next = g_ptr_array_index(agent->paths, target);
+      if (customice_agent_switch_path(agent, nice, ifs, (guint) target))
+      {
+        gst_println("CustomICEAgent: Switched path %s (rtt %.1f ms, loss %.0f%%) -> %s (rtt %.1f ms, loss %.0f%%)", current->name, current->rtt_ms, current->loss * 100.0, next->name, next->rtt_ms, next->loss * 100.0);
+        agent->switches++;
+      }
+      else if (!current->up || current->loss >= ICE_PATH_LOSS_DEGRADED)
+      {
+        // No checked pair leads onto the target path: let a restart check the pairs again, but only when staying is worse
+        gst_println("CustomICEAgent: No checked pair on %s, requesting an ICE restart to leave %s", next->name, current->name);
+        agent->restarts++;
+        g_signal_emit(agent, s_signals[SIGNAL_PATH_RESTART], 0);
+      }
+      for (guint i = 0; i < agent->paths->len; i++)
+      {
+        ((IcePath *) g_ptr_array_index(agent->paths, i))->better_intervals = 0;
+      }
+    }
+  }
+
+  freeifaddrs(ifs);
+  g_object_unref(nice_agent_obj);
+  return G_SOURCE_CONTINUE;
+}
+
+// Returns the per-path RTT, loss and link state in preference order, plus the number of path switches.
+JsonObject *customice_agent_get_path_stats(CustomICEAgent *agent)
+{
+  JsonObject *stats = json_object_new();
+  JsonArray *paths = json_array_new();
+
+  g_mutex_lock(&agent->lock);
+  for (guint i = 0; i < agent->paths->len; i++)
+  {
+    IcePath *path = g_ptr_array_index(agent->paths, i);
+    JsonObject *entry = json_object_new();
+    json_object_set_string_member(entry, "interface", path->name);
+    json_object_set_int_member(entry, "preference", path->preference);
+    json_object_set_boolean_member(entry, "up", path->up);
+    json_object_set_boolean_member(entry, "selected", agent->selected == (gint) i);
+    json_object_set_double_member(entry, "rtt_ms", path->rtt_ms);
+    json_object_set_double_member(entry, "loss_percent", path->loss * 100.0);
+    json_object_set_int_member(entry, "probes_sent", path->probes_sent);
+    json_object_set_int_member(entry, "probes_answered", path->probes_answered);
+    json_array_add_object_element(paths, entry);
+  }
+  json_object_set_int_member(stats, "switches", agent->switches);
+  json_object_set_int_member(stats, "restarts", agent->restarts);
+  g_mutex_unlock(&agent->lock);
+
+  json_object_set_array_member(stats, "paths", paths);
+  return stats;
+}
+
+// Stops path monitoring and releases the network_interface string, the paths and the internal nice agent reference when the object is destroyed.
 static void customice_agent_finalize(GObject *object)
 {
   CustomICEAgent *ice = CUSTOMICE_AGENT(object);
+  if (ice->monitor_id) g_source_remove(ice->monitor_id);
+  g_ptr_array_unref(ice->paths);
+  g_ptr_array_unref(ice->checked);
+  g_array_unref(ice->stream_ids);
+  g_mutex_clear(&ice->lock);
   g_free(ice->network_interface);
   if (ice->nice_agent)
   {
@@ -174,6 +700,9 @@ static void customice_agent_class_init(CustomICEAgentClass *klass)
 
   gobject_class->finalize = customice_agent_finalize;
 
+  // Emitted on the main loop when the selected path is down or degraded and no checked pair leads elsewhere
+  s_signals[SIGNAL_PATH_RESTART] = g_signal_new("path-restart", G_TYPE_FROM_CLASS(klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 0);
+
   // override virtual functions
 #if (GST_VERSION_MINOR < 23)
   gst_webrtc_ice_class->add_candidate = (void (*)(GstWebRTCICE *, GstWebRTCICEStream *, const gchar *)) customice_agent_add_candidate;
@@ -202,6 +731,11 @@ static void customice_agent_init(CustomICEAgent *ice)
 {
   ice->nice_agent = gst_webrtc_nice_new("nice_agent");
   ice->network_interface = NULL;
+  ice->paths = g_ptr_array_new_with_free_func(ice_path_free);
+  ice->checked = g_ptr_array_new_with_free_func(ice_checked_pair_free);
+  ice->stream_ids = g_array_new(FALSE, FALSE, sizeof(guint));
+  ice->selected = -1;
+  g_mutex_init(&ice->lock);
 
   if (!ice->nice_agent)
   {
@@ -219,7 +753,28 @@ static void customice_agent_init(CustomICEAgent *ice)
   }
 }
 
-// Allocates a new CustomICEAgent and, if a network interface is specified, restricts the internal nice agent to that interface and IP.
+// Adds every address the interface currently holds as a local address of the nice agent, returning how many were added.
+static guint customice_agent_add_interface_addresses(NiceAgent *nice_agent, const gchar *interface_name)
+{
+  struct ifaddrs *ifs = NULL;
+  guint added = 0;
+  if (getifaddrs(&ifs) != 0) return 0;
+
+  for (struct ifaddrs *ifa = ifs; ifa; ifa = ifa->ifa_next)
+  {
+    if (!ifa->ifa_addr || (ifa->ifa_addr->sa_family != AF_INET && ifa->ifa_addr->sa_family != AF_INET6) || g_strcmp0(ifa->ifa_name, interface_name) != 0) continue;
+
+    NiceAddress addr;
+    nice_address_set_from_sockaddr(&addr, ifa->ifa_addr);
+    if (nice_address_is_linklocal(&addr)) continue;
+    if (nice_agent_add_local_address(nice_agent, &addr)) added++;
+  }
+
+  freeifaddrs(ifs);
+  return added;
+}
+
+// Allocates a new CustomICEAgent restricted to the listed interfaces ("wlan0,eth0:192.168.1.5", most preferred first) and, with more than one, monitors their paths for failover.
 CustomICEAgent *customice_agent_new(const gchar *name, const gchar *network_interface)
 {
   CustomICEAgent *agent = g_object_new(CUSTOMICE_TYPE_AGENT, "name", name, NULL);
@@ -228,72 +783,98 @@ CustomICEAgent *customice_agent_new(const gchar *name, const gchar *network_inte
   gst_println("CustomICEAgent type check: %s", GST_IS_WEBRTC_ICE(agent) ? "VALID GstWebRTCICE" : "NOT A VALID GstWebRTCICE");
   gst_println("CustomICEAgent GType: %s (parent: %s)", g_type_name(G_OBJECT_TYPE(agent)), g_type_name(g_type_parent(G_OBJECT_TYPE(agent))));
 
-  if (network_interface)
-  {
-    agent->network_interface = g_strdup(network_interface);
+  if (!network_interface) return agent;
 
-    // Get the internal NiceAgent from GstWebRTCNice
-    GObject *nice_agent_obj = NULL;
-    g_object_get(agent->nice_agent, "agent", &nice_agent_obj, NULL);
+  agent->network_interface = g_strdup(network_interface);
 
-    if (nice_agent_obj)
+  // Parse each entry for an IP address (format: "interface:ip" or just "interface")
+  gchar **entries = g_strsplit(network_interface, ",", -1);
+  for (gchar **entry = entries; *entry; entry++)
+  {
+    gchar *interface_name = g_strstrip(*entry);
+    if (*interface_name == '\0') continue;
+
+    gchar *colon = strchr(interface_name, ':');
+    IcePath *path = g_new0(IcePath, 1);
+    if (colon)
     {
-      // Parse network_interface for IP address (format: "interface:ip" or just "interface")
-      gchar *interface_name = g_strdup(network_interface);
-      gchar *ip_address = NULL;
-      gchar *colon = strchr(interface_name, ':');
+      *colon = '\0';  // Terminate interface name at colon
+      if (strlen(colon + 1) > 0) path->address = g_strdup(colon + 1);
+    }
+    path->name = g_strdup(interface_name);
+    path->preference = agent->paths->len;
+    path->probe_fd = -1;
+    path->rtt_ms = -1.0;
+    path->up = TRUE;
+    path->lock = &agent->lock;
+    g_ptr_array_add(agent->paths, path);
+  }
+  g_strfreev(entries);
 
-      if (colon)
-      {
-        *colon = '\0';           // Terminate interface name at colon
-        ip_address = colon + 1;  // IP address follows the colon
-      }
+  // Get the internal NiceAgent from GstWebRTCNice
+  GObject *nice_agent_obj = NULL;
+  g_object_get(agent->nice_agent, "agent", &nice_agent_obj, NULL);
+  if (!nice_agent_obj) return agent;
 
-      // If IP address is specified, use nice_agent_add_local_address() to restrict to that IP
-      if (ip_address && strlen(ip_address) > 0)
-      {
-        NiceAgent *nice_agent = NICE_AGENT(nice_agent_obj);
-        NiceAddress addr;
-
-        if (nice_address_set_from_string(&addr, ip_address))
-        {
-          if (nice_agent_add_local_address(nice_agent, &addr))
-          {
-            gst_println("CustomICEAgent: Successfully restricted to local address: %s", ip_address);
-          }
-          else
-          {
-            gst_printerrln("CustomICEAgent: Failed to add local address: %s", ip_address);
-          }
-        }
-        else
-        {
-          gst_printerrln("CustomICEAgent: Invalid IP address format: %s", ip_address);
-        }
-      }
+  NiceAgent *nice_agent = NICE_AGENT(nice_agent_obj);
+  gboolean multipath = agent->paths->len > 1;
+  GSList *interfaces = NULL;
 
-      // Also set the interfaces property as fallback
-      GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(nice_agent_obj), "interfaces");
+  // Local addresses are added in preference order; with several interfaces each one's addresses are listed
+  // explicitly so gathering covers all of them and nothing else
+  for (guint i = 0; i < agent->paths->len; i++)
+  {
+    IcePath *path = g_ptr_array_index(agent->paths, i);
+    interfaces = g_slist_append(interfaces, g_strdup(path->name));
 
-      if (pspec)
+    if (path->address)
+    {
+      NiceAddress addr;
+      if (!nice_address_set_from_string(&addr, path->address))
+      {
+        gst_printerrln("CustomICEAgent: Invalid IP address format: %s", path->address);
+      }
+      else if (nice_agent_add_local_address(nice_agent, &addr))
       {
-        GSList *interfaces = NULL;
-        interfaces = g_slist_append(interfaces, g_strdup(interface_name));
-        g_object_set(nice_agent_obj, "interfaces", interfaces, NULL);
-        g_slist_free_full(interfaces, g_free);
-        gst_println("CustomICEAgent: Restricting to network interface: %s\n", interface_name);
+        gst_println("CustomICEAgent: Successfully restricted to local address: %s (%s, preference %u)", path->address, path->name, path->preference);
       }
       else
       {
-        gst_printerrln(
-            "CustomICEAgent: 'interfaces' property not available on NiceAgent. "
-            "Network interface restriction may not work. Consider upgrading libnice or using "
-            "system-level network configuration.");
+        gst_printerrln("CustomICEAgent: Failed to add local address: %s", path->address);
       }
-
-      g_free(interface_name);
-      g_object_unref(nice_agent_obj);
     }
+    else if (multipath)
+    {
+      guint added = customice_agent_add_interface_addresses(nice_agent, path->name);
+      gst_println("CustomICEAgent: Gathering on %u address(es) of %s (preference %u)", added, path->name, path->preference);
+    }
+  }
+
+  // Also set the interfaces property as fallback
+  GParamSpec *pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(nice_agent_obj), "interfaces");
+
+  if (pspec)
+  {
+    g_object_set(nice_agent_obj, "interfaces", interfaces, NULL);
+    gst_println("CustomICEAgent: Restricting to network interface(s): %s\n", network_interface);
+  }
+  else
+  {
+    gst_printerrln(
+        "CustomICEAgent: 'interfaces' property not available on NiceAgent. "
+        "Network interface restriction may not work. Consider upgrading libnice or using "
+        "system-level network configuration.");
+  }
+  g_slist_free_full(interfaces, g_free);
+
+  // Path switches may only move media onto pairs libnice has checked
+  if (multipath) g_signal_connect_object(nice_agent_obj, "new-selected-pair-full", G_CALLBACK(customice_agent_on_selected_pair), agent, 0);
+  g_object_unref(nice_agent_obj);
+
+  if (multipath)
+  {
+    agent->monitor_id = g_timeout_add(ICE_PATH_PROBE_INTERVAL_MS, customice_agent_on_monitor, agent);
+    customice_agent_resolve_probe_server(agent, ICE_PATH_PROBE_SERVER);
   }
 
   return agent;
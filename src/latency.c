@@ -0,0 +1,220 @@
+#include "headers/latency.h"
+
+#include <gst/rtp/rtp.h>
+
+#include "headers/encoder.h"
+
+typedef struct
+{
+  GstClockTime pts;
+  gint64 encoder_in_us;
+  gboolean first_packet_seen;
+} LatencyFrame;
+
+typedef struct
+{
+  guint64 count;
+  gint64 sum_us;
+  gint64 max_us;
+} LatencySample;
+
+struct VtxLatency
+{
+  guint slices;
+  GstPad *encoder_sink;
+  GstPad *pay_src;
+  gulong encoder_sink_probe;
+  gulong pay_src_probe;
+
+  GMutex lock;
+  LatencyFrame frames[LATENCY_RING_SIZE];
+  guint next_frame;
+
+  LatencySample first_packet;  // encoder input -> first RTP packet of the frame
+  LatencySample last_packet;   // encoder input -> RTP packet carrying the marker bit
+};
+
+VtxLatency *g_latency = NULL;
+
+// Adds one measurement to a latency sample.
+static void vtx_latency_sample_add(LatencySample *sample, gint64 us)
+{
+  sample->count++;
+  sample->sum_us += us;
+  if (us > sample->max_us) sample->max_us = us;
+}
+
+// Returns the ring entry for the frame with the given PTS, or NULL if it has been overwritten. Must be called with the lock held.
+static LatencyFrame *vtx_latency_lookup(VtxLatency *latency, GstClockTime pts)
+{
+  for (guint i = 0; i < LATENCY_RING_SIZE; i++)
+  {
+    if (latency->frames[i].pts == pts) return &latency->frames[i];
+  }
+  return NULL;
+}
+
+// Records when each raw frame enters the encoder, keyed by PTS (encoders keep the input PTS on their output).
+static GstPadProbeReturn vtx_latency_on_encoder_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxLatency *latency = user_data;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+  if (!GST_BUFFER_PTS_IS_VALID(buf)) return GST_PAD_PROBE_OK;
+
+  g_mutex_lock(&latency->lock);
+  LatencyFrame *frame = &latency->frames[latency->next_frame];
+  frame->pts = GST_BUFFER_PTS(buf);
+  frame->encoder_in_us = g_get_monotonic_time();
+  frame->first_packet_seen = FALSE;
+  latency->next_frame = (latency->next_frame + 1) % LATENCY_RING_SIZE;
+  g_mutex_unlock(&latency->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Matches one RTP packet to its source frame and records first-packet and marker-packet latency.
+static gboolean vtx_latency_on_packet(GstBuffer **buf, guint idx, gpointer user_data)
+{
+  VtxLatency *latency = user_data;
+  if (!GST_BUFFER_PTS_IS_VALID(*buf)) return TRUE;
+
+  gboolean marker = FALSE;
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  if (gst_rtp_buffer_map(*buf, GST_MAP_READ, &rtp))
+  {
+    marker = gst_rtp_buffer_get_marker(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+  }
+
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&latency->lock);
+  LatencyFrame *frame = vtx_latency_lookup(latency, GST_BUFFER_PTS(*buf));
+  if (frame)
+  {
+    if (!frame->first_packet_seen)
+    {
+      frame->first_packet_seen = TRUE;
+      vtx_latency_sample_add(&latency->first_packet, now - frame->encoder_in_us);
+    }
+    if (marker)
+    {
+      vtx_latency_sample_add(&latency->last_packet, now - frame->encoder_in_us);
+      frame->pts = GST_CLOCK_TIME_NONE;
+    }
+  }
+  g_mutex_unlock(&latency->lock);
+
+  return TRUE;
+}
+
+// Walks every RTP packet leaving the video payloader (payloaders push either buffers or buffer lists).
+static GstPadProbeReturn vtx_latency_on_pay_src(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+  {
+    gst_buffer_list_foreach(GST_PAD_PROBE_INFO_BUFFER_LIST(info), vtx_latency_on_packet, user_data);
+  }
+  else
+  {
+    GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+    vtx_latency_on_packet(&buf, 0, user_data);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Configures slice encoding (when slices > 1) and installs probes measuring encoder input to RTP output latency.
+VtxLatency *vtx_latency_attach(GstElement *pipeline, guint slices)
+{
+  GstElement *encoder = vtx_encoder_find(GST_BIN(pipeline));
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (!encoder || !videopay)
+  {
+    gst_printerrln("Latency probes: video encoder or videopay not found");
+    if (encoder) gst_object_unref(encoder);
+    if (videopay) gst_object_unref(videopay);
+    return NULL;
+  }
+
+  VtxLatency *latency = g_new0(VtxLatency, 1);
+  g_mutex_init(&latency->lock);
+  for (guint i = 0; i < LATENCY_RING_SIZE; i++) latency->frames[i].pts = GST_CLOCK_TIME_NONE;
+
+  if (slices > 1 && vtx_encoder_set_slices(encoder, slices) > 0)
+  {
+    latency->slices = slices;
+    gst_println("Encoding %u slices per frame with %s", slices, GST_OBJECT_NAME(encoder));
+  }
+
+  latency->encoder_sink = gst_element_get_static_pad(encoder, "sink");
+  latency->pay_src = gst_element_get_static_pad(videopay, "src");
+  latency->encoder_sink_probe = gst_pad_add_probe(latency->encoder_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_latency_on_encoder_sink, latency, NULL);
+  latency->pay_src_probe = gst_pad_add_probe(latency->pay_src, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, vtx_latency_on_pay_src, latency, NULL);
+
+  gst_object_unref(encoder);
+  gst_object_unref(videopay);
+  return latency;
+}
+
+// Moves the encoder input probe and the slice setting onto the encoder that replaced the measured one (encoder failover).
+// The replacement must not be running yet, since encoders read the slice count when they start.
+void vtx_latency_replace_encoder(VtxLatency *latency, GstElement *old, GstElement *encoder)
+{
+  if (GST_OBJECT_PARENT(latency->encoder_sink) != GST_OBJECT(old)) return;
+
+  gst_pad_remove_probe(latency->encoder_sink, latency->encoder_sink_probe);
+  gst_object_unref(latency->encoder_sink);
+
+  if (latency->slices > 1 && vtx_encoder_set_slices(encoder, latency->slices) == 0)
+  {
+    gst_printerrln("Latency probes: %s does not support slices, encoding whole frames", GST_OBJECT_NAME(encoder));
+    latency->slices = 0;
+  }
+
+  latency->encoder_sink = gst_element_get_static_pad(encoder, "sink");
+  latency->encoder_sink_probe = gst_pad_add_probe(latency->encoder_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_latency_on_encoder_sink, latency, NULL);
+}
+
+// Logs the measured latency and frees the probe state. The pipeline must already be stopped.
+void vtx_latency_free(VtxLatency *latency)
+{
+  if (!latency) return;
+
+  if (latency->first_packet.count > 0 && latency->last_packet.count > 0)
+  {
+    gdouble first_ms = latency->first_packet.sum_us / 1000.0 / latency->first_packet.count;
+    gdouble last_ms = latency->last_packet.sum_us / 1000.0 / latency->last_packet.count;
+    gst_println("Encoder-to-packet latency (%u slices): first packet %.2f ms, last packet %.2f ms", latency->slices, first_ms, last_ms);
+  }
+
+  gst_pad_remove_probe(latency->encoder_sink, latency->encoder_sink_probe);
+  gst_pad_remove_probe(latency->pay_src, latency->pay_src_probe);
+  gst_object_unref(latency->encoder_sink);
+  gst_object_unref(latency->pay_src);
+  g_mutex_clear(&latency->lock);
+  g_free(latency);
+}
+
+// Converts a latency sample into a JSON object with frame count, mean and max in milliseconds.
+static JsonObject *vtx_latency_sample_to_json(const LatencySample *sample)
+{
+  JsonObject *o = json_object_new();
+  json_object_set_int_member(o, "frames", sample->count);
+  json_object_set_double_member(o, "mean_ms", sample->count ? sample->sum_us / 1000.0 / sample->count : 0);
+  json_object_set_double_member(o, "max_ms", sample->max_us / 1000.0);
+  return o;
+}
+
+// Returns the encoder-to-packet latency measurements as a JSON object.
+JsonObject *vtx_latency_get_stats(VtxLatency *latency)
+{
+  JsonObject *o = json_object_new();
+
+  g_mutex_lock(&latency->lock);
+  json_object_set_int_member(o, "slices", latency->slices);
+  json_object_set_object_member(o, "first_packet", vtx_latency_sample_to_json(&latency->first_packet));
+  json_object_set_object_member(o, "last_packet", vtx_latency_sample_to_json(&latency->last_packet));
+  g_mutex_unlock(&latency->lock);
+
+  return o;
+}
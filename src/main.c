@@ -1,10 +1,16 @@
 #include <stdio.h>
+#include <stdlib.h>
 
 #include "headers/common.h"
 #include "headers/data_channel.h"
+#include "headers/dtls.h"
 #include "headers/msp.h"
+#include "headers/netmon.h"
+#include "headers/pipeline.h"
 #include "headers/signaling.h"
+#include "headers/standby.h"
 #include "headers/utils.h"
+#include "headers/whip.h"
 
 GMainLoop *loop = NULL;
 
@@ -77,9 +83,39 @@ int main(int argc, char *argv[])
 
   loop = g_main_loop_new(NULL, FALSE);
 
-  vtx_soup_session_websocket_connect_async();
+  // Load or generate the DTLS certificate off the first session's critical path
+  g_dtls = vtx_dtls_start();
 
-  g_main_loop_run(loop);
+  // Start capture and encoding before the first viewer connects
+  vtx_standby_prewarm_from_env();
+
+  // Restart ICE instead of dropping the session when the network path changes
+  g_netmon = vtx_netmon_start();
+
+  // WHIP publishes the session with a single HTTP exchange; otherwise the receiver requests it over WebSocket signaling
+  const char *whip_endpoint = getenv(WHIP_ENDPOINT_ENV);
+  if (whip_endpoint)
+  {
+    g_whip = vtx_whip_start(whip_endpoint);
+  }
+  else if (vtx_pipeline_is_direct())
+  {
+    gst_println("Direct output started from %s, not connecting to the signaling server", STANDBY_MEDIA_PARAMS_ENV);
+  }
+  else
+  {
+    vtx_soup_session_websocket_connect_async();
+  }
+
+  if (!whip_endpoint || g_whip) g_main_loop_run(loop);
+
+  vtx_whip_free(g_whip);
+  g_whip = NULL;
+  vtx_pipeline_stop_standby();
+  vtx_netmon_free(g_netmon);
+  g_netmon = NULL;
+  vtx_dtls_free(g_dtls);
+  g_dtls = NULL;
 
   if (loop) g_main_loop_unref(loop);
   if (pipeline) gst_object_unref(pipeline);
@@ -0,0 +1,347 @@
+#include "headers/netmon.h"
+
+#include <errno.h>
+#include <net/if.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <glib-unix.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#endif
+
+#include "headers/common.h"
+#include "headers/inspection.h"
+#include "headers/spare.h"
+#include "headers/standby.h"
+#include "headers/webrtc.h"
+
+typedef struct
+{
+  GstElement *webrtc;
+  gint64 lost_us;   // when the path was lost (ICE disconnected/failed or a network change)
+  gboolean forced;  // network change: restart even if ICE still reports connected
+  guint attempts;
+  guint timeout_id;
+} IceRecovery;
+
+struct VtxNetmon
+{
+  gint fd;
+  guint fd_source_id;
+  guint debounce_id;
+};
+
+VtxNetmon *g_netmon = NULL;
+
+// webrtcbin -> IceRecovery for every peer currently being recovered (main thread only)
+static GHashTable *s_recoveries = NULL;
+
+static guint s_network_changes = 0;
+static guint s_restarts = 0;
+static guint s_recovered = 0;
+static guint s_given_up = 0;
+static gint64 s_last_recover_us = -1;
+static gint64 s_max_recover_us = -1;
+
+// Cancels the recovery timer and drops the webrtcbin reference.
+static void vtx_netmon_recovery_free(gpointer data)
+{
+  IceRecovery *rec = data;
+  if (rec->timeout_id) g_source_remove(rec->timeout_id);
+  gst_object_unref(rec->webrtc);
+  g_free(rec);
+}
+
+// Returns TRUE if ICE has a working candidate pair.
+static gboolean vtx_netmon_ice_connected(GstElement *webrtc)
+{
+  GstWebRTCICEConnectionState state;
+  g_object_get(webrtc, "ice-connection-state", &state, NULL);
+  return state == GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED || state == GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED;
+}
+
+// Ends a recovery; when restarts were needed, records the time from losing the path to ICE being connected again.
+static void vtx_netmon_finish(IceRecovery *rec)
+{
+  if (rec->attempts > 0)
+  {
+    gint64 elapsed = g_get_monotonic_time() - rec->lost_us;
+    s_recovered++;
+    s_last_recover_us = elapsed;
+    if (elapsed > s_max_recover_us) s_max_recover_us = elapsed;
+    gst_println("ICE recovered for %s after %u restart(s) in %.1f ms", vtx_webrtc_peer_id(rec->webrtc), rec->attempts, elapsed / 1000.0);
+  }
+  g_hash_table_remove(s_recoveries, rec->webrtc);
+}
+
+// Restarts ICE on a peer that has lost its path, retrying until it is connected again or the attempts run out.
+static gboolean vtx_netmon_on_recovery_timeout(gpointer user_data)
+{
+  IceRecovery *rec = user_data;
+  rec->timeout_id = 0;
+
+  // The session was closed in the meantime
+  GstObject *parent = gst_object_get_parent(GST_OBJECT(rec->webrtc));
+  if (!parent)
+  {
+    g_hash_table_remove(s_recoveries, rec->webrtc);
+    return G_SOURCE_REMOVE;
+  }
+  gst_object_unref(parent);
+
+  if (vtx_netmon_ice_connected(rec->webrtc) && !(rec->forced && rec->attempts == 0))
+  {
+    vtx_netmon_finish(rec);
+    return G_SOURCE_REMOVE;
+  }
+
+  if (rec->attempts >= NETMON_MAX_RESTARTS)
+  {
+    s_given_up++;
+    gst_printerrln("ICE restart for %s did not recover after %u attempts", vtx_webrtc_peer_id(rec->webrtc), rec->attempts);
+    g_hash_table_remove(s_recoveries, rec->webrtc);
+    return G_SOURCE_REMOVE;
+  }
+
+  // Signaling offline or a negotiation in flight: try again on the next interval
+  if (vtx_webrtc_restart_ice(rec->webrtc))
+  {
+    rec->attempts++;
+    s_restarts++;
+  }
+
+  rec->timeout_id = g_timeout_add(NETMON_RETRY_MS, vtx_netmon_on_recovery_timeout, rec);
+  return G_SOURCE_REMOVE;
+}
+
+// Starts recovering a peer after delay_ms, unless it is already being recovered.
+static void vtx_netmon_begin_recovery(GstElement *webrtc, const gchar *reason, guint delay_ms, gboolean forced)
+{
+  // The spare sits in have-local-offer until a session takes it; it has no path to recover
+  if (vtx_spare_is_pending(webrtc)) return;
+
+  if (!s_recoveries) s_recoveries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, vtx_netmon_recovery_free);
+
+  IceRecovery *rec = g_hash_table_lookup(s_recoveries, webrtc);
+  if (rec)
+  {
+    rec->forced |= forced;
+    return;
+  }
+
+  gst_println("ICE path lost for %s (%s)", vtx_webrtc_peer_id(webrtc), reason);
+
+  rec = g_new0(IceRecovery, 1);
+  rec->webrtc = gst_object_ref(webrtc);
+  rec->lost_us = g_get_monotonic_time();
+  rec->forced = forced;
+  rec->timeout_id = g_timeout_add(delay_ms, vtx_netmon_on_recovery_timeout, rec);
+  g_hash_table_insert(s_recoveries, webrtc, rec);
+}
+
+typedef struct
+{
+  GstElement *webrtc;
+  GstWebRTCICEConnectionState state;
+} IceStateChange;
+
+// Main-thread half of vtx_netmon_on_ice_state.
+static gboolean vtx_netmon_on_ice_state_idle(gpointer user_data)
+{
+  IceStateChange *change = user_data;
+  IceRecovery *rec = s_recoveries ? g_hash_table_lookup(s_recoveries, change->webrtc) : NULL;
+
+  switch (change->state)
+  {
+    case GST_WEBRTC_ICE_CONNECTION_STATE_DISCONNECTED:
+      vtx_netmon_begin_recovery(change->webrtc, "ICE disconnected", NETMON_DISCONNECTED_GRACE_MS, FALSE);
+      break;
+    case GST_WEBRTC_ICE_CONNECTION_STATE_FAILED:
+      vtx_netmon_begin_recovery(change->webrtc, "ICE failed", 0, FALSE);
+      break;
+    case GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED:
+    case GST_WEBRTC_ICE_CONNECTION_STATE_COMPLETED:
+      if (rec && !(rec->forced && rec->attempts == 0)) vtx_netmon_finish(rec);
+      break;
+    default:
+      break;
+  }
+
+  gst_object_unref(change->webrtc);
+  g_free(change);
+  return G_SOURCE_REMOVE;
+}
+
+// Feeds ICE connection state changes of any session into recovery. Called from webrtcbin's notify handler, which may run on
+// a streaming thread, so the work is moved to the main loop.
+void vtx_netmon_on_ice_state(GstElement *webrtc, GstWebRTCICEConnectionState state)
+{
+  IceStateChange *change = g_new0(IceStateChange, 1);
+  change->webrtc = gst_object_ref(webrtc);
+  change->state = state;
+  g_idle_add(vtx_netmon_on_ice_state_idle, change);
+}
+
+// Restarts ICE on a session whose ICE agent lost or degraded its path with no checked pair on another one.
+void vtx_netmon_on_path_restart(GObject *agent, gpointer user_data)
+{
+  vtx_netmon_begin_recovery(GST_ELEMENT(user_data), "no checked pair on another path", 0, TRUE);
+}
+
+// Restarts ICE on one attached peer after a network change.
+static void vtx_netmon_restart_peer(gpointer data, gpointer user_data)
+{
+  vtx_netmon_begin_recovery(GST_ELEMENT(data), "network change", 0, TRUE);
+}
+
+// Fires once a burst of rtnetlink events has settled and restarts ICE on every live session.
+static gboolean vtx_netmon_on_debounce(gpointer user_data)
+{
+  VtxNetmon *netmon = user_data;
+  netmon->debounce_id = 0;
+  s_network_changes++;
+
+  if (webrtc) vtx_netmon_restart_peer(webrtc, NULL);
+  vtx_standby_foreach_peer(g_standby, vtx_netmon_restart_peer, NULL);
+
+  return G_SOURCE_REMOVE;
+}
+
+#ifdef __linux__
+// Returns TRUE if an rtnetlink message describes a change of usable addresses, routes or links.
+static gboolean vtx_netmon_is_path_change(struct nlmsghdr *nh)
+{
+  gint ifindex = 0;
+
+  switch (nh->nlmsg_type)
+  {
+    case RTM_NEWADDR:
+    case RTM_DELADDR:
+      ifindex = ((struct ifaddrmsg *) NLMSG_DATA(nh))->ifa_index;
+      break;
+    case RTM_NEWROUTE:
+    case RTM_DELROUTE:
+      if (((struct rtmsg *) NLMSG_DATA(nh))->rtm_table != RT_TABLE_MAIN) return FALSE;
+      break;
+    case RTM_NEWLINK:
+    case RTM_DELLINK:
+      ifindex = ((struct ifinfomsg *) NLMSG_DATA(nh))->ifi_index;
+      break;
+    default:
+      return FALSE;
+  }
+
+  if (ifindex > 0)
+  {
+    char ifname[IF_NAMESIZE] = {0};
+    if (if_indextoname(ifindex, ifname) && vtx_nic_should_skip_interface(ifname)) return FALSE;
+    gst_println("Network change on %s (rtnetlink type %u)", ifname[0] ? ifname : "?", nh->nlmsg_type);
+  }
+  else
+  {
+    gst_println("Network change: main routing table (rtnetlink type %u)", nh->nlmsg_type);
+  }
+  return TRUE;
+}
+
+// Drains the rtnetlink socket and (re)arms the debounce timer on path changes.
+static gboolean vtx_netmon_on_readable(gint fd, GIOCondition condition, gpointer user_data)
+{
+  VtxNetmon *netmon = user_data;
+  gchar buf[8192] __attribute__((aligned(__alignof__(struct nlmsghdr))));
+  gboolean changed = FALSE;
+
+  for (;;)
+  {
+    int len = (int) recv(fd, buf, sizeof(buf), 0);
+    if (len <= 0) break;
+
+    for (struct nlmsghdr *nh = (struct nlmsghdr *) buf; NLMSG_OK(nh, len); nh = NLMSG_NEXT(nh, len))
+    {
+      if (nh->nlmsg_type == NLMSG_DONE || nh->nlmsg_type == NLMSG_ERROR) break;
+      changed |= vtx_netmon_is_path_change(nh);
+    }
+  }
+
+  // Only sessions with media in flight need a restart
+  if (changed && (webrtc || g_standby))
+  {
+    if (netmon->debounce_id) g_source_remove(netmon->debounce_id);
+    netmon->debounce_id = g_timeout_add(NETMON_DEBOUNCE_MS, vtx_netmon_on_debounce, netmon);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+// Subscribes to rtnetlink address, route and link notifications. ICE state driven recovery works without it (and on
+// non-Linux platforms, where NULL is returned).
+VtxNetmon *vtx_netmon_start(void)
+{
+#ifdef __linux__
+  gint fd = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (fd < 0)
+  {
+    gst_printerrln("Netmon: failed to open rtnetlink socket: %s", g_strerror(errno));
+    return NULL;
+  }
+
+  struct sockaddr_nl addr = {0};
+  addr.nl_family = AF_NETLINK;
+  addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR | RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+  {
+    gst_printerrln("Netmon: failed to bind rtnetlink socket: %s", g_strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  VtxNetmon *netmon = g_new0(VtxNetmon, 1);
+  netmon->fd = fd;
+  netmon->fd_source_id = g_unix_fd_add(fd, G_IO_IN, vtx_netmon_on_readable, netmon);
+
+  gst_println("Netmon: watching address, route and link changes");
+  return netmon;
+#else
+  return NULL;
+#endif
+}
+
+// Stops watching the network and cancels any recovery in progress.
+void vtx_netmon_free(VtxNetmon *netmon)
+{
+  if (s_recoveries) g_clear_pointer(&s_recoveries, g_hash_table_destroy);
+  if (!netmon) return;
+
+  if (netmon->debounce_id) g_source_remove(netmon->debounce_id);
+  if (netmon->fd_source_id) g_source_remove(netmon->fd_source_id);
+  close(netmon->fd);
+  g_free(netmon);
+}
+
+// Returns network change, ICE restart and time-to-recover counters.
+JsonObject *vtx_netmon_get_stats(void)
+{
+  JsonObject *o = json_object_new();
+  json_object_set_int_member(o, "network_changes", s_network_changes);
+  json_object_set_int_member(o, "restarts", s_restarts);
+  json_object_set_int_member(o, "recovered", s_recovered);
+  json_object_set_int_member(o, "given_up", s_given_up);
+  json_object_set_int_member(o, "recovering", s_recoveries ? g_hash_table_size(s_recoveries) : 0);
+
+  if (s_last_recover_us >= 0)
+  {
+    json_object_set_double_member(o, "last_recover_ms", s_last_recover_us / 1000.0);
+    json_object_set_double_member(o, "max_recover_ms", s_max_recover_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "last_recover_ms");
+    json_object_set_null_member(o, "max_recover_ms");
+  }
+
+  return o;
+}
@@ -19,7 +19,7 @@
 #include "headers/wpa.h"
 
 // Returns TRUE if the network interface should be skipped (loopback, virtual, or container interfaces).
-static gboolean vtx_nic_should_skip_interface(const gchar *ifname)
+gboolean vtx_nic_should_skip_interface(const gchar *ifname)
 {
   if (!ifname || ifname[0] == '\0') return TRUE;
 
@@ -0,0 +1,296 @@
+#include "headers/pacer.h"
+
+#include "headers/encoder.h"
+
+// Smallest burst the token bucket allows, so a single full-size RTP packet is never delayed on an idle link.
+#define PACER_MIN_BURST_BYTES 2400
+#define PACER_BURST_US 5000
+#define PACER_ARRIVAL_RING_SIZE 4096
+
+static const guint s_histogram_bounds_ms[PACER_HISTOGRAM_BUCKETS - 1] = {1, 2, 5, 10, 20, 50, 100};
+
+struct VtxPacer
+{
+  GstElement *queue;
+  GstPad *queue_sink;
+  GstPad *queue_src;
+  GstPad *audio_src;
+  gulong queue_sink_probe;
+  gulong queue_src_probe;
+  gulong audio_src_probe;
+
+  GMutex lock;
+  guint headroom_percent;
+  guint target_kbps;
+  gdouble rate_bytes_per_us;
+  gdouble burst_bytes;
+  gdouble tokens;
+  gint64 last_refill_us;
+  gint64 max_delay_us;
+
+  // Arrival times of the items currently held in the queue, in FIFO order
+  gint64 arrivals[PACER_ARRIVAL_RING_SIZE];
+  guint arrival_head;
+  guint arrival_count;
+
+  guint64 histogram[PACER_HISTOGRAM_BUCKETS];
+  guint64 packets;
+  guint64 bytes;
+  guint64 audio_bytes;
+  guint64 over_budget;
+  gint64 max_observed_delay_us;
+};
+
+VtxPacer *g_pacer = NULL;
+
+// Returns the total payload size of a buffer or buffer list carried by a probe.
+static gsize vtx_pacer_probe_size(GstPadProbeInfo *info)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+  {
+    return gst_buffer_list_calculate_size(GST_PAD_PROBE_INFO_BUFFER_LIST(info));
+  }
+  return gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+}
+
+// Adds the tokens accumulated since the last refill, capped at the burst size. Must be called with the lock held.
+static void vtx_pacer_refill(VtxPacer *pacer, gint64 now)
+{
+  pacer->tokens += (now - pacer->last_refill_us) * pacer->rate_bytes_per_us;
+  if (pacer->tokens > pacer->burst_bytes) pacer->tokens = pacer->burst_bytes;
+  pacer->last_refill_us = now;
+}
+
+// Records the time an item entered the pacing queue.
+static GstPadProbeReturn vtx_pacer_on_queue_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxPacer *pacer = user_data;
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&pacer->lock);
+  if (pacer->arrival_count < PACER_ARRIVAL_RING_SIZE)
+  {
+    guint tail = (pacer->arrival_head + pacer->arrival_count) % PACER_ARRIVAL_RING_SIZE;
+    pacer->arrivals[tail] = now;
+    pacer->arrival_count++;
+  }
+  g_mutex_unlock(&pacer->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Holds each item leaving the pacing queue until the token bucket allows it, but never beyond the queue-delay budget.
+static GstPadProbeReturn vtx_pacer_on_queue_src(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxPacer *pacer = user_data;
+  gsize size = vtx_pacer_probe_size(info);
+  gint64 now = g_get_monotonic_time();
+  gint64 arrival = now;
+  gint64 wait_us = 0;
+
+  g_mutex_lock(&pacer->lock);
+  if (pacer->arrival_count > 0)
+  {
+    arrival = pacer->arrivals[pacer->arrival_head];
+    pacer->arrival_head = (pacer->arrival_head + 1) % PACER_ARRIVAL_RING_SIZE;
+    pacer->arrival_count--;
+  }
+
+  vtx_pacer_refill(pacer, now);
+  if (pacer->tokens < (gdouble) size)
+  {
+    wait_us = (gint64) (((gdouble) size - pacer->tokens) / pacer->rate_bytes_per_us);
+    gint64 remaining_us = pacer->max_delay_us - (now - arrival);
+    if (wait_us > remaining_us)
+    {
+      wait_us = MAX(remaining_us, 0);
+      pacer->over_budget++;
+    }
+  }
+  pacer->tokens -= size;
+  // Bound the debt so a long overload does not keep delaying packets after it ends
+  if (pacer->tokens < -pacer->rate_bytes_per_us * pacer->max_delay_us) pacer->tokens = -pacer->rate_bytes_per_us * pacer->max_delay_us;
+
+  gint64 delay_us = now + wait_us - arrival;
+  guint bucket = PACER_HISTOGRAM_BUCKETS - 1;
+  for (guint i = 0; i < PACER_HISTOGRAM_BUCKETS - 1; i++)
+  {
+    if (delay_us <= (gint64) s_histogram_bounds_ms[i] * 1000)
+    {
+      bucket = i;
+      break;
+    }
+  }
+  pacer->histogram[bucket]++;
+  pacer->packets++;
+  pacer->bytes += size;
+  if (delay_us > pacer->max_observed_delay_us) pacer->max_observed_delay_us = delay_us;
+  g_mutex_unlock(&pacer->lock);
+
+  if (wait_us > 0) g_usleep(wait_us);
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Charges audio packets against the shared budget without delaying them, so video yields to audio.
+static GstPadProbeReturn vtx_pacer_on_audio_src(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxPacer *pacer = user_data;
+  gsize size = vtx_pacer_probe_size(info);
+
+  g_mutex_lock(&pacer->lock);
+  vtx_pacer_refill(pacer, g_get_monotonic_time());
+  pacer->tokens -= size;
+  pacer->audio_bytes += size;
+  g_mutex_unlock(&pacer->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Sets the release rate for a new encoder bitrate (plus the configured headroom).
+void vtx_pacer_set_bitrate_kbps(VtxPacer *pacer, guint bitrate_kbps)
+{
+  g_mutex_lock(&pacer->lock);
+  pacer->target_kbps = bitrate_kbps * (100 + pacer->headroom_percent) / 100;
+  pacer->rate_bytes_per_us = pacer->target_kbps / 8000.0;
+  pacer->burst_bytes = MAX(PACER_MIN_BURST_BYTES, pacer->rate_bytes_per_us * PACER_BURST_US);
+  if (pacer->tokens > pacer->burst_bytes) pacer->tokens = pacer->burst_bytes;
+  g_mutex_unlock(&pacer->lock);
+}
+
+// Inserts a pacing queue between the video payloader and its downstream peer (webrtcbin). The release rate is the
+// encoder's configured bitrate plus headroom; RTX is generated inside webrtcbin and rides on that headroom.
+VtxPacer *vtx_pacer_insert(GstElement *pipeline, guint headroom_percent, guint max_delay_ms)
+{
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (!videopay)
+  {
+    gst_printerrln("Pacer: videopay not found in pipeline, pacing disabled");
+    return NULL;
+  }
+
+  GstElement *encoder = vtx_encoder_find(GST_BIN(pipeline));
+  guint bitrate_kbps = vtx_encoder_get_bitrate_kbps(encoder);
+  if (encoder) gst_object_unref(encoder);
+
+  if (bitrate_kbps == 0)
+  {
+    gst_printerrln("Pacer: encoder bitrate unknown, pacing disabled");
+    gst_object_unref(videopay);
+    return NULL;
+  }
+
+  GstPad *pay_src = gst_element_get_static_pad(videopay, "src");
+  GstPad *peer = gst_pad_get_peer(pay_src);
+  GstBin *parent = GST_BIN(gst_object_get_parent(GST_OBJECT(videopay)));
+  gst_object_unref(videopay);
+
+  if (!peer || !parent)
+  {
+    gst_printerrln("Pacer: videopay is not linked, pacing disabled");
+    if (peer) gst_object_unref(peer);
+    if (parent) gst_object_unref(parent);
+    gst_object_unref(pay_src);
+    return NULL;
+  }
+
+  VtxPacer *pacer = g_new0(VtxPacer, 1);
+  g_mutex_init(&pacer->lock);
+  pacer->headroom_percent = headroom_percent;
+  vtx_pacer_set_bitrate_kbps(pacer, bitrate_kbps);
+  pacer->tokens = pacer->burst_bytes;
+  pacer->last_refill_us = g_get_monotonic_time();
+  pacer->max_delay_us = (gint64) max_delay_ms * 1000;
+
+  // The queue only has to absorb a burst for the delay budget; the probe releases anything older than that.
+  pacer->queue = gst_element_factory_make_full("queue", "name", "vtxpacer", "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", (guint64) max_delay_ms * 4 * GST_MSECOND, NULL);
+  gst_bin_add(parent, pacer->queue);
+  gst_object_unref(parent);
+
+  pacer->queue_sink = gst_element_get_static_pad(pacer->queue, "sink");
+  pacer->queue_src = gst_element_get_static_pad(pacer->queue, "src");
+
+  gst_pad_unlink(pay_src, peer);
+  if (gst_pad_link(pay_src, pacer->queue_sink) != GST_PAD_LINK_OK || gst_pad_link(pacer->queue_src, peer) != GST_PAD_LINK_OK)
+  {
+    gst_printerrln("Pacer: failed to link pacing queue");
+  }
+  gst_object_unref(peer);
+  gst_object_unref(pay_src);
+
+  GstPadProbeType types = GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST;
+  pacer->queue_sink_probe = gst_pad_add_probe(pacer->queue_sink, types, vtx_pacer_on_queue_sink, pacer, NULL);
+  pacer->queue_src_probe = gst_pad_add_probe(pacer->queue_src, types, vtx_pacer_on_queue_src, pacer, NULL);
+
+  // Brings the queue to the pipeline's state once it is linked and probed, so pacing can also be inserted while running
+  gst_element_sync_state_with_parent(pacer->queue);
+
+  GstElement *audiopay = gst_bin_get_by_name(GST_BIN(pipeline), "audiopay");
+  if (audiopay)
+  {
+    pacer->audio_src = gst_element_get_static_pad(audiopay, "src");
+    pacer->audio_src_probe = gst_pad_add_probe(pacer->audio_src, types, vtx_pacer_on_audio_src, pacer, NULL);
+    gst_object_unref(audiopay);
+  }
+
+  gst_println("Pacer: encoder %u kbps + %u%% headroom -> %u kbps, delay budget %u ms", bitrate_kbps, headroom_percent, pacer->target_kbps, max_delay_ms);
+
+  return pacer;
+}
+
+// Returns the pacer counters and queue-delay histogram as a JsonObject.
+JsonObject *vtx_pacer_get_stats(VtxPacer *pacer)
+{
+  JsonObject *stats = json_object_new();
+  JsonArray *histogram = json_array_new();
+
+  g_mutex_lock(&pacer->lock);
+  json_object_set_int_member(stats, "target_kbps", pacer->target_kbps);
+  json_object_set_int_member(stats, "max_delay_ms", pacer->max_delay_us / 1000);
+  json_object_set_int_member(stats, "packets", pacer->packets);
+  json_object_set_int_member(stats, "bytes", pacer->bytes);
+  json_object_set_int_member(stats, "audio_bytes", pacer->audio_bytes);
+  json_object_set_int_member(stats, "over_budget", pacer->over_budget);
+  json_object_set_double_member(stats, "max_observed_delay_ms", pacer->max_observed_delay_us / 1000.0);
+
+  for (guint i = 0; i < PACER_HISTOGRAM_BUCKETS; i++)
+  {
+    JsonObject *bucket = json_object_new();
+    if (i < PACER_HISTOGRAM_BUCKETS - 1)
+    {
+      json_object_set_int_member(bucket, "le_ms", s_histogram_bounds_ms[i]);
+    }
+    else
+    {
+      json_object_set_null_member(bucket, "le_ms");
+    }
+    json_object_set_int_member(bucket, "count", pacer->histogram[i]);
+    json_array_add_object_element(histogram, bucket);
+  }
+  g_mutex_unlock(&pacer->lock);
+
+  json_object_set_array_member(stats, "queue_delay_histogram", histogram);
+  return stats;
+}
+
+// Removes the pacer probes and frees the pacer. The pipeline must already be stopped.
+void vtx_pacer_free(VtxPacer *pacer)
+{
+  if (!pacer) return;
+
+  gst_println("Pacer: %" G_GUINT64_FORMAT " packets paced, %" G_GUINT64_FORMAT " over delay budget, max delay %.1f ms", pacer->packets, pacer->over_budget, pacer->max_observed_delay_us / 1000.0);
+
+  gst_pad_remove_probe(pacer->queue_sink, pacer->queue_sink_probe);
+  gst_pad_remove_probe(pacer->queue_src, pacer->queue_src_probe);
+  gst_object_unref(pacer->queue_sink);
+  gst_object_unref(pacer->queue_src);
+
+  if (pacer->audio_src)
+  {
+    gst_pad_remove_probe(pacer->audio_src, pacer->audio_src_probe);
+    gst_object_unref(pacer->audio_src);
+  }
+
+  g_mutex_clear(&pacer->lock);
+  g_free(pacer);
+}
@@ -1,16 +1,47 @@
 #include "headers/pipeline.h"
 
+#include "headers/camera.h"
+#include "headers/codec_branch.h"
 #include "headers/common.h"
 #include "headers/data_channel.h"
+#include "headers/dtls.h"
+#include "headers/dvr.h"
+#include "headers/fallback.h"
+#include "headers/latency.h"
+#include "headers/pacer.h"
+#include "headers/reconfig.h"
+#include "headers/recorder.h"
 #include "headers/rtp.h"
+#include "headers/scene.h"
+#include "headers/spare.h"
+#include "headers/standby.h"
+#include "headers/svc.h"
+#include "headers/tap.h"
+#include "headers/tracks.h"
 #include "headers/utils.h"
+#include "headers/watchdog.h"
 #include "headers/webrtc.h"
 
 GstElement *pipeline = NULL;
 GstElement *webrtc = NULL;
 
+static guint s_direct_report_id = 0;
+static CpuSample s_direct_cpu = {0};
+
+// Handles pipeline errors and EOS. user_data is TRUE for the shared media pipeline, which is torn down with all its viewers.
 static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer user_data)
 {
+  gboolean warm = GPOINTER_TO_INT(user_data);
+
+  // Errors of the recording branch end the recording only
+  if (g_recorder && vtx_recorder_handle_message(g_recorder, msg)) return TRUE;
+
+  // Encoder errors fail over to a software encoder
+  if (g_fallback && vtx_fallback_handle_message(g_fallback, msg)) return TRUE;
+
+  // Errors of a source or encoder restart that branch only, until the watchdog gives up on it
+  if (g_watchdog && vtx_watchdog_handle_message(g_watchdog, msg)) return TRUE;
+
   switch (GST_MESSAGE_TYPE(msg))
   {
     case GST_MESSAGE_ERROR:
@@ -21,7 +52,14 @@ static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer user_data)
       gst_printerrln("Pipeline error: %s (%s)", err->message, debug ? debug : "none");
       g_error_free(err);
       g_free(debug);
-      vtx_cleanup_connection("Pipeline error");
+      if (warm)
+      {
+        vtx_pipeline_stop_standby();
+      }
+      else
+      {
+        vtx_cleanup_connection("Pipeline error");
+      }
       break;
     }
     case GST_MESSAGE_WARNING:
@@ -36,7 +74,14 @@ static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer user_data)
     }
     case GST_MESSAGE_EOS:
       gst_println("Pipeline EOS");
-      vtx_cleanup_connection("Pipeline EOS");
+      if (warm)
+      {
+        vtx_pipeline_stop_standby();
+      }
+      else
+      {
+        vtx_cleanup_connection("Pipeline EOS");
+      }
       break;
     default:
       break;
@@ -44,9 +89,343 @@ static gboolean on_bus_message(GstBus *bus, GstMessage *msg, gpointer user_data)
   return TRUE;
 }
 
+// Adds RTP header extensions and the per-stream media hooks (SVC, scene rate control, latency, pacing) to a pipeline that
+// has not been started yet. Fails only when an additional video track cannot be built.
+static gboolean vtx_pipeline_attach_media_hooks(GstElement *media, const MediaParams *params, gchar **error_msg)
+{
+  // camera controls (H264 profile, camera_controls) on the V4L2 device, before the camera starts streaming
+  g_camera = vtx_camera_attach(media, params->video_profile, params->camera_controls);
+
+  // header extensions (the add functions release the payloader reference)
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(media), "videopay");
+  if (videopay) vtx_rtp_add_video_header_extensions(videopay);
+
+  GstElement *audiopay = gst_bin_get_by_name(GST_BIN(media), "audiopay");
+  if (audiopay) vtx_rtp_add_audio_header_extensions(audiopay);
+
+  // temporal layers (frame marking must be added before caps are negotiated)
+  if (params->temporal_layers > 1)
+  {
+    g_svc = vtx_svc_setup(media, params->temporal_layers);
+  }
+
+  // scene-complexity rate control (sets the encoder to the ceiling, so it must run before the pacer reads the bitrate)
+  if (params->scene_rate_control)
+  {
+    g_scene = vtx_scene_attach(media, params->max_bitrate_kbps, params->min_bitrate_percent);
+  }
+
+  // slice encoding and encoder-to-packet latency measurement (before the pacer so pacing delay is excluded); a multi-codec
+  // offer only learns its encoder from the answer, so it is not measured
+  if (!params->video_source_pipeline)
+  {
+    g_latency = vtx_latency_attach(media, params->slices);
+  }
+
+  // pacing between videopay and webrtcbin (or the shared tee, ahead of the per-viewer fan-out)
+  if (params->pacing)
+  {
+    g_pacer = vtx_pacer_insert(media, params->pacing_headroom_percent, params->pacing_max_delay_ms);
+  }
+
+  // local tap of the encoded stream (videopay input) and raw frames (encoder input)
+  if (params->tap_dir)
+  {
+    g_tap = vtx_tap_attach(media, params->tap_dir, params->tap_raw, params->tap_queue_frames);
+  }
+
+  // bitrate, frame-rate and resolution changes over the CMD channel
+  g_reconfig = vtx_reconfig_attach(media);
+
+  // source fallback selector ahead of the encoder, and encoder failover (before the watchdog, which watches the selector's
+  // source side)
+  if (params->fallback_source != FALLBACK_SOURCE_NONE || params->encoder_failover)
+  {
+    g_fallback = vtx_fallback_attach(media, params->fallback_source, params->fallback_timeout_ms, params->encoder_failover);
+  }
+
+  // buffer-flow watchdog (before the recording tees, so restarts leave them alone)
+  if (params->watchdog_stall_frames)
+  {
+    g_watchdog = vtx_watchdog_attach(media, params->watchdog_stall_frames);
+  }
+
+  // recording tees ahead of videopay/audiopay (or the encoder); the branch itself is linked on RECORD_START
+  if (params->record_dir)
+  {
+    g_recorder = vtx_recorder_attach(media, params->record_dir, params->record_format, params->record_segment_s, params->record_segment_mb, params->record_encoder);
+  }
+
+  // pre-event ring of the encoded video and MSP telemetry
+  if (params->dvr_seconds)
+  {
+    g_dvr = vtx_dvr_attach(media, params->dvr_dir, params->dvr_seconds, params->dvr_memory_mb, params->dvr_trigger_flags, params->dvr_flush_on_disarm);
+  }
+
+  // additional video tracks, last so the hooks above only see the main track's encoder
+  if (params->n_video_tracks)
+  {
+    g_tracks = vtx_tracks_attach(media, params->video_tracks, params->n_video_tracks, params->main_bitrate_share, error_msg);
+    if (!g_tracks) return FALSE;
+  }
+  return TRUE;
+}
+
+// Connects the state callbacks of a session's webrtcbin. Data channels (telemetry and CMD) belong to the primary session only.
+static void vtx_pipeline_connect_session(GstElement *element, gboolean primary)
+{
+  if (primary)
+  {
+    g_signal_connect(element, "on-data-channel", G_CALLBACK(vtx_webrtc_on_data_channel), NULL);
+  }
+  g_signal_connect(element, "notify::ice-gathering-state", G_CALLBACK(vtx_webrtc_notify_ice_gathering_state), NULL);
+  g_signal_connect(element, "notify::ice-connection-state", G_CALLBACK(vtx_webrtc_notify_ice_connection_state), NULL);
+}
+
+// Sets transceiver priorities and connects the signaling and state callbacks of a session's webrtcbin.
+static void vtx_pipeline_connect_webrtc(GstElement *element, const MediaParams *params, gboolean primary)
+{
+  // set priority
+  const gchar *priorities[PIPELINE_MAX_TRANSCEIVERS];
+  guint n_priorities = vtx_pipeline_get_transceiver_priorities(params, priorities);
+  GArray *transceivers = NULL;
+  g_signal_emit_by_name(element, "get-transceivers", &transceivers);
+  if (transceivers)
+  {
+    vtx_rtp_set_transceiver_priority(transceivers, priorities, n_priorities);
+    g_array_unref(transceivers);
+  }
+
+  // shared DTLS certificate, before negotiation creates the transports
+  vtx_dtls_apply(element);
+  vtx_webrtc_batch_ice_candidates(element, params->ice_batch_ms);
+
+  // callbacks
+  g_signal_connect(element, "on-negotiation-needed", G_CALLBACK(vtx_webrtc_on_negotiation_needed), NULL);
+  g_signal_connect(element, "on-ice-candidate", G_CALLBACK(vtx_webrtc_on_ice_candidate), NULL);
+  vtx_pipeline_connect_session(element, primary);
+}
+
+// Reports the time from the stream-start request to the first video keyframe sent once the peer connection is up (video
+// comes first, so it is sink_0). Cold and warm starts are measured the same way.
+static void vtx_pipeline_watch_first_frame(GstElement *element, gint64 start_us, gboolean warm)
+{
+  GstPad *sink = gst_element_get_static_pad(element, "sink_0");
+  vtx_standby_watch_first_frame(sink, start_us, warm);
+  if (sink) gst_object_unref(sink);
+}
+
+// Builds the shared media pipeline (unless one with the same media descriptions is already running), attaches the media
+// hooks once and starts capture and encoding without any viewer. Hook settings of later sessions that reuse it are ignored.
+gboolean vtx_pipeline_prewarm(const MediaParams *params, gchar **error_msg)
+{
+  if (g_standby)
+  {
+    if (vtx_standby_matches(g_standby, params))
+    {
+      if (params->warm_standby) vtx_standby_set_keep_warm(g_standby, TRUE);
+      return TRUE;
+    }
+    vtx_pipeline_stop_standby();
+  }
+
+  g_standby = vtx_standby_new(params, error_msg);
+  if (!g_standby) return FALSE;
+
+  GstElement *media = vtx_standby_get_pipeline(g_standby);
+  if (!vtx_pipeline_attach_media_hooks(media, params, error_msg))
+  {
+    vtx_pipeline_stop_standby();
+    return FALSE;
+  }
+
+  if (gst_element_set_state(media, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+  {
+    if (error_msg) *error_msg = g_strdup("Failed to set standby pipeline state to PLAYING");
+    vtx_pipeline_stop_standby();
+    return FALSE;
+  }
+
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(media));
+  gst_bus_add_watch(bus, on_bus_message, GINT_TO_POINTER(TRUE));
+  gst_object_unref(bus);
+
+  return TRUE;
+}
+
+// Stops the shared media pipeline, ending every session attached to it, and frees its media hooks.
+void vtx_pipeline_stop_standby(void)
+{
+  if (!g_standby) return;
+
+  // Ending the primary session may already stop an idle shared pipeline
+  if (pipeline && pipeline == vtx_standby_get_pipeline(g_standby))
+  {
+    vtx_cleanup_connection("Stopping shared media pipeline");
+  }
+  if (!g_standby) return;
+
+  vtx_spare_discard();
+  vtx_standby_free(g_standby);
+  g_standby = NULL;
+
+  // Pacer probes can only be removed once the streaming threads have stopped
+  vtx_cleanup_media_hooks();
+}
+
+// Stops the shared media pipeline once its last viewer has left, unless it is kept warm; a pipeline kept warm gets a spare
+// webrtcbin negotiating ahead of the next session.
+void vtx_pipeline_release_standby(void)
+{
+  if (g_standby && vtx_standby_is_idle(g_standby))
+  {
+    vtx_pipeline_stop_standby();
+  }
+  else if (g_standby && !pipeline)
+  {
+    vtx_spare_prepare(g_standby);
+  }
+}
+
+// Starts the primary session on the shared media pipeline; when it is already running only a new webrtcbin is created and
+// linked to the running encoders.
+static gboolean vtx_pipeline_start_shared(const MediaParams *params, gint64 start_us, gchar **error_msg)
+{
+  // A primary receiver that reconnects replaces its previous webrtcbin
+  if (vtx_pipeline_is_shared())
+  {
+    vtx_standby_detach(g_standby, webrtc);
+    gst_clear_object(&webrtc);
+    gst_clear_object(&pipeline);
+  }
+
+  gboolean warm = g_standby && vtx_standby_matches(g_standby, params);
+  if (!vtx_pipeline_prewarm(params, error_msg)) return FALSE;
+
+  // The spare webrtcbin already holds the data channels, the offer and the gathered candidates, so the offer goes out
+  // before this STREAM_START handler returns.
+  GstElement *spare = vtx_spare_take(params);
+  vtx_spare_remember(params);
+  if (spare)
+  {
+    webrtc = spare;
+    pipeline = gst_object_ref(vtx_standby_get_pipeline(g_standby));
+    vtx_pipeline_connect_session(webrtc, TRUE);
+    vtx_pipeline_watch_first_frame(webrtc, start_us, TRUE);
+    vtx_standby_activate(g_standby, webrtc);
+    vtx_dc_create_late_channels(webrtc);
+    vtx_webrtc_batch_ice_candidates(webrtc, params->ice_batch_ms);
+    app_state = PEER_CALL_NEGOTIATING;
+    vtx_spare_send_offer(webrtc);
+    return TRUE;
+  }
+
+  webrtc = vtx_pipeline_make_webrtcbin(params, error_msg);
+  if (!webrtc)
+  {
+    vtx_pipeline_release_standby();
+    return FALSE;
+  }
+  gst_object_ref_sink(webrtc);
+
+  if (!vtx_standby_attach(g_standby, webrtc, NULL))
+  {
+    if (error_msg) *error_msg = g_strdup("Failed to link standby media to webrtcbin");
+    gst_object_unref(webrtc);
+    webrtc = NULL;
+    vtx_pipeline_release_standby();
+    return FALSE;
+  }
+
+  pipeline = gst_object_ref(vtx_standby_get_pipeline(g_standby));
+
+  vtx_pipeline_connect_webrtc(webrtc, params, TRUE);
+  vtx_pipeline_watch_first_frame(webrtc, start_us, warm);
+  vtx_standby_activate(g_standby, webrtc);
+
+  return TRUE;
+}
+
+// Logs the CPU usage and encoder-to-packet latency of a running direct output, for comparison with the WebRTC path (where
+// the same numbers are in CMD_GET_STATS). Stops with the session.
+static gboolean vtx_pipeline_on_direct_report(gpointer user_data)
+{
+  if (!vtx_pipeline_is_direct())
+  {
+    s_direct_report_id = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  gdouble cpu = vtx_cpu_percent_since(&s_direct_cpu);
+  if (g_latency)
+  {
+    JsonObject *stats = vtx_latency_get_stats(g_latency);
+    JsonNode *node = json_node_init_object(json_node_alloc(), stats);
+    gchar *latency = json_to_string(node, FALSE);
+    gst_println("Direct output: CPU %.1f%%, latency %s", cpu, latency);
+    g_free(latency);
+    json_node_unref(node);
+    json_object_unref(stats);
+  }
+  else
+  {
+    gst_println("Direct output: CPU %.1f%%", cpu);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+// Starts a session that streams straight to the ground station over RTP/SRTP or SRT: no webrtcbin, DTLS, SCTP or SDP
+// exchange. Like the multi-codec session it owns its pipeline, so a running shared pipeline is stopped first.
+static gboolean vtx_pipeline_start_direct(const MediaParams *params, gchar **error_msg)
+{
+  vtx_pipeline_stop_standby();
+
+  pipeline = vtx_pipeline_build_direct(params, error_msg);
+  if (!pipeline) return FALSE;
+
+  if (!vtx_pipeline_attach_media_hooks(pipeline, params, error_msg)) return FALSE;
+
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+  {
+    if (error_msg) *error_msg = g_strdup("Failed to set pipeline state to PLAYING");
+    return FALSE;
+  }
+
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  gst_bus_add_watch(bus, on_bus_message, GINT_TO_POINTER(FALSE));
+  gst_object_unref(bus);
+
+  if (!s_direct_report_id)
+  {
+    s_direct_cpu = (CpuSample) {0};
+    vtx_cpu_percent_since(&s_direct_cpu);
+    s_direct_report_id = g_timeout_add_seconds(OUTPUT_REPORT_INTERVAL_S, vtx_pipeline_on_direct_report, NULL);
+  }
+
+  return TRUE;
+}
+
 // Builds and starts the GStreamer pipeline, wires up webrtcbin callbacks, and sets the pipeline to PLAYING state.
 gboolean vtx_pipeline_start(const MediaParams *params, gchar **error_msg)
 {
+  gint64 start_us = g_get_monotonic_time();
+
+  if (params->output != OUTPUT_WEBRTC)
+  {
+    return vtx_pipeline_start_direct(params, error_msg);
+  }
+
+  // Single-codec sessions share one capture/encode pipeline so further viewers can be attached without encoding again
+  if (!params->video_source_pipeline)
+  {
+    return vtx_pipeline_start_shared(params, start_us, error_msg);
+  }
+
+  // The multi-codec offer selects its encoder branch per answer, so it always gets a session-owned pipeline, and a running
+  // shared pipeline would hold the capture device
+  vtx_pipeline_stop_standby();
+
   pipeline = vtx_pipeline_build(params, error_msg);
   if (!pipeline) return FALSE;
 
@@ -62,44 +441,90 @@ gboolean vtx_pipeline_start(const MediaParams *params, gchar **error_msg)
   // g_object_set(webrtc, "ice-agent", agent, NULL);
   // g_object_unref(agent);
 
-  // header extensions
-  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
-  if (videopay)
-  {
-    vtx_rtp_add_video_header_extensions(videopay);
-  }
+  // multi-codec offer: header extensions on the other branches and codec preferences on the video transceiver
+  vtx_codec_branch_setup(pipeline, webrtc);
+
+  if (!vtx_pipeline_attach_media_hooks(pipeline, params, error_msg)) return FALSE;
+  vtx_pipeline_connect_webrtc(webrtc, params, TRUE);
+  vtx_pipeline_watch_first_frame(webrtc, start_us, FALSE);
 
-  GstElement *audiopay = gst_bin_get_by_name(GST_BIN(pipeline), "audiopay");
-  if (audiopay)
+  // set state
+  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
   {
-    vtx_rtp_add_audio_header_extensions(audiopay);
+    if (error_msg) *error_msg = g_strdup("Failed to set pipeline state to PLAYING");
+    return FALSE;
   }
 
-  // set priority
-  GArray *transceivers = NULL;
-  g_signal_emit_by_name(webrtc, "get-transceivers", &transceivers);
-  if (transceivers && transceivers->len > 1)
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  gst_bus_add_watch(bus, on_bus_message, GINT_TO_POINTER(FALSE));
+  gst_object_unref(bus);
+
+  return TRUE;
+}
+
+// Returns TRUE if the primary session is a direct RTP/SRT output, which has a pipeline but no webrtcbin.
+gboolean vtx_pipeline_is_direct(void)
+{
+  return pipeline && !webrtc;
+}
+
+// Returns TRUE if the primary session runs on the shared media pipeline, so further receivers can join it.
+gboolean vtx_pipeline_is_shared(void)
+{
+  return pipeline && g_standby && pipeline == vtx_standby_get_pipeline(g_standby);
+}
+
+// Returns the webrtcbin of the additional viewer with the given ws2Id, or NULL if it is not an additional viewer.
+GstElement *vtx_pipeline_find_viewer(const gchar *viewer_id)
+{
+  return vtx_standby_find_viewer(g_standby, viewer_id);
+}
+
+// Attaches another receiver to the running shared pipeline with its own webrtcbin (own ICE, DTLS and congestion state).
+gboolean vtx_pipeline_add_viewer(const gchar *viewer_id, const MediaParams *params, gchar **error_msg)
+{
+  gint64 start_us = g_get_monotonic_time();
+
+  if (!vtx_pipeline_is_shared() || !vtx_standby_matches(g_standby, params))
   {
-    vtx_rtp_set_transceiver_priority(transceivers, params->video_priority, params->audio_priority);
+    if (error_msg) *error_msg = g_strdup("Another receiver is streaming with different media settings");
+    return FALSE;
   }
 
-  // callbacks
-  g_signal_connect(webrtc, "on-negotiation-needed", G_CALLBACK(vtx_webrtc_on_negotiation_needed), NULL);
-  g_signal_connect(webrtc, "on-ice-candidate", G_CALLBACK(vtx_webrtc_on_ice_candidate), NULL);
-  g_signal_connect(webrtc, "on-data-channel", G_CALLBACK(vtx_webrtc_on_data_channel), NULL);
-  g_signal_connect(webrtc, "notify::ice-gathering-state", G_CALLBACK(vtx_webrtc_notify_ice_gathering_state), NULL);
-  g_signal_connect(webrtc, "notify::ice-connection-state", G_CALLBACK(vtx_webrtc_notify_ice_connection_state), NULL);
+  // A receiver that reconnects replaces its previous webrtcbin
+  vtx_pipeline_remove_viewer(viewer_id);
 
-  // set state
-  if (gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+  GstElement *viewer = vtx_pipeline_make_webrtcbin(params, error_msg);
+  if (!viewer) return FALSE;
+  gst_object_ref_sink(viewer);
+
+  gchar *name = g_strdup_printf("webrtcbin_%s", viewer_id);
+  gst_object_set_name(GST_OBJECT(viewer), name);
+  g_free(name);
+  g_object_set_data_full(G_OBJECT(viewer), VTX_WEBRTC_VIEWER_ID, g_strdup(viewer_id), g_free);
+
+  if (!vtx_standby_attach(g_standby, viewer, viewer_id))
   {
-    if (error_msg) *error_msg = g_strdup("Failed to set pipeline state to PLAYING");
+    if (error_msg) *error_msg = g_strdup("Failed to link standby media to webrtcbin");
+    gst_object_unref(viewer);
     return FALSE;
   }
 
-  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
-  gst_bus_add_watch(bus, on_bus_message, NULL);
-  gst_object_unref(bus);
+  vtx_pipeline_connect_webrtc(viewer, params, FALSE);
+  vtx_pipeline_watch_first_frame(viewer, start_us, TRUE);
+  vtx_standby_activate(g_standby, viewer);
 
+  // The standby pipeline and the peer hold it from here
+  gst_object_unref(viewer);
   return TRUE;
 }
+
+// Detaches an additional viewer from the shared pipeline; the other viewers are not interrupted.
+void vtx_pipeline_remove_viewer(const gchar *viewer_id)
+{
+  GstElement *viewer = vtx_pipeline_find_viewer(viewer_id);
+  if (!viewer) return;
+
+  vtx_standby_detach(g_standby, viewer);
+  vtx_pipeline_release_standby();
+}
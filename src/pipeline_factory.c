@@ -1,7 +1,19 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "headers/codec_branch.h"
+#include "headers/dvr.h"
+#include "headers/fallback.h"
+#include "headers/graph.h"
+#include "headers/netmon.h"
+#include "headers/pacer.h"
 #include "headers/pipeline.h"
+#include "headers/recorder.h"
+#include "headers/scene.h"
+#include "headers/standby.h"
+#include "headers/svc.h"
+#include "headers/tap.h"
+#include "headers/watchdog.h"
 
 // Prints a GStreamer pipeline description with newlines inserted after each element delimiter for readability.
 static void vtx_pipeline_print_pretty(const char *desc)
@@ -65,11 +77,50 @@ static gchar *vtx_pipeline_sanitize_description(const gchar *desc)
   return sanitized;
 }
 
+// Maps the "output" media param to its mode; a missing value selects WebRTC.
+static gboolean vtx_pipeline_parse_output(const gchar *name, OutputMode *mode)
+{
+  if (!name || g_strcmp0(name, "webrtc") == 0)
+  {
+    *mode = OUTPUT_WEBRTC;
+  }
+  else if (g_strcmp0(name, "rtp") == 0)
+  {
+    *mode = OUTPUT_RTP;
+  }
+  else if (g_strcmp0(name, "srt") == 0)
+  {
+    *mode = OUTPUT_SRT;
+  }
+  else
+  {
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Returns the name of an output mode for logs and stats.
+static const gchar *vtx_pipeline_output_to_string(OutputMode mode)
+{
+  switch (mode)
+  {
+    case OUTPUT_RTP:
+      return "rtp";
+    case OUTPUT_SRT:
+      return "srt";
+    default:
+      return "webrtc";
+  }
+}
+
 // Parses a JSON object from the signaling message into a MediaParams struct and logs the result.
 gboolean vtx_pipeline_parse_media_params(JsonObject *o, MediaParams *p)
 {
-  p->video_pipeline = json_object_get_string_member(o, "video_pipeline");
+  p->video_pipeline = json_object_has_member(o, "video_pipeline") ? json_object_get_string_member(o, "video_pipeline") : NULL;
+  p->video_source_pipeline = json_object_has_member(o, "video_source_pipeline") ? json_object_get_string_member(o, "video_source_pipeline") : NULL;
   p->audio_pipeline = json_object_get_string_member(o, "audio_pipeline");
+  p->video_graph = json_object_has_member(o, "video_graph") ? json_object_get_member(o, "video_graph") : NULL;
+  p->audio_graph = json_object_has_member(o, "audio_graph") ? json_object_get_member(o, "audio_graph") : NULL;
   p->video_priority = json_object_get_string_member(o, "video_priority");
   p->audio_priority = json_object_get_string_member(o, "audio_priority");
   p->video_payload_type = json_object_get_int_member(o, "video_payload_type");
@@ -78,115 +129,256 @@ gboolean vtx_pipeline_parse_media_params(JsonObject *o, MediaParams *p)
   p->network_interface = json_object_has_member(o, "network_interface") ? json_object_get_string_member(o, "network_interface") : NULL;
   p->video_profile = json_object_has_member(o, "video_profile") ? json_object_get_string_member(o, "video_profile") : NULL;
   p->flight_controller = json_object_has_member(o, "flight_controller") ? json_object_get_string_member(o, "flight_controller") : NULL;
+  p->camera_controls = json_object_has_member(o, "camera_controls") ? json_object_get_object_member(o, "camera_controls") : NULL;
+  p->pacing = json_object_has_member(o, "pacing") ? json_object_get_boolean_member(o, "pacing") : FALSE;
+  gint64 pacing_headroom_percent = json_object_has_member(o, "pacing_headroom_percent") ? json_object_get_int_member(o, "pacing_headroom_percent") : PACER_DEFAULT_HEADROOM_PERCENT;
+  gint64 pacing_max_delay_ms = json_object_has_member(o, "pacing_max_delay_ms") ? json_object_get_int_member(o, "pacing_max_delay_ms") : PACER_DEFAULT_MAX_DELAY_MS;
+  gint64 slices = json_object_has_member(o, "slices") ? json_object_get_int_member(o, "slices") : 0;
+  p->scene_rate_control = json_object_has_member(o, "scene_rate_control") ? json_object_get_boolean_member(o, "scene_rate_control") : FALSE;
+  gint64 max_bitrate_kbps = json_object_has_member(o, "max_bitrate_kbps") ? json_object_get_int_member(o, "max_bitrate_kbps") : 0;
+  gint64 min_bitrate_percent = json_object_has_member(o, "min_bitrate_percent") ? json_object_get_int_member(o, "min_bitrate_percent") : SCENE_DEFAULT_MIN_BITRATE_PERCENT;
+  p->warm_standby = json_object_has_member(o, "warm_standby") ? json_object_get_boolean_member(o, "warm_standby") : FALSE;
+  gint64 ice_batch_ms = json_object_has_member(o, "ice_batch_ms") ? json_object_get_int_member(o, "ice_batch_ms") : 0;
+  p->temporal_layers = vtx_svc_parse_scalability_mode(json_object_has_member(o, "scalability_mode") ? json_object_get_string_member(o, "scalability_mode") : NULL);
+  p->output_host = json_object_has_member(o, "output_host") ? json_object_get_string_member(o, "output_host") : NULL;
+  gint64 output_port = json_object_has_member(o, "output_port") ? json_object_get_int_member(o, "output_port") : OUTPUT_DEFAULT_PORT;
+  p->srtp_key = json_object_has_member(o, "srtp_key") ? json_object_get_string_member(o, "srtp_key") : NULL;
+  p->srt_mode = json_object_has_member(o, "srt_mode") ? json_object_get_string_member(o, "srt_mode") : "caller";
+  p->srt_latency_ms = json_object_has_member(o, "srt_latency_ms") ? json_object_get_int_member(o, "srt_latency_ms") : OUTPUT_SRT_DEFAULT_LATENCY_MS;
+  p->srt_passphrase = json_object_has_member(o, "srt_passphrase") ? json_object_get_string_member(o, "srt_passphrase") : NULL;
+  p->tap_dir = json_object_has_member(o, "tap_dir") ? json_object_get_string_member(o, "tap_dir") : NULL;
+  p->tap_raw = json_object_has_member(o, "tap_raw") ? json_object_get_boolean_member(o, "tap_raw") : FALSE;
+  gint64 tap_queue_frames = json_object_has_member(o, "tap_queue_frames") ? json_object_get_int_member(o, "tap_queue_frames") : TAP_DEFAULT_QUEUE_FRAMES;
+  p->record_dir = json_object_has_member(o, "record_dir") ? json_object_get_string_member(o, "record_dir") : NULL;
+  p->record_format = json_object_has_member(o, "record_format") ? json_object_get_string_member(o, "record_format") : RECORD_DEFAULT_FORMAT;
+  p->record_segment_s = json_object_has_member(o, "record_segment_s") ? json_object_get_int_member(o, "record_segment_s") : RECORD_DEFAULT_SEGMENT_S;
+  p->record_segment_mb = json_object_has_member(o, "record_segment_mb") ? json_object_get_int_member(o, "record_segment_mb") : 0;
+  p->record_encoder = json_object_has_member(o, "record_encoder") ? json_object_get_string_member(o, "record_encoder") : NULL;
+  gint64 dvr_seconds = json_object_has_member(o, "dvr_seconds") ? json_object_get_int_member(o, "dvr_seconds") : 0;
+  gint64 dvr_memory_mb = json_object_has_member(o, "dvr_memory_mb") ? json_object_get_int_member(o, "dvr_memory_mb") : DVR_DEFAULT_MEMORY_MB;
+  p->dvr_dir = json_object_has_member(o, "dvr_dir") ? json_object_get_string_member(o, "dvr_dir") : DVR_DEFAULT_DIR;
+  gint64 dvr_trigger_flags = json_object_has_member(o, "dvr_trigger_flags") ? json_object_get_int_member(o, "dvr_trigger_flags") : DVR_DEFAULT_TRIGGER_FLAGS;
+  p->dvr_flush_on_disarm = json_object_has_member(o, "dvr_flush_on_disarm") ? json_object_get_boolean_member(o, "dvr_flush_on_disarm") : FALSE;
+  p->fallback_source = vtx_fallback_parse_source(json_object_has_member(o, "fallback_source") ? json_object_get_string_member(o, "fallback_source") : NULL);
+  p->fallback_timeout_ms = json_object_has_member(o, "fallback_timeout_ms") ? json_object_get_int_member(o, "fallback_timeout_ms") : FALLBACK_DEFAULT_TIMEOUT_MS;
+  p->encoder_failover = json_object_has_member(o, "encoder_failover") ? json_object_get_boolean_member(o, "encoder_failover") : TRUE;
+  gint64 watchdog_stall_frames = json_object_has_member(o, "watchdog_stall_frames") ? json_object_get_int_member(o, "watchdog_stall_frames") : WATCHDOG_DEFAULT_STALL_FRAMES;
+
+  if (pacing_headroom_percent < 0 || pacing_headroom_percent > G_MAXINT || pacing_max_delay_ms < 0 || pacing_max_delay_ms > G_MAXINT)
+  {
+    gst_printerrln("Invalid pacing_headroom_percent or pacing_max_delay_ms");
+    return FALSE;
+  }
+  p->pacing_headroom_percent = pacing_headroom_percent;
+  p->pacing_max_delay_ms = pacing_max_delay_ms;
+
+  if (slices < 0 || slices > G_MAXINT)
+  {
+    gst_printerrln("Invalid slices");
+    return FALSE;
+  }
+  p->slices = slices;
+
+  if (max_bitrate_kbps < 0 || max_bitrate_kbps > G_MAXINT || min_bitrate_percent < 0 || min_bitrate_percent > 100)
+  {
+    gst_printerrln("Invalid max_bitrate_kbps or min_bitrate_percent (0-100)");
+    return FALSE;
+  }
+  p->max_bitrate_kbps = max_bitrate_kbps;
+  p->min_bitrate_percent = min_bitrate_percent;
+
+  if (ice_batch_ms < 0)
+  {
+    gst_printerrln("Invalid ice_batch_ms");
+    return FALSE;
+  }
+  p->ice_batch_ms = MIN(ice_batch_ms, ICE_BATCH_MAX_MS);
+
+  const gchar *output = json_object_has_member(o, "output") ? json_object_get_string_member(o, "output") : NULL;
+  if (!vtx_pipeline_parse_output(output, &p->output))
+  {
+    gst_printerrln("Unknown output mode: %s", output);
+    return FALSE;
+  }
+
+  // RTP output also sends on output_port + 1 to + 3
+  gint64 max_port = p->output == OUTPUT_RTP ? G_MAXUINT16 - 3 : G_MAXUINT16;
+  if (output_port < 1 || output_port > max_port)
+  {
+    gst_printerrln("Invalid output_port (1-%" G_GINT64_FORMAT ")", max_port);
+    return FALSE;
+  }
+  p->output_port = output_port;
+
+  if (tap_queue_frames < 0 || tap_queue_frames > TAP_MAX_QUEUE_FRAMES)
+  {
+    gst_printerrln("Invalid tap_queue_frames (0-%d)", TAP_MAX_QUEUE_FRAMES);
+    return FALSE;
+  }
+  p->tap_queue_frames = tap_queue_frames;
+
+  if (dvr_seconds < 0 || dvr_seconds > G_MAXINT || dvr_memory_mb < 0 || dvr_memory_mb > G_MAXINT || dvr_trigger_flags < 0 || dvr_trigger_flags > G_MAXUINT32)
+  {
+    gst_printerrln("Invalid dvr_seconds, dvr_memory_mb or dvr_trigger_flags");
+    return FALSE;
+  }
+  p->dvr_seconds = dvr_seconds;
+  p->dvr_memory_mb = dvr_memory_mb;
+  p->dvr_trigger_flags = dvr_trigger_flags;
+
+  if (watchdog_stall_frames < 0 || watchdog_stall_frames > G_MAXINT)
+  {
+    gst_printerrln("Invalid watchdog_stall_frames");
+    return FALSE;
+  }
+  p->watchdog_stall_frames = watchdog_stall_frames;
+
+  gchar *tracks_error = NULL;
+  JsonArray *tracks = json_object_has_member(o, "video_tracks") ? json_object_get_array_member(o, "video_tracks") : NULL;
+  if (!vtx_tracks_parse(tracks, p->video_tracks, &p->n_video_tracks, &p->main_bitrate_share, &tracks_error))
+  {
+    gst_printerrln("%s", tracks_error);
+    g_free(tracks_error);
+    return FALSE;
+  }
 
   gst_println("=== MediaParams parsed ===\n");
   gst_println("MediaParams {");
   gst_println("  video_pipeline: %s", p->video_pipeline ? p->video_pipeline : "NULL");
+  gst_println("  video_source_pipeline: %s", p->video_source_pipeline ? p->video_source_pipeline : "NULL");
   gst_println("  audio_pipeline: %s", p->audio_pipeline ? p->audio_pipeline : "NULL");
+  gst_println("  graph: video %s, audio %s", p->video_graph ? "yes" : "no", p->audio_graph ? "yes" : "no");
   gst_println("  video_priority: %s", p->video_priority ? p->video_priority : "NULL");
   gst_println("  audio_priority: %s", p->audio_priority ? p->audio_priority : "NULL");
+  for (guint i = 0; i < p->n_video_tracks; i++)
+  {
+    gst_println("  video_track %s: %s (priority %s, %u%% of the bitrate)", p->video_tracks[i].name, p->video_tracks[i].pipeline, p->video_tracks[i].priority ? p->video_tracks[i].priority : "NULL", p->video_tracks[i].bitrate_share);
+  }
   gst_println("  video_payload_type: %u", p->video_payload_type);
   gst_println("  audio_payload_type: %u", p->audio_payload_type);
   gst_println("  platform: %d", p->platform);
   gst_println("  network_interface: %s", p->network_interface ? p->network_interface : "NULL");
   gst_println("  video_profile: %s", p->video_profile ? p->video_profile : "NULL");
   gst_println("  flight_controller: %s", p->flight_controller ? p->flight_controller : "NULL");
+  gst_println("  camera_controls: %u", p->camera_controls ? json_object_get_size(p->camera_controls) : 0);
+  gst_println("  pacing: %s (headroom %u%%, max delay %u ms)", p->pacing ? "on" : "off", p->pacing_headroom_percent, p->pacing_max_delay_ms);
+  gst_println("  scalability_mode: L1T%u", p->temporal_layers);
+  gst_println("  slices: %u", p->slices);
+  gst_println("  scene_rate_control: %s (max %u kbps, min %u%%)", p->scene_rate_control ? "on" : "off", p->max_bitrate_kbps, p->min_bitrate_percent);
+  gst_println("  warm_standby: %s", p->warm_standby ? "on" : "off");
+  gst_println("  ice_batch_ms: %u%s", p->ice_batch_ms, p->ice_batch_ms ? "" : " (one message per candidate)");
+  if (p->output != OUTPUT_WEBRTC)
+  {
+    gst_println("  output: %s to %s:%u%s", vtx_pipeline_output_to_string(p->output), p->output_host ? p->output_host : "*", p->output_port, p->output == OUTPUT_RTP && p->srtp_key ? " (SRTP)" : "");
+  }
+  if (p->tap_dir)
+  {
+    gst_println("  tap: %s (%s, queue %u frames)", p->tap_dir, p->tap_raw ? "encoded and raw" : "encoded", p->tap_queue_frames);
+  }
+  if (p->record_dir)
+  {
+    gst_println("  record: %s (%s, %u s / %u MB segments, %s)", p->record_dir, p->record_format, p->record_segment_s, p->record_segment_mb, p->record_encoder ? p->record_encoder : "live encoded stream");
+  }
+  if (p->dvr_seconds)
+  {
+    gst_println("  dvr: %u s, %u MB, %s (trigger flags 0x%x%s)", p->dvr_seconds, p->dvr_memory_mb, p->dvr_dir, p->dvr_trigger_flags, p->dvr_flush_on_disarm ? ", on disarm" : "");
+  }
+  if (p->fallback_source != FALLBACK_SOURCE_NONE)
+  {
+    gst_println("  fallback_source: %s after %u ms", p->fallback_source == FALLBACK_SOURCE_PATTERN ? "pattern" : "freeze", p->fallback_timeout_ms);
+  }
+  gst_println("  encoder_failover: %s", p->encoder_failover ? "on" : "off");
+  gst_println("  watchdog_stall_frames: %u%s", p->watchdog_stall_frames, p->watchdog_stall_frames ? "" : " (watchdog off)");
   gst_println("}\n");
 
   return TRUE;
 }
 
-// Constructs and returns a GStreamer pipeline with webrtcbin, using a custom ICE agent when a network interface is specified.
-GstElement *vtx_pipeline_build(const MediaParams *p, gchar **error_msg)
+// Fills priorities with the DSCP priority of each transceiver in link order (video, audio, additional video tracks) and
+// returns their number.
+guint vtx_pipeline_get_transceiver_priorities(const MediaParams *p, const gchar **priorities)
 {
-  GstElement *pipeline = NULL;
-  GstElement *webrtc = NULL;
-  GError *error = NULL;
+  gboolean graph = p->video_graph || p->audio_graph;
+  guint n = 0;
 
-  // Set camera H264 profile based on browser support
-  if (p->video_profile)
+  if (graph ? p->video_graph != NULL : p->video_pipeline || p->video_source_pipeline) priorities[n++] = p->video_priority;
+  if (graph ? p->audio_graph != NULL : p->audio_pipeline != NULL) priorities[n++] = p->audio_priority;
+  for (guint i = 0; i < p->n_video_tracks; i++)
   {
-    gint profile_value = -1;
-    if (g_strcmp0(p->video_profile, "high") == 0)
-      profile_value = 4;
-    else if (g_strcmp0(p->video_profile, "main") == 0)
-      profile_value = 2;
-    else if (g_strcmp0(p->video_profile, "constrained-baseline") == 0)
-      profile_value = 1;
-    else if (g_strcmp0(p->video_profile, "baseline") == 0)
-      profile_value = 0;
+    priorities[n++] = p->video_tracks[i].priority;
+  }
+  return n;
+}
 
-    if (profile_value >= 0)
-    {
-      gchar *cmd = g_strdup_printf("v4l2-ctl -d /dev/video0 --set-ctrl h264_profile=%d", profile_value);
-      gst_println("Setting camera H264 profile: %s (value=%d)", p->video_profile, profile_value);
-      gst_println("Executing: %s", cmd);
+// Creates a webrtcbin named "webrtcbin", with the custom ICE agent bound to the network interface when one is specified.
+GstElement *vtx_pipeline_make_webrtcbin(const MediaParams *p, gchar **error_msg)
+{
+  if (!p->network_interface)
+  {
+    return gst_element_factory_make_full("webrtcbin", "name", "webrtcbin", "latency", 0, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+  }
 
-      gint exit_status;
-      GError *exec_error = NULL;
-      if (!g_spawn_command_line_sync(cmd, NULL, NULL, &exit_status, &exec_error))
-      {
-        gst_printerrln("Failed to execute v4l2-ctl: %s", exec_error ? exec_error->message : "unknown");
-        g_clear_error(&exec_error);
-      }
-      else if (exit_status != 0)
-      {
-        gst_printerrln("v4l2-ctl returned non-zero exit status: %d", exit_status);
-      }
-      else
-      {
-        gst_println("Successfully set camera H264 profile to %s", p->video_profile);
-      }
+  gst_println("=== Creating WebRTC with custom ICE agent for interface: %s ===\n", p->network_interface);
 
-      g_free(cmd);
-    }
-  }
+  GstWebRTCICE *agent = GST_WEBRTC_ICE(customice_agent_new("ice-agent", p->network_interface));
 
-  // If network interface is specified, use custom ICE agent
-  if (p->network_interface)
+  if (!agent || !GST_IS_WEBRTC_ICE(agent))
   {
-    gst_println("=== Creating WebRTC with custom ICE agent for interface: %s ===\n", p->network_interface);
+    gst_printerrln("Failed to create valid CustomICEAgent as GstWebRTCICE");
+    if (error_msg) *error_msg = g_strdup("Failed to create custom ICE agent for network interface");
+    return NULL;
+  }
 
-    GstWebRTCICE *agent = GST_WEBRTC_ICE(customice_agent_new("ice-agent", p->network_interface));
+  gst_println("CustomICEAgent cast to GstWebRTCICE succeeded\n");
 
-    if (!agent || !GST_IS_WEBRTC_ICE(agent))
-    {
-      gst_printerrln("Failed to create valid CustomICEAgent as GstWebRTCICE");
-      if (error_msg) *error_msg = g_strdup("Failed to create custom ICE agent for network interface");
-      return NULL;
-    }
+  // webrtc = gst_element_factory_make_full("webrtcbin", "name", "webrtcbin", "latency", 0, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, "stun-server", STUN_SERVER, "ice-agent", agent, NULL);
+  GstElement *webrtc = gst_element_factory_make_full("webrtcbin", "name", "webrtcbin", "latency", 0, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, "ice-agent", agent, NULL);
 
-    gst_println("CustomICEAgent cast to GstWebRTCICE succeeded\n");
+  if (webrtc)
+  {
+    // Keep CustomICEAgent alive for the lifetime of webrtcbin even if the
+    // construct-only property does not hold its own reference.
+    g_object_set_data_full(G_OBJECT(webrtc), "custom-ice-agent", g_object_ref(agent), (GDestroyNotify) g_object_unref);
 
-    // webrtc = gst_element_factory_make_full("webrtcbin", "name", "webrtcbin", "latency", 0, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, "stun-server", STUN_SERVER, "ice-agent", agent, NULL);
-    webrtc = gst_element_factory_make_full("webrtcbin", "name", "webrtcbin", "latency", 0, "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, "ice-agent", agent, NULL);
+    // A path the agent cannot switch away from on a checked pair is recovered with an ICE restart
+    g_signal_connect_object(agent, "path-restart", G_CALLBACK(vtx_netmon_on_path_restart), webrtc, 0);
+  }
+  g_object_unref(agent);
 
-    if (webrtc)
-    {
-      // Keep CustomICEAgent alive for the lifetime of webrtcbin even if the
-      // construct-only property does not hold its own reference.
-      g_object_set_data_full(G_OBJECT(webrtc), "custom-ice-agent", g_object_ref(agent), (GDestroyNotify) g_object_unref);
-    }
-    g_object_unref(agent);
+  if (!webrtc)
+  {
+    gst_printerrln("Failed to create webrtcbin with custom ICE agent");
+    if (error_msg) *error_msg = g_strdup("Failed to create webrtcbin with custom ICE agent");
+    return NULL;
+  }
 
-    if (!webrtc)
-    {
-      gst_printerrln("Failed to create webrtcbin with custom ICE agent");
-      if (error_msg) *error_msg = g_strdup("Failed to create webrtcbin with custom ICE agent");
-      return NULL;
-    }
+  return webrtc;
+}
+
+// Constructs and returns a GStreamer pipeline with webrtcbin, using a custom ICE agent when a network interface is specified.
+static GstElement *vtx_pipeline_build_with_video(const MediaParams *p, const gchar *video_pipeline, gchar **error_msg)
+{
+  GstElement *pipeline = NULL;
+  GstElement *webrtc = NULL;
+  GError *error = NULL;
+
+  // If network interface is specified, use custom ICE agent
+  if (p->network_interface)
+  {
+    webrtc = vtx_pipeline_make_webrtcbin(p, error_msg);
+    if (!webrtc) return NULL;
 
     pipeline = gst_pipeline_new("pipeline");
     gst_bin_add(GST_BIN(pipeline), webrtc);
 
-    if (p->video_pipeline)
+    if (video_pipeline)
     {
       gst_println("=== Video Pipeline description ===\n");
-      vtx_pipeline_print_pretty(p->video_pipeline);
+      vtx_pipeline_print_pretty(video_pipeline);
       gst_println("\n");
 
       // Sanitize the pipeline description to remove trailing caps
-      gchar *sanitized_video = vtx_pipeline_sanitize_description(p->video_pipeline);
+      gchar *sanitized_video = vtx_pipeline_sanitize_description(video_pipeline);
 
       GstElement *video_bin = gst_parse_bin_from_description(sanitized_video, TRUE, &error);
       g_free(sanitized_video);
@@ -254,20 +446,20 @@ GstElement *vtx_pipeline_build(const MediaParams *p, gchar **error_msg)
 
     // "webrtcbin name=webrtcbin latency=0 bundle-policy=max-bundle stun-server=stun://stun.l.google.com:19302 "
 
-    if (p->video_pipeline && p->audio_pipeline)
+    if (video_pipeline && p->audio_pipeline)
     {
       desc = g_strdup_printf(
           "webrtcbin name=webrtcbin latency=0 bundle-policy=max-bundle "
           "%s ! webrtcbin. "
           "%s ! webrtcbin.",
-          p->video_pipeline, p->audio_pipeline);
+          video_pipeline, p->audio_pipeline);
     }
-    else if (p->video_pipeline)
+    else if (video_pipeline)
     {
       desc = g_strdup_printf(
           "webrtcbin name=webrtcbin latency=0 bundle-policy=max-bundle "
           "%s ! webrtcbin.",
-          p->video_pipeline);
+          video_pipeline);
     }
     else if (p->audio_pipeline)
     {
@@ -299,3 +491,306 @@ GstElement *vtx_pipeline_build(const MediaParams *p, gchar **error_msg)
     return pipeline;
   }
 }
+
+// Instantiates the JSON media graphs into a new pipeline and returns the chain tails for the caller to link. The graph
+// (and its element handles) becomes g_graph.
+static GstElement *vtx_pipeline_build_graph(const MediaParams *p, GstElement **video_tail, GstElement **audio_tail, gchar **error_msg)
+{
+  gchar *problem = NULL;
+
+  vtx_graph_free(g_graph);
+  g_graph = vtx_graph_parse(p->video_graph, p->audio_graph, &problem);
+
+  GstElement *pipeline = gst_pipeline_new("pipeline");
+  if (g_graph && vtx_graph_build(g_graph, GST_BIN(pipeline), video_tail, audio_tail, &problem)) return pipeline;
+
+  gst_printerrln("Graph error: %s", problem);
+  if (error_msg) *error_msg = g_strdup_printf("Graph error: %s", problem);
+  g_free(problem);
+  gst_object_unref(pipeline);
+  vtx_graph_free(g_graph);
+  g_graph = NULL;
+  return NULL;
+}
+
+// Builds the session pipeline from the media graphs, linking each chain tail to a webrtcbin request pad.
+static GstElement *vtx_pipeline_build_from_graph(const MediaParams *p, gchar **error_msg)
+{
+  GstElement *tails[2];
+  GstElement *pipeline = vtx_pipeline_build_graph(p, &tails[0], &tails[1], error_msg);
+  if (!pipeline) return NULL;
+
+  GstElement *webrtc = vtx_pipeline_make_webrtcbin(p, error_msg);
+  if (!webrtc)
+  {
+    gst_object_unref(pipeline);
+    vtx_graph_free(g_graph);
+    g_graph = NULL;
+    return NULL;
+  }
+  gst_bin_add(GST_BIN(pipeline), webrtc);
+
+  for (guint i = 0; i < G_N_ELEMENTS(tails); i++)
+  {
+    // webrtcbin has on-request sink pads (sink_%u), so we must use gst_element_link_pads
+    if (tails[i] && !gst_element_link_pads(tails[i], NULL, webrtc, "sink_%u"))
+    {
+      gst_printerrln("Failed to link %s to webrtcbin", GST_OBJECT_NAME(tails[i]));
+      if (error_msg) *error_msg = g_strdup_printf("Failed to link %s to webrtcbin", GST_OBJECT_NAME(tails[i]));
+      gst_object_unref(pipeline);
+      vtx_graph_free(g_graph);
+      g_graph = NULL;
+      return NULL;
+    }
+  }
+
+  return pipeline;
+}
+
+// Returns the media param of a hook that binds to one encoder or to videopay when the pipeline is built, and so cannot follow
+// the branch the viewer's answer selects in a multi-codec offer; NULL if none is enabled.
+static const gchar *vtx_pipeline_multi_codec_conflict(const MediaParams *p)
+{
+  if (p->pacing) return "pacing";
+  if (p->temporal_layers > 1) return "scalability_mode";
+  if (p->scene_rate_control) return "scene_rate_control";
+  if (p->slices > 1) return "slices";
+  if (p->dvr_seconds) return "dvr_seconds";
+  if (p->tap_dir) return "tap_dir";
+  if (p->record_dir) return "record_dir";
+  return NULL;
+}
+
+// Builds the session pipeline; with video_source_pipeline set, the video side is a multi-codec encoder branch set.
+GstElement *vtx_pipeline_build(const MediaParams *p, gchar **error_msg)
+{
+  if (p->video_graph || p->audio_graph) return vtx_pipeline_build_from_graph(p, error_msg);
+  if (!p->video_source_pipeline) return vtx_pipeline_build_with_video(p, p->video_pipeline, error_msg);
+
+  const gchar *conflict = vtx_pipeline_multi_codec_conflict(p);
+  if (conflict)
+  {
+    gst_printerrln("%s is not supported with the multi-codec offer (video_source_pipeline)", conflict);
+    if (error_msg) *error_msg = g_strdup_printf("%s is not supported with the multi-codec offer (video_source_pipeline)", conflict);
+    return NULL;
+  }
+
+  gchar *video_pipeline = vtx_codec_branch_describe(p->video_source_pipeline, p->video_payload_type, p->audio_payload_type);
+  if (!video_pipeline)
+  {
+    if (error_msg) *error_msg = g_strdup("No video encoder available for multi-codec offer");
+    return NULL;
+  }
+
+  GstElement *pipeline = vtx_pipeline_build_with_video(p, video_pipeline, error_msg);
+  g_free(video_pipeline);
+  return pipeline;
+}
+
+// Ends a media chain in a standby tee whose permanent branch is an idle leaky queue and fakesink.
+gboolean vtx_pipeline_add_standby_tee(GstBin *bin, GstElement *tail, const gchar *tee_name)
+{
+  GstElement *tee = gst_element_factory_make_full("tee", "name", tee_name, "allow-not-linked", TRUE, NULL);
+  GstElement *queue = gst_element_factory_make_full("queue", "max-size-buffers", 1, NULL);
+  GstElement *sink = gst_element_factory_make_full("fakesink", "sync", FALSE, "async", FALSE, NULL);
+  gst_util_set_object_arg(G_OBJECT(queue), "leaky", "downstream");
+
+  gst_bin_add_many(bin, tee, queue, sink, NULL);
+  return gst_element_link_many(tail, tee, queue, sink, NULL);
+}
+
+// Builds the warm-standby pipeline: capture and encoding run continuously into tees whose only permanent branch is an
+// idle fakesink. Sessions later add their own webrtcbin on a tee request pad.
+GstElement *vtx_pipeline_build_standby(const MediaParams *p, gchar **error_msg)
+{
+  GError *error = NULL;
+
+  if (p->video_graph || p->audio_graph)
+  {
+    GstElement *tails[2];
+    const gchar *tees[] = {STANDBY_VIDEO_TEE, STANDBY_AUDIO_TEE};
+    GstElement *pipeline = vtx_pipeline_build_graph(p, &tails[0], &tails[1], error_msg);
+    if (!pipeline) return NULL;
+
+    for (guint i = 0; i < G_N_ELEMENTS(tails); i++)
+    {
+      if (tails[i] && !vtx_pipeline_add_standby_tee(GST_BIN(pipeline), tails[i], tees[i]))
+      {
+        gst_printerrln("Failed to link %s to the standby tee", GST_OBJECT_NAME(tails[i]));
+        if (error_msg) *error_msg = g_strdup_printf("Failed to link %s to the standby tee", GST_OBJECT_NAME(tails[i]));
+        gst_object_unref(pipeline);
+        vtx_graph_free(g_graph);
+        g_graph = NULL;
+        return NULL;
+      }
+    }
+    return pipeline;
+  }
+
+  if (!p->video_pipeline && !p->audio_pipeline)
+  {
+    if (error_msg) *error_msg = g_strdup("No video or audio pipeline specified");
+    return NULL;
+  }
+
+  GString *desc = g_string_new(NULL);
+  if (p->video_pipeline)
+  {
+    g_string_append_printf(desc, "%s ! tee name=%s allow-not-linked=true %s. ! queue leaky=downstream max-size-buffers=1 ! fakesink sync=false async=false ", p->video_pipeline, STANDBY_VIDEO_TEE, STANDBY_VIDEO_TEE);
+  }
+  if (p->audio_pipeline)
+  {
+    g_string_append_printf(desc, "%s ! tee name=%s allow-not-linked=true %s. ! queue leaky=downstream max-size-buffers=1 ! fakesink sync=false async=false ", p->audio_pipeline, STANDBY_AUDIO_TEE, STANDBY_AUDIO_TEE);
+  }
+
+  gst_println("=== Assembled standby pipeline ===\n");
+  gst_println("%s", desc->str);
+  gst_println("\n");
+
+  GstElement *pipeline = gst_parse_launch(desc->str, &error);
+  g_string_free(desc, TRUE);
+  if (error)
+  {
+    gst_printerrln("Standby pipeline parse error: %s", error->message);
+    if (error_msg) *error_msg = g_strdup_printf("Standby pipeline parse error: %s", error->message);
+    g_clear_error(&error);
+    if (pipeline) gst_object_unref(pipeline);
+    return NULL;
+  }
+
+  return pipeline;
+}
+
+// Converts the hex SRTP master key to the buffer srtpenc expects. Returns NULL unless it is a 30-byte AES-128 key and salt.
+static GstBuffer *vtx_pipeline_srtp_key_buffer(const gchar *hex)
+{
+  if (strlen(hex) != OUTPUT_SRTP_KEY_HEX_LENGTH) return NULL;
+
+  guint8 key[OUTPUT_SRTP_KEY_HEX_LENGTH / 2];
+  for (gsize i = 0; i < sizeof(key); i++)
+  {
+    gint high = g_ascii_xdigit_value(hex[2 * i]);
+    gint low = g_ascii_xdigit_value(hex[2 * i + 1]);
+    if (high < 0 || low < 0) return NULL;
+    key[i] = (guint8) (high << 4 | low);
+  }
+
+  return gst_buffer_new_memdup(key, sizeof(key));
+}
+
+// Builds a session pipeline without webrtcbin for a ground station on the local link. The same video/audio descriptions,
+// ending in their RTP payloaders, go out as plain RTP/RTCP through rtpbin (SRTP with a static key when srtp_key is set), or
+// as RTP packets in SRT messages.
+GstElement *vtx_pipeline_build_direct(const MediaParams *p, gchar **error_msg)
+{
+  const gchar *problem = NULL;
+  gboolean listener = g_strcmp0(p->srt_mode, "listener") == 0;
+
+  if (p->video_source_pipeline)
+  {
+    problem = "The multi-codec offer needs WebRTC negotiation, use video_pipeline for direct output";
+  }
+  else if (p->video_graph || p->audio_graph)
+  {
+    problem = "Media graphs are built for WebRTC sessions, use video_pipeline/audio_pipeline for direct output";
+  }
+  else if (p->n_video_tracks)
+  {
+    problem = "Additional video tracks need WebRTC transceivers, direct output carries one video stream";
+  }
+  else if (!p->video_pipeline && !p->audio_pipeline)
+  {
+    problem = "No video or audio pipeline specified";
+  }
+  else if (!p->output_host && (p->output == OUTPUT_RTP || !listener))
+  {
+    problem = "Direct output needs output_host";
+  }
+
+  GstBuffer *key = NULL;
+  if (!problem && p->output == OUTPUT_RTP && p->srtp_key)
+  {
+    key = vtx_pipeline_srtp_key_buffer(p->srtp_key);
+    if (!key) problem = "srtp_key must be 60 hex characters (AES-128 key and salt)";
+  }
+
+  if (problem)
+  {
+    gst_printerrln("%s", problem);
+    if (error_msg) *error_msg = g_strdup(problem);
+    return NULL;
+  }
+
+  const gchar *media[] = {p->video_pipeline, p->audio_pipeline};
+  GString *desc = g_string_new(NULL);
+
+  if (p->output == OUTPUT_RTP)
+  {
+    g_string_append(desc, key ? "rtpbin name=rtpbin srtpenc name=srtpenc " : "rtpbin name=rtpbin ");
+    for (guint i = 0; i < G_N_ELEMENTS(media); i++)
+    {
+      if (!media[i]) continue;
+
+      guint port = p->output_port + 2 * i;
+      g_string_append_printf(desc, "%s ! rtpbin.send_rtp_sink_%u ", media[i], i);
+      if (key)
+      {
+        g_string_append_printf(desc, "rtpbin.send_rtp_src_%u ! srtpenc.rtp_sink_%u srtpenc.rtp_src_%u ! udpsink host=%s port=%u sync=false async=false ", i, i, i, p->output_host, port);
+        g_string_append_printf(desc, "rtpbin.send_rtcp_src_%u ! srtpenc.rtcp_sink_%u srtpenc.rtcp_src_%u ! udpsink host=%s port=%u sync=false async=false ", i, i, i, p->output_host, port + 1);
+      }
+      else
+      {
+        g_string_append_printf(desc, "rtpbin.send_rtp_src_%u ! udpsink host=%s port=%u sync=false async=false ", i, p->output_host, port);
+        g_string_append_printf(desc, "rtpbin.send_rtcp_src_%u ! udpsink host=%s port=%u sync=false async=false ", i, p->output_host, port + 1);
+      }
+    }
+  }
+  else
+  {
+    // One SRT stream carries both tracks; rtpfunnel keeps their SSRCs apart for the receiver's rtpssrcdemux
+    g_string_append(desc, "rtpfunnel name=funnel ! srtsink name=srtsink sync=false async=false wait-for-connection=false ");
+    for (guint i = 0; i < G_N_ELEMENTS(media); i++)
+    {
+      if (media[i]) g_string_append_printf(desc, "%s ! funnel. ", media[i]);
+    }
+  }
+
+  gst_println("=== Assembled direct %s pipeline ===\n", vtx_pipeline_output_to_string(p->output));
+  gst_println("%s", desc->str);
+  gst_println("\n");
+
+  GError *error = NULL;
+  GstElement *pipeline = gst_parse_launch(desc->str, &error);
+  g_string_free(desc, TRUE);
+  if (error)
+  {
+    gst_printerrln("Direct pipeline parse error: %s", error->message);
+    if (error_msg) *error_msg = g_strdup_printf("Direct pipeline parse error: %s", error->message);
+    g_clear_error(&error);
+    if (pipeline) gst_object_unref(pipeline);
+    if (key) gst_buffer_unref(key);
+    return NULL;
+  }
+
+  // Key and passphrase are set on the elements rather than written into the description
+  if (key)
+  {
+    GstElement *srtpenc = gst_bin_get_by_name(GST_BIN(pipeline), "srtpenc");
+    g_object_set(srtpenc, "key", key, NULL);
+    gst_object_unref(srtpenc);
+    gst_buffer_unref(key);
+  }
+
+  if (p->output == OUTPUT_SRT)
+  {
+    GstElement *srtsink = gst_bin_get_by_name(GST_BIN(pipeline), "srtsink");
+    gchar *uri = g_strdup_printf("srt://%s:%u", p->output_host ? p->output_host : "", p->output_port);
+    g_object_set(srtsink, "uri", uri, "latency", (gint) p->srt_latency_ms, NULL);
+    gst_util_set_object_arg(G_OBJECT(srtsink), "mode", listener ? "listener" : "caller");
+    if (p->srt_passphrase) g_object_set(srtsink, "passphrase", p->srt_passphrase, NULL);
+    gst_object_unref(srtsink);
+    g_free(uri);
+  }
+
+  return pipeline;
+}
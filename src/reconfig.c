@@ -0,0 +1,524 @@
+#include "headers/reconfig.h"
+
+#include <gst/sdp/sdp.h>
+#include <gst/webrtc/webrtc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/common.h"
+#include "headers/encoder.h"
+#include "headers/pacer.h"
+#include "headers/scene.h"
+#include "headers/tracks.h"
+
+static const ReconfigH264Level s_h264_levels[] = {
+    {10, 1485, 99},       //
+    {11, 3000, 396},      //
+    {12, 6000, 396},      //
+    {13, 11880, 396},     //
+    {20, 11880, 396},     //
+    {21, 19800, 792},     //
+    {22, 20250, 1620},    //
+    {30, 40500, 1620},    //
+    {31, 108000, 3600},   //
+    {32, 216000, 5120},   //
+    {40, 245760, 8192},   //
+    {41, 245760, 8192},   //
+    {42, 522240, 8704},   //
+    {50, 589824, 22080},  //
+    {51, 983040, 36864},  //
+    {52, 2073600, 36864}, //
+};
+
+// Switch-time statistics of one kind of caps change.
+typedef struct
+{
+  guint changes;
+  guint timeouts;
+  gdouble last_ms;
+  gdouble max_ms;
+} ReconfigSwitch;
+
+struct VtxReconfig
+{
+  GstElement *pipeline;
+  guint bitrate_kbps;  // last value set, 0 before the first SET_BITRATE
+  guint bitrate_changes;
+
+  // caps change in flight, measured on the encoder src pad (guarded by lock)
+  GMutex lock;
+  GstPad *probe_pad;
+  gulong probe_id;
+  guint timeout_id;
+  ReconfigSwitch *pending;
+  gint64 pending_start_us;
+  guint pending_width;  // 0 for a frame-rate change
+  guint pending_height;
+  guint pending_fps;    // 0 for a resolution change
+  gboolean pending_caps_seen;
+
+  ReconfigSwitch framerate;
+  ReconfigSwitch resolution;
+};
+
+VtxReconfig *g_reconfig = NULL;
+
+// Starts handling reconfiguration commands for the pipeline.
+VtxReconfig *vtx_reconfig_attach(GstElement *pipeline)
+{
+  VtxReconfig *reconfig = g_new0(VtxReconfig, 1);
+  g_mutex_init(&reconfig->lock);
+  reconfig->pipeline = gst_object_ref(pipeline);
+  return reconfig;
+}
+
+// Stops measuring a caps change. Must be called with the lock held.
+static void vtx_reconfig_clear_pending(VtxReconfig *reconfig)
+{
+  if (reconfig->probe_id) gst_pad_remove_probe(reconfig->probe_pad, reconfig->probe_id);
+  if (reconfig->probe_pad) gst_object_unref(reconfig->probe_pad);
+  if (reconfig->timeout_id) g_source_remove(reconfig->timeout_id);
+  reconfig->probe_pad = NULL;
+  reconfig->probe_id = 0;
+  reconfig->timeout_id = 0;
+  reconfig->pending = NULL;
+}
+
+// Frees the reconfiguration state. The pipeline must already be stopped.
+void vtx_reconfig_free(VtxReconfig *reconfig)
+{
+  if (!reconfig) return;
+
+  g_mutex_lock(&reconfig->lock);
+  vtx_reconfig_clear_pending(reconfig);
+  g_mutex_unlock(&reconfig->lock);
+  gst_object_unref(reconfig->pipeline);
+  g_mutex_clear(&reconfig->lock);
+  g_free(reconfig);
+}
+
+// Returns the element owning a pad, looking through ghost pads to the element they proxy.
+static GstElement *vtx_reconfig_pad_element(GstPad *pad)
+{
+  GstPad *target = gst_object_ref(pad);
+  while (GST_IS_GHOST_PAD(target))
+  {
+    GstPad *inner = gst_ghost_pad_get_target(GST_GHOST_PAD(target));
+    gst_object_unref(target);
+    if (!inner) return NULL;
+    target = inner;
+  }
+  GstElement *element = gst_pad_get_parent_element(target);
+  gst_object_unref(target);
+  return element;
+}
+
+// Returns the nearest capsfilter upstream of the element whose caps set the field, following the first sink pad of each
+// element (the source side of a fallback selector).
+static GstElement *vtx_reconfig_find_capsfilter(GstElement *element, const gchar *field)
+{
+  GstElement *current = gst_object_ref(element);
+  while (current)
+  {
+    GstPad *sink = NULL;
+    GValue item = G_VALUE_INIT;
+    GstIterator *it = gst_element_iterate_sink_pads(current);
+    if (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+      sink = g_value_dup_object(&item);
+      g_value_unset(&item);
+    }
+    gst_iterator_free(it);
+    gst_object_unref(current);
+    current = NULL;
+    if (!sink) break;
+
+    GstPad *peer = gst_pad_get_peer(sink);
+    gst_object_unref(sink);
+    if (!peer) break;
+    current = vtx_reconfig_pad_element(peer);
+    gst_object_unref(peer);
+    if (!current) break;
+
+    GstElementFactory *factory = gst_element_get_factory(current);
+    if (factory && g_strcmp0(gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(factory)), "capsfilter") == 0)
+    {
+      GstCaps *caps = NULL;
+      g_object_get(current, "caps", &caps, NULL);
+      gboolean match = caps && !gst_caps_is_any(caps) && gst_caps_get_size(caps) > 0 && gst_structure_has_field(gst_caps_get_structure(caps, 0), field);
+      if (caps) gst_caps_unref(caps);
+      if (match) return current;
+    }
+  }
+  return NULL;
+}
+
+// Returns the H.264 level the viewer answered for the video payload type, or NULL when there is no constraint to apply.
+static const ReconfigH264Level *vtx_reconfig_answered_h264_level(VtxReconfig *reconfig)
+{
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(reconfig->pipeline), "videopay");
+  if (!videopay || !webrtc)
+  {
+    if (videopay) gst_object_unref(videopay);
+    return NULL;
+  }
+  guint pt = 0;
+  g_object_get(videopay, "pt", &pt, NULL);
+  gst_object_unref(videopay);
+
+  GstWebRTCSessionDescription *answer = NULL;
+  g_object_get(webrtc, "remote-description", &answer, NULL);
+  if (!answer) return NULL;
+
+  const ReconfigH264Level *level = NULL;
+  for (guint i = 0; i < gst_sdp_message_medias_len(answer->sdp) && !level; i++)
+  {
+    const GstSDPMedia *media = gst_sdp_message_get_media(answer->sdp, i);
+    if (g_strcmp0(gst_sdp_media_get_media(media), "video") != 0) continue;
+
+    GstCaps *caps = gst_sdp_media_get_caps_from_media(media, pt);
+    if (!caps) continue;
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    const gchar *profile_level_id = gst_structure_get_string(s, "profile-level-id");
+    if (g_strcmp0(gst_structure_get_string(s, "encoding-name"), "H264") == 0 && profile_level_id && strlen(profile_level_id) == 6)
+    {
+      guint level_idc = strtoul(profile_level_id + 4, NULL, 16);
+      for (guint l = 0; l < G_N_ELEMENTS(s_h264_levels); l++)
+      {
+        if (s_h264_levels[l].level_idc == level_idc) level = &s_h264_levels[l];
+      }
+    }
+    gst_caps_unref(caps);
+  }
+  gst_webrtc_session_description_free(answer);
+  return level;
+}
+
+// Checks a frame size and rate against the answered H.264 level.
+static gboolean vtx_reconfig_check_level(VtxReconfig *reconfig, guint width, guint height, guint fps, gchar **error_msg)
+{
+  const ReconfigH264Level *level = vtx_reconfig_answered_h264_level(reconfig);
+  if (!level || !width || !height) return TRUE;
+
+  guint frame_mbs = ((width + 15) / 16) * ((height + 15) / 16);
+  if (frame_mbs > level->max_fs || (fps && (guint64) frame_mbs * fps > level->max_mbps))
+  {
+    if (error_msg) *error_msg = g_strdup_printf("%ux%u at %u fps exceeds the answered H.264 level %u.%u", width, height, fps, level->level_idc / 10, level->level_idc % 10);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Records the switch time once an encoded frame follows caps in the new format.
+static GstPadProbeReturn vtx_reconfig_on_encoder_src(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxReconfig *reconfig = user_data;
+  GstPadProbeReturn ret = GST_PAD_PROBE_OK;
+
+  g_mutex_lock(&reconfig->lock);
+  if (!reconfig->pending)
+  {
+    // already measured or timed out
+  }
+  else if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+    {
+      GstCaps *caps = NULL;
+      gint width = 0, height = 0, num = 0, den = 1;
+      gst_event_parse_caps(event, &caps);
+      const GstStructure *s = gst_caps_get_structure(caps, 0);
+      gst_structure_get_int(s, "width", &width);
+      gst_structure_get_int(s, "height", &height);
+      gst_structure_get_fraction(s, "framerate", &num, &den);
+      if (reconfig->pending_width)
+      {
+        reconfig->pending_caps_seen = (guint) width == reconfig->pending_width && (guint) height == reconfig->pending_height;
+      }
+      else
+      {
+        reconfig->pending_caps_seen = den > 0 && (guint) (num / den) == reconfig->pending_fps;
+      }
+    }
+  }
+  else if (reconfig->pending_caps_seen)
+  {
+    ReconfigSwitch *sw = reconfig->pending;
+    sw->last_ms = (g_get_monotonic_time() - reconfig->pending_start_us) / 1000.0;
+    if (sw->last_ms > sw->max_ms) sw->max_ms = sw->last_ms;
+    gst_println("Reconfiguration: %s switched in %.0f ms", sw == &reconfig->resolution ? "resolution" : "framerate", sw->last_ms);
+
+    // The timeout is removed from the main thread; only the probe ends here
+    reconfig->pending = NULL;
+    reconfig->probe_id = 0;
+    ret = GST_PAD_PROBE_REMOVE;
+  }
+  g_mutex_unlock(&reconfig->lock);
+  return ret;
+}
+
+// Gives up measuring a caps change that produced no frame in the new format.
+static gboolean vtx_reconfig_on_timeout(gpointer user_data)
+{
+  VtxReconfig *reconfig = user_data;
+
+  g_mutex_lock(&reconfig->lock);
+  reconfig->timeout_id = 0;
+  if (reconfig->pending)
+  {
+    reconfig->pending->timeouts++;
+    gst_printerrln("Reconfiguration: no frame in the new format after %u ms", RECONFIG_SWITCH_TIMEOUT_MS);
+  }
+  vtx_reconfig_clear_pending(reconfig);
+  g_mutex_unlock(&reconfig->lock);
+  return G_SOURCE_REMOVE;
+}
+
+// Starts measuring the time from now to the first encoded frame in the new format.
+static void vtx_reconfig_measure(VtxReconfig *reconfig, GstElement *encoder, ReconfigSwitch *sw, guint width, guint height, guint fps)
+{
+  g_mutex_lock(&reconfig->lock);
+  vtx_reconfig_clear_pending(reconfig);
+  sw->changes++;
+  reconfig->pending = sw;
+  reconfig->pending_start_us = g_get_monotonic_time();
+  reconfig->pending_width = width;
+  reconfig->pending_height = height;
+  reconfig->pending_fps = fps;
+  reconfig->pending_caps_seen = FALSE;
+  reconfig->probe_pad = gst_element_get_static_pad(encoder, "src");
+  if (reconfig->probe_pad)
+  {
+    reconfig->probe_id = gst_pad_add_probe(reconfig->probe_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_reconfig_on_encoder_src, reconfig, NULL);
+  }
+  reconfig->timeout_id = g_timeout_add(RECONFIG_SWITCH_TIMEOUT_MS, vtx_reconfig_on_timeout, reconfig);
+  g_mutex_unlock(&reconfig->lock);
+}
+
+// Sets the caps of a capsfilter after checking that its upstream can produce them and its downstream accepts them.
+static gboolean vtx_reconfig_apply_caps(GstElement *capsfilter, GstCaps *caps, gchar **error_msg)
+{
+  GstPad *sink = gst_element_get_static_pad(capsfilter, "sink");
+  GstPad *src = gst_element_get_static_pad(capsfilter, "src");
+  GstCaps *upstream = gst_pad_peer_query_caps(sink, caps);
+  GstCaps *downstream = gst_pad_peer_query_caps(src, caps);
+  gboolean possible = !gst_caps_is_empty(upstream) && !gst_caps_is_empty(downstream);
+  gst_caps_unref(upstream);
+  gst_caps_unref(downstream);
+  gst_object_unref(sink);
+  gst_object_unref(src);
+
+  if (!possible)
+  {
+    gchar *desc = gst_caps_to_string(caps);
+    if (error_msg) *error_msg = g_strdup_printf("%s is not supported by the pipeline around %s", desc, GST_OBJECT_NAME(capsfilter));
+    g_free(desc);
+    return FALSE;
+  }
+
+  // capsfilter sends a reconfigure event upstream, so the source or converter renegotiates
+  g_object_set(capsfilter, "caps", caps, NULL);
+  return TRUE;
+}
+
+// Returns the current output caps field of the encoder's input, or 0.
+static guint vtx_reconfig_current_int(GstElement *encoder, const gchar *field)
+{
+  GstPad *sink = gst_element_get_static_pad(encoder, "sink");
+  GstCaps *caps = sink ? gst_pad_get_current_caps(sink) : NULL;
+  gint value = 0;
+  if (caps)
+  {
+    const GstStructure *s = gst_caps_get_structure(caps, 0);
+    gint num = 0, den = 1;
+    if (g_strcmp0(field, "framerate") == 0)
+    {
+      if (gst_structure_get_fraction(s, field, &num, &den) && den > 0) value = num / den;
+    }
+    else
+    {
+      gst_structure_get_int(s, field, &value);
+    }
+    gst_caps_unref(caps);
+  }
+  if (sink) gst_object_unref(sink);
+  return MAX(value, 0);
+}
+
+// Iterator predicate matching the main video track's encoders (not those of additional tracks).
+static gint vtx_reconfig_compare_encoder(gconstpointer a, gconstpointer b)
+{
+  GstElement *element = g_value_get_object((const GValue *) a);
+  return vtx_encoder_is_video_encoder(element) && !(g_tracks && vtx_tracks_owns(g_tracks, element)) ? 0 : 1;
+}
+
+// Returns a new reference to the main video track's encoder, or NULL.
+static GstElement *vtx_reconfig_find_encoder(VtxReconfig *reconfig)
+{
+  GstElement *encoder = NULL;
+  GValue item = G_VALUE_INIT;
+
+  GstIterator *it = gst_bin_iterate_recurse(GST_BIN(reconfig->pipeline));
+  if (gst_iterator_find_custom(it, vtx_reconfig_compare_encoder, &item, NULL))
+  {
+    encoder = g_value_dup_object(&item);
+    g_value_unset(&item);
+  }
+  gst_iterator_free(it);
+
+  return encoder;
+}
+
+// Sets the target bitrate of every video encoder, the pacer rate and the scene-control ceiling. With additional video
+// tracks the bitrate is the session total, split between the running tracks by their shares.
+gboolean vtx_reconfig_set_bitrate(VtxReconfig *reconfig, guint total_kbps, gchar **error_msg)
+{
+  if (total_kbps < RECONFIG_MIN_BITRATE_KBPS)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Bitrate below %u kbps", RECONFIG_MIN_BITRATE_KBPS);
+    return FALSE;
+  }
+
+  // A paused main track keeps its encoder settings; the others got its share
+  guint kbps = g_tracks ? vtx_tracks_split_bitrate(g_tracks, total_kbps) : total_kbps;
+  guint encoders = 0;
+  if (!kbps)
+  {
+    encoders++;
+  }
+  else if (g_scene)
+  {
+    // With scene rate control the encoder follows the new ceiling on its next update
+    vtx_scene_set_ceiling_kbps(g_scene, kbps);
+    encoders++;
+  }
+  else
+  {
+    GstIterator *it = gst_bin_iterate_recurse(GST_BIN(reconfig->pipeline));
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+      GstElement *element = g_value_get_object(&item);
+      if (vtx_reconfig_compare_encoder(&item, NULL) == 0 && vtx_encoder_set_bitrate_kbps(element, kbps)) encoders++;
+      g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+  }
+
+  if (encoders == 0)
+  {
+    if (error_msg) *error_msg = g_strdup("No encoder with a known bitrate property");
+    return FALSE;
+  }
+  if (g_pacer && kbps) vtx_pacer_set_bitrate_kbps(g_pacer, kbps);
+
+  reconfig->bitrate_kbps = total_kbps;
+  reconfig->bitrate_changes++;
+  gst_println("Reconfiguration: bitrate %u kbps (main track %u kbps)", total_kbps, kbps);
+  return TRUE;
+}
+
+// Changes the frame rate at the nearest upstream capsfilter that sets one (videorate, or a camera mode switch).
+gboolean vtx_reconfig_set_framerate(VtxReconfig *reconfig, guint fps, gchar **error_msg)
+{
+  GstElement *encoder = vtx_reconfig_find_encoder(reconfig);
+  GstElement *capsfilter = encoder ? vtx_reconfig_find_capsfilter(encoder, "framerate") : NULL;
+  gboolean ok = FALSE;
+
+  if (!fps)
+  {
+    if (error_msg) *error_msg = g_strdup("Frame rate must be positive");
+  }
+  else if (!capsfilter)
+  {
+    if (error_msg) *error_msg = g_strdup("No capsfilter with a framerate upstream of the encoder (add videorate ! video/x-raw,framerate=N/1)");
+  }
+  else if (vtx_reconfig_check_level(reconfig, vtx_reconfig_current_int(encoder, "width"), vtx_reconfig_current_int(encoder, "height"), fps, error_msg))
+  {
+    GstCaps *caps = NULL;
+    g_object_get(capsfilter, "caps", &caps, NULL);
+    caps = gst_caps_make_writable(caps);
+    gst_caps_set_simple(caps, "framerate", GST_TYPE_FRACTION, fps, 1, NULL);
+    ok = vtx_reconfig_apply_caps(capsfilter, caps, error_msg);
+    gst_caps_unref(caps);
+  }
+
+  if (ok)
+  {
+    gst_println("Reconfiguration: framerate %u fps at %s", fps, GST_OBJECT_NAME(capsfilter));
+    vtx_reconfig_measure(reconfig, encoder, &reconfig->framerate, 0, 0, fps);
+  }
+  if (capsfilter) gst_object_unref(capsfilter);
+  if (encoder) gst_object_unref(encoder);
+  return ok;
+}
+
+// Changes the resolution at the nearest upstream capsfilter that sets one (videoscale, or a camera mode switch).
+gboolean vtx_reconfig_set_resolution(VtxReconfig *reconfig, guint width, guint height, gchar **error_msg)
+{
+  GstElement *encoder = vtx_reconfig_find_encoder(reconfig);
+  GstElement *capsfilter = encoder ? vtx_reconfig_find_capsfilter(encoder, "width") : NULL;
+  gboolean ok = FALSE;
+
+  if (!width || !height || width % 2 || height % 2)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Invalid resolution %ux%u", width, height);
+  }
+  else if (!capsfilter)
+  {
+    if (error_msg) *error_msg = g_strdup("No capsfilter with a width upstream of the encoder (add videoscale ! video/x-raw,width=W,height=H)");
+  }
+  else if (vtx_reconfig_check_level(reconfig, width, height, vtx_reconfig_current_int(encoder, "framerate"), error_msg))
+  {
+    GstCaps *caps = NULL;
+    g_object_get(capsfilter, "caps", &caps, NULL);
+    caps = gst_caps_make_writable(caps);
+    gst_caps_set_simple(caps, "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+    ok = vtx_reconfig_apply_caps(capsfilter, caps, error_msg);
+    gst_caps_unref(caps);
+  }
+
+  if (ok)
+  {
+    gst_println("Reconfiguration: resolution %ux%u at %s", width, height, GST_OBJECT_NAME(capsfilter));
+    vtx_reconfig_measure(reconfig, encoder, &reconfig->resolution, width, height, 0);
+  }
+  if (capsfilter) gst_object_unref(capsfilter);
+  if (encoder) gst_object_unref(encoder);
+  return ok;
+}
+
+// Returns the counters of one kind of caps change.
+static JsonObject *vtx_reconfig_switch_stats(const ReconfigSwitch *sw)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_int_member(stats, "changes", sw->changes);
+  json_object_set_int_member(stats, "timeouts", sw->timeouts);
+  json_object_set_double_member(stats, "last_switch_ms", sw->last_ms);
+  json_object_set_double_member(stats, "max_switch_ms", sw->max_ms);
+  return stats;
+}
+
+// Returns the current encoder input format, the last bitrate set and the switch times of frame-rate and resolution changes.
+JsonObject *vtx_reconfig_get_stats(VtxReconfig *reconfig)
+{
+  JsonObject *stats = json_object_new();
+  GstElement *encoder = vtx_reconfig_find_encoder(reconfig);
+  if (encoder)
+  {
+    json_object_set_int_member(stats, "width", vtx_reconfig_current_int(encoder, "width"));
+    json_object_set_int_member(stats, "height", vtx_reconfig_current_int(encoder, "height"));
+    json_object_set_int_member(stats, "framerate", vtx_reconfig_current_int(encoder, "framerate"));
+    gst_object_unref(encoder);
+  }
+  if (reconfig->bitrate_kbps) json_object_set_int_member(stats, "bitrate_kbps", reconfig->bitrate_kbps);
+  json_object_set_int_member(stats, "bitrate_changes", reconfig->bitrate_changes);
+
+  g_mutex_lock(&reconfig->lock);
+  json_object_set_object_member(stats, "framerate_switch", vtx_reconfig_switch_stats(&reconfig->framerate));
+  json_object_set_object_member(stats, "resolution_switch", vtx_reconfig_switch_stats(&reconfig->resolution));
+  g_mutex_unlock(&reconfig->lock);
+  return stats;
+}
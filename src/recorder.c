@@ -0,0 +1,512 @@
+#include "headers/recorder.h"
+
+#include <errno.h>
+#include <glib/gstdio.h>
+#include <gst/video/video.h>
+
+#include "headers/encoder.h"
+
+// One recorded stream: the tee inserted into the live path and, while recording, its link into the branch.
+typedef struct
+{
+  GstElement *tee;
+  GstPad *tee_pad;     // tee request pad feeding the branch
+  GstPad *link_pad;    // pad linked to branch_pad: tee_pad, or a ghost pad when the tee sits in a sub-bin
+  GstPad *branch_pad;  // ghost sink pad of the branch
+} RecordInput;
+
+struct VtxRecorder
+{
+  GstElement *pipeline;
+  gchar *dir;
+  gchar *format;
+  guint segment_s;
+  guint segment_mb;
+  gchar *encoder;  // pipeline fragment of the second encoder, NULL to record the live encoded stream
+  RecordInput video;
+  RecordInput audio;
+
+  GstElement *branch;  // queues, splitmuxsink and filesink while recording
+  gboolean stopping;
+  guint stop_timeout_id;
+  gint64 started_us;
+  gint64 stopped_us;
+  gchar *location;  // segment being written
+  guint segments;
+  guint dropped;  // buffers dropped by the leaky queues (atomic)
+
+  GMutex lock;
+  guint64 bytes;  // written to the segment files
+};
+
+VtxRecorder *g_recorder = NULL;
+
+// Inserts a tee (allow-not-linked) ahead of the sink pad so a recording branch can be linked while the live path runs.
+static GstElement *vtx_recorder_insert_tee(GstPad *sink_pad, const gchar *name)
+{
+  GstElement *element = gst_pad_get_parent_element(sink_pad);
+  GstObject *bin = element ? gst_object_get_parent(GST_OBJECT(element)) : NULL;
+  GstPad *peer = gst_pad_get_peer(sink_pad);
+  GstElement *tee = NULL;
+
+  if (bin && peer)
+  {
+    tee = gst_element_factory_make_full("tee", "name", name, "allow-not-linked", TRUE, NULL);
+    gst_bin_add(GST_BIN(bin), tee);
+    gst_pad_unlink(peer, sink_pad);
+
+    GstPad *tee_sink = gst_element_get_static_pad(tee, "sink");
+    GstPad *tee_src = gst_element_request_pad_simple(tee, "src_%u");
+    gboolean linked = gst_pad_link(peer, tee_sink) == GST_PAD_LINK_OK && gst_pad_link(tee_src, sink_pad) == GST_PAD_LINK_OK;
+    gst_object_unref(tee_sink);
+    gst_object_unref(tee_src);
+
+    if (linked)
+    {
+      gst_object_ref(tee);
+    }
+    else
+    {
+      gst_bin_remove(GST_BIN(bin), tee);
+      gst_pad_link(peer, sink_pad);
+      tee = NULL;
+    }
+  }
+
+  if (peer) gst_object_unref(peer);
+  if (bin) gst_object_unref(bin);
+  if (element) gst_object_unref(element);
+  return tee;
+}
+
+// Returns the parser that converts the stream on the pad to what the muxer accepts, or NULL if none is needed.
+static const gchar *vtx_recorder_parser_for(GstPad *pad)
+{
+  GstCaps *caps = gst_pad_get_current_caps(pad);
+  if (!caps) return NULL;
+
+  const gchar *name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
+  const gchar *parser = NULL;
+  if (g_strcmp0(name, "video/x-h264") == 0)
+    parser = "h264parse";
+  else if (g_strcmp0(name, "video/x-h265") == 0)
+    parser = "h265parse";
+  gst_caps_unref(caps);
+  return parser;
+}
+
+// Counts buffers the leaky queues drop because the disk fell behind.
+static void vtx_recorder_on_queue_overrun(GstElement *queue, gpointer user_data)
+{
+  VtxRecorder *recorder = user_data;
+  g_atomic_int_inc(&recorder->dropped);
+}
+
+// Counts the bytes reaching the segment files.
+static GstPadProbeReturn vtx_recorder_on_file_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxRecorder *recorder = user_data;
+  g_mutex_lock(&recorder->lock);
+  recorder->bytes += gst_buffer_get_size(GST_PAD_PROBE_INFO_BUFFER(info));
+  g_mutex_unlock(&recorder->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+// Drops the live stream's delta frames until the first keyframe, so every recording starts decodable.
+static GstPadProbeReturn vtx_recorder_on_first_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  if (GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT)) return GST_PAD_PROBE_DROP;
+  return GST_PAD_PROBE_REMOVE;
+}
+
+// Creates a leaky queue in the branch and exposes its sink pad as a ghost pad of the branch.
+static GstElement *vtx_recorder_add_queue(VtxRecorder *recorder, RecordInput *input, const gchar *name)
+{
+  GstElement *queue = gst_element_factory_make_full("queue", "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", (guint64) RECORD_QUEUE_MS * GST_MSECOND, NULL);
+  g_signal_connect(queue, "overrun", G_CALLBACK(vtx_recorder_on_queue_overrun), recorder);
+  gst_bin_add(GST_BIN(recorder->branch), queue);
+
+  GstPad *queue_sink = gst_element_get_static_pad(queue, "sink");
+  input->branch_pad = gst_ghost_pad_new(name, queue_sink);
+  gst_object_unref(queue_sink);
+  gst_element_add_pad(recorder->branch, input->branch_pad);
+  return queue;
+}
+
+// Builds the video side of the branch: queue, optional second encoder, parser, splitmuxsink video pad.
+static gboolean vtx_recorder_build_video(VtxRecorder *recorder, GstElement *splitmux, gchar **error_msg)
+{
+  GstElement *queue = vtx_recorder_add_queue(recorder, &recorder->video, "video");
+  GstElement *last = queue;
+
+  if (recorder->encoder)
+  {
+    GError *error = NULL;
+    GstElement *encoder = gst_parse_bin_from_description(recorder->encoder, TRUE, &error);
+    if (!encoder)
+    {
+      *error_msg = g_strdup_printf("Recording encoder parse error: %s", error ? error->message : "unknown");
+      g_clear_error(&error);
+      return FALSE;
+    }
+    gst_bin_add(GST_BIN(recorder->branch), encoder);
+    if (!gst_element_link(last, encoder))
+    {
+      *error_msg = g_strdup("Failed to link the recording encoder");
+      return FALSE;
+    }
+    last = encoder;
+  }
+  else
+  {
+    GstPad *tee_sink = gst_element_get_static_pad(recorder->video.tee, "sink");
+    gboolean flowing = gst_pad_has_current_caps(tee_sink);
+    const gchar *parser_name = vtx_recorder_parser_for(tee_sink);
+    gst_object_unref(tee_sink);
+    if (!flowing)
+    {
+      *error_msg = g_strdup("No video is flowing yet");
+      return FALSE;
+    }
+
+    if (parser_name)
+    {
+      GstElement *parser = gst_element_factory_make(parser_name, NULL);
+      gst_bin_add(GST_BIN(recorder->branch), parser);
+      gst_element_link(last, parser);
+      last = parser;
+    }
+
+    GstPad *queue_sink = gst_element_get_static_pad(queue, "sink");
+    gst_pad_add_probe(queue_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_recorder_on_first_frame, NULL, NULL);
+    gst_object_unref(queue_sink);
+  }
+
+  if (!gst_element_link_pads(last, NULL, splitmux, "video"))
+  {
+    *error_msg = g_strdup_printf("The %s muxer does not accept the video stream", recorder->format);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Links a tee to the branch through a new request pad, ghosting through the tee's bin when needed.
+static gboolean vtx_recorder_link_input(VtxRecorder *recorder, RecordInput *input)
+{
+  input->tee_pad = gst_element_request_pad_simple(input->tee, "src_%u");
+  if (!gst_pad_link_maybe_ghosting(input->tee_pad, input->branch_pad)) return FALSE;
+  input->link_pad = gst_pad_get_peer(input->branch_pad);
+  return TRUE;
+}
+
+// Unlinks a stream from the branch and releases its tee pad (and the ghost pad crossing the tee's bin).
+static void vtx_recorder_release_input(RecordInput *input)
+{
+  if (input->link_pad)
+  {
+    if (gst_pad_is_linked(input->link_pad)) gst_pad_unlink(input->link_pad, input->branch_pad);
+    if (input->link_pad != input->tee_pad)
+    {
+      GstElement *parent = gst_pad_get_parent_element(input->link_pad);
+      if (parent)
+      {
+        gst_element_remove_pad(parent, input->link_pad);
+        gst_object_unref(parent);
+      }
+    }
+    gst_object_unref(input->link_pad);
+    input->link_pad = NULL;
+  }
+  if (input->tee_pad)
+  {
+    gst_element_release_request_pad(input->tee, input->tee_pad);
+    gst_object_unref(input->tee_pad);
+    input->tee_pad = NULL;
+  }
+  input->branch_pad = NULL;
+}
+
+// Removes the recording branch and logs what was written.
+static void vtx_recorder_teardown(VtxRecorder *recorder)
+{
+  if (!recorder->branch) return;
+
+  if (recorder->stop_timeout_id)
+  {
+    g_source_remove(recorder->stop_timeout_id);
+    recorder->stop_timeout_id = 0;
+  }
+
+  vtx_recorder_release_input(&recorder->video);
+  vtx_recorder_release_input(&recorder->audio);
+  gst_element_set_state(recorder->branch, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(recorder->pipeline), recorder->branch);
+  recorder->branch = NULL;
+  recorder->stopping = FALSE;
+
+  // A branch that failed to start was never counted as a recording
+  if (!recorder->started_us || recorder->stopped_us) return;
+  recorder->stopped_us = g_get_monotonic_time();
+
+  g_mutex_lock(&recorder->lock);
+  guint64 bytes = recorder->bytes;
+  g_mutex_unlock(&recorder->lock);
+  gst_println("Recording stopped: %u segments, %" G_GUINT64_FORMAT " bytes, %u dropped buffers", recorder->segments, bytes, g_atomic_int_get(&recorder->dropped));
+}
+
+// Starts recording into a new set of segments in the recording directory.
+gboolean vtx_recorder_start(VtxRecorder *recorder, gchar **error_msg)
+{
+  if (recorder->branch)
+  {
+    *error_msg = g_strdup(recorder->stopping ? "The previous recording is still being finalised" : "Already recording");
+    return FALSE;
+  }
+  if (g_mkdir_with_parents(recorder->dir, 0755) < 0)
+  {
+    *error_msg = g_strdup_printf("Cannot create %s: %s", recorder->dir, g_strerror(errno));
+    return FALSE;
+  }
+
+  gboolean mkv = g_strcmp0(recorder->format, "mkv") == 0;
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  gchar *pattern = g_strdup_printf("vtx-%s-%%05d.%s", stamp, mkv ? "mkv" : "mp4");
+  gchar *location = g_build_filename(recorder->dir, pattern, NULL);
+  g_date_time_unref(now);
+  g_free(stamp);
+  g_free(pattern);
+
+  GstElement *filesink = gst_element_factory_make("filesink", NULL);
+  GstPad *file_sink = gst_element_get_static_pad(filesink, "sink");
+  gst_pad_add_probe(file_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_recorder_on_file_buffer, recorder, NULL);
+  gst_object_unref(file_sink);
+
+  GstElement *splitmux = gst_element_factory_make_full("splitmuxsink", "location", location, "muxer-factory", mkv ? "matroskamux" : "mp4mux", "max-size-time", (guint64) recorder->segment_s * GST_SECOND, "max-size-bytes", (guint64) recorder->segment_mb * 1024 * 1024, "send-keyframe-requests", recorder->segment_s > 0, "sink", filesink, NULL);
+  g_free(location);
+  if (!mkv)
+  {
+    GstStructure *props = gst_structure_new("properties", "fragment-duration", G_TYPE_UINT, RECORD_MP4_FRAGMENT_MS, NULL);
+    g_object_set(splitmux, "muxer-properties", props, NULL);
+    gst_structure_free(props);
+  }
+
+  // message-forward wraps the branch's EOS in an element message, the signal that the last segment is finalised
+  recorder->branch = gst_bin_new("recorder");
+  g_object_set(recorder->branch, "message-forward", TRUE, NULL);
+  gst_bin_add(GST_BIN(recorder->branch), splitmux);
+
+  g_mutex_lock(&recorder->lock);
+  recorder->bytes = 0;
+  g_mutex_unlock(&recorder->lock);
+  g_atomic_int_set(&recorder->dropped, 0);
+  recorder->segments = 0;
+  g_clear_pointer(&recorder->location, g_free);
+
+  gboolean ok = vtx_recorder_build_video(recorder, splitmux, error_msg);
+  if (ok && recorder->audio.tee)
+  {
+    GstElement *queue = vtx_recorder_add_queue(recorder, &recorder->audio, "audio");
+    if (!gst_element_link_pads(queue, NULL, splitmux, "audio_%u"))
+    {
+      *error_msg = g_strdup_printf("The %s muxer does not accept the audio stream", recorder->format);
+      ok = FALSE;
+    }
+  }
+
+  gst_bin_add(GST_BIN(recorder->pipeline), recorder->branch);
+  if (ok && !(vtx_recorder_link_input(recorder, &recorder->video) && (!recorder->audio.tee || vtx_recorder_link_input(recorder, &recorder->audio))))
+  {
+    *error_msg = g_strdup("Failed to link the recording branch");
+    ok = FALSE;
+  }
+  if (!ok)
+  {
+    vtx_recorder_teardown(recorder);
+    return FALSE;
+  }
+
+  gst_element_sync_state_with_parent(recorder->branch);
+  recorder->started_us = g_get_monotonic_time();
+  recorder->stopped_us = 0;
+
+  // Reusing the live stream: ask its encoder for a keyframe instead of waiting for the next GOP
+  if (!recorder->encoder)
+  {
+    gst_pad_send_event(recorder->video.tee_pad, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+  }
+  gst_println("Recording started in %s (%s, %s)", recorder->dir, recorder->format, recorder->encoder ? "second encoder" : "live encoded stream");
+  return TRUE;
+}
+
+// Idle probe on a tee pad: cuts the stream off from the branch between buffers and ends it with EOS.
+static GstPadProbeReturn vtx_recorder_on_tee_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  RecordInput *input = user_data;
+  gst_pad_unlink(input->link_pad, input->branch_pad);
+  gst_pad_send_event(input->branch_pad, gst_event_new_eos());
+  return GST_PAD_PROBE_REMOVE;
+}
+
+// Removes the branch when the muxer did not finish the last segment in time.
+static gboolean vtx_recorder_on_stop_timeout(gpointer user_data)
+{
+  VtxRecorder *recorder = user_data;
+  gst_printerrln("Recording did not finalise within %u ms", RECORD_STOP_TIMEOUT_MS);
+  recorder->stop_timeout_id = 0;
+  vtx_recorder_teardown(recorder);
+  return G_SOURCE_REMOVE;
+}
+
+// Stops recording: the branch gets EOS so the last segment is finalised, then it is removed. Returns FALSE if not recording.
+gboolean vtx_recorder_stop(VtxRecorder *recorder)
+{
+  if (!recorder->branch || recorder->stopping) return FALSE;
+
+  recorder->stopping = TRUE;
+  gst_pad_add_probe(recorder->video.link_pad, GST_PAD_PROBE_TYPE_IDLE, vtx_recorder_on_tee_idle, &recorder->video, NULL);
+  if (recorder->audio.link_pad)
+  {
+    gst_pad_add_probe(recorder->audio.link_pad, GST_PAD_PROBE_TYPE_IDLE, vtx_recorder_on_tee_idle, &recorder->audio, NULL);
+  }
+  recorder->stop_timeout_id = g_timeout_add(RECORD_STOP_TIMEOUT_MS, vtx_recorder_on_stop_timeout, recorder);
+  return TRUE;
+}
+
+// Returns TRUE while a recording branch is linked and not being stopped.
+gboolean vtx_recorder_is_recording(VtxRecorder *recorder)
+{
+  return recorder->branch && !recorder->stopping;
+}
+
+// Handles bus messages from the recording branch, returning FALSE for every other message. An error there only ends the
+// recording; the live session keeps running.
+gboolean vtx_recorder_handle_message(VtxRecorder *recorder, GstMessage *msg)
+{
+  if (!recorder->branch || !gst_object_has_as_ancestor(GST_MESSAGE_SRC(msg), GST_OBJECT(recorder->branch))) return FALSE;
+
+  switch (GST_MESSAGE_TYPE(msg))
+  {
+    case GST_MESSAGE_ERROR:
+    {
+      GError *err = NULL;
+      gst_message_parse_error(msg, &err, NULL);
+      gst_printerrln("Recording error: %s", err->message);
+      g_error_free(err);
+      vtx_recorder_teardown(recorder);
+      break;
+    }
+    case GST_MESSAGE_ELEMENT:
+    {
+      const GstStructure *s = gst_message_get_structure(msg);
+      if (gst_structure_has_name(s, "splitmuxsink-fragment-opened"))
+      {
+        g_free(recorder->location);
+        recorder->location = g_strdup(gst_structure_get_string(s, "location"));
+        recorder->segments++;
+        gst_println("Recording segment %s", recorder->location);
+      }
+      else if (gst_structure_has_name(s, "GstBinForwarded") && recorder->stopping)
+      {
+        GstMessage *forwarded = NULL;
+        gst_structure_get(s, "message", GST_TYPE_MESSAGE, &forwarded, NULL);
+        gboolean eos = forwarded && GST_MESSAGE_TYPE(forwarded) == GST_MESSAGE_EOS;
+        if (forwarded) gst_message_unref(forwarded);
+        if (eos) vtx_recorder_teardown(recorder);
+      }
+      break;
+    }
+    default:
+      break;
+  }
+  return TRUE;
+}
+
+// Inserts the recording tees into a pipeline that has not been started yet. Recording itself starts on request.
+VtxRecorder *vtx_recorder_attach(GstElement *pipeline, const gchar *dir, const gchar *format, guint segment_s, guint segment_mb, const gchar *encoder)
+{
+  if (g_strcmp0(format, "mp4") != 0 && g_strcmp0(format, "mkv") != 0)
+  {
+    gst_printerrln("Recording: unknown format %s", format);
+    return NULL;
+  }
+
+  // The second encoder records the raw frames entering the live encoder; otherwise the live encoded stream is recorded
+  GstElement *video = encoder ? vtx_encoder_find(GST_BIN(pipeline)) : gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (!video)
+  {
+    gst_printerrln("Recording: %s not found", encoder ? "video encoder" : "videopay");
+    return NULL;
+  }
+
+  VtxRecorder *recorder = g_new0(VtxRecorder, 1);
+  g_mutex_init(&recorder->lock);
+  recorder->pipeline = gst_object_ref(pipeline);
+  recorder->dir = g_strdup(dir);
+  recorder->format = g_strdup(format);
+  recorder->segment_s = segment_s;
+  recorder->segment_mb = segment_mb;
+  recorder->encoder = g_strdup(encoder);
+
+  GstPad *video_sink = gst_element_get_static_pad(video, "sink");
+  recorder->video.tee = vtx_recorder_insert_tee(video_sink, "record_video_tee");
+  gst_object_unref(video_sink);
+  gst_object_unref(video);
+  if (!recorder->video.tee)
+  {
+    gst_printerrln("Recording: failed to insert the video tee");
+    vtx_recorder_free(recorder);
+    return NULL;
+  }
+
+  GstElement *audiopay = gst_bin_get_by_name(GST_BIN(pipeline), "audiopay");
+  if (audiopay)
+  {
+    GstPad *audio_sink = gst_element_get_static_pad(audiopay, "sink");
+    recorder->audio.tee = vtx_recorder_insert_tee(audio_sink, "record_audio_tee");
+    gst_object_unref(audio_sink);
+    gst_object_unref(audiopay);
+  }
+
+  gst_println("Recording available in %s (%s, %u s / %u MB segments)", dir, format, segment_s, segment_mb);
+  return recorder;
+}
+
+// Frees the recorder. The pipeline must already be stopped; a recording still running is cut off without finalising.
+void vtx_recorder_free(VtxRecorder *recorder)
+{
+  if (!recorder) return;
+
+  vtx_recorder_teardown(recorder);
+  if (recorder->video.tee) gst_object_unref(recorder->video.tee);
+  if (recorder->audio.tee) gst_object_unref(recorder->audio.tee);
+  gst_object_unref(recorder->pipeline);
+  g_free(recorder->dir);
+  g_free(recorder->format);
+  g_free(recorder->encoder);
+  g_free(recorder->location);
+  g_mutex_clear(&recorder->lock);
+  g_free(recorder);
+}
+
+// Returns the state of the current (or last) recording: segments, bytes written, write throughput and dropped buffers.
+JsonObject *vtx_recorder_get_stats(VtxRecorder *recorder)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_boolean_member(stats, "recording", vtx_recorder_is_recording(recorder));
+  if (!recorder->started_us) return stats;
+
+  g_mutex_lock(&recorder->lock);
+  guint64 bytes = recorder->bytes;
+  g_mutex_unlock(&recorder->lock);
+
+  gint64 end_us = recorder->stopped_us ? recorder->stopped_us : g_get_monotonic_time();
+  gdouble duration_s = (end_us - recorder->started_us) / (gdouble) G_USEC_PER_SEC;
+  json_object_set_string_member(stats, "location", recorder->location ? recorder->location : "");
+  json_object_set_int_member(stats, "segments", recorder->segments);
+  json_object_set_int_member(stats, "bytes_written", bytes);
+  json_object_set_double_member(stats, "duration_s", duration_s);
+  json_object_set_double_member(stats, "write_kbps", duration_s > 0 ? bytes * 8 / 1000.0 / duration_s : 0.0);
+  json_object_set_int_member(stats, "dropped_buffers", g_atomic_int_get(&recorder->dropped));
+  return stats;
+}
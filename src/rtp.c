@@ -76,15 +76,16 @@ static GstWebRTCPriorityType vtx_rtp_priority_from_string(const gchar *s)
   return 0;
 }
 
-// Sets sendonly direction and optional DSCP priority on the first two WebRTC transceivers for video and audio.
-void vtx_rtp_set_transceiver_priority(GArray *transceivers, const gchar *video_priority, const gchar *audio_priority)
+// Sets sendonly direction on every WebRTC transceiver and the optional DSCP priority of each, in transceiver order (video,
+// audio, then the additional video tracks).
+void vtx_rtp_set_transceiver_priority(GArray *transceivers, const gchar *const *priorities, guint n_priorities)
 {
-  GstWebRTCRTPTransceiver *trans = g_array_index(transceivers, GstWebRTCRTPTransceiver *, 0);
-  g_object_set(trans, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, NULL);
-
-  if (video_priority)
+  for (guint i = 0; i < transceivers->len; i++)
   {
-    GstWebRTCPriorityType priority = vtx_rtp_priority_from_string(video_priority);
+    GstWebRTCRTPTransceiver *trans = g_array_index(transceivers, GstWebRTCRTPTransceiver *, i);
+    g_object_set(trans, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, NULL);
+
+    GstWebRTCPriorityType priority = i < n_priorities && priorities[i] ? vtx_rtp_priority_from_string(priorities[i]) : 0;
     if (priority)
     {
       GstWebRTCRTPSender *sender = NULL;
@@ -93,21 +94,70 @@ void vtx_rtp_set_transceiver_priority(GArray *transceivers, const gchar *video_p
       g_object_unref(sender);
     }
   }
+}
 
-  trans = g_array_index(transceivers, GstWebRTCRTPTransceiver *, 1);
-  g_object_set(trans, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, NULL);
+typedef struct
+{
+  VtxRtpRemoteInboundFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+  gboolean found;
+  gdouble fraction_lost;
+  gdouble round_trip_time;
+} RemoteInboundRequest;
+
+// Frees a stats request and its user data.
+static void vtx_rtp_remote_inbound_free(gpointer data)
+{
+  RemoteInboundRequest *req = data;
+  if (req->notify) req->notify(req->user_data);
+  g_free(req);
+}
+
+// Hands the parsed stats to the caller on the main loop.
+static gboolean vtx_rtp_remote_inbound_deliver(gpointer data)
+{
+  RemoteInboundRequest *req = data;
+  req->func(req->found, req->fraction_lost, req->round_trip_time, req->user_data);
+  return G_SOURCE_REMOVE;
+}
+
+// Picks the worst fraction-lost and round-trip-time (s) of the remote-inbound-rtp entries out of a get-stats reply. Runs on
+// a webrtcbin thread.
+static void vtx_rtp_on_remote_inbound_stats(GstPromise *promise, gpointer user_data)
+{
+  RemoteInboundRequest *req = user_data;
+  const GstStructure *reply = gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED ? gst_promise_get_reply(promise) : NULL;
 
-  if (audio_priority)
+  for (gint i = 0; reply && i < gst_structure_n_fields(reply); i++)
   {
-    GstWebRTCPriorityType priority = vtx_rtp_priority_from_string(audio_priority);
-    if (priority)
-    {
-      GstWebRTCRTPSender *sender = NULL;
-      g_object_get(trans, "sender", &sender, NULL);
-      gst_webrtc_rtp_sender_set_priority(sender, priority);
-      g_object_unref(sender);
-    }
+    const GValue *value = gst_structure_get_value(reply, gst_structure_nth_field_name(reply, i));
+    if (!GST_VALUE_HOLDS_STRUCTURE(value)) continue;
+
+    const GstStructure *s = gst_value_get_structure(value);
+    GstWebRTCStatsType type;
+    if (!gst_structure_get(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, NULL) || type != GST_WEBRTC_STATS_REMOTE_INBOUND_RTP) continue;
+
+    gdouble loss = 0;
+    gdouble rtt = 0;
+    if (gst_structure_get_double(s, "fraction-lost", &loss)) req->fraction_lost = MAX(req->fraction_lost, loss);
+    if (gst_structure_get_double(s, "round-trip-time", &rtt)) req->round_trip_time = MAX(req->round_trip_time, rtt);
+    req->found = TRUE;
   }
 
-  g_array_unref(transceivers);
+  g_idle_add_full(G_PRIORITY_DEFAULT, vtx_rtp_remote_inbound_deliver, req, vtx_rtp_remote_inbound_free);
+}
+
+// Requests webrtcbin stats without blocking the main loop; func gets the worst fraction-lost and round-trip-time (s)
+// reported by the receiver on the main loop, with found FALSE when there were none. notify frees user_data afterwards.
+void vtx_rtp_request_remote_inbound_stats(GstElement *webrtc, VtxRtpRemoteInboundFunc func, gpointer user_data, GDestroyNotify notify)
+{
+  RemoteInboundRequest *req = g_new0(RemoteInboundRequest, 1);
+  req->func = func;
+  req->user_data = user_data;
+  req->notify = notify;
+
+  GstPromise *promise = gst_promise_new_with_change_func(vtx_rtp_on_remote_inbound_stats, req, NULL);
+  g_signal_emit_by_name(webrtc, "get-stats", NULL, promise);
+  gst_promise_unref(promise);
 }
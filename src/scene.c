@@ -0,0 +1,367 @@
+#include "headers/scene.h"
+
+#include <gst/video/video.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "headers/encoder.h"
+
+// Accumulates the luma sum, sum of squares and (when prev is set) sum of absolute differences of one row.
+typedef void (*SceneRowKernel)(const guint8 *row, const guint8 *prev, guint width, guint64 *sum, guint64 *sum_sq, guint64 *sad);
+
+struct VtxScene
+{
+  GstElement *encoder;
+  GstPad *encoder_sink;
+  gulong encoder_sink_probe;
+
+  SceneRowKernel kernel;
+  const gchar *kernel_name;
+
+  GstVideoInfo info;
+  gboolean info_valid;
+  guint8 *prev_rows;
+  gsize prev_rows_size;
+  gboolean have_prev;
+
+  guint ceiling_kbps;
+  guint floor_kbps;
+  guint current_kbps;
+  gdouble complexity;
+  guint frames_since_update;
+
+  GMutex lock;
+  guint64 frames;
+  guint64 bitrate_changes;
+  guint64 cpu_ns_sum;
+  guint64 cpu_ns_max;
+  gdouble last_stddev;
+  gdouble last_motion;
+};
+
+VtxScene *g_scene = NULL;
+
+// Portable row kernel used when no SIMD path is available and for row tails.
+static void vtx_scene_row_scalar(const guint8 *row, const guint8 *prev, guint width, guint64 *sum, guint64 *sum_sq, guint64 *sad)
+{
+  guint64 s = 0, sq = 0, d = 0;
+  for (guint x = 0; x < width; x++)
+  {
+    s += row[x];
+    sq += (guint32) row[x] * row[x];
+    if (prev) d += ABS((gint) row[x] - (gint) prev[x]);
+  }
+  *sum += s;
+  *sum_sq += sq;
+  *sad += d;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX2 row kernel: 32 pixels per iteration, psadbw for sums and SAD, pmaddwd for squares.
+__attribute__((target("avx2"))) static void vtx_scene_row_avx2(const guint8 *row, const guint8 *prev, guint width, guint64 *sum, guint64 *sum_sq, guint64 *sad)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i vsum = zero, vsq = zero, vsad = zero;
+  guint x = 0;
+
+  for (; x + 32 <= width; x += 32)
+  {
+    __m256i p = _mm256_loadu_si256((const __m256i *) (row + x));
+    vsum = _mm256_add_epi64(vsum, _mm256_sad_epu8(p, zero));
+
+    // Squares fit 32-bit lanes for any row width up to 8K
+    __m256i lo = _mm256_unpacklo_epi8(p, zero);
+    __m256i hi = _mm256_unpackhi_epi8(p, zero);
+    vsq = _mm256_add_epi32(vsq, _mm256_add_epi32(_mm256_madd_epi16(lo, lo), _mm256_madd_epi16(hi, hi)));
+
+    if (prev) vsad = _mm256_add_epi64(vsad, _mm256_sad_epu8(p, _mm256_loadu_si256((const __m256i *) (prev + x))));
+  }
+
+  __m256i vsq64 = _mm256_add_epi64(_mm256_cvtepu32_epi64(_mm256_castsi256_si128(vsq)), _mm256_cvtepu32_epi64(_mm256_extracti128_si256(vsq, 1)));
+  guint64 lanes[4];
+  _mm256_storeu_si256((__m256i *) lanes, vsum);
+  *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm256_storeu_si256((__m256i *) lanes, vsq64);
+  *sum_sq += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  _mm256_storeu_si256((__m256i *) lanes, vsad);
+  *sad += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+  if (x < width) vtx_scene_row_scalar(row + x, prev ? prev + x : NULL, width - x, sum, sum_sq, sad);
+}
+#endif
+
+#if defined(__ARM_NEON)
+// NEON row kernel: 16 pixels per iteration, pairwise widening adds for sums, vabd for SAD, vmull for squares.
+static void vtx_scene_row_neon(const guint8 *row, const guint8 *prev, guint width, guint64 *sum, guint64 *sum_sq, guint64 *sad)
+{
+  uint64x2_t vsum = vdupq_n_u64(0), vsq = vdupq_n_u64(0), vsad = vdupq_n_u64(0);
+  guint x = 0;
+
+  for (; x + 16 <= width; x += 16)
+  {
+    uint8x16_t p = vld1q_u8(row + x);
+    vsum = vpadalq_u32(vsum, vpaddlq_u16(vpaddlq_u8(p)));
+
+    uint16x8_t sq_lo = vmull_u8(vget_low_u8(p), vget_low_u8(p));
+    uint16x8_t sq_hi = vmull_u8(vget_high_u8(p), vget_high_u8(p));
+    vsq = vpadalq_u32(vsq, vaddq_u32(vpaddlq_u16(sq_lo), vpaddlq_u16(sq_hi)));
+
+    if (prev) vsad = vpadalq_u32(vsad, vpaddlq_u16(vpaddlq_u8(vabdq_u8(p, vld1q_u8(prev + x)))));
+  }
+
+  *sum += vgetq_lane_u64(vsum, 0) + vgetq_lane_u64(vsum, 1);
+  *sum_sq += vgetq_lane_u64(vsq, 0) + vgetq_lane_u64(vsq, 1);
+  *sad += vgetq_lane_u64(vsad, 0) + vgetq_lane_u64(vsad, 1);
+
+  if (x < width) vtx_scene_row_scalar(row + x, prev ? prev + x : NULL, width - x, sum, sum_sq, sad);
+}
+#endif
+
+// Picks the fastest row kernel the CPU supports.
+static void vtx_scene_select_kernel(VtxScene *scene)
+{
+  scene->kernel = vtx_scene_row_scalar;
+  scene->kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("avx2"))
+  {
+    scene->kernel = vtx_scene_row_avx2;
+    scene->kernel_name = "avx2";
+  }
+#elif defined(__ARM_NEON)
+  scene->kernel = vtx_scene_row_neon;
+  scene->kernel_name = "neon";
+#endif
+}
+
+// Returns the CPU time consumed by the calling thread in nanoseconds.
+static guint64 vtx_scene_thread_cpu_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (guint64) ts.tv_sec * G_GUINT64_CONSTANT(1000000000) + ts.tv_nsec;
+}
+
+// Updates the video info from new caps. Only system-memory formats with an 8-bit, 1-byte-stride luma plane are analysed.
+static void vtx_scene_set_caps(VtxScene *scene, GstCaps *caps)
+{
+  scene->info_valid = FALSE;
+  scene->have_prev = FALSE;
+
+  GstCapsFeatures *features = gst_caps_get_features(caps, 0);
+  if (features && !gst_caps_features_is_equal(features, GST_CAPS_FEATURES_MEMORY_SYSTEM_MEMORY)) return;
+  if (!gst_video_info_from_caps(&scene->info, caps)) return;
+
+  const GstVideoFormatInfo *finfo = scene->info.finfo;
+  if (!(GST_VIDEO_FORMAT_INFO_IS_YUV(finfo) || GST_VIDEO_FORMAT_INFO_IS_GRAY(finfo)) || GST_VIDEO_FORMAT_INFO_DEPTH(finfo, 0) != 8 || GST_VIDEO_INFO_COMP_PSTRIDE(&scene->info, 0) != 1)
+  {
+    gst_printerrln("Scene analysis: unsupported format %s, rate control disabled", gst_video_format_to_string(GST_VIDEO_INFO_FORMAT(&scene->info)));
+    return;
+  }
+
+  gsize size = (gsize) GST_VIDEO_INFO_WIDTH(&scene->info) * ((GST_VIDEO_INFO_HEIGHT(&scene->info) + SCENE_ROW_STEP - 1) / SCENE_ROW_STEP);
+  if (size != scene->prev_rows_size)
+  {
+    g_free(scene->prev_rows);
+    scene->prev_rows = g_malloc(size);
+    scene->prev_rows_size = size;
+  }
+  scene->info_valid = TRUE;
+}
+
+// Maps the scene complexity (0..1) onto the bitrate range and reconfigures the encoder when the target moved enough.
+static void vtx_scene_update_bitrate(VtxScene *scene)
+{
+  guint target = scene->floor_kbps + (guint) ((scene->ceiling_kbps - scene->floor_kbps) * scene->complexity);
+  guint change = (guint) ABS((gint) target - (gint) scene->current_kbps);
+  guint interval = target > scene->current_kbps ? SCENE_RAISE_INTERVAL_FRAMES : SCENE_LOWER_INTERVAL_FRAMES;
+
+  if (++scene->frames_since_update < interval || change * 100 < scene->current_kbps * SCENE_MIN_CHANGE_PERCENT) return;
+
+  if (vtx_encoder_set_bitrate_kbps(scene->encoder, target))
+  {
+    scene->current_kbps = target;
+    scene->bitrate_changes++;
+  }
+  scene->frames_since_update = 0;
+}
+
+// Computes luma variance and frame difference for each raw frame entering the encoder and steers its bitrate.
+static GstPadProbeReturn vtx_scene_on_encoder_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxScene *scene = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+    {
+      GstCaps *caps;
+      gst_event_parse_caps(event, &caps);
+      vtx_scene_set_caps(scene, caps);
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (!scene->info_valid) return GST_PAD_PROBE_OK;
+
+  guint64 cpu_start = vtx_scene_thread_cpu_ns();
+
+  GstVideoFrame frame;
+  if (!gst_video_frame_map(&frame, &scene->info, GST_PAD_PROBE_INFO_BUFFER(info), GST_MAP_READ)) return GST_PAD_PROBE_OK;
+
+  guint width = GST_VIDEO_FRAME_COMP_WIDTH(&frame, 0);
+  guint height = GST_VIDEO_FRAME_COMP_HEIGHT(&frame, 0);
+  gint stride = GST_VIDEO_FRAME_COMP_STRIDE(&frame, 0);
+  const guint8 *luma = GST_VIDEO_FRAME_COMP_DATA(&frame, 0);
+  guint64 sum = 0, sum_sq = 0, sad = 0, pixels = 0;
+
+  for (guint y = 0, r = 0; y < height; y += SCENE_ROW_STEP, r++)
+  {
+    const guint8 *row = luma + (gsize) y * stride;
+    guint8 *prev = scene->prev_rows + (gsize) r * width;
+    scene->kernel(row, scene->have_prev ? prev : NULL, width, &sum, &sum_sq, &sad);
+    memcpy(prev, row, width);
+    pixels += width;
+  }
+  gst_video_frame_unmap(&frame);
+
+  gdouble mean = (gdouble) sum / pixels;
+  gdouble stddev = sqrt(MAX((gdouble) sum_sq / pixels - mean * mean, 0));
+  gdouble motion = scene->have_prev ? (gdouble) sad / pixels : 0;
+  scene->have_prev = TRUE;
+
+  gdouble complexity = 0.5 * MIN(motion / SCENE_MOTION_HIGH, 1.0) + 0.5 * MIN(stddev / SCENE_SPATIAL_HIGH, 1.0);
+  scene->complexity += SCENE_EMA_ALPHA * (complexity - scene->complexity);
+  vtx_scene_update_bitrate(scene);
+
+  guint64 cpu_ns = vtx_scene_thread_cpu_ns() - cpu_start;
+
+  g_mutex_lock(&scene->lock);
+  scene->frames++;
+  scene->cpu_ns_sum += cpu_ns;
+  if (cpu_ns > scene->cpu_ns_max) scene->cpu_ns_max = cpu_ns;
+  scene->last_stddev = stddev;
+  scene->last_motion = motion;
+  g_mutex_unlock(&scene->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Starts scene-complexity rate control on the pipeline's video encoder. The bitrate moves between
+// min_bitrate_percent of the ceiling and the ceiling (max_bitrate_kbps, or the encoder's configured bitrate when 0).
+VtxScene *vtx_scene_attach(GstElement *pipeline, guint max_bitrate_kbps, guint min_bitrate_percent)
+{
+  GstElement *encoder = vtx_encoder_find(GST_BIN(pipeline));
+  if (!encoder)
+  {
+    gst_printerrln("Scene analysis: no video encoder found");
+    return NULL;
+  }
+
+  guint ceiling = max_bitrate_kbps ? max_bitrate_kbps : vtx_encoder_get_bitrate_kbps(encoder);
+  if (ceiling == 0)
+  {
+    gst_printerrln("Scene analysis: bitrate of %s is unknown and no max_bitrate_kbps given", GST_OBJECT_NAME(encoder));
+    gst_object_unref(encoder);
+    return NULL;
+  }
+
+  VtxScene *scene = g_new0(VtxScene, 1);
+  g_mutex_init(&scene->lock);
+  vtx_scene_select_kernel(scene);
+  scene->encoder = encoder;
+  scene->ceiling_kbps = ceiling;
+  scene->floor_kbps = ceiling * CLAMP(min_bitrate_percent, 1, 100) / 100;
+  scene->current_kbps = ceiling;
+  scene->complexity = 1.0;
+  vtx_encoder_set_bitrate_kbps(encoder, ceiling);
+
+  scene->encoder_sink = gst_element_get_static_pad(encoder, "sink");
+  GstCaps *caps = gst_pad_get_current_caps(scene->encoder_sink);
+  if (caps)
+  {
+    vtx_scene_set_caps(scene, caps);
+    gst_caps_unref(caps);
+  }
+  scene->encoder_sink_probe = gst_pad_add_probe(scene->encoder_sink, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_scene_on_encoder_sink, scene, NULL);
+
+  gst_println("Scene rate control on %s: %u-%u kbps (%s)", GST_OBJECT_NAME(encoder), scene->floor_kbps, scene->ceiling_kbps, scene->kernel_name);
+  return scene;
+}
+
+// Moves rate control onto the encoder that replaced the analysed one (encoder failover), at the current target bitrate.
+// The replacement must not be running yet; its caps are picked up from the first caps event.
+void vtx_scene_replace_encoder(VtxScene *scene, GstElement *old, GstElement *encoder)
+{
+  if (scene->encoder != old) return;
+
+  gst_pad_remove_probe(scene->encoder_sink, scene->encoder_sink_probe);
+  gst_object_unref(scene->encoder_sink);
+  gst_object_unref(scene->encoder);
+
+  scene->encoder = gst_object_ref(encoder);
+  scene->info_valid = FALSE;
+  scene->have_prev = FALSE;
+  vtx_encoder_set_bitrate_kbps(encoder, scene->current_kbps);
+
+  scene->encoder_sink = gst_element_get_static_pad(encoder, "sink");
+  scene->encoder_sink_probe = gst_pad_add_probe(scene->encoder_sink, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_scene_on_encoder_sink, scene, NULL);
+  gst_println("Scene rate control moved to %s at %u kbps", GST_OBJECT_NAME(encoder), scene->current_kbps);
+}
+
+// Moves the bitrate range to a new ceiling, keeping the floor at the same fraction of it. The encoder follows on the next
+// update.
+void vtx_scene_set_ceiling_kbps(VtxScene *scene, guint ceiling_kbps)
+{
+  scene->floor_kbps = (guint) ((guint64) scene->floor_kbps * ceiling_kbps / scene->ceiling_kbps);
+  scene->ceiling_kbps = ceiling_kbps;
+  scene->frames_since_update = SCENE_LOWER_INTERVAL_FRAMES;
+}
+
+// Removes the analysis probe and frees the scene state. The pipeline must already be stopped.
+void vtx_scene_free(VtxScene *scene)
+{
+  if (!scene) return;
+
+  if (scene->frames > 0)
+  {
+    gst_println("Scene analysis: %" G_GUINT64_FORMAT " frames, %.1f us CPU per frame, %" G_GUINT64_FORMAT " bitrate changes", scene->frames, scene->cpu_ns_sum / 1000.0 / scene->frames, scene->bitrate_changes);
+  }
+
+  gst_pad_remove_probe(scene->encoder_sink, scene->encoder_sink_probe);
+  gst_object_unref(scene->encoder_sink);
+  gst_object_unref(scene->encoder);
+  g_free(scene->prev_rows);
+  g_mutex_clear(&scene->lock);
+  g_free(scene);
+}
+
+// Returns the latest scene statistics, current bitrate and per-frame analysis CPU cost as a JSON object.
+JsonObject *vtx_scene_get_stats(VtxScene *scene)
+{
+  JsonObject *o = json_object_new();
+
+  g_mutex_lock(&scene->lock);
+  json_object_set_string_member(o, "kernel", scene->kernel_name);
+  json_object_set_int_member(o, "frames", scene->frames);
+  json_object_set_double_member(o, "cpu_us_mean", scene->frames ? scene->cpu_ns_sum / 1000.0 / scene->frames : 0);
+  json_object_set_double_member(o, "cpu_us_max", scene->cpu_ns_max / 1000.0);
+  json_object_set_double_member(o, "luma_stddev", scene->last_stddev);
+  json_object_set_double_member(o, "motion", scene->last_motion);
+  g_mutex_unlock(&scene->lock);
+
+  json_object_set_double_member(o, "complexity", scene->complexity);
+  json_object_set_int_member(o, "bitrate_kbps", scene->current_kbps);
+  json_object_set_int_member(o, "ceiling_kbps", scene->ceiling_kbps);
+  json_object_set_int_member(o, "bitrate_changes", scene->bitrate_changes);
+  return o;
+}
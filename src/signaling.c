@@ -4,10 +4,12 @@
 #include <gst/webrtc/webrtc.h>
 #include <json-glib/json-glib.h>
 
+#include "headers/codec_branch.h"
 #include "headers/data_channel.h"
 #include "headers/inspection.h"
 #include "headers/msp.h"
 #include "headers/pipeline.h"
+#include "headers/signaling_codec.h"
 #include "headers/utils.h"
 #include "headers/wpa.h"
 
@@ -15,6 +17,10 @@ SoupWebsocketConnection *ws_conn = NULL;
 gchar *ws1Id = NULL;
 gchar *ws2Id = NULL;
 
+static SoupSession *s_session = NULL;
+static guint s_reconnect_attempt = 0;
+static guint s_reconnect_timeout_id = 0;
+
 // Returns TRUE if the given SDP media section has been rejected by the peer (port 0 or inactive attribute).
 static gboolean vtx_sdp_media_is_rejected(const GstSDPMedia *media)
 {
@@ -26,21 +32,31 @@ static gboolean vtx_sdp_media_is_rejected(const GstSDPMedia *media)
   return inactive != NULL;
 }
 
-// Inspects the SDP answer for rejected video/audio tracks, sends an error to the receiver, and tears down the connection if any track was rejected.
-static gboolean vtx_sdp_handle_rejected_media(const GstSDPMessage *sdp)
+// Inspects the SDP answer for rejected video/audio tracks. A partially rejected answer keeps the session running with the
+// accepted tracks; the connection is only torn down (with an error to the receiver) when no media was accepted at all.
+// viewer_id names an additional viewer; NULL means the primary session.
+static gboolean vtx_sdp_handle_rejected_media(const GstSDPMessage *sdp, const gchar *viewer_id)
 {
   if (!sdp) return FALSE;
 
   guint media_count = gst_sdp_message_medias_len(sdp);
+  guint accepted_count = 0;
   gboolean video_rejected = FALSE;
   gboolean audio_rejected = FALSE;
 
   for (guint i = 0; i < media_count; i++)
   {
+    // The application (DataChannel) section carries no media, so it does not keep a session alive
     const GstSDPMedia *media = gst_sdp_message_get_media(sdp, i);
-    if (!vtx_sdp_media_is_rejected(media)) continue;
-
     const gchar *media_type = gst_sdp_media_get_media(media);
+    if (g_strcmp0(media_type, "video") != 0 && g_strcmp0(media_type, "audio") != 0) continue;
+
+    if (!vtx_sdp_media_is_rejected(media))
+    {
+      accepted_count++;
+      continue;
+    }
+
     if (g_strcmp0(media_type, "video") == 0)
     {
       video_rejected = TRUE;
@@ -56,11 +72,11 @@ static gboolean vtx_sdp_handle_rejected_media(const GstSDPMessage *sdp)
   GString *err_msg = g_string_new("Peer rejected ");
   if (video_rejected && audio_rejected)
   {
-    g_string_append(err_msg, "both video and audio tracks. The viewer likely lacks the required codecs (H264 video / Opus audio).");
+    g_string_append(err_msg, "both video and audio tracks. The viewer likely lacks the required codecs (offered video codecs / Opus audio).");
   }
   else if (video_rejected)
   {
-    g_string_append(err_msg, "the video track. Ensure the viewer supports H264 decoding.");
+    g_string_append(err_msg, "the video track. Ensure the viewer supports one of the offered video codecs.");
   }
   else
   {
@@ -69,44 +85,96 @@ static gboolean vtx_sdp_handle_rejected_media(const GstSDPMessage *sdp)
 
   gst_printerrln("%s", err_msg->str);
 
-  if (ws2Id)
+  if (accepted_count > 0)
+  {
+    gst_println("Continuing with the %u accepted audio/video section(s)", accepted_count);
+    g_string_free(err_msg, TRUE);
+    return FALSE;
+  }
+
+  const gchar *receiver = viewer_id ? viewer_id : ws2Id;
+  if (receiver)
   {
     JsonObject *error_obj = json_object_new();
     json_object_set_string_member(error_obj, "message", err_msg->str);
-    vtx_ws_send(ws_conn, RECEIVER_SYSTEM_ERROR, ws1Id, ws2Id, error_obj);
+    vtx_ws_send(ws_conn, RECEIVER_SYSTEM_ERROR, ws1Id, receiver, error_obj);
     json_object_unref(error_obj);
   }
 
-  vtx_cleanup_connection("Remote SDP rejected offered media");
+  if (viewer_id)
+  {
+    vtx_pipeline_remove_viewer(viewer_id);
+  }
+  else
+  {
+    vtx_cleanup_connection("Remote SDP rejected offered media");
+  }
 
   g_string_free(err_msg, TRUE);
   return TRUE;
 }
 
+// Initializes WPA supplicant on the first Wi-Fi interface of the network_interface list ("wlan0,eth0:192.168.1.5").
+static gboolean vtx_signaling_wpa_init(const gchar *network_interface)
+{
+  gboolean ok = FALSE;
+  gchar **entries = g_strsplit(network_interface, ",", -1);
+  for (gchar **entry = entries; *entry && !ok; entry++)
+  {
+    gchar *interface_name = g_strstrip(*entry);
+    gchar *colon = strchr(interface_name, ':');
+    if (colon) *colon = '\0';
+    if (*interface_name != '\0') ok = vtx_wpa_supplicant_init(interface_name);
+  }
+  g_strfreev(entries);
+  return ok;
+}
+
+// Returns the ws2Id of the message sender if it is an additional viewer of the shared pipeline, or NULL for the primary session.
+static const gchar *vtx_signaling_viewer_id(JsonObject *object)
+{
+  const gchar *sender = json_object_has_member(object, "ws2Id") ? json_object_get_string_member(object, "ws2Id") : NULL;
+  return vtx_pipeline_find_viewer(sender) ? sender : NULL;
+}
+
+// Attaches a further receiver to the running shared pipeline, replying with an error if its media settings differ.
+static void vtx_signaling_add_viewer(JsonObject *object, const gchar *viewer_id)
+{
+  MediaParams params = {0};
+  gchar *pipeline_error = NULL;
+
+  gst_println("Adding viewer %s to the shared media pipeline", viewer_id);
+  if (!vtx_pipeline_parse_media_params(object, &params) || !vtx_pipeline_add_viewer(viewer_id, &params, &pipeline_error))
+  {
+    JsonObject *error_messeage = json_object_new();
+    json_object_set_string_member(error_messeage, "message", pipeline_error ? pipeline_error : "Failed to add viewer");
+    vtx_ws_send(ws_conn, RECEIVER_SYSTEM_ERROR, ws1Id, viewer_id, error_messeage);
+    g_free(pipeline_error);
+  }
+}
+
 // Handles incoming WebSocket messages from the signaling server and dispatches actions based on the message type field.
 void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType type, GBytes *message, gpointer user_data)
 {
   gsize size;
   const gchar *data = g_bytes_get_data(message, &size);
-  gchar *text = g_strndup(data, size);
+  VtxSignalingEncoding encoding = type == SOUP_WEBSOCKET_DATA_BINARY ? VTX_SIGNALING_CBOR : VTX_SIGNALING_JSON;
 
   // gst_println("[WebSocket-Recv] Size: %lu, Content: %.*s", (unsigned long) size, (int) size, data);
 
-  JsonParser *parser = json_parser_new();
-  if (!json_parser_load_from_data(parser, text, -1, NULL))
+  GError *error = NULL;
+  JsonNode *root = vtx_signaling_decode(message, encoding, &error);
+  if (!root)
   {
-    gst_printerrln("Failed to parse message: %s", text);
-    g_object_unref(parser);
-    g_free(text);
+    gst_printerrln("Failed to parse message (%s): %.*s", error ? error->message : "empty", encoding == VTX_SIGNALING_JSON ? (int) size : 0, data);
+    g_clear_error(&error);
     return;
   }
 
-  JsonNode *root = json_parser_get_root(parser);
   if (!JSON_NODE_HOLDS_OBJECT(root))
   {
     gst_printerrln("Message is not a JSON objects");
-    g_object_unref(parser);
-    g_free(text);
+    json_node_unref(root);
     return;
   }
 
@@ -120,8 +188,18 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
       gst_println(">>> %d SENDER_SESSION_ID_ISSUANCE", SENDER_SESSION_ID_ISSUANCE);
       if (json_object_has_member(object, "sessionId"))
       {
-        ws1Id = g_strdup(json_object_get_string_member(object, "sessionId"));
-        gst_println("assigned TX session ID : %s", ws1Id);
+        const gchar *session_id = json_object_get_string_member(object, "sessionId");
+        if (ws1Id && g_strcmp0(ws1Id, session_id) == 0)
+        {
+          gst_println("resumed TX session ID : %s", ws1Id);
+        }
+        else
+        {
+          if (ws1Id) gst_println("previous TX session ID %s was not resumed", ws1Id);
+          g_free(ws1Id);
+          ws1Id = g_strdup(session_id);
+          gst_println("assigned TX session ID : %s", ws1Id);
+        }
 
         if (json_object_has_member(object, "pin"))
         {
@@ -129,30 +207,25 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
           gst_println("\n=== Access PIN: %s ===\n", pin);
         }
 
-        app_state = SERVER_REGISTERED;
+        // A live media session keeps its streaming state across signaling reconnects
+        if (!pipeline) app_state = SERVER_REGISTERED;
 
         // Send platform info to server
-        JsonObject *platform_info = json_object_new();
-        json_object_set_int_member(platform_info, "type", SENDER_PLATFORM_INFO);
-        json_object_set_string_member(platform_info, "platform", vtx_platform_to_string(g_platform));
+        VtxSignalingWriter *w = vtx_signaling_writer_acquire(vtx_signaling_encoding(conn));
+        vtx_signaling_writer_begin_object(w);
+        vtx_signaling_writer_key(w, "type");
+        vtx_signaling_writer_int(w, SENDER_PLATFORM_INFO);
+        vtx_signaling_writer_key(w, "platform");
+        vtx_signaling_writer_string(w, vtx_platform_to_string(g_platform));
         if (g_platform == LINUX_X86 && g_gpu_vendor != GPU_VENDOR_UNKNOWN)
         {
-          json_object_set_string_member(platform_info, "gpu", vtx_gpu_vendor_to_string(g_gpu_vendor));
+          vtx_signaling_writer_key(w, "gpu");
+          vtx_signaling_writer_string(w, vtx_gpu_vendor_to_string(g_gpu_vendor));
         }
+        vtx_signaling_writer_end_object(w);
 
-        JsonNode *root = json_node_new(JSON_NODE_OBJECT);
-        json_node_set_object(root, platform_info);
-        JsonGenerator *gen = json_generator_new();
-        json_generator_set_root(gen, root);
-        gchar *json_str = json_generator_to_data(gen, NULL);
-
-        gst_println("<<< %d SENDER_PLATFORM_INFO: %s", SENDER_PLATFORM_INFO, json_str);
-        soup_websocket_connection_send_text(conn, json_str);
-
-        g_free(json_str);
-        g_object_unref(gen);
-        json_node_free(root);
-        json_object_unref(platform_info);
+        gst_println("<<< %d SENDER_PLATFORM_INFO: %s", SENDER_PLATFORM_INFO, vtx_platform_to_string(g_platform));
+        vtx_signaling_writer_send(w, conn);
       }
       else
       {
@@ -206,6 +279,14 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
 
       if (json_object_has_member(object, "ws2Id"))
       {
+        // A further receiver joins the running shared pipeline instead of replacing the primary session
+        const gchar *receiver = json_object_get_string_member(object, "ws2Id");
+        if (ws2Id && g_strcmp0(ws2Id, receiver) != 0 && vtx_pipeline_is_shared())
+        {
+          vtx_signaling_add_viewer(object, receiver);
+          break;
+        }
+
         // Clear old ws2Id if exists (for reconnection)
         if (ws2Id)
         {
@@ -225,7 +306,7 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
           vtx_ws_send(ws_conn, RECEIVER_SYSTEM_ERROR, ws1Id, ws2Id_, error_messeage);
           g_free(ws2Id_);
         }
-        else if (params.network_interface && !vtx_wpa_supplicant_init(params.network_interface))
+        else if (params.network_interface && !vtx_signaling_wpa_init(params.network_interface))
         {
           JsonObject *error_messeage = json_object_new();
           json_object_set_string_member(error_messeage, "message", "Failed to initialize WPA supplicant");
@@ -307,32 +388,61 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
         gst_sdp_message_free(sdp);
         break;
       }
-      if (vtx_sdp_handle_rejected_media(sdp))
+      const gchar *viewer_id = vtx_signaling_viewer_id(object);
+      if (vtx_sdp_handle_rejected_media(sdp, viewer_id))
+      {
+        gst_sdp_message_free(sdp);
+        break;
+      }
+      GstElement *peer = viewer_id ? vtx_pipeline_find_viewer(viewer_id) : webrtc;
+      if (!peer)
       {
+        gst_printerrln("Ignoring SDP answer because WebRTC pipeline has been cleaned up");
         gst_sdp_message_free(sdp);
         break;
       }
       GstWebRTCSessionDescription *desc = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
       GstPromise *promise = gst_promise_new();
-      g_signal_emit_by_name(webrtc, "set-remote-description", desc, promise);
+      g_signal_emit_by_name(peer, "set-remote-description", desc, promise);
       gst_promise_interrupt(promise);
-      app_state = PEER_CALL_RECIVE_ANSWER;
       gst_promise_unref(promise);
+      if (!viewer_id)
+      {
+        app_state = PEER_CALL_RECIVE_ANSWER;
+        vtx_codec_branch_select(pipeline, desc->sdp);
+      }
       gst_webrtc_session_description_free(desc);
       break;
     }
 
     case SENDER_ICE:
     {
-      JsonObject *cand = json_object_get_object_member(object, "candidate");
-      const gchar *cand_str = json_object_get_string_member(cand, "candidate");
-      gint mline = json_object_get_int_member(cand, "sdpMLineIndex");
-      gst_println(">>> %d SENDER_ICE: %s", SENDER_ICE, cand_str);
-      if (webrtc)
+      const gchar *viewer_id = vtx_signaling_viewer_id(object);
+      GstElement *peer = viewer_id ? vtx_pipeline_find_viewer(viewer_id) : webrtc;
+
+      // Batching receivers send {"candidates": [...], "endOfCandidates": bool}, older ones a single "candidate"
+      if (json_object_has_member(object, "candidates"))
       {
-        g_signal_emit_by_name(webrtc, "add-ice-candidate", mline, cand_str);
+        JsonArray *cands = json_object_get_array_member(object, "candidates");
+        guint count = json_array_get_length(cands);
+        gboolean complete = json_object_has_member(object, "endOfCandidates") ? json_object_get_boolean_member(object, "endOfCandidates") : FALSE;
+        gst_println(">>> %d SENDER_ICE: %u candidate(s)%s", SENDER_ICE, count, complete ? ", end of candidates" : "");
+        for (guint i = 0; peer && i < count; i++)
+        {
+          JsonObject *cand = json_array_get_object_element(cands, i);
+          g_signal_emit_by_name(peer, "add-ice-candidate", (guint) json_object_get_int_member(cand, "sdpMLineIndex"), json_object_get_string_member(cand, "candidate"));
+        }
       }
       else
+      {
+        JsonObject *cand = json_object_get_object_member(object, "candidate");
+        const gchar *cand_str = json_object_get_string_member(cand, "candidate");
+        gint mline = json_object_get_int_member(cand, "sdpMLineIndex");
+        gst_println(">>> %d SENDER_ICE: %s", SENDER_ICE, cand_str);
+        if (peer) g_signal_emit_by_name(peer, "add-ice-candidate", mline, cand_str);
+      }
+
+      if (!peer)
       {
         gst_printerrln("Ignoring ICE candidate because WebRTC pipeline has been cleaned up");
       }
@@ -342,14 +452,25 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
     case SENDER_RECEIVER_CLOSE:
     {
       gst_println(">>> %d SENDER_RECEIVER_CLOSE", SENDER_RECEIVER_CLOSE);
-      vtx_cleanup_connection("Receiver closed connection");
+      const gchar *viewer_id = vtx_signaling_viewer_id(object);
+      if (viewer_id)
+      {
+        gst_println("Viewer %s closed connection", viewer_id);
+        vtx_pipeline_remove_viewer(viewer_id);
+      }
+      else
+      {
+        vtx_cleanup_connection("Receiver closed connection");
+      }
       break;
     }
 
     case SENDER_SYSTEM_ERROR:
     {
       gst_println(">>> %d SENDER_SYSTEM_ERROR", SENDER_SYSTEM_ERROR);
+      gchar *text = json_to_string(root, FALSE);
       gst_printerrln("%s", text);
+      g_free(text);
       break;
     }
 
@@ -357,16 +478,46 @@ void vtx_soup_on_message(SoupWebsocketConnection *conn, SoupWebsocketDataType ty
       gst_println("Unhandled message type: %d", type_value);
   }
 
-  g_object_unref(parser);
-  g_free(text);
+  json_node_unref(root);
+}
+
+static void vtx_soup_connect(void);
+
+// Retries the signaling connection after the current backoff delay.
+static gboolean vtx_soup_on_reconnect_timeout(gpointer user_data)
+{
+  s_reconnect_timeout_id = 0;
+  vtx_soup_connect();
+  return G_SOURCE_REMOVE;
+}
+
+// Schedules the next connection attempt with exponential backoff and jitter, so a fleet of senders does not reconnect in lockstep
+// after a server restart.
+static void vtx_soup_schedule_reconnect(void)
+{
+  if (!loop || s_reconnect_timeout_id) return;
+
+  guint delay_ms = SIGNALING_RECONNECT_MAX_MS;
+  if (s_reconnect_attempt < 16)
+  {
+    delay_ms = MIN((guint) SIGNALING_RECONNECT_MIN_MS << s_reconnect_attempt, SIGNALING_RECONNECT_MAX_MS);
+  }
+  delay_ms = g_random_int_range(delay_ms / 2, delay_ms + 1);
+  s_reconnect_attempt++;
+
+  gst_println("Reconnecting to signaling server in %u ms (attempt %u)%s", delay_ms, s_reconnect_attempt, pipeline ? ", media session kept alive" : "");
+  s_reconnect_timeout_id = g_timeout_add(delay_ms, vtx_soup_on_reconnect_timeout, NULL);
 }
 
-// Called when the WebSocket connection to the signaling server is closed; cleans up and quits the main loop.
+// Called when the WebSocket connection to the signaling server is closed. Established peer connections do not need signaling,
+// so media, MSP and WPA keep running while the connection is re-established in the background.
 static void vtx_soup_on_closed(SoupWebsocketConnection *conn, gpointer user_data)
 {
   gst_println("Disconnected signaling server.");
-  vtx_cleanup_and_quit_loop("Server connection closed", 0);
-  app_state = SERVER_CLOSED;
+  if (conn == ws_conn) g_clear_object(&ws_conn);
+  if (!pipeline) app_state = SERVER_CLOSED;
+
+  vtx_soup_schedule_reconnect();
 }
 
 // Async callback invoked when the WebSocket handshake completes; stores the connection and registers message/closed signal handlers.
@@ -378,12 +529,17 @@ static void vtx_soup_on_connected(GObject *source_object, GAsyncResult *res, gpo
 
   if (error)
   {
-    vtx_cleanup_and_quit_loop(error->message, SERVER_CONNECTION_ERROR);
+    gst_printerrln("Signaling connection failed: %s", error->message);
     g_error_free(error);
+    if (!pipeline) app_state = SERVER_CONNECTION_ERROR;
+    vtx_soup_schedule_reconnect();
     return;
   }
 
-  app_state = SERVER_CONNECTED;
+  if (!pipeline) app_state = SERVER_CONNECTED;
+  s_reconnect_attempt = 0;
+
+  if (vtx_signaling_encoding(ws_conn) == VTX_SIGNALING_CBOR) gst_println("Signaling server selected the %s protocol", SIGNALING_PROTOCOL_CBOR);
 
   g_signal_connect(ws_conn, "closed", G_CALLBACK(vtx_soup_on_closed), NULL);
   g_signal_connect(ws_conn, "message", G_CALLBACK(vtx_soup_on_message), NULL);
@@ -403,17 +559,42 @@ const char *get_certificate_authority(void)
   return certificate ? certificate : DEFAULT_SERVER_CERTIFICATE_AUTHORITY;
 }
 
-// Creates a libsoup session (with optional custom CA certificate) and initiates an async WebSocket connection to the signaling server.
-void vtx_soup_session_websocket_connect_async(void)
+// Opens the WebSocket to the signaling server on the shared session. After a disconnect the previous sender session ID is
+// offered for resumption, so receivers that know it can keep addressing this sender.
+static void vtx_soup_connect(void)
 {
-  gst_println("----- Connect signaling -----");
-  const char *endpoint = get_signaling_endpoint();
-  gst_println("[Config] SIGNALING_ENDPOINT: %s", endpoint);
+  SoupMessage *message = soup_message_new(SOUP_METHOD_GET, get_signaling_endpoint());
+  // The JSON protocol stays first: servers that just pick the first offered protocol keep speaking JSON
+  char *protocols[] = {SIGNALING_PROTOCOL, NULL, NULL};
+  if (g_strcmp0(getenv(SIGNALING_CBOR_ENV), "1") == 0) protocols[1] = SIGNALING_PROTOCOL_CBOR;
 
-  const char *certificate = get_certificate_authority();
+  if (ws1Id)
+  {
+    gst_println("Requesting resumption of TX session ID: %s", ws1Id);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+    soup_message_headers_replace(soup_message_get_request_headers(message), SIGNALING_RESUME_HEADER, ws1Id);
+#else
+    soup_message_headers_replace(message->request_headers, SIGNALING_RESUME_HEADER, ws1Id);
+#endif
+  }
 
-  SoupMessage *message = soup_message_new(SOUP_METHOD_GET, endpoint);
-  char *protocols[] = {"sender", NULL};
+  gst_println("Connecting to signaling server...");
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+  soup_session_websocket_connect_async(s_session, message, NULL, protocols, G_PRIORITY_DEFAULT, NULL, vtx_soup_on_connected, NULL);
+#else
+  soup_session_websocket_connect_async(s_session, message, NULL, protocols, NULL, (GAsyncReadyCallback) vtx_soup_on_connected, NULL);
+#endif
+  g_object_unref(message);
+
+  if (!pipeline) app_state = SERVER_CONNECTING;
+}
+
+// Creates a libsoup session that trusts the custom CA certificate (SERVER_CERTIFICATE_AUTHORITY) when it exists, or the
+// system certificate store otherwise. Shared by the WebSocket signaling and the WHIP transport.
+SoupSession *vtx_soup_session_new(void)
+{
+  const char *certificate = get_certificate_authority();
 
   // Check if certificate file exists
   char *server_ca_cert = realpath(certificate, NULL);
@@ -429,8 +610,6 @@ void vtx_soup_session_websocket_connect_async(void)
     gst_println("Custom CA certificate not found, using system default");
   }
 
-  gst_println("Connecting to signaling server...");
-
 #if SOUP_CHECK_VERSION(3, 0, 0)
   // --- libsoup 3.x ---
   SoupSession *session = NULL;
@@ -462,8 +641,6 @@ void vtx_soup_session_websocket_connect_async(void)
   soup_session_add_feature(session, SOUP_SESSION_FEATURE(logger));
   g_object_unref(logger);
 
-  soup_session_websocket_connect_async(session, message, NULL, protocols, G_PRIORITY_DEFAULT, NULL, vtx_soup_on_connected, NULL);
-
 #else
   // --- libsoup 2.4 ---
   SoupSession *session = NULL;
@@ -482,13 +659,28 @@ void vtx_soup_session_websocket_connect_async(void)
   soup_session_add_feature(session, SOUP_SESSION_FEATURE(logger));
   g_object_unref(logger);
 
-  soup_session_websocket_connect_async(session, message, NULL, protocols, NULL, (GAsyncReadyCallback) vtx_soup_on_connected, message);
-
 #endif
 
   if (server_ca_cert)
   {
     free(server_ca_cert);
   }
-  app_state = SERVER_CONNECTING;
+
+  return session;
+}
+
+// Creates a libsoup session (with optional custom CA certificate) and initiates an async WebSocket connection to the signaling server.
+void vtx_soup_session_websocket_connect_async(void)
+{
+  gst_println("----- Connect signaling -----");
+  const char *endpoint = get_signaling_endpoint();
+  gst_println("[Config] SIGNALING_ENDPOINT: %s", endpoint);
+
+  SoupSession *session = vtx_soup_session_new();
+
+  // The session is kept for reconnects
+  if (s_session) g_object_unref(s_session);
+  s_session = session;
+
+  vtx_soup_connect();
 }
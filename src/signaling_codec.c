@@ -0,0 +1,703 @@
+#include "headers/signaling_codec.h"
+
+#include <gio/gio.h>
+#include <math.h>
+#include <string.h>
+
+// CBOR major types (RFC 8949) and the simple values the codec uses.
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE 0xf4
+#define CBOR_TRUE 0xf5
+#define CBOR_NULL 0xf6
+#define CBOR_DOUBLE 0xfb
+#define CBOR_BREAK 0xff
+#define CBOR_INDEFINITE 31
+
+// Frees a thread's writer when the thread exits.
+static void vtx_signaling_writer_free(gpointer data)
+{
+  VtxSignalingWriter *w = data;
+  g_string_free(w->buf, TRUE);
+  g_free(w);
+}
+
+static GPrivate s_writer = G_PRIVATE_INIT(vtx_signaling_writer_free);
+
+// Returns the encoding the server selected for this connection.
+VtxSignalingEncoding vtx_signaling_encoding(SoupWebsocketConnection *conn)
+{
+  return conn && g_strcmp0(soup_websocket_connection_get_protocol(conn), SIGNALING_PROTOCOL_CBOR) == 0 ? VTX_SIGNALING_CBOR : VTX_SIGNALING_JSON;
+}
+
+// Returns this thread's writer, emptied and set to the given encoding. The buffer keeps its capacity between messages.
+VtxSignalingWriter *vtx_signaling_writer_acquire(VtxSignalingEncoding encoding)
+{
+  VtxSignalingWriter *w = g_private_get(&s_writer);
+  if (!w)
+  {
+    w = g_new0(VtxSignalingWriter, 1);
+    w->buf = g_string_sized_new(1024);
+    g_private_set(&s_writer, w);
+  }
+
+  g_string_truncate(w->buf, 0);
+  w->encoding = encoding;
+  w->depth = 0;
+  w->has_items = 0;
+  w->after_key = FALSE;
+  return w;
+}
+
+// Appends a CBOR head: major type plus an argument in the shortest form.
+static void vtx_cbor_head(GString *buf, guint8 major, guint64 value)
+{
+  guint8 head[9];
+  gsize len;
+
+  if (value < 24)
+  {
+    head[0] = (major << 5) | (guint8) value;
+    len = 1;
+  }
+  else if (value <= G_MAXUINT8)
+  {
+    head[0] = (major << 5) | 24;
+    len = 2;
+  }
+  else if (value <= G_MAXUINT16)
+  {
+    head[0] = (major << 5) | 25;
+    len = 3;
+  }
+  else if (value <= G_MAXUINT32)
+  {
+    head[0] = (major << 5) | 26;
+    len = 5;
+  }
+  else
+  {
+    head[0] = (major << 5) | 27;
+    len = 9;
+  }
+
+  for (gsize i = 1; i < len; i++) head[i] = (guint8) (value >> (8 * (len - 1 - i)));
+
+  g_string_append_len(buf, (const gchar *) head, len);
+}
+
+// Emits the separator a JSON value needs at the current position; CBOR containers carry no separators.
+static void vtx_signaling_writer_prefix(VtxSignalingWriter *w)
+{
+  if (w->encoding != VTX_SIGNALING_JSON) return;
+
+  if (w->after_key)
+  {
+    w->after_key = FALSE;
+    return;
+  }
+
+  guint32 bit = 1u << w->depth;
+  if (w->has_items & bit) g_string_append_c(w->buf, ',');
+  w->has_items |= bit;
+}
+
+// Opens a container and clears the separator state of the new level.
+static void vtx_signaling_writer_open(VtxSignalingWriter *w, gchar json, guint8 major)
+{
+  g_return_if_fail(w->depth + 1 < SIGNALING_CODEC_MAX_DEPTH);
+
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    g_string_append_c(w->buf, json);
+  }
+  else
+  {
+    g_string_append_c(w->buf, (gchar) ((major << 5) | CBOR_INDEFINITE));
+  }
+
+  w->depth++;
+  w->has_items &= ~(1u << w->depth);
+}
+
+// Closes the innermost container.
+static void vtx_signaling_writer_close(VtxSignalingWriter *w, gchar json)
+{
+  g_return_if_fail(w->depth > 0);
+
+  w->depth--;
+  g_string_append_c(w->buf, w->encoding == VTX_SIGNALING_JSON ? json : (gchar) CBOR_BREAK);
+}
+
+// Begins an object; members follow as key/value pairs.
+void vtx_signaling_writer_begin_object(VtxSignalingWriter *w)
+{
+  vtx_signaling_writer_open(w, '{', CBOR_MAP);
+}
+
+// Ends the current object.
+void vtx_signaling_writer_end_object(VtxSignalingWriter *w)
+{
+  vtx_signaling_writer_close(w, '}');
+}
+
+// Begins an array.
+void vtx_signaling_writer_begin_array(VtxSignalingWriter *w)
+{
+  vtx_signaling_writer_open(w, '[', CBOR_ARRAY);
+}
+
+// Ends the current array.
+void vtx_signaling_writer_end_array(VtxSignalingWriter *w)
+{
+  vtx_signaling_writer_close(w, ']');
+}
+
+// Appends a JSON string literal, escaping quotes, backslashes and control characters. UTF-8 passes through unchanged.
+static void vtx_json_append_string(GString *buf, const gchar *value)
+{
+  static const gchar hex[] = "0123456789abcdef";
+  const gchar *run = value;
+
+  g_string_append_c(buf, '"');
+  for (const gchar *p = value; *p; p++)
+  {
+    guchar c = (guchar) *p;
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+    g_string_append_len(buf, run, p - run);
+    run = p + 1;
+
+    switch (c)
+    {
+      case '"':
+        g_string_append(buf, "\\\"");
+        break;
+      case '\\':
+        g_string_append(buf, "\\\\");
+        break;
+      case '\n':
+        g_string_append(buf, "\\n");
+        break;
+      case '\r':
+        g_string_append(buf, "\\r");
+        break;
+      case '\t':
+        g_string_append(buf, "\\t");
+        break;
+      default:
+        g_string_append(buf, "\\u00");
+        g_string_append_c(buf, hex[c >> 4]);
+        g_string_append_c(buf, hex[c & 0xf]);
+    }
+  }
+
+  g_string_append(buf, run);
+  g_string_append_c(buf, '"');
+}
+
+// Writes an object member name; the next value written belongs to it.
+void vtx_signaling_writer_key(VtxSignalingWriter *w, const gchar *key)
+{
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    vtx_json_append_string(w->buf, key);
+    g_string_append_c(w->buf, ':');
+    w->after_key = TRUE;
+  }
+  else
+  {
+    gsize len = strlen(key);
+    vtx_cbor_head(w->buf, CBOR_TEXT, len);
+    g_string_append_len(w->buf, key, len);
+  }
+}
+
+// Writes a string value; NULL is written as null.
+void vtx_signaling_writer_string(VtxSignalingWriter *w, const gchar *value)
+{
+  if (!value)
+  {
+    vtx_signaling_writer_null(w);
+    return;
+  }
+
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    vtx_json_append_string(w->buf, value);
+  }
+  else
+  {
+    gsize len = strlen(value);
+    vtx_cbor_head(w->buf, CBOR_TEXT, len);
+    g_string_append_len(w->buf, value, len);
+  }
+}
+
+// Writes an integer value.
+void vtx_signaling_writer_int(VtxSignalingWriter *w, gint64 value)
+{
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    g_string_append_printf(w->buf, "%" G_GINT64_FORMAT, value);
+  }
+  else if (value >= 0)
+  {
+    vtx_cbor_head(w->buf, CBOR_UINT, (guint64) value);
+  }
+  else
+  {
+    vtx_cbor_head(w->buf, CBOR_NEGINT, (guint64) (-1 - value));
+  }
+}
+
+// Writes a floating point value; NaN and infinities have no JSON form and are written as null.
+void vtx_signaling_writer_double(VtxSignalingWriter *w, gdouble value)
+{
+  if (!isfinite(value))
+  {
+    vtx_signaling_writer_null(w);
+    return;
+  }
+
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    gchar str[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_dtostr(str, sizeof(str), value);
+    g_string_append(w->buf, str);
+    // Keep whole numbers typed as doubles for the receiver
+    if (!strpbrk(str, ".eE")) g_string_append(w->buf, ".0");
+  }
+  else
+  {
+    guint64 bits;
+    memcpy(&bits, &value, sizeof(bits));
+    g_string_append_c(w->buf, (gchar) CBOR_DOUBLE);
+    for (gint i = 7; i >= 0; i--) g_string_append_c(w->buf, (gchar) (bits >> (8 * i)));
+  }
+}
+
+// Writes a boolean value.
+void vtx_signaling_writer_boolean(VtxSignalingWriter *w, gboolean value)
+{
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    g_string_append(w->buf, value ? "true" : "false");
+  }
+  else
+  {
+    g_string_append_c(w->buf, (gchar) (value ? CBOR_TRUE : CBOR_FALSE));
+  }
+}
+
+// Writes a null value.
+void vtx_signaling_writer_null(VtxSignalingWriter *w)
+{
+  vtx_signaling_writer_prefix(w);
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    g_string_append(w->buf, "null");
+  }
+  else
+  {
+    g_string_append_c(w->buf, (gchar) CBOR_NULL);
+  }
+}
+
+// Writes an existing json-glib tree without copying it.
+void vtx_signaling_writer_node(VtxSignalingWriter *w, JsonNode *node)
+{
+  switch (node ? json_node_get_node_type(node) : JSON_NODE_NULL)
+  {
+    case JSON_NODE_OBJECT:
+      vtx_signaling_writer_begin_object(w);
+      vtx_signaling_writer_members(w, json_node_get_object(node));
+      vtx_signaling_writer_end_object(w);
+      break;
+
+    case JSON_NODE_ARRAY:
+    {
+      JsonArray *array = json_node_get_array(node);
+      guint length = json_array_get_length(array);
+
+      vtx_signaling_writer_begin_array(w);
+      for (guint i = 0; i < length; i++) vtx_signaling_writer_node(w, json_array_get_element(array, i));
+      vtx_signaling_writer_end_array(w);
+      break;
+    }
+
+    case JSON_NODE_VALUE:
+    {
+      GType value_type = json_node_get_value_type(node);
+      if (value_type == G_TYPE_INT64)
+      {
+        vtx_signaling_writer_int(w, json_node_get_int(node));
+      }
+      else if (value_type == G_TYPE_DOUBLE)
+      {
+        vtx_signaling_writer_double(w, json_node_get_double(node));
+      }
+      else if (value_type == G_TYPE_BOOLEAN)
+      {
+        vtx_signaling_writer_boolean(w, json_node_get_boolean(node));
+      }
+      else
+      {
+        vtx_signaling_writer_string(w, json_node_get_string(node));
+      }
+      break;
+    }
+
+    default:
+      vtx_signaling_writer_null(w);
+  }
+}
+
+// Writes one object member; json_object_foreach_member keeps insertion order.
+static void vtx_signaling_writer_member(JsonObject *object, const gchar *key, JsonNode *value, gpointer user_data)
+{
+  VtxSignalingWriter *w = user_data;
+  vtx_signaling_writer_key(w, key);
+  vtx_signaling_writer_node(w, value);
+}
+
+// Writes every member of an object into the object currently open in the writer.
+void vtx_signaling_writer_members(VtxSignalingWriter *w, JsonObject *object)
+{
+  if (object) json_object_foreach_member(object, vtx_signaling_writer_member, w);
+}
+
+// Sends the finished message as a text frame (JSON) or a binary frame (CBOR).
+void vtx_signaling_writer_send(VtxSignalingWriter *w, SoupWebsocketConnection *conn)
+{
+  g_return_if_fail(w->depth == 0);
+
+  if (w->encoding == VTX_SIGNALING_JSON)
+  {
+    soup_websocket_connection_send_text(conn, w->buf->str);
+  }
+  else
+  {
+    soup_websocket_connection_send_binary(conn, w->buf->str, w->buf->len);
+  }
+}
+
+typedef struct
+{
+  const guint8 *p;
+  const guint8 *end;
+} CborReader;
+
+// Reads a CBOR head. Returns the major type, the argument and whether the item is indefinite-length.
+static gboolean vtx_cbor_read_head(CborReader *r, guint8 *major, guint8 *info, guint64 *value, GError **error)
+{
+  if (r->p >= r->end)
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated CBOR item");
+    return FALSE;
+  }
+
+  guint8 initial = *r->p++;
+  *major = initial >> 5;
+  *info = initial & 0x1f;
+  *value = *info;
+
+  if (*info < 24 || *info == CBOR_INDEFINITE) return TRUE;
+
+  if (*info > 27)
+  {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Reserved CBOR additional info %u", *info);
+    return FALSE;
+  }
+
+  gsize len = (gsize) 1 << (*info - 24);
+  if ((gsize) (r->end - r->p) < len)
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated CBOR argument");
+    return FALSE;
+  }
+
+  *value = 0;
+  for (gsize i = 0; i < len; i++) *value = (*value << 8) | *r->p++;
+  return TRUE;
+}
+
+// Returns TRUE and consumes the byte when the next item is the break marker of an indefinite-length container.
+static gboolean vtx_cbor_at_break(CborReader *r)
+{
+  if (r->p < r->end && *r->p == CBOR_BREAK)
+  {
+    r->p++;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+// Reads a text or byte string, joining the chunks of an indefinite-length one. Byte strings are returned base64 encoded.
+static gchar *vtx_cbor_read_string(CborReader *r, guint8 major, guint8 info, guint64 length, GError **error)
+{
+  GString *str = g_string_new(NULL);
+
+  if (info == CBOR_INDEFINITE)
+  {
+    while (!vtx_cbor_at_break(r))
+    {
+      guint8 chunk_major, chunk_info;
+      guint64 chunk_length;
+      if (!vtx_cbor_read_head(r, &chunk_major, &chunk_info, &chunk_length, error)) goto fail;
+      if (chunk_major != major || chunk_info == CBOR_INDEFINITE || chunk_length > (guint64) (r->end - r->p))
+      {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Malformed CBOR string chunk");
+        goto fail;
+      }
+      g_string_append_len(str, (const gchar *) r->p, chunk_length);
+      r->p += chunk_length;
+    }
+  }
+  else
+  {
+    if (length > (guint64) (r->end - r->p))
+    {
+      g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Truncated CBOR string");
+      goto fail;
+    }
+    g_string_append_len(str, (const gchar *) r->p, length);
+    r->p += length;
+  }
+
+  if (major == CBOR_BYTES)
+  {
+    gchar *encoded = g_base64_encode((const guchar *) str->str, str->len);
+    g_string_free(str, TRUE);
+    return encoded;
+  }
+
+  if (!g_utf8_validate(str->str, str->len, NULL))
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "CBOR text string is not valid UTF-8");
+    goto fail;
+  }
+
+  return g_string_free(str, FALSE);
+
+fail:
+  g_string_free(str, TRUE);
+  return NULL;
+}
+
+// Converts an IEEE 754 half-precision value.
+static gdouble vtx_cbor_half_to_double(guint16 half)
+{
+  gint exponent = (half >> 10) & 0x1f;
+  gint mantissa = half & 0x3ff;
+  gdouble value;
+
+  if (exponent == 0)
+  {
+    value = ldexp(mantissa, -24);
+  }
+  else if (exponent != 31)
+  {
+    value = ldexp(mantissa + 1024, exponent - 25);
+  }
+  else
+  {
+    value = mantissa == 0 ? INFINITY : NAN;
+  }
+
+  return half & 0x8000 ? -value : value;
+}
+
+// Decodes one CBOR data item into a json-glib node.
+static JsonNode *vtx_cbor_read_item(CborReader *r, guint depth, GError **error)
+{
+  guint8 major, info;
+  guint64 value;
+
+  if (depth >= SIGNALING_CODEC_MAX_DEPTH)
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "CBOR nesting too deep");
+    return NULL;
+  }
+
+  if (!vtx_cbor_read_head(r, &major, &info, &value, error)) return NULL;
+
+  // Tags carry no meaning for signaling; decode the tagged item
+  while (major == CBOR_TAG)
+  {
+    if (!vtx_cbor_read_head(r, &major, &info, &value, error)) return NULL;
+  }
+
+  if (info == CBOR_INDEFINITE && (major == CBOR_UINT || major == CBOR_NEGINT || major == CBOR_SIMPLE))
+  {
+    g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unexpected CBOR break");
+    return NULL;
+  }
+
+  JsonNode *node = NULL;
+
+  switch (major)
+  {
+    case CBOR_UINT:
+      if (value > G_MAXINT64)
+      {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "CBOR integer out of range");
+        return NULL;
+      }
+      node = json_node_init_int(json_node_alloc(), (gint64) value);
+      break;
+
+    case CBOR_NEGINT:
+      if (value > G_MAXINT64)
+      {
+        g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "CBOR integer out of range");
+        return NULL;
+      }
+      node = json_node_init_int(json_node_alloc(), -1 - (gint64) value);
+      break;
+
+    case CBOR_BYTES:
+    case CBOR_TEXT:
+    {
+      gchar *str = vtx_cbor_read_string(r, major, info, value, error);
+      if (!str) return NULL;
+      node = json_node_init_string(json_node_alloc(), str);
+      g_free(str);
+      break;
+    }
+
+    case CBOR_ARRAY:
+    {
+      JsonArray *array = json_array_new();
+      for (guint64 i = 0; info == CBOR_INDEFINITE ? !vtx_cbor_at_break(r) : i < value; i++)
+      {
+        JsonNode *element = vtx_cbor_read_item(r, depth + 1, error);
+        if (!element)
+        {
+          json_array_unref(array);
+          return NULL;
+        }
+        json_array_add_element(array, element);
+      }
+      node = json_node_init_array(json_node_alloc(), array);
+      json_array_unref(array);
+      break;
+    }
+
+    case CBOR_MAP:
+    {
+      JsonObject *object = json_object_new();
+      for (guint64 i = 0; info == CBOR_INDEFINITE ? !vtx_cbor_at_break(r) : i < value; i++)
+      {
+        guint8 key_major, key_info;
+        guint64 key_length;
+        gchar *key = NULL;
+
+        if (vtx_cbor_read_head(r, &key_major, &key_info, &key_length, error))
+        {
+          if (key_major == CBOR_TEXT)
+          {
+            key = vtx_cbor_read_string(r, key_major, key_info, key_length, error);
+          }
+          else
+          {
+            g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "CBOR map key is not a text string");
+          }
+        }
+
+        JsonNode *member = key ? vtx_cbor_read_item(r, depth + 1, error) : NULL;
+        if (!member)
+        {
+          g_free(key);
+          json_object_unref(object);
+          return NULL;
+        }
+        json_object_set_member(object, key, member);
+        g_free(key);
+      }
+      node = json_node_init_object(json_node_alloc(), object);
+      json_object_unref(object);
+      break;
+    }
+
+    case CBOR_SIMPLE:
+      switch (info)
+      {
+        case 20:
+          node = json_node_init_boolean(json_node_alloc(), FALSE);
+          break;
+        case 21:
+          node = json_node_init_boolean(json_node_alloc(), TRUE);
+          break;
+        case 22:
+        case 23:
+          node = json_node_init_null(json_node_alloc());
+          break;
+        case 25:
+          node = json_node_init_double(json_node_alloc(), vtx_cbor_half_to_double((guint16) value));
+          break;
+        case 26:
+        {
+          guint32 bits = (guint32) value;
+          gfloat f;
+          memcpy(&f, &bits, sizeof(f));
+          node = json_node_init_double(json_node_alloc(), f);
+          break;
+        }
+        case 27:
+        {
+          gdouble d;
+          memcpy(&d, &value, sizeof(d));
+          node = json_node_init_double(json_node_alloc(), d);
+          break;
+        }
+        default:
+          g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unsupported CBOR simple value %u", info);
+      }
+      break;
+  }
+
+  return node;
+}
+
+// Parses a received frame straight from its bytes, without copying it into a NUL-terminated string first.
+JsonNode *vtx_signaling_decode(GBytes *message, VtxSignalingEncoding encoding, GError **error)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data(message, &size);
+
+  if (encoding == VTX_SIGNALING_CBOR)
+  {
+    CborReader reader = {data, data + size};
+    JsonNode *root = vtx_cbor_read_item(&reader, 0, error);
+    if (root && reader.p != reader.end)
+    {
+      g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Trailing bytes after CBOR message");
+      json_node_unref(root);
+      return NULL;
+    }
+    return root;
+  }
+
+  JsonParser *parser = json_parser_new();
+  JsonNode *root = NULL;
+  if (json_parser_load_from_data(parser, (const gchar *) data, (gssize) size, error))
+  {
+    root = json_parser_steal_root(parser);
+  }
+  g_object_unref(parser);
+  return root;
+}
@@ -0,0 +1,345 @@
+#include "headers/spare.h"
+
+#include <gst/webrtc/webrtc.h>
+
+#include "headers/common.h"
+#include "headers/data_channel.h"
+#include "headers/dtls.h"
+#include "headers/rtp.h"
+#include "headers/webrtc.h"
+
+#define SPARE_STATE_KEY "vtx-spare-state"
+
+typedef struct
+{
+  gchar *candidate;
+  guint mlineindex;
+} SpareCandidate;
+
+// Negotiation state of a spare webrtcbin, owned by the webrtcbin so its handlers stay valid after it becomes a session.
+typedef struct
+{
+  GstWebRTCSessionDescription *offer;  // local description, NULL until created
+  GPtrArray *candidates;               // SpareCandidate gathered before the session started
+  gboolean negotiated;                 // the pre-session offer has been requested
+  gboolean taken;                      // a session owns the webrtcbin; candidates go straight to signaling
+  gint64 build_us;                     // webrtcbin creation, linking and start
+  gint64 built_at_us;
+  gint64 offer_at_us;     // data channels created and local description set
+  gint64 gathered_at_us;  // ICE gathering complete, 0 while still gathering
+} SpareState;
+
+// The spare webrtcbin attached to the idle shared pipeline, NULL when none is prepared
+static GstElement *s_spare = NULL;
+
+// Guards SpareState, which webrtcbin's own threads update
+static GMutex s_lock;
+
+// Session settings the spare is built for, from the last warm session (or VTX_MEDIA_PARAMS)
+static gchar *s_network_interface = NULL;
+static gchar *s_priorities[PIPELINE_MAX_TRANSCEIVERS];  // per transceiver, in link order
+static guint s_n_priorities = 0;
+
+static guint s_used = 0;
+static guint s_discarded = 0;
+static gint64 s_last_build_us = -1;
+static gint64 s_last_offer_us = -1;
+static gint64 s_last_gathering_us = -1;
+
+// Frees a buffered candidate.
+static void vtx_spare_candidate_free(gpointer data)
+{
+  SpareCandidate *c = data;
+  g_free(c->candidate);
+  g_free(c);
+}
+
+// Frees the spare state when its webrtcbin is finalized.
+static void vtx_spare_state_free(gpointer data)
+{
+  SpareState *state = data;
+  if (state->offer) gst_webrtc_session_description_free(state->offer);
+  g_ptr_array_unref(state->candidates);
+  g_free(state);
+}
+
+// Buffers candidates gathered before the session exists; once taken, forwards them like any session's.
+static void vtx_spare_on_ice_candidate(GstElement *element, guint mlineindex, gchar *candidate, gpointer user_data)
+{
+  SpareState *state = user_data;
+
+  g_mutex_lock(&s_lock);
+  gboolean taken = state->taken;
+  if (!taken)
+  {
+    SpareCandidate *c = g_new0(SpareCandidate, 1);
+    c->candidate = g_strdup(candidate);
+    c->mlineindex = mlineindex;
+    g_ptr_array_add(state->candidates, c);
+  }
+  g_mutex_unlock(&s_lock);
+
+  if (taken) vtx_webrtc_on_ice_candidate(element, mlineindex, candidate, NULL);
+}
+
+// Records when gathering of the pre-session candidates completed.
+static void vtx_spare_on_gathering_state(GstElement *element, GParamSpec *pspec, gpointer user_data)
+{
+  SpareState *state = user_data;
+  GstWebRTCICEGatheringState gathering;
+  g_object_get(element, "ice-gathering-state", &gathering, NULL);
+  if (gathering != GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE) return;
+
+  g_mutex_lock(&s_lock);
+  if (!state->gathered_at_us) state->gathered_at_us = g_get_monotonic_time();
+  g_mutex_unlock(&s_lock);
+}
+
+// Sets the pre-session offer as local description, which starts gathering, and keeps it until a session takes the spare.
+static void vtx_spare_on_create_offer(GstPromise *promise, gpointer user_data)
+{
+  GstElement *element = user_data;
+  SpareState *state = g_object_get_data(G_OBJECT(element), SPARE_STATE_KEY);
+  GstWebRTCSessionDescription *offer = NULL;
+  const GstStructure *reply = gst_promise_get_reply(promise);
+  if (reply) gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+  if (!offer || !state)
+  {
+    gst_printerrln("Spare webrtcbin could not create an offer");
+    return;
+  }
+
+  GstPromise *local_desc_promise = gst_promise_new();
+  g_signal_emit_by_name(element, "set-local-description", offer, local_desc_promise);
+  gst_promise_interrupt(local_desc_promise);
+  gst_promise_unref(local_desc_promise);
+
+  g_mutex_lock(&s_lock);
+  state->offer = offer;
+  state->offer_at_us = g_get_monotonic_time();
+  g_mutex_unlock(&s_lock);
+}
+
+// Creates the data channels and the offer of the spare before any session exists; later renegotiations are handled as
+// for any primary session.
+static void vtx_spare_on_negotiation_needed(GstElement *element, gpointer user_data)
+{
+  SpareState *state = user_data;
+
+  g_mutex_lock(&s_lock);
+  gboolean first = !state->negotiated;
+  gboolean taken = state->taken;
+  state->negotiated = TRUE;
+  g_mutex_unlock(&s_lock);
+
+  if (!first)
+  {
+    if (taken) vtx_webrtc_on_negotiation_needed(element, NULL);
+    return;
+  }
+
+  vtx_dc_create_offer(element);
+  GstPromise *promise = gst_promise_new_with_change_func(vtx_spare_on_create_offer, gst_object_ref(element), gst_object_unref);
+  g_signal_emit_by_name(element, "create-offer", NULL, promise);
+}
+
+// Remembers the session settings a spare webrtcbin has to be built with.
+void vtx_spare_remember(const MediaParams *params)
+{
+  g_free(s_network_interface);
+  const gchar *priorities[PIPELINE_MAX_TRANSCEIVERS];
+  guint n_priorities = vtx_pipeline_get_transceiver_priorities(params, priorities);
+
+  for (guint i = 0; i < s_n_priorities; i++)
+  {
+    g_clear_pointer(&s_priorities[i], g_free);
+  }
+  s_network_interface = g_strdup(params->network_interface);
+  for (guint i = 0; i < n_priorities; i++)
+  {
+    s_priorities[i] = g_strdup(priorities[i]);
+  }
+  s_n_priorities = n_priorities;
+}
+
+// Attaches a spare webrtcbin to the idle shared pipeline and lets it create its data channels and offer and gather its
+// candidates, so the next session only has to send them. Only done while the pipeline is kept warm and no session runs.
+void vtx_spare_prepare(VtxStandby *standby)
+{
+  if (s_spare || pipeline || !standby || vtx_standby_is_idle(standby)) return;
+
+  gint64 start_us = g_get_monotonic_time();
+  MediaParams params = {0};
+  params.network_interface = s_network_interface;
+
+  gchar *error_msg = NULL;
+  GstElement *element = vtx_pipeline_make_webrtcbin(&params, &error_msg);
+  if (!element)
+  {
+    gst_printerrln("Failed to create spare webrtcbin: %s", error_msg ? error_msg : "unknown");
+    g_free(error_msg);
+    return;
+  }
+  gst_object_ref_sink(element);
+
+  if (!vtx_standby_attach(standby, element, NULL))
+  {
+    gst_object_unref(element);
+    return;
+  }
+
+  GArray *transceivers = NULL;
+  g_signal_emit_by_name(element, "get-transceivers", &transceivers);
+  if (transceivers)
+  {
+    vtx_rtp_set_transceiver_priority(transceivers, (const gchar *const *) s_priorities, s_n_priorities);
+    g_array_unref(transceivers);
+  }
+
+  vtx_dtls_apply(element);
+
+  SpareState *state = g_new0(SpareState, 1);
+  state->candidates = g_ptr_array_new_with_free_func(vtx_spare_candidate_free);
+  g_object_set_data_full(G_OBJECT(element), SPARE_STATE_KEY, state, vtx_spare_state_free);
+
+  g_signal_connect(element, "on-negotiation-needed", G_CALLBACK(vtx_spare_on_negotiation_needed), state);
+  g_signal_connect(element, "on-ice-candidate", G_CALLBACK(vtx_spare_on_ice_candidate), state);
+  g_signal_connect(element, "notify::ice-gathering-state", G_CALLBACK(vtx_spare_on_gathering_state), state);
+
+  state->built_at_us = g_get_monotonic_time();
+  state->build_us = state->built_at_us - start_us;
+  vtx_standby_preroll(standby, element);
+  s_spare = element;
+  gst_println("Spare webrtcbin prepared in %.1f ms, negotiating ahead of the next session", state->build_us / 1000.0);
+}
+
+// Returns TRUE if the spare's transceiver priorities are the ones the session asks for.
+static gboolean vtx_spare_priorities_match(const MediaParams *params)
+{
+  const gchar *priorities[PIPELINE_MAX_TRANSCEIVERS];
+  guint n_priorities = vtx_pipeline_get_transceiver_priorities(params, priorities);
+  if (n_priorities != s_n_priorities) return FALSE;
+
+  for (guint i = 0; i < n_priorities; i++)
+  {
+    if (g_strcmp0(priorities[i], s_priorities[i]) != 0) return FALSE;
+  }
+  return TRUE;
+}
+
+// Hands the spare webrtcbin to a new primary session (the caller takes the reference) if its offer is ready and it was
+// built for the same settings; otherwise discards it and returns NULL.
+GstElement *vtx_spare_take(const MediaParams *params)
+{
+  if (!s_spare) return NULL;
+
+  SpareState *state = g_object_get_data(G_OBJECT(s_spare), SPARE_STATE_KEY);
+  g_mutex_lock(&s_lock);
+  gboolean ready = state->offer != NULL;
+  g_mutex_unlock(&s_lock);
+
+  const gchar *reason = NULL;
+  if (!ready)
+  {
+    reason = "offer not ready yet";
+  }
+  else if (g_strcmp0(s_network_interface, params->network_interface) != 0)
+  {
+    reason = "different network interface";
+  }
+  else if (!vtx_spare_priorities_match(params))
+  {
+    reason = "different transceiver priorities";
+  }
+
+  if (reason)
+  {
+    gst_println("Spare webrtcbin not used (%s)", reason);
+    vtx_spare_discard();
+    return NULL;
+  }
+
+  GstElement *element = s_spare;
+  s_spare = NULL;
+  return element;
+}
+
+// Sends the offer and the candidates the spare prepared, then lets further candidates go out directly.
+void vtx_spare_send_offer(GstElement *element)
+{
+  SpareState *state = g_object_get_data(G_OBJECT(element), SPARE_STATE_KEY);
+  if (!state) return;
+
+  vtx_webrtc_send_sdp_offer(element, state->offer);
+
+  g_mutex_lock(&s_lock);
+  state->taken = TRUE;
+  GPtrArray *candidates = state->candidates;
+  state->candidates = g_ptr_array_new_with_free_func(vtx_spare_candidate_free);
+  gint64 now_us = g_get_monotonic_time();
+  gint64 offer_us = state->offer_at_us - state->built_at_us;
+  gint64 gathering_us = (state->gathered_at_us ? state->gathered_at_us : now_us) - state->offer_at_us;
+  gboolean gathered = state->gathered_at_us != 0;
+  g_mutex_unlock(&s_lock);
+
+  for (guint i = 0; i < candidates->len; i++)
+  {
+    SpareCandidate *c = g_ptr_array_index(candidates, i);
+    vtx_webrtc_on_ice_candidate(element, c->mlineindex, c->candidate, NULL);
+  }
+  if (gathered) vtx_webrtc_end_of_candidates(element);
+
+  s_used++;
+  s_last_build_us = state->build_us;
+  s_last_offer_us = offer_us;
+  s_last_gathering_us = gathering_us;
+  gst_println("Pre-negotiated offer sent with %u candidate(s): saved %.1f ms (webrtcbin %.1f, offer %.1f, gathering %.1f%s)", candidates->len, (state->build_us + offer_us + gathering_us) / 1000.0, state->build_us / 1000.0, offer_us / 1000.0, gathering_us / 1000.0, gathered ? "" : ", still gathering");
+  g_ptr_array_unref(candidates);
+}
+
+// Removes the spare webrtcbin and the data channels it created.
+void vtx_spare_discard(void)
+{
+  if (!s_spare) return;
+
+  if (g_standby) vtx_standby_detach(g_standby, s_spare);
+  gst_object_unref(s_spare);
+  s_spare = NULL;
+  s_discarded++;
+
+  // The spare's data channels are the only ones while no session runs
+  if (!pipeline) vtx_dc_cleanup();
+}
+
+// Returns TRUE if the webrtcbin is the spare, negotiating ahead of a session that has not started yet.
+gboolean vtx_spare_is_pending(GstElement *webrtc)
+{
+  return webrtc && webrtc == s_spare;
+}
+
+// Returns whether a spare is ready and the phases the last pre-negotiated session skipped.
+JsonObject *vtx_spare_get_stats(void)
+{
+  JsonObject *o = json_object_new();
+  SpareState *state = s_spare ? g_object_get_data(G_OBJECT(s_spare), SPARE_STATE_KEY) : NULL;
+
+  g_mutex_lock(&s_lock);
+  json_object_set_boolean_member(o, "ready", state && state->offer);
+  g_mutex_unlock(&s_lock);
+  json_object_set_int_member(o, "used", s_used);
+  json_object_set_int_member(o, "discarded", s_discarded);
+
+  if (s_used > 0)
+  {
+    json_object_set_double_member(o, "last_saved_ms", (s_last_build_us + s_last_offer_us + s_last_gathering_us) / 1000.0);
+    json_object_set_double_member(o, "last_webrtcbin_ms", s_last_build_us / 1000.0);
+    json_object_set_double_member(o, "last_offer_ms", s_last_offer_us / 1000.0);
+    json_object_set_double_member(o, "last_gathering_ms", s_last_gathering_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "last_saved_ms");
+  }
+
+  return o;
+}
@@ -0,0 +1,666 @@
+#include "headers/standby.h"
+
+#include <gst/video/video.h>
+#include <gst/webrtc/webrtc.h>
+#include <stdlib.h>
+
+#include "headers/spare.h"
+
+typedef struct
+{
+  GstPad *tee_pad;    // request pad on the standby tee, NULL if the stream is not present
+  GstElement *queue;  // leaky per-peer queue between the tee and webrtcbin
+  gboolean unlinked;  // unlinked from the tee by the idle probe of a detach, guarded by PeerDetach.lock
+} PeerBranch;
+
+typedef struct
+{
+  GstElement *webrtc;
+  gchar *viewer_id;  // ws2Id of an additional viewer, NULL for the primary session
+  PeerBranch video;
+  PeerBranch audio;
+  PeerBranch tracks[TRACKS_MAX];  // additional video tracks, in order
+  guint overruns;  // buffers dropped by this peer's leaky queues (atomic)
+} StandbyPeer;
+
+// A peer being detached. Its webrtcbin leaves the pipeline right away; its queues are released on the main loop once every
+// tee branch went idle, or after STANDBY_DETACH_TIMEOUT_MS. Shared with the idle probes and freed with the last reference,
+// so a probe that fires after the timeout does not touch freed memory.
+typedef struct
+{
+  GMutex lock;
+  gint refs;
+  StandbyPeer *peer;
+  GstElement *pipeline;
+  guint pending;      // tee branches not unlinked yet, guarded by lock
+  gboolean finished;  // guarded by lock
+  guint timeout_id;
+  guint remaining;  // peers still attached, for the log
+} PeerDetach;
+
+// Idle probe data of one branch of a detach.
+typedef struct
+{
+  PeerDetach *detach;
+  PeerBranch *branch;
+} BranchIdle;
+
+struct VtxStandby
+{
+  GstElement *pipeline;
+  gchar *video_pipeline;
+  gchar *audio_pipeline;
+  gchar *tracks;
+  GstElement *video_tee;
+  GstElement *audio_tee;
+  GList *peers;  // StandbyPeer, in attach order
+  gboolean keep_warm;
+  guint sessions;
+};
+
+VtxStandby *g_standby = NULL;
+
+// Time from SENDER_MEDIA_STREAM_START to the first video packet reaching webrtcbin, per start mode (-1 = not measured)
+static gint64 s_first_frame_cold_us = -1;
+static gint64 s_first_frame_warm_us = -1;
+
+// Returns the description a standby pipeline is matched on: the serialized media graph when one is given, else the pipeline string.
+static gchar *vtx_standby_describe(const gchar *media_pipeline, JsonNode *graph)
+{
+  return graph ? json_to_string(graph, FALSE) : g_strdup(media_pipeline);
+}
+
+// Builds the capture+encode pipeline with its payloaders feeding idle fakesinks. The caller sets it to PLAYING.
+VtxStandby *vtx_standby_new(const MediaParams *params, gchar **error_msg)
+{
+  GstElement *pipeline = vtx_pipeline_build_standby(params, error_msg);
+  if (!pipeline) return NULL;
+
+  VtxStandby *standby = g_new0(VtxStandby, 1);
+  standby->pipeline = pipeline;
+  standby->video_pipeline = vtx_standby_describe(params->video_pipeline, params->video_graph);
+  standby->audio_pipeline = vtx_standby_describe(params->audio_pipeline, params->audio_graph);
+  standby->tracks = vtx_tracks_describe(params->video_tracks, params->n_video_tracks);
+  standby->video_tee = gst_bin_get_by_name(GST_BIN(pipeline), STANDBY_VIDEO_TEE);
+  standby->audio_tee = gst_bin_get_by_name(GST_BIN(pipeline), STANDBY_AUDIO_TEE);
+  standby->keep_warm = params->warm_standby;
+
+  gst_println("Shared media pipeline created (%s)", standby->keep_warm ? "kept warm" : "stopped with the last viewer");
+  return standby;
+}
+
+// Returns the peer attached through the given webrtcbin, or NULL.
+static StandbyPeer *vtx_standby_find_peer(VtxStandby *standby, GstElement *webrtc)
+{
+  for (GList *l = standby->peers; l; l = l->next)
+  {
+    StandbyPeer *peer = l->data;
+    if (peer->webrtc == webrtc) return peer;
+  }
+  return NULL;
+}
+
+// Stops the standby pipeline, detaching any peers still attached, and frees it.
+void vtx_standby_free(VtxStandby *standby)
+{
+  if (!standby) return;
+
+  while (standby->peers)
+  {
+    StandbyPeer *peer = standby->peers->data;
+    vtx_standby_detach(standby, peer->webrtc);
+  }
+
+  GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(standby->pipeline));
+  gst_bus_remove_watch(bus);
+  gst_object_unref(bus);
+  gst_element_set_state(standby->pipeline, GST_STATE_NULL);
+
+  if (standby->video_tee) gst_object_unref(standby->video_tee);
+  if (standby->audio_tee) gst_object_unref(standby->audio_tee);
+  gst_object_unref(standby->pipeline);
+  g_free(standby->video_pipeline);
+  g_free(standby->audio_pipeline);
+  g_free(standby->tracks);
+  g_free(standby);
+
+  gst_println("Shared media pipeline stopped");
+}
+
+// Returns the standby pipeline (borrowed reference).
+GstElement *vtx_standby_get_pipeline(VtxStandby *standby)
+{
+  return standby ? standby->pipeline : NULL;
+}
+
+// Returns TRUE if the standby pipeline was built from the same media descriptions (or graphs) as the requested session.
+gboolean vtx_standby_matches(VtxStandby *standby, const MediaParams *params)
+{
+  gchar *video = vtx_standby_describe(params->video_pipeline, params->video_graph);
+  gchar *audio = vtx_standby_describe(params->audio_pipeline, params->audio_graph);
+  gchar *tracks = vtx_tracks_describe(params->video_tracks, params->n_video_tracks);
+  gboolean matches = g_strcmp0(standby->video_pipeline, video) == 0 && g_strcmp0(standby->audio_pipeline, audio) == 0 && g_strcmp0(standby->tracks, tracks) == 0;
+  g_free(video);
+  g_free(audio);
+  g_free(tracks);
+  return matches;
+}
+
+// Keeps the pipeline running after its last viewer leaves.
+void vtx_standby_set_keep_warm(VtxStandby *standby, gboolean keep_warm)
+{
+  standby->keep_warm = keep_warm;
+}
+
+// Returns TRUE if no viewer is attached and the pipeline is not meant to be kept warm.
+gboolean vtx_standby_is_idle(VtxStandby *standby)
+{
+  return !standby->peers && !standby->keep_warm;
+}
+
+// Returns the webrtcbin of the additional viewer with the given ws2Id (borrowed reference), or NULL.
+GstElement *vtx_standby_find_viewer(VtxStandby *standby, const gchar *viewer_id)
+{
+  if (!standby || !viewer_id) return NULL;
+
+  for (GList *l = standby->peers; l; l = l->next)
+  {
+    StandbyPeer *peer = l->data;
+    if (g_strcmp0(peer->viewer_id, viewer_id) == 0) return peer->webrtc;
+  }
+  return NULL;
+}
+
+// Calls func with each attached peer's webrtcbin.
+void vtx_standby_foreach_peer(VtxStandby *standby, GFunc func, gpointer user_data)
+{
+  if (!standby) return;
+
+  for (GList *l = standby->peers; l; l = l->next)
+  {
+    StandbyPeer *peer = l->data;
+    func(peer->webrtc, user_data);
+  }
+}
+
+// Counts buffers a leaky peer queue drops because its webrtcbin fell behind.
+static void vtx_standby_on_queue_overrun(GstElement *queue, gpointer user_data)
+{
+  StandbyPeer *peer = user_data;
+  g_atomic_int_inc(&peer->overruns);
+}
+
+// Requests a tee src pad and links it through a fresh leaky queue to a new webrtcbin sink pad.
+static gboolean vtx_standby_branch_attach(VtxStandby *standby, GstElement *tee, StandbyPeer *peer, PeerBranch *branch)
+{
+  if (!tee) return TRUE;
+
+  // A peer whose network falls behind drops its own oldest packets instead of stalling the tee for everyone
+  branch->queue = gst_element_factory_make_full("queue", "leaky", 2, "max-size-buffers", 0, "max-size-bytes", 0, "max-size-time", (guint64) STANDBY_PEER_QUEUE_MS * GST_MSECOND, NULL);
+  g_signal_connect(branch->queue, "overrun", G_CALLBACK(vtx_standby_on_queue_overrun), peer);
+  gst_bin_add(GST_BIN(standby->pipeline), branch->queue);
+
+  branch->tee_pad = gst_element_request_pad_simple(tee, "src_%u");
+  GstPad *queue_sink = gst_element_get_static_pad(branch->queue, "sink");
+  gboolean linked = gst_pad_link(branch->tee_pad, queue_sink) == GST_PAD_LINK_OK && gst_element_link_pads(branch->queue, "src", peer->webrtc, "sink_%u");
+  gst_object_unref(queue_sink);
+
+  return linked;
+}
+
+// Returns the tee of the additional video track with the 1-based index (new reference), or NULL past the last track.
+static GstElement *vtx_standby_track_tee(VtxStandby *standby, guint index)
+{
+  gchar *name = g_strdup_printf(TRACKS_TEE_PREFIX "%u", index);
+  GstElement *tee = gst_bin_get_by_name(GST_BIN(standby->pipeline), name);
+  g_free(name);
+  return tee;
+}
+
+// Adds a session's webrtcbin to the running standby pipeline and links video (first, so it is transceiver 0), audio and
+// the additional video tracks into it through per-peer queues. The new elements stay in NULL state until
+// vtx_standby_activate, so callers can configure webrtcbin first. On failure the peer is detached again.
+gboolean vtx_standby_attach(VtxStandby *standby, GstElement *webrtc, const gchar *viewer_id)
+{
+  StandbyPeer *peer = g_new0(StandbyPeer, 1);
+  peer->webrtc = gst_object_ref(webrtc);
+  peer->viewer_id = g_strdup(viewer_id);
+  standby->peers = g_list_append(standby->peers, peer);
+  gst_bin_add(GST_BIN(standby->pipeline), webrtc);
+
+  gboolean linked = vtx_standby_branch_attach(standby, standby->video_tee, peer, &peer->video) && vtx_standby_branch_attach(standby, standby->audio_tee, peer, &peer->audio);
+  for (guint i = 0; i < TRACKS_MAX && linked; i++)
+  {
+    GstElement *tee = vtx_standby_track_tee(standby, i + 1);
+    if (!tee) break;
+    linked = vtx_standby_branch_attach(standby, tee, peer, &peer->tracks[i]);
+    gst_object_unref(tee);
+  }
+
+  if (!linked)
+  {
+    gst_printerrln("Failed to link standby media to webrtcbin");
+    vtx_standby_detach(standby, webrtc);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+// Starts the peer's elements without counting it as a session, so webrtcbin can negotiate before a viewer exists.
+void vtx_standby_preroll(VtxStandby *standby, GstElement *webrtc)
+{
+  StandbyPeer *peer = vtx_standby_find_peer(standby, webrtc);
+  if (!peer) return;
+
+  gst_element_sync_state_with_parent(peer->webrtc);
+  if (peer->video.queue) gst_element_sync_state_with_parent(peer->video.queue);
+  if (peer->audio.queue) gst_element_sync_state_with_parent(peer->audio.queue);
+  for (guint i = 0; i < TRACKS_MAX; i++)
+  {
+    if (peer->tracks[i].queue) gst_element_sync_state_with_parent(peer->tracks[i].queue);
+  }
+}
+
+// Starts the peer's elements and asks the encoders for a keyframe so the new viewer does not wait for the next GOP.
+void vtx_standby_activate(VtxStandby *standby, GstElement *webrtc)
+{
+  StandbyPeer *peer = vtx_standby_find_peer(standby, webrtc);
+  if (!peer) return;
+
+  vtx_standby_preroll(standby, webrtc);
+
+  GstElement *queues[1 + TRACKS_MAX] = {peer->video.queue};
+  for (guint i = 0; i < TRACKS_MAX; i++)
+  {
+    queues[i + 1] = peer->tracks[i].queue;
+  }
+  for (guint i = 0; i < G_N_ELEMENTS(queues); i++)
+  {
+    if (!queues[i]) continue;
+
+    GstPad *queue_src = gst_element_get_static_pad(queues[i], "src");
+    gst_pad_send_event(queue_src, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref(queue_src);
+  }
+
+  standby->sessions++;
+  gst_println("Viewer %s attached to shared media pipeline (%u attached, %u total)", peer->viewer_id ? peer->viewer_id : "primary", g_list_length(standby->peers), standby->sessions);
+}
+
+// Fills branches with the peer's branches: video, audio, then the additional video tracks.
+static void vtx_standby_peer_branches(StandbyPeer *peer, PeerBranch **branches)
+{
+  branches[0] = &peer->video;
+  branches[1] = &peer->audio;
+  for (guint i = 0; i < TRACKS_MAX; i++)
+  {
+    branches[i + 2] = &peer->tracks[i];
+  }
+}
+
+// Takes a reference to a peer detach.
+static PeerDetach *vtx_standby_detach_ref(PeerDetach *detach)
+{
+  g_atomic_int_inc(&detach->refs);
+  return detach;
+}
+
+// Drops one reference to a peer detach; the last one frees the peer.
+static void vtx_standby_detach_unref(gpointer data)
+{
+  PeerDetach *detach = data;
+  if (!g_atomic_int_dec_and_test(&detach->refs)) return;
+
+  gst_object_unref(detach->peer->webrtc);
+  g_free(detach->peer->viewer_id);
+  g_free(detach->peer);
+  gst_object_unref(detach->pipeline);
+  g_mutex_clear(&detach->lock);
+  g_free(detach);
+}
+
+// Releases the tee pads and queues of a detached peer; a branch that never went idle is unlinked anyway. Main thread only.
+static void vtx_standby_detach_finish(PeerDetach *detach)
+{
+  g_mutex_lock(&detach->lock);
+  gboolean finished = detach->finished;
+  detach->finished = TRUE;
+  g_mutex_unlock(&detach->lock);
+  if (finished) return;
+
+  if (detach->timeout_id)
+  {
+    g_source_remove(detach->timeout_id);
+    detach->timeout_id = 0;
+  }
+
+  StandbyPeer *peer = detach->peer;
+  PeerBranch *branches[PIPELINE_MAX_TRANSCEIVERS];
+  vtx_standby_peer_branches(peer, branches);
+  for (guint i = 0; i < G_N_ELEMENTS(branches); i++)
+  {
+    PeerBranch *branch = branches[i];
+    if (branch->tee_pad)
+    {
+      // A late probe finds the detach finished and leaves the pad alone
+      if (!branch->unlinked) gst_printerrln("Standby branch did not go idle, unlinking anyway");
+
+      GstPad *queue_sink = gst_pad_get_peer(branch->tee_pad);
+      if (queue_sink)
+      {
+        gst_pad_unlink(branch->tee_pad, queue_sink);
+        gst_object_unref(queue_sink);
+      }
+
+      GstElement *tee = gst_pad_get_parent_element(branch->tee_pad);
+      if (tee)
+      {
+        gst_element_release_request_pad(tee, branch->tee_pad);
+        gst_object_unref(tee);
+      }
+      gst_object_unref(branch->tee_pad);
+      branch->tee_pad = NULL;
+    }
+
+    if (branch->queue)
+    {
+      gst_element_set_state(branch->queue, GST_STATE_NULL);
+      gst_bin_remove(GST_BIN(detach->pipeline), branch->queue);
+      branch->queue = NULL;
+    }
+  }
+
+  gst_println("Viewer %s detached (%u dropped buffers), %u still attached", peer->viewer_id ? peer->viewer_id : "primary", g_atomic_int_get(&peer->overruns), detach->remaining);
+}
+
+// Finishes a detach once all its tee branches are unlinked.
+static gboolean vtx_standby_on_detach_idle(gpointer user_data)
+{
+  vtx_standby_detach_finish(user_data);
+  return G_SOURCE_REMOVE;
+}
+
+// Finishes a detach whose tee branches did not all go idle in time.
+static gboolean vtx_standby_on_detach_timeout(gpointer user_data)
+{
+  PeerDetach *detach = user_data;
+  detach->timeout_id = 0;
+  vtx_standby_detach_finish(detach);
+  return G_SOURCE_REMOVE;
+}
+
+// Frees the idle probe data of one branch.
+static void vtx_standby_branch_idle_free(gpointer data)
+{
+  BranchIdle *idle = data;
+  vtx_standby_detach_unref(idle->detach);
+  g_free(idle);
+}
+
+// Unlinks the peer branch from the tee once no buffer is in flight on it; the last branch finishes the detach on the main
+// loop.
+static GstPadProbeReturn vtx_standby_on_branch_idle(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  BranchIdle *idle = user_data;
+  PeerDetach *detach = idle->detach;
+
+  g_mutex_lock(&detach->lock);
+  if (!detach->finished && !idle->branch->unlinked)
+  {
+    GstPad *peer = gst_pad_get_peer(pad);
+    if (peer)
+    {
+      gst_pad_unlink(pad, peer);
+      gst_object_unref(peer);
+    }
+    idle->branch->unlinked = TRUE;
+    if (--detach->pending == 0) g_idle_add_full(G_PRIORITY_DEFAULT, vtx_standby_on_detach_idle, vtx_standby_detach_ref(detach), vtx_standby_detach_unref);
+  }
+  g_mutex_unlock(&detach->lock);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+// Drops whatever a detached peer's queue still pushes.
+static GstPadProbeReturn vtx_standby_on_detached_queue(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  return GST_PAD_PROBE_DROP;
+}
+
+// Cuts a peer queue off from its webrtcbin. The queue keeps accepting from the tee until its branch is unlinked there, and
+// drops what it pushes instead of failing with not-linked.
+static void vtx_standby_branch_cut(PeerBranch *branch)
+{
+  if (!branch->queue) return;
+
+  GstPad *queue_src = gst_element_get_static_pad(branch->queue, "src");
+  gst_pad_add_probe(queue_src, GST_PAD_PROBE_TYPE_DATA_DOWNSTREAM, vtx_standby_on_detached_queue, NULL, NULL);
+  GstPad *peer = gst_pad_get_peer(queue_src);
+  if (peer)
+  {
+    gst_pad_unlink(queue_src, peer);
+    gst_object_unref(peer);
+  }
+  gst_object_unref(queue_src);
+}
+
+// Removes a peer's webrtcbin and queues without blocking; capture, encoding and the other peers keep running. The
+// webrtcbin leaves the pipeline before this returns, so a reconnecting session can reuse its name. Each tee branch is
+// unlinked once it is idle and the queues are released on the main loop afterwards.
+void vtx_standby_detach(VtxStandby *standby, GstElement *webrtc)
+{
+  StandbyPeer *peer = standby && webrtc ? vtx_standby_find_peer(standby, webrtc) : NULL;
+  if (!peer) return;
+
+  standby->peers = g_list_remove(standby->peers, peer);
+
+  PeerDetach *detach = g_new0(PeerDetach, 1);
+  g_mutex_init(&detach->lock);
+  detach->refs = 1;
+  detach->peer = peer;
+  detach->pipeline = gst_object_ref(standby->pipeline);
+  detach->remaining = g_list_length(standby->peers);
+
+  PeerBranch *branches[PIPELINE_MAX_TRANSCEIVERS];
+  vtx_standby_peer_branches(peer, branches);
+  for (guint i = 0; i < G_N_ELEMENTS(branches); i++)
+  {
+    vtx_standby_branch_cut(branches[i]);
+    if (branches[i]->tee_pad) detach->pending++;
+  }
+
+  gst_element_set_state(peer->webrtc, GST_STATE_NULL);
+  gst_bin_remove(GST_BIN(standby->pipeline), peer->webrtc);
+
+  // An idle pad runs its probe inside gst_pad_add_probe, so pending is complete before the first probe is added
+  guint pending = detach->pending;
+  for (guint i = 0; i < G_N_ELEMENTS(branches); i++)
+  {
+    if (!branches[i]->tee_pad) continue;
+
+    BranchIdle *idle = g_new0(BranchIdle, 1);
+    idle->detach = vtx_standby_detach_ref(detach);
+    idle->branch = branches[i];
+    gst_pad_add_probe(branches[i]->tee_pad, GST_PAD_PROBE_TYPE_IDLE, vtx_standby_on_branch_idle, idle, vtx_standby_branch_idle_free);
+  }
+
+  if (pending == 0)
+  {
+    vtx_standby_detach_finish(detach);
+  }
+  else
+  {
+    detach->timeout_id = g_timeout_add_full(G_PRIORITY_DEFAULT, STANDBY_DETACH_TIMEOUT_MS, vtx_standby_on_detach_timeout, vtx_standby_detach_ref(detach), vtx_standby_detach_unref);
+  }
+  vtx_standby_detach_unref(detach);
+}
+
+// Builds and starts the standby pipeline from the MediaParams JSON file named by VTX_MEDIA_PARAMS, so even the first
+// viewer after boot gets a warm start. A direct RTP/SRT output in the file starts streaming instead.
+void vtx_standby_prewarm_from_env(void)
+{
+  const gchar *path = getenv(STANDBY_MEDIA_PARAMS_ENV);
+  if (!path) return;
+
+  gst_println("[Config] %s: %s", STANDBY_MEDIA_PARAMS_ENV, path);
+
+  GError *error = NULL;
+  JsonParser *parser = json_parser_new();
+  if (!json_parser_load_from_file(parser, path, &error) || !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+  {
+    gst_printerrln("Failed to load %s: %s", path, error ? error->message : "not a JSON object");
+    g_clear_error(&error);
+    g_object_unref(parser);
+    return;
+  }
+
+  MediaParams params = {0};
+  gboolean parsed = vtx_pipeline_parse_media_params(json_node_get_object(json_parser_get_root(parser)), &params);
+  if (parsed && params.output != OUTPUT_WEBRTC)
+  {
+    // A direct RTP/SRT output needs no receiver request, it streams right away
+    gchar *pipeline_error = NULL;
+    if (!vtx_pipeline_start(&params, &pipeline_error))
+    {
+      gst_printerrln("Failed to start direct output: %s", pipeline_error ? pipeline_error : "unknown");
+      g_free(pipeline_error);
+    }
+  }
+  else if (parsed)
+  {
+    params.warm_standby = TRUE;
+    gchar *pipeline_error = NULL;
+    if (!vtx_pipeline_prewarm(&params, &pipeline_error))
+    {
+      gst_printerrln("Failed to prewarm media pipeline: %s", pipeline_error ? pipeline_error : "unknown");
+      g_free(pipeline_error);
+    }
+    else
+    {
+      // Negotiate the first session's transport ahead of its request too
+      vtx_spare_remember(&params);
+      vtx_spare_prepare(g_standby);
+    }
+  }
+
+  g_object_unref(parser);
+}
+
+typedef struct
+{
+  gint64 start_us;
+  gboolean warm;
+} FirstFrameWatch;
+
+// Returns TRUE if the buffer (or any buffer of the list) starts a key unit. Payloaders that do not mark delta units make
+// every packet count.
+static gboolean vtx_standby_is_key_unit(GstPadProbeInfo *info)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) return !GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT);
+
+  GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+  for (guint i = 0; list && i < gst_buffer_list_length(list); i++)
+  {
+    if (!GST_BUFFER_FLAG_IS_SET(gst_buffer_list_get(list, i), GST_BUFFER_FLAG_DELTA_UNIT)) return TRUE;
+  }
+  return FALSE;
+}
+
+// Records the time to the first keyframe a session's webrtcbin sends once ICE and DTLS are connected (earlier packets never
+// reach the viewer, and its decoder starts at a keyframe), then removes itself.
+static GstPadProbeReturn vtx_standby_on_first_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  FirstFrameWatch *watch = user_data;
+  if (!vtx_standby_is_key_unit(info)) return GST_PAD_PROBE_OK;
+
+  GstWebRTCPeerConnectionState state = GST_WEBRTC_PEER_CONNECTION_STATE_NEW;
+  GstElement *webrtc = gst_pad_get_parent_element(pad);
+  if (webrtc)
+  {
+    g_object_get(webrtc, "connection-state", &state, NULL);
+    gst_object_unref(webrtc);
+  }
+  if (state != GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED) return GST_PAD_PROBE_OK;
+
+  gint64 elapsed = g_get_monotonic_time() - watch->start_us;
+  if (watch->warm)
+  {
+    s_first_frame_warm_us = elapsed;
+  }
+  else
+  {
+    s_first_frame_cold_us = elapsed;
+  }
+  gst_println("Time to first frame (%s start): %.1f ms", watch->warm ? "warm" : "cold", elapsed / 1000.0);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+// Installs a probe on a webrtcbin sink pad that reports the time from start_us (the stream-start request) to the first
+// keyframe sent over the connected transport.
+void vtx_standby_watch_first_frame(GstPad *pad, gint64 start_us, gboolean warm)
+{
+  if (!pad) return;
+
+  FirstFrameWatch *watch = g_new0(FirstFrameWatch, 1);
+  watch->start_us = start_us;
+  watch->warm = warm;
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, vtx_standby_on_first_frame, watch, g_free);
+}
+
+// Returns the standby state and the last measured cold and warm time to first frame.
+JsonObject *vtx_standby_get_stats(void)
+{
+  JsonObject *o = json_object_new();
+  json_object_set_boolean_member(o, "warm_standby", g_standby && g_standby->keep_warm);
+  json_object_set_int_member(o, "standby_sessions", g_standby ? g_standby->sessions : 0);
+
+  if (s_first_frame_cold_us >= 0)
+  {
+    json_object_set_double_member(o, "cold_first_frame_ms", s_first_frame_cold_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "cold_first_frame_ms");
+  }
+
+  if (s_first_frame_warm_us >= 0)
+  {
+    json_object_set_double_member(o, "warm_first_frame_ms", s_first_frame_warm_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "warm_first_frame_ms");
+  }
+
+  return o;
+}
+
+// Returns one entry per attached peer with its ws2Id (NULL for the primary session) and ICE state and the buffers its queues dropped.
+JsonArray *vtx_standby_get_viewer_stats(void)
+{
+  JsonArray *viewers = json_array_new();
+  if (!g_standby) return viewers;
+
+  for (GList *l = g_standby->peers; l; l = l->next)
+  {
+    StandbyPeer *peer = l->data;
+    GstWebRTCICEConnectionState ice_state;
+    g_object_get(peer->webrtc, "ice-connection-state", &ice_state, NULL);
+
+    JsonObject *o = json_object_new();
+    if (peer->viewer_id)
+    {
+      json_object_set_string_member(o, "ws2Id", peer->viewer_id);
+    }
+    else
+    {
+      json_object_set_null_member(o, "ws2Id");
+    }
+    json_object_set_int_member(o, "ice_connection_state", ice_state);
+    json_object_set_int_member(o, "dropped_buffers", g_atomic_int_get(&peer->overruns));
+    json_array_add_object_element(viewers, o);
+  }
+
+  return viewers;
+}
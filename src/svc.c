@@ -0,0 +1,542 @@
+#include "headers/svc.h"
+
+#include <string.h>
+
+#include "headers/common.h"
+#include "headers/encoder.h"
+#include "headers/rtp.h"
+
+// --- Frame marking RTP header extension ----------------------------------
+// Long form of the frame marking extension (scalable streams), 3 bytes:
+//  0 1 2 3 4 5 6 7 8 ...    15 16 ...   23
+// |S|E|I|D|B| TID |    LID    | TL0PICIDX |
+
+#define FRAME_MARKING_SIZE 3
+
+struct _VtxFrameMarking
+{
+  GstRTPHeaderExtension parent;
+  const GstBuffer *last_input;
+  GstClockTime last_pts;
+  guint8 tl0picidx;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE(VtxFrameMarking, vtx_frame_marking, GST_TYPE_RTP_HEADER_EXTENSION)
+/* *INDENT-ON* */
+
+// Frame marking fits both the one-byte and two-byte header extension forms.
+static GstRTPHeaderExtensionFlags vtx_frame_marking_get_supported_flags(GstRTPHeaderExtension *ext)
+{
+  return GST_RTP_HEADER_EXTENSION_ONE_BYTE | GST_RTP_HEADER_EXTENSION_TWO_BYTE;
+}
+
+// Returns the size of the long-form frame marking extension.
+static gsize vtx_frame_marking_get_max_size(GstRTPHeaderExtension *ext, const GstBuffer *input_meta)
+{
+  return FRAME_MARKING_SIZE;
+}
+
+// Writes the frame marking bits for one RTP packet from the temporal layer meta of the frame it carries.
+static gssize vtx_frame_marking_write(GstRTPHeaderExtension *ext, const GstBuffer *input_meta, GstRTPHeaderExtensionFlags write_flags, GstBuffer *output, guint8 *data, gsize size)
+{
+  VtxFrameMarking *self = VTX_FRAME_MARKING(ext);
+  g_return_val_if_fail(size >= FRAME_MARKING_SIZE, -1);
+
+  guint tid = 0;
+  gboolean sync = FALSE;
+  gboolean discardable = FALSE;
+  GstCustomMeta *meta = gst_buffer_get_custom_meta((GstBuffer *) input_meta, SVC_TEMPORAL_LAYER_META);
+  if (meta)
+  {
+    GstStructure *s = gst_custom_meta_get_structure(meta);
+    gst_structure_get_uint(s, "tid", &tid);
+    gst_structure_get_boolean(s, "sync", &sync);
+    gst_structure_get_boolean(s, "discardable", &discardable);
+  }
+
+  gboolean start = input_meta != self->last_input || GST_BUFFER_PTS(input_meta) != self->last_pts;
+  self->last_input = input_meta;
+  self->last_pts = GST_BUFFER_PTS(input_meta);
+  if (start && tid == 0) self->tl0picidx++;
+
+  // The payloader sets the marker bit on the last packet of a frame before extensions are written
+  gboolean end = FALSE;
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  if (gst_rtp_buffer_map(output, GST_MAP_READ, &rtp))
+  {
+    end = gst_rtp_buffer_get_marker(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+  }
+
+  gboolean independent = !GST_BUFFER_FLAG_IS_SET(input_meta, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  data[0] = (start << 7) | (end << 6) | (independent << 5) | (discardable << 4) | (sync << 3) | (tid & 0x07);
+  data[1] = 0;  // LID: single spatial layer
+  data[2] = self->tl0picidx;
+
+  return FRAME_MARKING_SIZE;
+}
+
+// vtx only sends, so incoming frame marking is accepted and ignored.
+static gboolean vtx_frame_marking_read(GstRTPHeaderExtension *ext, GstRTPHeaderExtensionFlags read_flags, const guint8 *data, gsize size, GstBuffer *buffer)
+{
+  return TRUE;
+}
+
+// Registers the extension URI and overrides the GstRTPHeaderExtension virtual functions.
+static void vtx_frame_marking_class_init(VtxFrameMarkingClass *klass)
+{
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstRTPHeaderExtensionClass *ext_class = GST_RTP_HEADER_EXTENSION_CLASS(klass);
+
+  ext_class->get_supported_flags = vtx_frame_marking_get_supported_flags;
+  ext_class->get_max_size = vtx_frame_marking_get_max_size;
+  ext_class->write = vtx_frame_marking_write;
+  ext_class->read = vtx_frame_marking_read;
+
+  gst_element_class_set_static_metadata(element_class, "Frame Marking", GST_RTP_HDREXT_ELEMENT_CLASS, "Marks temporal layer IDs on RTP packets", "vtx");
+  gst_rtp_header_extension_class_set_uri(ext_class, RTP_HDREXT_FRAME_MARKING_URI);
+}
+
+// Initializes the per-stream frame tracking state.
+static void vtx_frame_marking_init(VtxFrameMarking *self)
+{
+  self->last_input = NULL;
+  self->last_pts = GST_CLOCK_TIME_NONE;
+  self->tl0picidx = 0;
+}
+
+// --- Temporal layer classification and dropping ----------------------------------
+
+typedef enum
+{
+  SVC_CODEC_OTHER = 0,
+  SVC_CODEC_H264,
+  SVC_CODEC_VPX,
+} SvcCodec;
+
+// libvpx temporal layer patterns (layer ID per frame) with their sync points, as in the libvpx RTC examples
+static const guint s_pattern_l1t2[] = {0, 1};
+static const gboolean s_sync_l1t2[] = {FALSE, TRUE};
+static const guint s_pattern_l1t3[] = {0, 2, 1, 2};
+static const gboolean s_sync_l1t3[] = {FALSE, TRUE, TRUE, FALSE};
+
+// A get-stats request in flight; svc is cleared if the SVC state is freed before the reply arrives.
+typedef struct
+{
+  VtxSvc *svc;
+} SvcStatsRequest;
+
+struct VtxSvc
+{
+  guint layers;
+  SvcCodec codec;
+  const guint *pattern;
+  const gboolean *sync;
+  guint periodicity;
+  guint64 frame_index;
+
+  GstPad *pay_sink;
+  gulong pay_sink_probe;
+  guint stats_timeout_id;
+  SvcStatsRequest *stats_request;  // in-flight get-stats request, NULL when none
+
+  gint max_tid;  // highest temporal layer currently forwarded (atomic)
+  guint good_intervals;
+
+  guint64 sent[SVC_MAX_TEMPORAL_LAYERS];
+  guint64 dropped[SVC_MAX_TEMPORAL_LAYERS];
+};
+
+VtxSvc *g_svc = NULL;
+
+// Converts a W3C scalability mode string ("L1T1", "L1T2", "L1T3") into a temporal layer count; 1 when unset or unsupported.
+guint vtx_svc_parse_scalability_mode(const gchar *mode)
+{
+  if (g_strcmp0(mode, "L1T2") == 0) return 2;
+  if (g_strcmp0(mode, "L1T3") == 0) return 3;
+  if (mode && g_strcmp0(mode, "L1T1") != 0) gst_printerrln("Unsupported scalability mode %s, using L1T1", mode);
+  return 1;
+}
+
+// Sets a property from its serialized string form if the encoder exposes it.
+static gboolean vtx_svc_set_encoder_arg(GstElement *encoder, const gchar *property, const gchar *value)
+{
+  if (!g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), property))
+  {
+    gst_printerrln("SVC: %s has no property %s", GST_OBJECT_NAME(encoder), property);
+    return FALSE;
+  }
+  gst_util_set_object_arg(G_OBJECT(encoder), property, value);
+  return TRUE;
+}
+
+// Configures libvpx temporal scalability (layer pattern, reference flags and per-layer bitrates) on vp8enc/vp9enc.
+static gboolean vtx_svc_configure_vpx(VtxSvc *svc, GstElement *encoder)
+{
+  guint bps = vtx_encoder_get_bitrate_kbps(encoder) * 1000;
+  if (bps == 0) bps = 1000000;
+
+  gchar *layers = g_strdup_printf("%u", svc->layers);
+  gchar *periodicity = g_strdup_printf("%u", svc->periodicity);
+  gchar *bitrates = NULL;
+  const gchar *decimator = NULL;
+  const gchar *layer_id = NULL;
+  const gchar *layer_flags = NULL;
+  const gchar *sync_flags = NULL;
+
+  if (svc->layers == 2)
+  {
+    bitrates = g_strdup_printf("<%u,%u>", bps * 6 / 10, bps);
+    decimator = "<2,1>";
+    layer_id = "<0,1>";
+    layer_flags = "<no-ref-golden+no-ref-alt+no-upd-golden+no-upd-alt,no-ref-golden+no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt>";
+    sync_flags = "<false,true>";
+  }
+  else
+  {
+    bitrates = g_strdup_printf("<%u,%u,%u>", bps * 4 / 10, bps * 6 / 10, bps);
+    decimator = "<4,2,1>";
+    layer_id = "<0,2,1,2>";
+    layer_flags =
+        "<no-ref-golden+no-ref-alt+no-upd-golden+no-upd-alt,"
+        "no-ref-golden+no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt,"
+        "no-ref-golden+no-ref-alt+no-upd-last+no-upd-alt,"
+        "no-ref-alt+no-upd-last+no-upd-golden+no-upd-alt>";
+    sync_flags = "<false,true,true,false>";
+  }
+
+  gboolean ok = vtx_svc_set_encoder_arg(encoder, "temporal-scalability-number-layers", layers) &&  //
+                vtx_svc_set_encoder_arg(encoder, "temporal-scalability-periodicity", periodicity) &&  //
+                vtx_svc_set_encoder_arg(encoder, "temporal-scalability-rate-decimator", decimator) &&  //
+                vtx_svc_set_encoder_arg(encoder, "temporal-scalability-target-bitrate", bitrates) &&  //
+                vtx_svc_set_encoder_arg(encoder, "temporal-scalability-layer-id", layer_id);
+
+  // Reference flags keep upper layers out of the prediction chain (GStreamer >= 1.20)
+  if (ok && vtx_svc_set_encoder_arg(encoder, "temporal-scalability-layer-flags", layer_flags))
+  {
+    vtx_svc_set_encoder_arg(encoder, "temporal-scalability-layer-sync-flags", sync_flags);
+  }
+
+  g_free(layers);
+  g_free(periodicity);
+  g_free(bitrates);
+  return ok;
+}
+
+// Returns TRUE if an H.264 access unit contains no reference slice (all slice NALs have nal_ref_idc == 0).
+static gboolean vtx_svc_h264_is_non_reference(const guint8 *data, gsize size, gboolean avc, guint nal_length_size)
+{
+  gboolean seen_slice = FALSE;
+  gsize i = 0;
+
+  while (i < size)
+  {
+    gsize nal_start;
+    gsize nal_size;
+
+    if (avc)
+    {
+      if (i + nal_length_size > size) break;
+      nal_size = 0;
+      for (guint b = 0; b < nal_length_size; b++) nal_size = (nal_size << 8) | data[i + b];
+      nal_start = i + nal_length_size;
+      i = nal_start + nal_size;
+    }
+    else
+    {
+      // Find the next 00 00 01 start code
+      while (i + 3 <= size && !(data[i] == 0 && data[i + 1] == 0 && data[i + 2] == 1)) i++;
+      if (i + 3 > size) break;
+      nal_start = i + 3;
+      i = nal_start;
+    }
+
+    if (nal_start >= size) break;
+
+    guint8 header = data[nal_start];
+    guint nal_type = header & 0x1f;
+    guint ref_idc = (header >> 5) & 0x03;
+    if (nal_type == 1 || nal_type == 5)
+    {
+      if (ref_idc != 0) return FALSE;
+      seen_slice = TRUE;
+    }
+  }
+
+  return seen_slice;
+}
+
+// Determines the temporal layer of an encoded frame and whether it is a switching point / droppable.
+static guint vtx_svc_classify(VtxSvc *svc, GstBuffer *buf, GstPad *pad, gboolean *sync, gboolean *discardable)
+{
+  guint index = svc->frame_index++ % svc->periodicity;
+  *sync = FALSE;
+  *discardable = FALSE;
+
+  if (!GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT)) return 0;
+
+  if (svc->codec == SVC_CODEC_VPX)
+  {
+    // vp8enc reports the layer it actually used; fall back to the configured pattern (vp9enc)
+    guint tid = svc->pattern[index];
+    GstCustomMeta *vp8_meta = gst_buffer_get_custom_meta(buf, "GstVP8Meta");
+    if (vp8_meta)
+    {
+      GstStructure *s = gst_custom_meta_get_structure(vp8_meta);
+      gst_structure_get_uint(s, "layer-id", &tid);
+      gst_structure_get_boolean(s, "layer-sync", sync);
+    }
+    else
+    {
+      *sync = svc->sync[index];
+    }
+    *discardable = tid == svc->layers - 1;
+    return tid;
+  }
+
+  if (svc->codec == SVC_CODEC_H264)
+  {
+    gboolean avc = FALSE;
+    guint nal_length_size = 4;
+    GstCaps *caps = gst_pad_get_current_caps(pad);
+    if (caps)
+    {
+      GstStructure *s = gst_caps_get_structure(caps, 0);
+      avc = g_strcmp0(gst_structure_get_string(s, "stream-format"), "avc") == 0;
+      const GValue *codec_data = gst_structure_get_value(s, "codec_data");
+      if (avc && codec_data && GST_VALUE_HOLDS_BUFFER(codec_data))
+      {
+        GstMapInfo cd;
+        GstBuffer *cd_buf = gst_value_get_buffer(codec_data);
+        if (gst_buffer_map(cd_buf, &cd, GST_MAP_READ))
+        {
+          if (cd.size > 4) nal_length_size = (cd.data[4] & 0x03) + 1;
+          gst_buffer_unmap(cd_buf, &cd);
+        }
+      }
+      gst_caps_unref(caps);
+    }
+
+    GstMapInfo map;
+    gboolean non_reference = FALSE;
+    if (gst_buffer_map(buf, &map, GST_MAP_READ))
+    {
+      non_reference = vtx_svc_h264_is_non_reference(map.data, map.size, avc, nal_length_size);
+      gst_buffer_unmap(buf, &map);
+    }
+    *discardable = non_reference;
+    *sync = non_reference;
+    return non_reference ? 1 : 0;
+  }
+
+  return 0;
+}
+
+// Tags every encoded frame entering the video payloader with its temporal layer and drops layers above the current limit.
+static GstPadProbeReturn vtx_svc_on_pay_sink(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  VtxSvc *svc = user_data;
+  GstBuffer *buf = GST_PAD_PROBE_INFO_BUFFER(info);
+  gboolean sync;
+  gboolean discardable;
+
+  guint tid = MIN(vtx_svc_classify(svc, buf, pad, &sync, &discardable), SVC_MAX_TEMPORAL_LAYERS - 1);
+
+  // Dropping whole frames before payloading keeps RTP sequence numbers contiguous, so the viewer sees no loss
+  if ((gint) tid > g_atomic_int_get(&svc->max_tid))
+  {
+    svc->dropped[tid]++;
+    return GST_PAD_PROBE_DROP;
+  }
+  svc->sent[tid]++;
+
+  buf = gst_buffer_make_writable(buf);
+  GstCustomMeta *meta = gst_buffer_add_custom_meta(buf, SVC_TEMPORAL_LAYER_META);
+  gst_structure_set(gst_custom_meta_get_structure(meta), "tid", G_TYPE_UINT, tid, "sync", G_TYPE_BOOLEAN, sync, "discardable", G_TYPE_BOOLEAN, discardable, NULL);
+  GST_PAD_PROBE_INFO_DATA(info) = buf;
+
+  return GST_PAD_PROBE_OK;
+}
+
+// Steps the forwarded temporal layer down under congestion and back up after it clears, from the receiver's loss/RTT.
+static void vtx_svc_on_remote_inbound_stats(gboolean found, gdouble loss, gdouble rtt, gpointer user_data)
+{
+  SvcStatsRequest *req = user_data;
+  VtxSvc *svc = req->svc;
+  if (!svc) return;
+
+  svc->stats_request = NULL;
+  if (!found) return;
+
+  gint max_tid = g_atomic_int_get(&svc->max_tid);
+  if (loss > SVC_CONGESTION_LOSS || rtt > SVC_CONGESTION_RTT_S)
+  {
+    svc->good_intervals = 0;
+    if (max_tid > 0)
+    {
+      g_atomic_int_set(&svc->max_tid, max_tid - 1);
+      gst_println("SVC: congestion (loss %.1f%%, rtt %.0f ms), forwarding up to T%d", loss * 100, rtt * 1000, max_tid - 1);
+    }
+  }
+  else if (loss < SVC_RECOVERY_LOSS && rtt < SVC_RECOVERY_RTT_S)
+  {
+    if (++svc->good_intervals >= SVC_RECOVERY_INTERVALS && max_tid < (gint) svc->layers - 1)
+    {
+      svc->good_intervals = 0;
+      g_atomic_int_set(&svc->max_tid, max_tid + 1);
+      gst_println("SVC: network recovered, forwarding up to T%d", max_tid + 1);
+    }
+  }
+  else
+  {
+    svc->good_intervals = 0;
+  }
+}
+
+// Asks the current session's webrtcbin for its stats, unless the previous request is still pending. With a warm standby
+// pipeline there may be no session attached, in which case nothing changes.
+static gboolean vtx_svc_on_stats_timeout(gpointer user_data)
+{
+  VtxSvc *svc = user_data;
+  if (!webrtc || svc->stats_request) return G_SOURCE_CONTINUE;
+
+  svc->stats_request = g_new0(SvcStatsRequest, 1);
+  svc->stats_request->svc = svc;
+  vtx_rtp_request_remote_inbound_stats(webrtc, vtx_svc_on_remote_inbound_stats, svc->stats_request, g_free);
+  return G_SOURCE_CONTINUE;
+}
+
+// Appends the frame marking extension to the payloader with the next free one-byte extension ID.
+static void vtx_svc_add_frame_marking(GstElement *videopay)
+{
+  guint next_id = 1;
+  GValue extensions = G_VALUE_INIT;
+
+  if (g_object_class_find_property(G_OBJECT_GET_CLASS(videopay), "extensions"))
+  {
+    g_object_get_property(G_OBJECT(videopay), "extensions", &extensions);
+    for (guint i = 0; i < gst_value_array_get_size(&extensions); i++)
+    {
+      GstRTPHeaderExtension *ext = g_value_get_object(gst_value_array_get_value(&extensions, i));
+      next_id = MAX(next_id, gst_rtp_header_extension_get_id(ext) + 1);
+    }
+    g_value_unset(&extensions);
+  }
+
+  if (next_id > 14)
+  {
+    gst_printerrln("SVC: no free one-byte RTP header extension ID for frame marking");
+    return;
+  }
+
+  GstRTPHeaderExtension *ext = g_object_new(VTX_TYPE_FRAME_MARKING, NULL);
+  gst_rtp_header_extension_set_id(ext, next_id);
+  g_signal_emit_by_name(videopay, "add-extension", ext);
+  g_object_unref(ext);
+}
+
+// Configures temporal layers on the pipeline's video encoder, tags payloaded frames with frame marking and starts
+// congestion-driven layer dropping. Returns NULL if the encoder cannot produce droppable layers.
+VtxSvc *vtx_svc_setup(GstElement *pipeline, guint layers)
+{
+  static gsize meta_registered = 0;
+  if (g_once_init_enter(&meta_registered))
+  {
+    static const gchar *tags[] = {NULL};
+    gst_meta_register_custom(SVC_TEMPORAL_LAYER_META, tags, NULL, NULL, NULL);
+    g_once_init_leave(&meta_registered, 1);
+  }
+
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  GstElement *encoder = vtx_encoder_find(GST_BIN(pipeline));
+  if (!videopay || !encoder)
+  {
+    gst_printerrln("SVC: videopay or video encoder not found, temporal layers disabled");
+    if (videopay) gst_object_unref(videopay);
+    if (encoder) gst_object_unref(encoder);
+    return NULL;
+  }
+
+  VtxSvc *svc = g_new0(VtxSvc, 1);
+  svc->layers = MIN(layers, SVC_MAX_TEMPORAL_LAYERS);
+  svc->pattern = svc->layers == 2 ? s_pattern_l1t2 : s_pattern_l1t3;
+  svc->sync = svc->layers == 2 ? s_sync_l1t2 : s_sync_l1t3;
+  svc->periodicity = svc->layers == 2 ? G_N_ELEMENTS(s_pattern_l1t2) : G_N_ELEMENTS(s_pattern_l1t3);
+
+  const gchar *factory = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(gst_element_get_factory(encoder)));
+  if (g_strcmp0(factory, "vp8enc") == 0 || g_strcmp0(factory, "vp9enc") == 0)
+  {
+    svc->codec = vtx_svc_configure_vpx(svc, encoder) ? SVC_CODEC_VPX : SVC_CODEC_OTHER;
+  }
+  else if (strstr(factory, "h264"))
+  {
+    // No H.264 encoder plugin exposes temporal layers; frames the encoder marks as non-reference form the droppable layer
+    gst_println("SVC: %s has no temporal layer settings, non-reference frames are used as T1", factory);
+    svc->codec = SVC_CODEC_H264;
+    svc->layers = 2;
+  }
+
+  if (svc->codec == SVC_CODEC_OTHER)
+  {
+    gst_printerrln("SVC: temporal layers are not supported with %s", factory);
+    gst_object_unref(videopay);
+    gst_object_unref(encoder);
+    g_free(svc);
+    return NULL;
+  }
+
+  vtx_svc_add_frame_marking(videopay);
+
+  svc->max_tid = svc->layers - 1;
+  svc->pay_sink = gst_element_get_static_pad(videopay, "sink");
+  svc->pay_sink_probe = gst_pad_add_probe(svc->pay_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_svc_on_pay_sink, svc, NULL);
+  svc->stats_timeout_id = g_timeout_add(SVC_STATS_INTERVAL_MS, vtx_svc_on_stats_timeout, svc);
+
+  gst_println("SVC: %s configured for L1T%u", factory, svc->layers);
+
+  gst_object_unref(videopay);
+  gst_object_unref(encoder);
+  return svc;
+}
+
+// Stops layer dropping, logs per-layer counters and frees the SVC state. The pipeline must already be stopped.
+void vtx_svc_free(VtxSvc *svc)
+{
+  if (!svc) return;
+
+  for (guint i = 0; i < svc->layers; i++)
+  {
+    gst_println("SVC: T%u sent %" G_GUINT64_FORMAT " frames, dropped %" G_GUINT64_FORMAT, i, svc->sent[i], svc->dropped[i]);
+  }
+
+  if (svc->stats_timeout_id > 0) g_source_remove(svc->stats_timeout_id);
+  if (svc->stats_request) svc->stats_request->svc = NULL;
+  gst_pad_remove_probe(svc->pay_sink, svc->pay_sink_probe);
+  gst_object_unref(svc->pay_sink);
+  g_free(svc);
+}
+
+// Returns the current forwarding limit and per-layer frame counters as a JSON object.
+JsonObject *vtx_svc_get_stats(VtxSvc *svc)
+{
+  JsonObject *o = json_object_new();
+  gchar *mode = g_strdup_printf("L1T%u", svc->layers);
+  json_object_set_string_member(o, "scalability_mode", mode);
+  json_object_set_int_member(o, "max_temporal_layer", g_atomic_int_get(&svc->max_tid));
+
+  JsonArray *layers = json_array_new();
+  for (guint i = 0; i < svc->layers; i++)
+  {
+    JsonObject *layer = json_object_new();
+    json_object_set_int_member(layer, "tid", i);
+    json_object_set_int_member(layer, "sent", svc->sent[i]);
+    json_object_set_int_member(layer, "dropped", svc->dropped[i]);
+    json_array_add_object_element(layers, layer);
+  }
+  json_object_set_array_member(o, "layers", layers);
+
+  g_free(mode);
+  return o;
+}
@@ -0,0 +1,484 @@
+#define _GNU_SOURCE
+
+#include "headers/tap.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "headers/encoder.h"
+
+// Approximate kernel accounting of one queued TapRecord message, used to size a reader's send buffer from queue_frames.
+#define TAP_RECORD_QUEUE_COST 1024
+
+typedef struct TapStream TapStream;
+
+typedef struct
+{
+  TapStream *stream;
+  guint id;
+  gint fd;
+  guint watch_id;  // g_unix_fd_add source noticing the reader hanging up
+  gboolean closed; // a send failed; removed once the hang-up is seen
+  guint64 sent;
+  guint64 dropped;
+} TapReader;
+
+struct TapStream
+{
+  VtxTap *tap;
+  const gchar *kind;  // "encoded" or "raw"
+  gchar *path;
+  gint listen_fd;
+  guint listen_watch_id;
+
+  gint ring_fd;
+  guint8 *map;
+  gsize map_size;
+  TapRingHeader *header;
+  guint8 *data;
+
+  GstPad *pad;
+  gulong probe_id;
+
+  // guarded by tap->lock
+  gchar *caps;
+  guint64 seq;
+  guint64 oversize;  // frames larger than half the ring, never written
+  GPtrArray *readers;
+};
+
+struct VtxTap
+{
+  GMutex lock;
+  guint queue_frames;
+  guint next_reader_id;
+  TapStream encoded;
+  TapStream raw;
+};
+
+VtxTap *g_tap = NULL;
+
+// Closes a reader's socket and frees it. Must be called on the main thread with the reader already out of the list.
+static void vtx_tap_reader_free(TapReader *reader)
+{
+  if (reader->watch_id) g_source_remove(reader->watch_id);
+  close(reader->fd);
+  g_free(reader);
+}
+
+// Sends one record (and an optional trailing payload) to a reader without blocking, counting it as dropped when the
+// reader's queue is full. Must be called with the lock held.
+static void vtx_tap_reader_send(TapReader *reader, TapRecord *record, const gchar *payload)
+{
+  if (reader->closed) return;
+
+  struct iovec iov[2] = {{record, sizeof(*record)}, {(gpointer) payload, payload ? strlen(payload) + 1 : 0}};
+  struct msghdr msg = {0};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = payload ? 2 : 1;
+
+  if (sendmsg(reader->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+  {
+    if (record->type == TAP_RECORD_FRAME) reader->sent++;
+    return;
+  }
+
+  if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)
+  {
+    if (record->type == TAP_RECORD_FRAME) reader->dropped++;
+    return;
+  }
+  reader->closed = TRUE;
+}
+
+// Copies one frame into the ring and announces it to every reader. Runs on the streaming thread and never waits.
+static void vtx_tap_write(TapStream *stream, GstBuffer *buf)
+{
+  gsize size = gst_buffer_get_size(buf);
+  guint64 ring_size = stream->header->ring_size;
+
+  g_mutex_lock(&stream->tap->lock);
+  if (stream->readers->len == 0)
+  {
+    g_mutex_unlock(&stream->tap->lock);
+    return;
+  }
+  if (size == 0 || size > ring_size / 2)
+  {
+    stream->oversize++;
+    g_mutex_unlock(&stream->tap->lock);
+    return;
+  }
+
+  // Frames are contiguous: skip the ring tail when the frame does not fit before the wrap
+  guint64 start = stream->header->head;
+  guint64 offset = start % ring_size;
+  if (offset + size > ring_size)
+  {
+    start += ring_size - offset;
+    offset = 0;
+  }
+
+  // Publish the new head before overwriting so readers copying older frames can tell they were overwritten
+  __atomic_store_n(&stream->header->head, start + size, __ATOMIC_RELEASE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  gst_buffer_extract(buf, 0, stream->data + offset, size);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  TapRecord record = {0};
+  record.type = TAP_RECORD_FRAME;
+  record.flags = (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DELTA_UNIT) ? 0 : TAP_FRAME_KEY) | (GST_BUFFER_FLAG_IS_SET(buf, GST_BUFFER_FLAG_DISCONT) ? TAP_FRAME_DISCONT : 0);
+  record.seq = stream->seq++;
+  record.offset = offset;
+  record.position = start + size;
+  record.size = (guint32) size;
+  record.pts = GST_BUFFER_PTS_IS_VALID(buf) ? (gint64) GST_BUFFER_PTS(buf) : -1;
+  record.dts = GST_BUFFER_DTS_IS_VALID(buf) ? (gint64) GST_BUFFER_DTS(buf) : -1;
+
+  for (guint i = 0; i < stream->readers->len; i++)
+  {
+    TapReader *reader = g_ptr_array_index(stream->readers, i);
+    record.dropped = (guint32) reader->dropped;
+    vtx_tap_reader_send(reader, &record, NULL);
+  }
+  g_mutex_unlock(&stream->tap->lock);
+}
+
+// Tracks the caps of the tapped stream and forwards changes to the connected readers.
+static void vtx_tap_on_caps(TapStream *stream, GstCaps *caps)
+{
+  gchar *str = gst_caps_to_string(caps);
+
+  g_mutex_lock(&stream->tap->lock);
+  g_free(stream->caps);
+  stream->caps = str;
+
+  TapRecord record = {0};
+  record.type = TAP_RECORD_CAPS;
+  record.pts = -1;
+  record.dts = -1;
+  for (guint i = 0; i < stream->readers->len; i++)
+  {
+    vtx_tap_reader_send(g_ptr_array_index(stream->readers, i), &record, stream->caps);
+  }
+  g_mutex_unlock(&stream->tap->lock);
+}
+
+// Pad probe copying buffers and caps of the tapped pad into the stream.
+static GstPadProbeReturn vtx_tap_on_pad(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  TapStream *stream = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+  {
+    vtx_tap_write(stream, GST_PAD_PROBE_INFO_BUFFER(info));
+  }
+  else if (info->type & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+  {
+    GstBufferList *list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+    for (guint i = 0; i < gst_buffer_list_length(list); i++) vtx_tap_write(stream, gst_buffer_list_get(list, i));
+  }
+  else if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM && GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_CAPS)
+  {
+    GstCaps *caps = NULL;
+    gst_event_parse_caps(GST_PAD_PROBE_INFO_EVENT(info), &caps);
+    vtx_tap_on_caps(stream, caps);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+// Removes a reader once it has hung up, logging how much of the stream it received.
+static gboolean vtx_tap_on_reader_hup(gint fd, GIOCondition condition, gpointer user_data)
+{
+  TapReader *reader = user_data;
+  TapStream *stream = reader->stream;
+
+  g_mutex_lock(&stream->tap->lock);
+  g_ptr_array_remove(stream->readers, reader);
+  g_mutex_unlock(&stream->tap->lock);
+
+  gst_println("Tap %s: reader %u left after %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " dropped", stream->kind, reader->id, reader->sent, reader->dropped);
+  reader->watch_id = 0;
+  vtx_tap_reader_free(reader);
+  return G_SOURCE_REMOVE;
+}
+
+// Sends the hello record to a new reader with the ring memfd attached. Must be called with the lock held, so no caps
+// change slips between the hello and the reader joining the fan-out.
+static gboolean vtx_tap_send_hello(TapStream *stream, gint fd)
+{
+  TapRecord record = {0};
+  record.type = TAP_RECORD_HELLO;
+  record.pts = -1;
+  record.dts = -1;
+
+  const gchar *caps = stream->caps ? stream->caps : "";
+  struct iovec iov[2] = {{&record, sizeof(record)}, {(gpointer) caps, strlen(caps) + 1}};
+
+  union
+  {
+    struct cmsghdr align;
+    gchar buf[CMSG_SPACE(sizeof(gint))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg = {0};
+  msg.msg_iov = iov;
+  msg.msg_iovlen = 2;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(gint));
+  memcpy(CMSG_DATA(cmsg), &stream->ring_fd, sizeof(gint));
+
+  return sendmsg(fd, &msg, MSG_NOSIGNAL) >= 0;
+}
+
+// Accepts a reader on a tap socket: sends it the ring, bounds its announcement queue and adds it to the fan-out.
+static gboolean vtx_tap_on_accept(gint listen_fd, GIOCondition condition, gpointer user_data)
+{
+  TapStream *stream = user_data;
+
+  gint fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return G_SOURCE_CONTINUE;
+
+  gint sndbuf = (gint) (stream->tap->queue_frames * TAP_RECORD_QUEUE_COST);
+  setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+  g_mutex_lock(&stream->tap->lock);
+  if (stream->readers->len >= TAP_MAX_READERS)
+  {
+    g_mutex_unlock(&stream->tap->lock);
+    gst_printerrln("Tap %s: refusing reader, %u already connected", stream->kind, TAP_MAX_READERS);
+    close(fd);
+    return G_SOURCE_CONTINUE;
+  }
+  if (!vtx_tap_send_hello(stream, fd))
+  {
+    g_mutex_unlock(&stream->tap->lock);
+    gst_printerrln("Tap %s: failed to send the ring to a reader: %s", stream->kind, g_strerror(errno));
+    close(fd);
+    return G_SOURCE_CONTINUE;
+  }
+
+  TapReader *reader = g_new0(TapReader, 1);
+  reader->stream = stream;
+  reader->fd = fd;
+  reader->id = ++stream->tap->next_reader_id;
+  g_ptr_array_add(stream->readers, reader);
+  g_mutex_unlock(&stream->tap->lock);
+
+  reader->watch_id = g_unix_fd_add(fd, G_IO_HUP | G_IO_ERR, vtx_tap_on_reader_hup, reader);
+  gst_println("Tap %s: reader %u connected", stream->kind, reader->id);
+  return G_SOURCE_CONTINUE;
+}
+
+// Creates the sealed memfd ring of a stream and maps it.
+static gboolean vtx_tap_open_ring(TapStream *stream, gsize ring_size)
+{
+  gchar *name = g_strdup_printf("vtx-tap-%s", stream->kind);
+  stream->ring_fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  g_free(name);
+  if (stream->ring_fd < 0) return FALSE;
+
+  stream->map_size = sizeof(TapRingHeader) + ring_size;
+  if (ftruncate(stream->ring_fd, stream->map_size) < 0) return FALSE;
+  // Readers map the whole file, so it must never shrink under them
+  fcntl(stream->ring_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL);
+
+  stream->map = mmap(NULL, stream->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, stream->ring_fd, 0);
+  if (stream->map == MAP_FAILED)
+  {
+    stream->map = NULL;
+    return FALSE;
+  }
+
+  stream->header = (TapRingHeader *) stream->map;
+  stream->header->magic = TAP_MAGIC;
+  stream->header->version = TAP_VERSION;
+  stream->header->ring_size = ring_size;
+  stream->header->head = 0;
+  stream->data = stream->map + sizeof(TapRingHeader);
+  return TRUE;
+}
+
+// Binds the listening SOCK_SEQPACKET socket of a stream, replacing a stale socket file.
+static gboolean vtx_tap_listen(TapStream *stream)
+{
+  struct sockaddr_un addr = {0};
+  addr.sun_family = AF_UNIX;
+  if (strlen(stream->path) >= sizeof(addr.sun_path))
+  {
+    errno = ENAMETOOLONG;
+    return FALSE;
+  }
+  g_strlcpy(addr.sun_path, stream->path, sizeof(addr.sun_path));
+  g_unlink(stream->path);
+
+  stream->listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (stream->listen_fd < 0) return FALSE;
+  if (bind(stream->listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) return FALSE;
+  if (listen(stream->listen_fd, TAP_MAX_READERS) < 0) return FALSE;
+
+  stream->listen_watch_id = g_unix_fd_add(stream->listen_fd, G_IO_IN, vtx_tap_on_accept, stream);
+  return TRUE;
+}
+
+// Releases the socket, ring and probe of a stream. The pipeline must already be stopped.
+static void vtx_tap_stream_clear(TapStream *stream)
+{
+  if (stream->pad)
+  {
+    if (stream->probe_id) gst_pad_remove_probe(stream->pad, stream->probe_id);
+    gst_object_unref(stream->pad);
+  }
+  if (stream->listen_watch_id) g_source_remove(stream->listen_watch_id);
+  if (stream->listen_fd >= 0)
+  {
+    close(stream->listen_fd);
+    g_unlink(stream->path);
+  }
+  if (stream->readers)
+  {
+    for (guint i = 0; i < stream->readers->len; i++)
+    {
+      TapReader *reader = g_ptr_array_index(stream->readers, i);
+      gst_println("Tap %s: reader %u closed after %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " dropped", stream->kind, reader->id, reader->sent, reader->dropped);
+      vtx_tap_reader_free(reader);
+    }
+    g_ptr_array_free(stream->readers, TRUE);
+  }
+  if (stream->map) munmap(stream->map, stream->map_size);
+  if (stream->ring_fd >= 0) close(stream->ring_fd);
+  g_free(stream->path);
+  g_free(stream->caps);
+}
+
+// Opens a stream's ring and socket and installs its probe on the given pad (takes the pad reference).
+static gboolean vtx_tap_stream_open(VtxTap *tap, TapStream *stream, const gchar *kind, const gchar *dir, const gchar *socket_name, gsize ring_size, GstPad *pad)
+{
+  stream->tap = tap;
+  stream->kind = kind;
+  stream->path = g_build_filename(dir, socket_name, NULL);
+  stream->listen_fd = -1;
+  stream->ring_fd = -1;
+  stream->readers = g_ptr_array_new();
+  stream->pad = pad;
+
+  if (!vtx_tap_open_ring(stream, ring_size) || !vtx_tap_listen(stream))
+  {
+    gst_printerrln("Tap %s: cannot open %s: %s", kind, stream->path, g_strerror(errno));
+    vtx_tap_stream_clear(stream);
+    memset(stream, 0, sizeof(*stream));
+    stream->listen_fd = -1;
+    stream->ring_fd = -1;
+    return FALSE;
+  }
+
+  stream->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_tap_on_pad, stream, NULL);
+  gst_println("Tap %s: serving %s (%" G_GSIZE_FORMAT " KiB ring)", kind, stream->path, ring_size / 1024);
+  return TRUE;
+}
+
+// Exposes the encoded stream (videopay input) and, when raw is set, the raw frames (encoder input) to local readers
+// through the sockets in dir.
+VtxTap *vtx_tap_attach(GstElement *pipeline, const gchar *dir, gboolean raw, guint queue_frames)
+{
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (!videopay)
+  {
+    gst_printerrln("Tap: videopay not found");
+    return NULL;
+  }
+  if (g_mkdir_with_parents(dir, 0755) < 0)
+  {
+    gst_printerrln("Tap: cannot create %s: %s", dir, g_strerror(errno));
+    gst_object_unref(videopay);
+    return NULL;
+  }
+
+  VtxTap *tap = g_new0(VtxTap, 1);
+  g_mutex_init(&tap->lock);
+  tap->queue_frames = queue_frames ? queue_frames : TAP_DEFAULT_QUEUE_FRAMES;
+  tap->raw.listen_fd = -1;
+  tap->raw.ring_fd = -1;
+
+  GstPad *encoded_pad = gst_element_get_static_pad(videopay, "sink");
+  gst_object_unref(videopay);
+  if (!vtx_tap_stream_open(tap, &tap->encoded, "encoded", dir, TAP_ENCODED_SOCKET, TAP_ENCODED_RING_BYTES, encoded_pad))
+  {
+    vtx_tap_free(tap);
+    return NULL;
+  }
+
+  GstElement *encoder = raw ? vtx_encoder_find(GST_BIN(pipeline)) : NULL;
+  if (raw && !encoder)
+  {
+    gst_printerrln("Tap: video encoder not found, raw frames are not exposed");
+  }
+  else if (encoder)
+  {
+    vtx_tap_stream_open(tap, &tap->raw, "raw", dir, TAP_RAW_SOCKET, TAP_RAW_RING_BYTES, gst_element_get_static_pad(encoder, "sink"));
+    gst_object_unref(encoder);
+  }
+
+  return tap;
+}
+
+// Disconnects every reader, removes the sockets and frees the rings. The pipeline must already be stopped.
+void vtx_tap_free(VtxTap *tap)
+{
+  if (!tap) return;
+
+  vtx_tap_stream_clear(&tap->encoded);
+  vtx_tap_stream_clear(&tap->raw);
+  g_mutex_clear(&tap->lock);
+  g_free(tap);
+}
+
+// Returns the frame counts of a stream and the sent/dropped frames of each of its readers.
+static JsonObject *vtx_tap_stream_get_stats(TapStream *stream)
+{
+  JsonObject *stats = json_object_new();
+  JsonArray *readers = json_array_new();
+
+  g_mutex_lock(&stream->tap->lock);
+  json_object_set_string_member(stats, "socket", stream->path);
+  json_object_set_int_member(stats, "frames", stream->seq);
+  json_object_set_int_member(stats, "oversize", stream->oversize);
+  for (guint i = 0; i < stream->readers->len; i++)
+  {
+    TapReader *reader = g_ptr_array_index(stream->readers, i);
+    JsonObject *entry = json_object_new();
+    json_object_set_int_member(entry, "id", reader->id);
+    json_object_set_int_member(entry, "sent", reader->sent);
+    json_object_set_int_member(entry, "dropped", reader->dropped);
+    json_array_add_object_element(readers, entry);
+  }
+  g_mutex_unlock(&stream->tap->lock);
+
+  json_object_set_array_member(stats, "readers", readers);
+  return stats;
+}
+
+// Returns the tap statistics: frames written per stream and, per reader, frames announced and dropped.
+JsonObject *vtx_tap_get_stats(VtxTap *tap)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_object_member(stats, "encoded", vtx_tap_stream_get_stats(&tap->encoded));
+  if (tap->raw.probe_id)
+  {
+    json_object_set_object_member(stats, "raw", vtx_tap_stream_get_stats(&tap->raw));
+  }
+  return stats;
+}
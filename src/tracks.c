@@ -0,0 +1,367 @@
+#include "headers/tracks.h"
+
+#include <gst/video/video.h>
+
+#include "headers/encoder.h"
+#include "headers/pipeline.h"
+#include "headers/reconfig.h"
+#include "headers/rtp.h"
+
+typedef enum
+{
+  TRACK_RUNNING,
+  TRACK_PAUSED,
+  TRACK_RESUMING  // waiting for the keyframe requested on resume
+} TrackState;
+
+typedef struct
+{
+  gchar *name;
+  gchar *priority;
+  guint share;
+  GstElement *bin;      // NULL for the main track
+  GstElement *encoder;  // NULL for the main track, whose bitrate the reconfiguration applies
+  GstPad *pay_sink;     // payloader input, where a paused track drops its frames (NULL if there is no payloader to hold)
+  gulong probe_id;
+  gint state;  // TrackState (atomic)
+  gint frames;
+  gint dropped;
+  guint pauses;
+  guint kbps;
+} Track;
+
+struct VtxTracks
+{
+  GstElement *pipeline;
+  Track tracks[1 + TRACKS_MAX];  // the main track first
+  guint n_tracks;
+  guint total_kbps;  // session bitrate split between the tracks, 0 while unknown
+};
+
+VtxTracks *g_tracks = NULL;
+
+// Reads the video_tracks media param. Tracks without a bitrate_share split what the others leave with the main track.
+gboolean vtx_tracks_parse(JsonArray *array, VideoTrack *tracks, guint *n_tracks, guint *main_share, gchar **error_msg)
+{
+  guint n = array ? json_array_get_length(array) : 0;
+  guint explicit_share = 0;
+  guint unspecified = 1;  // the main track
+
+  *n_tracks = 0;
+  *main_share = 100;
+  if (n > TRACKS_MAX)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("At most %u video_tracks", TRACKS_MAX);
+    return FALSE;
+  }
+
+  for (guint i = 0; i < n; i++)
+  {
+    JsonObject *o = json_array_get_object_element(array, i);
+    VideoTrack *t = &tracks[i];
+    t->pipeline = o && json_object_has_member(o, "pipeline") ? json_object_get_string_member(o, "pipeline") : NULL;
+    t->name = o && json_object_has_member(o, "name") ? json_object_get_string_member(o, "name") : NULL;
+    t->priority = o && json_object_has_member(o, "priority") ? json_object_get_string_member(o, "priority") : NULL;
+    t->bitrate_share = o && json_object_has_member(o, "bitrate_share") ? json_object_get_int_member(o, "bitrate_share") : 0;
+
+    if (!t->pipeline || !t->name || g_strcmp0(t->name, TRACKS_MAIN_NAME) == 0)
+    {
+      if (error_msg) *error_msg = g_strdup_printf("video_tracks[%u] needs a pipeline and a name other than \"%s\"", i, TRACKS_MAIN_NAME);
+      return FALSE;
+    }
+    for (guint j = 0; j < i; j++)
+    {
+      if (g_strcmp0(tracks[j].name, t->name) == 0)
+      {
+        if (error_msg) *error_msg = g_strdup_printf("Duplicate video track name %s", t->name);
+        return FALSE;
+      }
+    }
+
+    explicit_share += t->bitrate_share;
+    if (!t->bitrate_share) unspecified++;
+  }
+
+  if (explicit_share >= 100)
+  {
+    if (error_msg) *error_msg = g_strdup("video_tracks bitrate shares leave nothing for the main track");
+    return FALSE;
+  }
+
+  guint each = (100 - explicit_share) / unspecified;
+  for (guint i = 0; i < n; i++)
+  {
+    if (!tracks[i].bitrate_share) tracks[i].bitrate_share = each;
+  }
+  *main_share = 100 - explicit_share - each * (unspecified - 1);
+  *n_tracks = n;
+  return TRUE;
+}
+
+// Returns the track pipelines as one string, for matching a running shared pipeline against a new session.
+gchar *vtx_tracks_describe(const VideoTrack *tracks, guint n_tracks)
+{
+  GString *desc = g_string_new(NULL);
+  for (guint i = 0; i < n_tracks; i++)
+  {
+    g_string_append_printf(desc, "%s=%s;", tracks[i].name, tracks[i].pipeline);
+  }
+  return g_string_free(desc, FALSE);
+}
+
+// Drops the frames of a paused track before its payloader, so its RTP sequence numbers stay contiguous; on resume, frames
+// are dropped until the requested keyframe.
+static GstPadProbeReturn vtx_tracks_on_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  Track *track = user_data;
+  gint state = g_atomic_int_get(&track->state);
+
+  if (state == TRACK_RESUMING && !GST_BUFFER_FLAG_IS_SET(GST_PAD_PROBE_INFO_BUFFER(info), GST_BUFFER_FLAG_DELTA_UNIT))
+  {
+    g_atomic_int_compare_and_exchange(&track->state, TRACK_RESUMING, TRACK_RUNNING);
+    state = TRACK_RUNNING;
+  }
+
+  if (state != TRACK_RUNNING)
+  {
+    g_atomic_int_inc(&track->dropped);
+    return GST_PAD_PROBE_DROP;
+  }
+  g_atomic_int_inc(&track->frames);
+  return GST_PAD_PROBE_OK;
+}
+
+// Installs the pause probe on the payloader's input.
+static void vtx_tracks_watch_payloader(Track *track, GstElement *payloader)
+{
+  track->pay_sink = gst_element_get_static_pad(payloader, "sink");
+  if (track->pay_sink) track->probe_id = gst_pad_add_probe(track->pay_sink, GST_PAD_PROBE_TYPE_BUFFER, vtx_tracks_on_frame, track, NULL);
+}
+
+// Builds an additional track and links it after the tracks already there: to the session's webrtcbin, or into its own
+// standby tee on the shared pipeline.
+static gboolean vtx_tracks_add(VtxTracks *tracks, const VideoTrack *config, guint index, GstElement *webrtc, gchar **error_msg)
+{
+  GError *error = NULL;
+  GstElement *bin = gst_parse_bin_from_description(config->pipeline, TRUE, &error);
+  if (!bin || error)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Video track %s: %s", config->name, error ? error->message : "parse error");
+    g_clear_error(&error);
+    if (bin) gst_object_unref(bin);
+    return FALSE;
+  }
+
+  gchar *bin_name = g_strdup_printf("track_%s", config->name);
+  gst_object_set_name(GST_OBJECT(bin), bin_name);
+  g_free(bin_name);
+  gst_bin_add(GST_BIN(tracks->pipeline), bin);
+
+  gboolean linked = FALSE;
+  if (webrtc)
+  {
+    // webrtcbin has on-request sink pads (sink_%u), so we must use gst_element_link_pads
+    linked = gst_element_link_pads(bin, "src", webrtc, "sink_%u");
+  }
+  else
+  {
+    gchar *tee_name = g_strdup_printf(TRACKS_TEE_PREFIX "%u", index);
+    linked = vtx_pipeline_add_standby_tee(GST_BIN(tracks->pipeline), bin, tee_name);
+    g_free(tee_name);
+  }
+  if (!linked)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Video track %s: failed to link", config->name);
+    gst_bin_remove(GST_BIN(tracks->pipeline), bin);
+    return FALSE;
+  }
+
+  Track *track = &tracks->tracks[tracks->n_tracks++];
+  track->name = g_strdup(config->name);
+  track->priority = g_strdup(config->priority);
+  track->share = config->bitrate_share;
+  track->bin = gst_object_ref(bin);
+  track->encoder = vtx_encoder_find(GST_BIN(bin));
+  track->kbps = vtx_encoder_get_bitrate_kbps(track->encoder);
+
+  // The payloader is the element behind the bin's ghost src pad
+  GstPad *src = gst_element_get_static_pad(bin, "src");
+  GstPad *target = src ? gst_ghost_pad_get_target(GST_GHOST_PAD(src)) : NULL;
+  GstElement *payloader = target ? gst_pad_get_parent_element(target) : NULL;
+  if (payloader)
+  {
+    vtx_rtp_add_video_header_extensions(gst_object_ref(payloader));
+    vtx_tracks_watch_payloader(track, payloader);
+    gst_object_unref(payloader);
+  }
+  if (target) gst_object_unref(target);
+  if (src) gst_object_unref(src);
+
+  gst_println("Video track %s: %u%% of the bitrate, priority %s", track->name, track->share, track->priority ? track->priority : "default");
+  return TRUE;
+}
+
+// Adds the additional video tracks to a pipeline that has not been started yet; the main track is the one already built
+// around videopay. Must run after the other media hooks, which find the main track's encoder as the only one. Returns
+// NULL if any track fails to build or link, since the transceivers would no longer match the configured tracks.
+VtxTracks *vtx_tracks_attach(GstElement *pipeline, const VideoTrack *configs, guint n_tracks, guint main_share, gchar **error_msg)
+{
+  VtxTracks *tracks = g_new0(VtxTracks, 1);
+  tracks->pipeline = gst_object_ref(pipeline);
+
+  Track *primary = &tracks->tracks[tracks->n_tracks++];
+  primary->name = g_strdup(TRACKS_MAIN_NAME);
+  primary->share = main_share;
+  GstElement *encoder = vtx_encoder_find(GST_BIN(pipeline));
+  primary->kbps = vtx_encoder_get_bitrate_kbps(encoder);
+  if (encoder) gst_object_unref(encoder);
+
+  GstElement *videopay = gst_bin_get_by_name(GST_BIN(pipeline), "videopay");
+  if (videopay)
+  {
+    vtx_tracks_watch_payloader(primary, videopay);
+    gst_object_unref(videopay);
+  }
+
+  GstElement *webrtc = gst_bin_get_by_name(GST_BIN(pipeline), "webrtcbin");
+  gboolean added = TRUE;
+  for (guint i = 0; i < n_tracks && added; i++)
+  {
+    added = vtx_tracks_add(tracks, &configs[i], i + 1, webrtc, error_msg);
+  }
+  if (webrtc) gst_object_unref(webrtc);
+  if (!added)
+  {
+    vtx_tracks_free(tracks);
+    return NULL;
+  }
+
+  // The configured encoder bitrates make up the initial session bitrate
+  for (guint i = 0; i < tracks->n_tracks; i++)
+  {
+    if (!tracks->tracks[i].kbps)
+    {
+      tracks->total_kbps = 0;
+      break;
+    }
+    tracks->total_kbps += tracks->tracks[i].kbps;
+  }
+  return tracks;
+}
+
+// Returns TRUE if the element belongs to an additional track.
+gboolean vtx_tracks_owns(VtxTracks *tracks, GstElement *element)
+{
+  for (GstObject *o = GST_OBJECT(element); o; o = GST_OBJECT_PARENT(o))
+  {
+    for (guint i = 1; i < tracks->n_tracks; i++)
+    {
+      if (o == GST_OBJECT(tracks->tracks[i].bin)) return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+// Splits the session bitrate between the running tracks by their shares and sets the additional tracks' encoders. Returns
+// the main track's part (0 while it is paused), which the caller applies to the main encoder, pacer and scene ceiling.
+guint vtx_tracks_split_bitrate(VtxTracks *tracks, guint total_kbps)
+{
+  guint shares = 0;
+  for (guint i = 0; i < tracks->n_tracks; i++)
+  {
+    if (g_atomic_int_get(&tracks->tracks[i].state) != TRACK_PAUSED) shares += tracks->tracks[i].share;
+  }
+
+  tracks->total_kbps = total_kbps;
+  if (!shares) return 0;
+
+  for (guint i = 0; i < tracks->n_tracks; i++)
+  {
+    Track *track = &tracks->tracks[i];
+    if (g_atomic_int_get(&track->state) == TRACK_PAUSED) continue;
+
+    track->kbps = MAX((guint) ((guint64) total_kbps * track->share / shares), RECONFIG_MIN_BITRATE_KBPS);
+    if (track->encoder) vtx_encoder_set_bitrate_kbps(track->encoder, track->kbps);
+  }
+  return g_atomic_int_get(&tracks->tracks[0].state) == TRACK_PAUSED ? 0 : tracks->tracks[0].kbps;
+}
+
+// Pauses or resumes a track by name. A resumed track asks its encoder for a keyframe; the session bitrate is split again
+// between the running tracks.
+gboolean vtx_tracks_set_paused(VtxTracks *tracks, const gchar *name, gboolean paused, gchar **error_msg)
+{
+  Track *track = NULL;
+  for (guint i = 0; i < tracks->n_tracks && !track; i++)
+  {
+    if (g_strcmp0(tracks->tracks[i].name, name) == 0) track = &tracks->tracks[i];
+  }
+
+  if (!track)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("No video track %s", name ? name : "(none)");
+    return FALSE;
+  }
+  if (!track->pay_sink)
+  {
+    if (error_msg) *error_msg = g_strdup_printf("Video track %s has no payloader to pause", name);
+    return FALSE;
+  }
+  if ((g_atomic_int_get(&track->state) == TRACK_PAUSED) == paused) return TRUE;
+
+  if (paused)
+  {
+    g_atomic_int_set(&track->state, TRACK_PAUSED);
+    track->pauses++;
+  }
+  else
+  {
+    g_atomic_int_set(&track->state, TRACK_RESUMING);
+    gst_pad_push_event(track->pay_sink, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+  }
+  gst_println("Video track %s %s", track->name, paused ? "paused" : "resumed");
+
+  if (tracks->total_kbps && g_reconfig) vtx_reconfig_set_bitrate(g_reconfig, tracks->total_kbps, NULL);
+  return TRUE;
+}
+
+// Removes the pause probes and releases the track elements (they go with the pipeline).
+void vtx_tracks_free(VtxTracks *tracks)
+{
+  if (!tracks) return;
+
+  for (guint i = 0; i < tracks->n_tracks; i++)
+  {
+    Track *track = &tracks->tracks[i];
+    if (track->probe_id) gst_pad_remove_probe(track->pay_sink, track->probe_id);
+    if (track->pay_sink) gst_object_unref(track->pay_sink);
+    if (track->encoder) gst_object_unref(track->encoder);
+    if (track->bin) gst_object_unref(track->bin);
+    g_free(track->name);
+    g_free(track->priority);
+  }
+  gst_object_unref(tracks->pipeline);
+  g_free(tracks);
+}
+
+// Returns per track its share, current bitrate, state and the frames sent and dropped while paused.
+JsonArray *vtx_tracks_get_stats(VtxTracks *tracks)
+{
+  static const gchar *states[] = {"running", "paused", "resuming"};
+  JsonArray *array = json_array_new();
+
+  for (guint i = 0; i < tracks->n_tracks; i++)
+  {
+    Track *track = &tracks->tracks[i];
+    JsonObject *o = json_object_new();
+    json_object_set_string_member(o, "name", track->name);
+    json_object_set_string_member(o, "state", states[g_atomic_int_get(&track->state)]);
+    json_object_set_int_member(o, "bitrate_share", track->share);
+    json_object_set_int_member(o, "bitrate_kbps", track->kbps);
+    if (track->priority) json_object_set_string_member(o, "priority", track->priority);
+    json_object_set_int_member(o, "frames", g_atomic_int_get(&track->frames));
+    json_object_set_int_member(o, "dropped_paused", g_atomic_int_get(&track->dropped));
+    json_object_set_int_member(o, "pauses", track->pauses);
+    json_array_add_object_element(array, o);
+  }
+  return array;
+}
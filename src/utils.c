@@ -3,8 +3,25 @@
 #include <locale.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/resource.h>
 
+#include "headers/camera.h"
 #include "headers/data_channel.h"
+#include "headers/dvr.h"
+#include "headers/fallback.h"
+#include "headers/graph.h"
+#include "headers/latency.h"
+#include "headers/pacer.h"
+#include "headers/reconfig.h"
+#include "headers/recorder.h"
+#include "headers/scene.h"
+#include "headers/signaling_codec.h"
+#include "headers/standby.h"
+#include "headers/svc.h"
+#include "headers/tap.h"
+#include "headers/tracks.h"
+#include "headers/watchdog.h"
+#include "headers/whip.h"
 #include "headers/wpa.h"
 
 // Global platform variable (detected at runtime)
@@ -196,41 +213,127 @@ gchar *vtx_platform_to_string(PlatformType platform)
   }
 }
 
-// Serializes a signaling message (type, session IDs, and data fields) to JSON and sends it over the WebSocket connection.
+// Serializes a signaling message (type, session IDs, and data fields) in the connection's encoding and sends it over the WebSocket connection.
+// Members are streamed into the per-thread writer buffer, so nothing is copied or allocated per message.
 void vtx_ws_send(SoupWebsocketConnection *conn, int type, const gchar *ws1Id, const gchar *ws2Id, JsonObject *data)
 {
-  JsonObject *msg = json_object_new();
+  // While signaling reconnects, established peers keep streaming; only late trickle candidates and errors are lost
+  if (!conn || soup_websocket_connection_get_state(conn) != SOUP_WEBSOCKET_STATE_OPEN)
+  {
+    gst_printerrln("Signaling offline, dropping message type %d", type);
+    return;
+  }
+
+  VtxSignalingWriter *w = vtx_signaling_writer_acquire(vtx_signaling_encoding(conn));
+
+  vtx_signaling_writer_begin_object(w);
+  vtx_signaling_writer_key(w, "type");
+  vtx_signaling_writer_int(w, type);
+  vtx_signaling_writer_key(w, "ws1Id");
+  vtx_signaling_writer_string(w, ws1Id);
+  vtx_signaling_writer_key(w, "ws2Id");
+  vtx_signaling_writer_string(w, ws2Id);
+  vtx_signaling_writer_members(w, data);
+  vtx_signaling_writer_end_object(w);
+
+  vtx_signaling_writer_send(w, conn);
+}
+
+// Returns the process CPU usage (user + system, in percent of one core) since the previous sample and stores the new sample.
+// The first call only takes the reference sample.
+gdouble vtx_cpu_percent_since(CpuSample *last)
+{
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+
+  gint64 cpu_us = (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+  gint64 wall_us = g_get_monotonic_time();
+  gdouble percent = last->wall_us && wall_us > last->wall_us ? 100.0 * (cpu_us - last->cpu_us) / (wall_us - last->wall_us) : 0.0;
+  last->wall_us = wall_us;
+  last->cpu_us = cpu_us;
+  return percent;
+}
 
-  json_object_set_int_member(msg, "type", type);
-  json_object_set_string_member(msg, "ws1Id", ws1Id);
-  json_object_set_string_member(msg, "ws2Id", ws2Id);
+// Frees the per-stream media hooks. The pipeline they are attached to must already be stopped.
+void vtx_cleanup_media_hooks(void)
+{
+  if (g_pacer)
+  {
+    vtx_pacer_free(g_pacer);
+    g_pacer = NULL;
+  }
 
-  GList *members = json_object_get_members(data);
-  for (GList *l = members; l != NULL; l = l->next)
+  if (g_scene)
   {
-    const gchar *key = l->data;
-    JsonNode *value = json_object_get_member(data, key);
-    json_object_set_member(msg, key, json_node_copy(value));
+    vtx_scene_free(g_scene);
+    g_scene = NULL;
   }
 
-  g_list_free(members);
+  if (g_latency)
+  {
+    vtx_latency_free(g_latency);
+    g_latency = NULL;
+  }
 
-  JsonNode *root = json_node_new(JSON_NODE_OBJECT);
-  json_node_set_object(root, msg);
+  if (g_svc)
+  {
+    vtx_svc_free(g_svc);
+    g_svc = NULL;
+  }
 
-  JsonGenerator *gen = json_generator_new();
-  json_generator_set_pretty(gen, TRUE);
-  json_generator_set_root(gen, root);
+  if (g_tap)
+  {
+    vtx_tap_free(g_tap);
+    g_tap = NULL;
+  }
 
-  gsize length = 0;
-  gchar *json_str = json_generator_to_data(gen, &length);
+  if (g_recorder)
+  {
+    vtx_recorder_free(g_recorder);
+    g_recorder = NULL;
+  }
 
-  soup_websocket_connection_send_text(conn, json_str);
+  if (g_dvr)
+  {
+    vtx_dvr_free(g_dvr);
+    g_dvr = NULL;
+  }
 
-  g_free(json_str);
-  g_object_unref(gen);
-  json_node_free(root);
-  json_object_unref(msg);
+  if (g_reconfig)
+  {
+    vtx_reconfig_free(g_reconfig);
+    g_reconfig = NULL;
+  }
+
+  if (g_fallback)
+  {
+    vtx_fallback_free(g_fallback);
+    g_fallback = NULL;
+  }
+
+  if (g_watchdog)
+  {
+    vtx_watchdog_free(g_watchdog);
+    g_watchdog = NULL;
+  }
+
+  if (g_graph)
+  {
+    vtx_graph_free(g_graph);
+    g_graph = NULL;
+  }
+
+  if (g_camera)
+  {
+    vtx_camera_free(g_camera);
+    g_camera = NULL;
+  }
+
+  if (g_tracks)
+  {
+    vtx_tracks_free(g_tracks);
+    g_tracks = NULL;
+  }
 }
 
 // Tears down data channels, MSP, WPA, pipeline, and webrtcbin, then resets app_state to SERVER_REGISTERED.
@@ -248,7 +351,15 @@ gboolean vtx_cleanup_connection(const gchar *msg)
   vtx_wpa_supplicant_cleanup();
 
   // Cleanup GStreamer pipeline and webrtc
-  if (pipeline)
+  gboolean shared = vtx_pipeline_is_shared();
+  if (shared)
+  {
+    // Shared pipeline: only the session's webrtcbin is removed, capture, encoding and other viewers keep running
+    vtx_standby_detach(g_standby, webrtc);
+    gst_object_unref(pipeline);
+    pipeline = NULL;
+  }
+  else if (pipeline)
   {
     GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
     if (bus)
@@ -259,6 +370,9 @@ gboolean vtx_cleanup_connection(const gchar *msg)
     gst_element_set_state(pipeline, GST_STATE_NULL);
     gst_object_unref(pipeline);
     pipeline = NULL;
+
+    // Pacer probes can only be removed once the streaming threads have stopped
+    vtx_cleanup_media_hooks();
   }
 
   if (webrtc)
@@ -279,6 +393,12 @@ gboolean vtx_cleanup_connection(const gchar *msg)
 
   gst_println("Connection cleaned up, ready for reconnection");
 
+  // The shared pipeline stops with its last viewer unless it is kept warm
+  if (shared) vtx_pipeline_release_standby();
+
+  // Without a receiver to start the next session, WHIP publishes it again
+  if (g_whip) vtx_whip_on_session_closed(g_whip);
+
   return TRUE;
 }
 
@@ -0,0 +1,398 @@
+#include "headers/watchdog.h"
+
+#include "headers/codec_branch.h"
+#include "headers/fallback.h"
+
+typedef struct VtxWatchdogBranch WatchdogBranch;
+
+struct VtxWatchdogBranch
+{
+  VtxWatchdog *watchdog;
+  const gchar *name;  // "video" or "audio"
+  GstPad *pad;        // watched sink pad
+  gulong probe_id;
+  GPtrArray *elements;  // everything upstream of the pad, nearest first
+
+  // guarded by watchdog->lock
+  gint64 last_buffer_us;  // 0 until the first buffer
+  gint64 frame_us;        // from the caps framerate, else the measured buffer interval
+  gboolean framerate_known;
+  gboolean eos;
+  gint64 detect_us;  // when the failure being recovered was detected, 0 when healthy
+  guint recoveries;
+  gdouble last_recovery_ms;
+  gdouble max_recovery_ms;
+
+  // main thread only
+  gint64 restart_us;  // when the pending restart was issued
+  GQueue restart_times;
+  guint stalls;
+  guint errors;
+  guint restarts;
+  gboolean gave_up;
+  const gchar *last_reason;
+};
+
+struct VtxWatchdog
+{
+  guint stall_frames;
+  guint check_id;
+  GMutex lock;
+  WatchdogBranch *video;
+  WatchdogBranch *audio;
+};
+
+VtxWatchdog *g_watchdog = NULL;
+
+// Returns the element owning the pad, looking through ghost pads to the element they proxy.
+static GstElement *vtx_watchdog_pad_element(GstPad *pad)
+{
+  GstPad *target = gst_object_ref(pad);
+  while (GST_IS_GHOST_PAD(target))
+  {
+    GstPad *inner = gst_ghost_pad_get_target(GST_GHOST_PAD(target));
+    gst_object_unref(target);
+    if (!inner) return NULL;
+    target = inner;
+  }
+  GstElement *element = gst_pad_get_parent_element(target);
+  gst_object_unref(target);
+  return element;
+}
+
+// Collects every element upstream of the pad, nearest first (the order they are stopped and restarted in).
+static GPtrArray *vtx_watchdog_collect_upstream(GstPad *pad)
+{
+  GPtrArray *elements = g_ptr_array_new_with_free_func(gst_object_unref);
+  GQueue pending = G_QUEUE_INIT;
+  g_queue_push_tail(&pending, gst_object_ref(pad));
+
+  GstPad *sink;
+  while ((sink = g_queue_pop_head(&pending)))
+  {
+    GstPad *peer = gst_pad_get_peer(sink);
+    gst_object_unref(sink);
+    if (!peer) continue;
+
+    GstElement *element = vtx_watchdog_pad_element(peer);
+    gst_object_unref(peer);
+    if (!element) continue;
+    if (g_ptr_array_find(elements, element, NULL))
+    {
+      gst_object_unref(element);
+      continue;
+    }
+    g_ptr_array_add(elements, element);
+
+    GstIterator *it = gst_element_iterate_sink_pads(element);
+    GValue item = G_VALUE_INIT;
+    while (gst_iterator_next(it, &item) == GST_ITERATOR_OK)
+    {
+      g_queue_push_tail(&pending, g_value_dup_object(&item));
+      g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+  }
+  return elements;
+}
+
+// Pad probe tracking buffer flow and frame interval; an EOS from a failing source is held back and restarts the branch.
+static GstPadProbeReturn vtx_watchdog_on_pad(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+  WatchdogBranch *branch = user_data;
+  VtxWatchdog *watchdog = branch->watchdog;
+  gint64 now_us = g_get_monotonic_time();
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+  {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+    {
+      GstCaps *caps = NULL;
+      gint num = 0, den = 0;
+      gst_event_parse_caps(event, &caps);
+      if (gst_structure_get_fraction(gst_caps_get_structure(caps, 0), "framerate", &num, &den) && num > 0 && den > 0)
+      {
+        g_mutex_lock(&watchdog->lock);
+        branch->frame_us = gst_util_uint64_scale(den, G_USEC_PER_SEC, num);
+        branch->framerate_known = TRUE;
+        g_mutex_unlock(&watchdog->lock);
+      }
+    }
+    else if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+    {
+      g_mutex_lock(&watchdog->lock);
+      branch->eos = TRUE;
+      g_mutex_unlock(&watchdog->lock);
+      return GST_PAD_PROBE_DROP;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  g_mutex_lock(&watchdog->lock);
+  if (!branch->framerate_known && branch->last_buffer_us)
+  {
+    // exponential moving average of the buffer interval (1/8 weight)
+    gint64 interval_us = now_us - branch->last_buffer_us;
+    branch->frame_us = branch->frame_us ? branch->frame_us + (interval_us - branch->frame_us) / 8 : interval_us;
+  }
+  branch->last_buffer_us = now_us;
+  if (branch->detect_us)
+  {
+    gdouble recovery_ms = (now_us - branch->detect_us) / 1000.0;
+    branch->recoveries++;
+    branch->last_recovery_ms = recovery_ms;
+    if (recovery_ms > branch->max_recovery_ms) branch->max_recovery_ms = recovery_ms;
+    branch->detect_us = 0;
+    gst_println("Watchdog: %s recovered in %.0f ms", branch->name, recovery_ms);
+  }
+  g_mutex_unlock(&watchdog->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+// Gives up on a branch that keeps failing: posts an error the bus handler no longer intercepts, ending the session as
+// before the watchdog.
+static void vtx_watchdog_give_up(WatchdogBranch *branch)
+{
+  branch->gave_up = TRUE;
+  gst_printerrln("Watchdog: %s failed %u times within %u s, giving up", branch->name, WATCHDOG_MAX_RESTARTS, WATCHDOG_RESTART_WINDOW_S);
+
+  GstElement *source = g_ptr_array_index(branch->elements, branch->elements->len - 1);
+  GError *error = g_error_new(GST_STREAM_ERROR, GST_STREAM_ERROR_FAILED, "%s branch did not recover (%s)", branch->name, branch->last_reason);
+  gst_element_post_message(source, gst_message_new_error(GST_OBJECT(source), error, "watchdog"));
+  g_error_free(error);
+}
+
+// Restarts the elements upstream of the watched pad: all are stopped nearest first, then brought back to the pipeline's
+// state nearest first, so each is ready before its upstream neighbour pushes again.
+static void vtx_watchdog_restart(WatchdogBranch *branch, const gchar *reason)
+{
+  gint64 now_us = g_get_monotonic_time();
+  branch->last_reason = reason;
+
+  while (!g_queue_is_empty(&branch->restart_times) && now_us - *(gint64 *) g_queue_peek_head(&branch->restart_times) > (gint64) WATCHDOG_RESTART_WINDOW_S * G_USEC_PER_SEC)
+  {
+    g_free(g_queue_pop_head(&branch->restart_times));
+  }
+  if (g_queue_get_length(&branch->restart_times) >= WATCHDOG_MAX_RESTARTS)
+  {
+    vtx_watchdog_give_up(branch);
+    return;
+  }
+  gint64 *restart_time = g_new(gint64, 1);
+  *restart_time = now_us;
+  g_queue_push_tail(&branch->restart_times, restart_time);
+
+  g_mutex_lock(&branch->watchdog->lock);
+  if (!branch->detect_us) branch->detect_us = now_us;
+  branch->eos = FALSE;
+  g_mutex_unlock(&branch->watchdog->lock);
+
+  gst_printerrln("Watchdog: restarting %u %s elements (%s)", branch->elements->len, branch->name, reason);
+  for (guint i = 0; i < branch->elements->len; i++)
+  {
+    gst_element_set_state(g_ptr_array_index(branch->elements, i), GST_STATE_NULL);
+  }
+  for (guint i = 0; i < branch->elements->len; i++)
+  {
+    gst_element_sync_state_with_parent(g_ptr_array_index(branch->elements, i));
+  }
+
+  branch->restart_us = now_us;
+  branch->restarts++;
+}
+
+// Checks one branch for a stall, a held-back EOS or a restart that did not bring buffers back.
+static void vtx_watchdog_check_branch(WatchdogBranch *branch, gint64 now_us)
+{
+  if (!branch || branch->gave_up) return;
+
+  VtxWatchdog *watchdog = branch->watchdog;
+  g_mutex_lock(&watchdog->lock);
+  gint64 frame_us = branch->frame_us ? branch->frame_us : WATCHDOG_DEFAULT_FRAME_MS * 1000;
+  gint64 stall_us = MAX(frame_us * watchdog->stall_frames, WATCHDOG_MIN_STALL_MS * 1000);
+  gboolean eos = branch->eos;
+  gboolean recovering = branch->detect_us != 0;
+  gboolean stalled = branch->last_buffer_us && now_us - branch->last_buffer_us > stall_us;
+  g_mutex_unlock(&watchdog->lock);
+
+  if (eos)
+  {
+    vtx_watchdog_restart(branch, "eos");
+  }
+  else if (recovering)
+  {
+    if (now_us - branch->restart_us > WATCHDOG_RESTART_GRACE_MS * 1000) vtx_watchdog_restart(branch, "no buffers after restart");
+  }
+  else if (stalled)
+  {
+    branch->stalls++;
+    vtx_watchdog_restart(branch, "stall");
+  }
+}
+
+// Periodic check of both branches.
+static gboolean vtx_watchdog_on_check(gpointer user_data)
+{
+  VtxWatchdog *watchdog = user_data;
+  gint64 now_us = g_get_monotonic_time();
+  vtx_watchdog_check_branch(watchdog->video, now_us);
+  vtx_watchdog_check_branch(watchdog->audio, now_us);
+  return G_SOURCE_CONTINUE;
+}
+
+// Watches a sink pad of the named element.
+static WatchdogBranch *vtx_watchdog_branch_new(VtxWatchdog *watchdog, GstElement *pipeline, const gchar *element_name, const gchar *pad_name, const gchar *name)
+{
+  GstElement *element = gst_bin_get_by_name(GST_BIN(pipeline), element_name);
+  if (!element) return NULL;
+
+  GstPad *pad = gst_element_get_static_pad(element, pad_name);
+  gst_object_unref(element);
+  if (!pad) return NULL;
+
+  WatchdogBranch *branch = g_new0(WatchdogBranch, 1);
+  branch->watchdog = watchdog;
+  branch->name = name;
+  branch->pad = pad;
+  branch->elements = vtx_watchdog_collect_upstream(pad);
+  g_queue_init(&branch->restart_times);
+  if (branch->elements->len == 0)
+  {
+    gst_object_unref(pad);
+    g_ptr_array_free(branch->elements, TRUE);
+    g_free(branch);
+    return NULL;
+  }
+
+  branch->probe_id = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, vtx_watchdog_on_pad, branch, NULL);
+  gst_println("Watchdog: watching %s (%u elements upstream of %s)", name, branch->elements->len, element_name);
+  return branch;
+}
+
+// Removes the probe of a branch and frees it.
+static void vtx_watchdog_branch_free(WatchdogBranch *branch)
+{
+  if (!branch) return;
+  gst_pad_remove_probe(branch->pad, branch->probe_id);
+  gst_object_unref(branch->pad);
+  g_ptr_array_free(branch->elements, TRUE);
+  g_queue_clear_full(&branch->restart_times, g_free);
+  g_free(branch);
+}
+
+// Starts watching the video and audio branches of a pipeline that has not been started yet. With the source fallback the
+// source side of its selector is watched (the encoder keeps receiving filler frames), in multi-codec mode the source tee,
+// since only the selected codec's payloader receives buffers.
+VtxWatchdog *vtx_watchdog_attach(GstElement *pipeline, guint stall_frames)
+{
+  VtxWatchdog *watchdog = g_new0(VtxWatchdog, 1);
+  g_mutex_init(&watchdog->lock);
+  watchdog->stall_frames = stall_frames;
+
+  watchdog->video = vtx_watchdog_branch_new(watchdog, pipeline, FALLBACK_SELECTOR, "sink_0", "video");
+  if (!watchdog->video) watchdog->video = vtx_watchdog_branch_new(watchdog, pipeline, CODEC_BRANCH_SOURCE_TEE, "sink", "video");
+  if (!watchdog->video) watchdog->video = vtx_watchdog_branch_new(watchdog, pipeline, "videopay", "sink", "video");
+  watchdog->audio = vtx_watchdog_branch_new(watchdog, pipeline, "audiopay", "sink", "audio");
+
+  if (!watchdog->video && !watchdog->audio)
+  {
+    vtx_watchdog_free(watchdog);
+    return NULL;
+  }
+  watchdog->check_id = g_timeout_add(WATCHDOG_CHECK_INTERVAL_MS, vtx_watchdog_on_check, watchdog);
+  return watchdog;
+}
+
+// Stops watching. The pipeline must already be stopped.
+void vtx_watchdog_free(VtxWatchdog *watchdog)
+{
+  if (!watchdog) return;
+
+  if (watchdog->check_id) g_source_remove(watchdog->check_id);
+  vtx_watchdog_branch_free(watchdog->video);
+  vtx_watchdog_branch_free(watchdog->audio);
+  g_mutex_clear(&watchdog->lock);
+  g_free(watchdog);
+}
+
+// Restarts the replacement instead of an element that was swapped out of the pipeline (encoder failover).
+void vtx_watchdog_replace_element(VtxWatchdog *watchdog, GstElement *old, GstElement *replacement)
+{
+  WatchdogBranch *branches[] = {watchdog->video, watchdog->audio};
+  for (guint b = 0; b < G_N_ELEMENTS(branches); b++)
+  {
+    guint index;
+    if (!branches[b] || !g_ptr_array_find(branches[b]->elements, old, &index)) continue;
+
+    gst_object_unref(g_ptr_array_index(branches[b]->elements, index));
+    g_ptr_array_index(branches[b]->elements, index) = gst_object_ref(replacement);
+  }
+}
+
+// Returns the branch an object (a bus message source) belongs to, or NULL.
+static WatchdogBranch *vtx_watchdog_find_branch(VtxWatchdog *watchdog, GstObject *object)
+{
+  WatchdogBranch *branches[] = {watchdog->video, watchdog->audio};
+  for (guint b = 0; b < G_N_ELEMENTS(branches); b++)
+  {
+    if (!branches[b]) continue;
+    for (guint i = 0; i < branches[b]->elements->len; i++)
+    {
+      if (gst_object_has_as_ancestor(object, g_ptr_array_index(branches[b]->elements, i))) return branches[b];
+    }
+  }
+  return NULL;
+}
+
+// Restarts the branch an error message came from instead of ending the session. Returns FALSE for messages the watchdog
+// does not handle, including errors of a branch it gave up on.
+gboolean vtx_watchdog_handle_message(VtxWatchdog *watchdog, GstMessage *msg)
+{
+  if (GST_MESSAGE_TYPE(msg) != GST_MESSAGE_ERROR) return FALSE;
+
+  WatchdogBranch *branch = vtx_watchdog_find_branch(watchdog, GST_MESSAGE_SRC(msg));
+  if (!branch || branch->gave_up) return FALSE;
+
+  GError *err = NULL;
+  gst_message_parse_error(msg, &err, NULL);
+  gst_printerrln("Watchdog: %s error from %s: %s", branch->name, GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), err->message);
+  g_error_free(err);
+  branch->errors++;
+
+  // One failure often posts several errors; the pending restart covers them
+  g_mutex_lock(&watchdog->lock);
+  gboolean recovering = branch->detect_us != 0;
+  g_mutex_unlock(&watchdog->lock);
+  if (!recovering) vtx_watchdog_restart(branch, "error");
+  return TRUE;
+}
+
+// Returns the counters of one branch.
+static JsonObject *vtx_watchdog_branch_get_stats(WatchdogBranch *branch)
+{
+  JsonObject *stats = json_object_new();
+  json_object_set_int_member(stats, "stalls", branch->stalls);
+  json_object_set_int_member(stats, "errors", branch->errors);
+  json_object_set_int_member(stats, "restarts", branch->restarts);
+  json_object_set_boolean_member(stats, "gave_up", branch->gave_up);
+  if (branch->last_reason) json_object_set_string_member(stats, "last_reason", branch->last_reason);
+
+  g_mutex_lock(&branch->watchdog->lock);
+  json_object_set_int_member(stats, "recoveries", branch->recoveries);
+  json_object_set_double_member(stats, "last_recovery_ms", branch->last_recovery_ms);
+  json_object_set_double_member(stats, "max_recovery_ms", branch->max_recovery_ms);
+  json_object_set_boolean_member(stats, "recovering", branch->detect_us != 0);
+  g_mutex_unlock(&branch->watchdog->lock);
+  return stats;
+}
+
+// Returns stall, restart and recovery-time counters per branch.
+JsonObject *vtx_watchdog_get_stats(VtxWatchdog *watchdog)
+{
+  JsonObject *stats = json_object_new();
+  if (watchdog->video) json_object_set_object_member(stats, "video", vtx_watchdog_branch_get_stats(watchdog->video));
+  if (watchdog->audio) json_object_set_object_member(stats, "audio", vtx_watchdog_branch_get_stats(watchdog->audio));
+  return stats;
+}
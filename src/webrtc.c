@@ -2,11 +2,28 @@
 #include <gst/webrtc/webrtc.h>
 
 #include "headers/data_channel.h"
+#include "headers/netmon.h"
 #include "headers/utils.h"
+#include "headers/webrtc.h"
+#include "headers/whip.h"
+
+// Returns the ws2Id of the receiver a webrtcbin belongs to: an additional viewer's own ID, or the primary session's.
+const gchar *vtx_webrtc_peer_id(GstElement *webrtc)
+{
+  const gchar *viewer_id = g_object_get_data(G_OBJECT(webrtc), VTX_WEBRTC_VIEWER_ID);
+  return viewer_id ? viewer_id : ws2Id;
+}
 
 // Serializes the local SDP offer and sends it to the receiver via the signaling WebSocket.
-static void vtx_webrtc_send_sdp_offer(GstWebRTCSessionDescription *desc)
+void vtx_webrtc_send_sdp_offer(GstElement *element, GstWebRTCSessionDescription *desc)
 {
+  // WHIP posts the local description once it carries the gathered candidates
+  if (g_whip)
+  {
+    vtx_whip_on_offer(g_whip, element);
+    return;
+  }
+
   gchar *sdp = gst_sdp_message_as_text(desc->sdp);
   JsonObject *offer = json_object_new();
   json_object_set_string_member(offer, "type", "offer");
@@ -16,24 +33,134 @@ static void vtx_webrtc_send_sdp_offer(GstWebRTCSessionDescription *desc)
   json_object_set_object_member(msg, "offer", offer);
 
   gst_println("<<< %d RECEIVER_SDP_OFFER", RECEIVER_SDP_OFFER);
-  vtx_ws_send(ws_conn, RECEIVER_SDP_OFFER, ws1Id, ws2Id, msg);
-  app_state = PEER_CALL_SEND_OFFER;
+  vtx_ws_send(ws_conn, RECEIVER_SDP_OFFER, ws1Id, vtx_webrtc_peer_id(element), msg);
+  if (element == webrtc) app_state = PEER_CALL_SEND_OFFER;
   g_free(sdp);
   json_object_unref(msg);
 }
 
-// Signal handler that forwards a locally gathered ICE candidate to the receiver via the signaling WebSocket.
+// Candidates of one webrtcbin waiting to go out as a single RECEIVER_ICE message.
+typedef struct
+{
+  GMutex lock;
+  guint window_ms;
+  JsonArray *pending;
+  guint timeout_id;
+} IceBatch;
+
+#define VTX_WEBRTC_ICE_BATCH "vtx-ice-batch"
+
+// Frees the batch state with its webrtcbin.
+static void vtx_webrtc_ice_batch_free(gpointer data)
+{
+  IceBatch *batch = data;
+  if (batch->timeout_id) g_source_remove(batch->timeout_id);
+  json_array_unref(batch->pending);
+  g_mutex_clear(&batch->lock);
+  g_free(batch);
+}
+
+// Switches a webrtcbin from one RECEIVER_ICE message per candidate to batches sent window_ms after their first
+// candidate or when gathering completes, the last one carrying endOfCandidates. For vrx builds that request it.
+void vtx_webrtc_batch_ice_candidates(GstElement *webrtc, guint window_ms)
+{
+  if (window_ms == 0) return;
+
+  IceBatch *batch = g_new0(IceBatch, 1);
+  g_mutex_init(&batch->lock);
+  batch->window_ms = window_ms;
+  batch->pending = json_array_new();
+  g_object_set_data_full(G_OBJECT(webrtc), VTX_WEBRTC_ICE_BATCH, batch, vtx_webrtc_ice_batch_free);
+}
+
+// Sends the pending candidates as one RECEIVER_ICE message, marking the end of gathering if complete is set.
+static void vtx_webrtc_flush_ice_candidates(GstElement *webrtc, IceBatch *batch, gboolean complete)
+{
+  g_mutex_lock(&batch->lock);
+  if (batch->timeout_id)
+  {
+    g_source_remove(batch->timeout_id);
+    batch->timeout_id = 0;
+  }
+  JsonArray *candidates = batch->pending;
+  batch->pending = json_array_new();
+  g_mutex_unlock(&batch->lock);
+
+  guint count = json_array_get_length(candidates);
+  if (count > 0 || complete)
+  {
+    JsonObject *msg = json_object_new();
+    json_object_set_array_member(msg, "candidates", candidates);
+    json_object_set_boolean_member(msg, "endOfCandidates", complete);
+
+    gst_println("<<< %d RECEIVER_ICE: %u candidate(s)%s", RECEIVER_ICE, count, complete ? ", end of candidates" : "");
+    vtx_ws_send(ws_conn, RECEIVER_ICE, ws1Id, vtx_webrtc_peer_id(webrtc), msg);
+    json_object_unref(msg);
+  }
+  else
+  {
+    json_array_unref(candidates);
+  }
+}
+
+// Sends a batch once its window has passed.
+static gboolean vtx_webrtc_on_ice_batch_timeout(gpointer user_data)
+{
+  GstElement *webrtc = user_data;
+  IceBatch *batch = g_object_get_data(G_OBJECT(webrtc), VTX_WEBRTC_ICE_BATCH);
+
+  // The session was closed in the meantime
+  GstObject *parent = gst_object_get_parent(GST_OBJECT(webrtc));
+  if (!parent) return G_SOURCE_REMOVE;
+  gst_object_unref(parent);
+
+  g_mutex_lock(&batch->lock);
+  gboolean due = batch->timeout_id != 0;
+  batch->timeout_id = 0;
+  g_mutex_unlock(&batch->lock);
+
+  if (due) vtx_webrtc_flush_ice_candidates(webrtc, batch, FALSE);
+  return G_SOURCE_REMOVE;
+}
+
+// Sends the candidates still waiting and the end-of-candidates marker (batching receivers only).
+void vtx_webrtc_end_of_candidates(GstElement *webrtc)
+{
+  if (g_whip) return;
+
+  IceBatch *batch = g_object_get_data(G_OBJECT(webrtc), VTX_WEBRTC_ICE_BATCH);
+  if (batch) vtx_webrtc_flush_ice_candidates(webrtc, batch, TRUE);
+}
+
+// Signal handler that forwards a locally gathered ICE candidate to the receiver via the signaling WebSocket, either in the
+// next batch or, for receivers that did not ask for batching, as its own message.
 void vtx_webrtc_on_ice_candidate(GstElement *webrtc, guint mlineindex, gchar *candidate, gpointer user_data)
 {
+  // WHIP sends the candidates in the offer
+  if (g_whip) return;
+
   JsonObject *ice = json_object_new();
   json_object_set_string_member(ice, "candidate", candidate);
   json_object_set_int_member(ice, "sdpMLineIndex", mlineindex);
 
+  IceBatch *batch = g_object_get_data(G_OBJECT(webrtc), VTX_WEBRTC_ICE_BATCH);
+  if (batch)
+  {
+    g_mutex_lock(&batch->lock);
+    json_array_add_object_element(batch->pending, ice);
+    if (!batch->timeout_id)
+    {
+      batch->timeout_id = g_timeout_add_full(G_PRIORITY_DEFAULT, batch->window_ms, vtx_webrtc_on_ice_batch_timeout, gst_object_ref(webrtc), gst_object_unref);
+    }
+    g_mutex_unlock(&batch->lock);
+    return;
+  }
+
   JsonObject *msg = json_object_new();
   json_object_set_object_member(msg, "candidate", ice);
 
   gst_println("<<< %d RECEIVER_ICE: %s", RECEIVER_ICE, candidate);
-  vtx_ws_send(ws_conn, RECEIVER_ICE, ws1Id, ws2Id, msg);
+  vtx_ws_send(ws_conn, RECEIVER_ICE, ws1Id, vtx_webrtc_peer_id(webrtc), msg);
   json_object_unref(msg);
 }
 
@@ -56,6 +183,12 @@ void vtx_webrtc_notify_ice_gathering_state(GstElement *webrtc, GParamSpec *pspec
       break;
   }
   gst_println("--- ICE gathering state: %s", state_str);
+
+  if (state == GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE)
+  {
+    vtx_webrtc_end_of_candidates(webrtc);
+    if (g_whip) vtx_whip_on_gathering_complete(g_whip, webrtc);
+  }
 }
 
 // Logs the current ICE connection state (checking / connected / failed / etc.) whenever it changes.
@@ -91,31 +224,57 @@ void vtx_webrtc_notify_ice_connection_state(GstElement *webrtc, GParamSpec *pspe
       break;
   }
   gst_println("=== ICE connection state: %s", state_str);
+
+  vtx_netmon_on_ice_state(webrtc, state);
 }
 
 // Promise callback that retrieves the generated SDP offer, sets it as the local description, and sends it to the receiver.
 static void vtx_webrtc_on_create_offer(GstPromise *promise, gpointer user_data)
 {
+  GstElement *element = user_data;
   GstWebRTCSessionDescription *offer = NULL;
   const GstStructure *reply = gst_promise_get_reply(promise);
   gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
 
   GstPromise *local_desc_promise = gst_promise_new();
-  g_signal_emit_by_name(webrtc, "set-local-description", offer, local_desc_promise);
+  g_signal_emit_by_name(element, "set-local-description", offer, local_desc_promise);
   gst_promise_interrupt(local_desc_promise);
   gst_promise_unref(local_desc_promise);
 
-  vtx_webrtc_send_sdp_offer(offer);
+  vtx_webrtc_send_sdp_offer(element, offer);
   gst_webrtc_session_description_free(offer);
 }
 
-// Signal handler triggered by webrtcbin when negotiation is needed; creates DataChannels and initiates SDP offer creation.
+// Signal handler triggered by webrtcbin when negotiation is needed; creates DataChannels (primary session only) and
+// initiates SDP offer creation.
 void vtx_webrtc_on_negotiation_needed(GstElement *element, gpointer user_data)
 {
-  app_state = PEER_CALL_NEGOTIATING;
-  
-  vtx_dc_create_offer(webrtc);
+  if (element == webrtc)
+  {
+    app_state = PEER_CALL_NEGOTIATING;
+    vtx_dc_create_offer(element);
+  }
+
+  GstPromise *promise = gst_promise_new_with_change_func(vtx_webrtc_on_create_offer, gst_object_ref(element), gst_object_unref);
+  g_signal_emit_by_name(element, "create-offer", NULL, promise);
+}
+
+// Creates an ICE-restart offer on an established webrtcbin: new ICE credentials and candidates, while the DTLS transport,
+// SRTP keys and the encoders stay as they are. Returns FALSE if signaling is offline or a negotiation is in progress.
+gboolean vtx_webrtc_restart_ice(GstElement *element)
+{
+  if (!ws_conn || soup_websocket_connection_get_state(ws_conn) != SOUP_WEBSOCKET_STATE_OPEN) return FALSE;
+
+  GstWebRTCSignalingState signaling_state;
+  g_object_get(element, "signaling-state", &signaling_state, NULL);
+  if (signaling_state != GST_WEBRTC_SIGNALING_STATE_STABLE) return FALSE;
+
+  gst_println("Restarting ICE for %s", vtx_webrtc_peer_id(element));
+
+  GstStructure *options = gst_structure_new("offer-options", "ice-restart", G_TYPE_BOOLEAN, TRUE, NULL);
+  GstPromise *promise = gst_promise_new_with_change_func(vtx_webrtc_on_create_offer, gst_object_ref(element), gst_object_unref);
+  g_signal_emit_by_name(element, "create-offer", options, promise);
+  gst_structure_free(options);
 
-  GstPromise *promise = gst_promise_new_with_change_func(vtx_webrtc_on_create_offer, NULL, NULL);
-  g_signal_emit_by_name(webrtc, "create-offer", NULL, promise);
+  return TRUE;
 }
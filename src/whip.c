@@ -0,0 +1,497 @@
+#include "headers/whip.h"
+
+#include <gst/sdp/sdp.h>
+#include <gst/webrtc/webrtc.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "headers/codec_branch.h"
+#include "headers/common.h"
+#include "headers/data_channel.h"
+#include "headers/msp.h"
+#include "headers/pipeline.h"
+#include "headers/signaling.h"
+#include "headers/standby.h"
+#include "headers/utils.h"
+
+struct VtxWhip
+{
+  SoupSession *session;
+  gchar *endpoint;
+  gchar *token;
+  gchar *resource;      // session URL from the Location header, deleted on teardown
+  JsonParser *parser;   // owns the strings params points to
+  MediaParams params;
+  GstElement *pending;  // webrtcbin whose offer waits for ICE gathering
+  guint gather_timeout_id;
+  guint retry_id;
+  guint attempt;
+  gboolean published;   // the current session's offer was posted; WHIP sessions are not renegotiated
+  gint64 post_us;
+};
+
+VtxWhip *g_whip = NULL;
+
+static guint s_publishes = 0;
+static guint s_failures = 0;
+static gint64 s_last_exchange_us = -1;
+
+typedef struct
+{
+  SoupMessage *message;
+  gchar *endpoint;
+  VtxWhipAnswerFunc func;
+  gpointer user_data;
+} WhipExchange;
+
+static void vtx_whip_start_session(VtxWhip *whip);
+
+// Adds the bearer token, if any, to a request.
+static void vtx_whip_authorize(SoupMessage *message, const gchar *token)
+{
+  if (!token) return;
+
+  gchar *value = g_strdup_printf("Bearer %s", token);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+  soup_message_headers_replace(soup_message_get_request_headers(message), "Authorization", value);
+#else
+  soup_message_headers_replace(message->request_headers, "Authorization", value);
+#endif
+  g_free(value);
+}
+
+// Completes an exchange: a 201 carries the answer in the body and the session URL in Location, anything else is an error.
+static void vtx_whip_finish_exchange(WhipExchange *exchange, guint status, SoupMessageHeaders *headers, const gchar *body, gsize size, GError *error)
+{
+  gchar *answer = NULL;
+  gchar *resource = NULL;
+
+  if (!error && status != SOUP_STATUS_CREATED)
+  {
+    g_set_error(&error, G_IO_ERROR, G_IO_ERROR_FAILED, "WHIP endpoint answered %u: %.*s", status, (int) MIN(size, 256), body ? body : "");
+  }
+
+  if (!error)
+  {
+    const gchar *location = soup_message_headers_get_one(headers, "Location");
+    resource = location ? g_uri_resolve_relative(exchange->endpoint, location, G_URI_FLAGS_NONE, NULL) : NULL;
+    answer = g_strndup(body ? body : "", size);
+    if (!resource) gst_printerrln("WHIP endpoint did not return a session URL, the session cannot be deleted");
+  }
+
+  exchange->func(answer, resource, error, exchange->user_data);
+
+  g_clear_error(&error);
+  g_free(answer);
+  g_free(resource);
+  g_object_unref(exchange->message);
+  g_free(exchange->endpoint);
+  g_free(exchange);
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+// Response callback of the offer POST.
+static void vtx_whip_on_response(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  WhipExchange *exchange = user_data;
+  GError *error = NULL;
+  GBytes *body = soup_session_send_and_read_finish(SOUP_SESSION(source), res, &error);
+  gsize size = 0;
+  const gchar *data = body ? g_bytes_get_data(body, &size) : NULL;
+
+  vtx_whip_finish_exchange(exchange, soup_message_get_status(exchange->message), soup_message_get_response_headers(exchange->message), data, size, error);
+  if (body) g_bytes_unref(body);
+}
+#else
+// Response callback of the offer POST. Transport errors arrive as status codes below 100.
+static void vtx_whip_on_response(SoupSession *session, SoupMessage *message, gpointer user_data)
+{
+  WhipExchange *exchange = user_data;
+  GError *error = NULL;
+  if (SOUP_STATUS_IS_TRANSPORT_ERROR(message->status_code))
+  {
+    g_set_error(&error, G_IO_ERROR, G_IO_ERROR_FAILED, "%s", soup_status_get_phrase(message->status_code));
+  }
+
+  vtx_whip_finish_exchange(exchange, message->status_code, message->response_headers, message->response_body->data, message->response_body->length, error);
+}
+#endif
+
+// POSTs an SDP offer to a WHIP endpoint and reports the answer: the whole session setup in one HTTP round trip.
+void vtx_whip_exchange(SoupSession *session, const gchar *endpoint, const gchar *token, const gchar *offer, VtxWhipAnswerFunc func, gpointer user_data)
+{
+  WhipExchange *exchange = g_new0(WhipExchange, 1);
+  exchange->message = soup_message_new(SOUP_METHOD_POST, endpoint);
+  exchange->endpoint = g_strdup(endpoint);
+  exchange->func = func;
+  exchange->user_data = user_data;
+
+  if (!exchange->message)
+  {
+    GError *error = g_error_new(G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid WHIP endpoint: %s", endpoint);
+    func(NULL, NULL, error, user_data);
+    g_error_free(error);
+    g_free(exchange->endpoint);
+    g_free(exchange);
+    return;
+  }
+
+  vtx_whip_authorize(exchange->message, token);
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+  GBytes *body = g_bytes_new(offer, strlen(offer));
+  soup_message_set_request_body_from_bytes(exchange->message, "application/sdp", body);
+  g_bytes_unref(body);
+  soup_session_send_and_read_async(session, exchange->message, G_PRIORITY_DEFAULT, NULL, vtx_whip_on_response, exchange);
+#else
+  soup_message_set_request(exchange->message, "application/sdp", SOUP_MEMORY_COPY, offer, strlen(offer));
+  // The queue drops its own reference after the callback; the exchange keeps one
+  g_object_ref(exchange->message);
+  soup_session_queue_message(session, exchange->message, vtx_whip_on_response, exchange);
+#endif
+}
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+// Completes a DELETE sent while the main loop keeps running.
+static void vtx_whip_on_deleted(GObject *source, GAsyncResult *res, gpointer user_data)
+{
+  GError *error = NULL;
+  GBytes *body = soup_session_send_and_read_finish(SOUP_SESSION(source), res, &error);
+  if (error)
+  {
+    gst_printerrln("Failed to delete WHIP session: %s", error->message);
+    g_error_free(error);
+  }
+  if (body) g_bytes_unref(body);
+  g_object_unref(user_data);
+}
+#endif
+
+// Deletes the published session on the server, so it does not linger until its ICE consent expires. Only shutdown waits for
+// the response.
+static void vtx_whip_delete_resource(VtxWhip *whip, gboolean wait)
+{
+  if (!whip->resource) return;
+
+  gst_println("Deleting WHIP session %s", whip->resource);
+  SoupMessage *message = soup_message_new(SOUP_METHOD_DELETE, whip->resource);
+  g_clear_pointer(&whip->resource, g_free);
+  if (!message) return;
+
+  vtx_whip_authorize(message, whip->token);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+  if (wait)
+  {
+    GBytes *body = soup_session_send_and_read(whip->session, message, NULL, NULL);
+    if (body) g_bytes_unref(body);
+    g_object_unref(message);
+  }
+  else
+  {
+    soup_session_send_and_read_async(whip->session, message, G_PRIORITY_DEFAULT, NULL, vtx_whip_on_deleted, message);
+  }
+#else
+  if (wait)
+  {
+    soup_session_send_message(whip->session, message);
+    g_object_unref(message);
+  }
+  else
+  {
+    // The queue takes over the reference
+    soup_session_queue_message(whip->session, message, NULL, NULL);
+  }
+#endif
+}
+
+// Retries the publish after the backoff delay.
+static gboolean vtx_whip_on_retry_timeout(gpointer user_data)
+{
+  VtxWhip *whip = user_data;
+  whip->retry_id = 0;
+  vtx_whip_start_session(whip);
+  return G_SOURCE_REMOVE;
+}
+
+// Schedules the next session with the signaling reconnect backoff.
+static void vtx_whip_schedule_retry(VtxWhip *whip)
+{
+  if (whip->retry_id) return;
+
+  guint delay_ms = SIGNALING_RECONNECT_MIN_MS << MIN(whip->attempt, 16);
+  delay_ms = MIN(delay_ms, SIGNALING_RECONNECT_MAX_MS);
+  whip->attempt++;
+
+  gst_println("Publishing to WHIP endpoint again in %u ms", delay_ms);
+  whip->retry_id = g_timeout_add(delay_ms, vtx_whip_on_retry_timeout, whip);
+}
+
+// Applies the answer of the offer POST to the session's webrtcbin.
+static void vtx_whip_on_answer(const gchar *answer, const gchar *resource, const GError *error, gpointer user_data)
+{
+  VtxWhip *whip = user_data;
+  s_last_exchange_us = g_get_monotonic_time() - whip->post_us;
+
+  if (error)
+  {
+    s_failures++;
+    gst_printerrln("WHIP publish failed: %s", error->message);
+    vtx_cleanup_connection("Closing the session that could not be published");
+    return;
+  }
+
+  gst_println(">>> WHIP answer after %.1f ms", s_last_exchange_us / 1000.0);
+  g_free(whip->resource);
+  whip->resource = g_strdup(resource);
+  whip->attempt = 0;
+
+  GstSDPMessage *sdp;
+  if (gst_sdp_message_new(&sdp) != GST_SDP_OK) return;
+  if (gst_sdp_message_parse_buffer((const guint8 *) answer, strlen(answer), sdp) != GST_SDP_OK || !webrtc)
+  {
+    gst_sdp_message_free(sdp);
+    vtx_cleanup_connection(webrtc ? "Invalid WHIP SDP answer" : NULL);
+    return;
+  }
+
+  GstWebRTCSessionDescription *desc = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+  GstPromise *promise = gst_promise_new();
+  g_signal_emit_by_name(webrtc, "set-remote-description", desc, promise);
+  gst_promise_interrupt(promise);
+  gst_promise_unref(promise);
+
+  app_state = PEER_CALL_RECIVE_ANSWER;
+  vtx_codec_branch_select(pipeline, desc->sdp);
+  gst_webrtc_session_description_free(desc);
+}
+
+// Posts the pending webrtcbin's local description, which carries the candidates gathered so far.
+static void vtx_whip_post_offer(VtxWhip *whip)
+{
+  GstElement *element = whip->pending;
+  whip->pending = NULL;
+  if (whip->gather_timeout_id)
+  {
+    g_source_remove(whip->gather_timeout_id);
+    whip->gather_timeout_id = 0;
+  }
+
+  GstWebRTCSessionDescription *desc = NULL;
+  g_object_get(element, "local-description", &desc, NULL);
+  if (desc)
+  {
+    gchar *sdp = gst_sdp_message_as_text(desc->sdp);
+    gst_println("<<< WHIP offer to %s", whip->endpoint);
+
+    whip->published = TRUE;
+    whip->post_us = g_get_monotonic_time();
+    s_publishes++;
+    app_state = PEER_CALL_SEND_OFFER;
+    vtx_whip_exchange(whip->session, whip->endpoint, whip->token, sdp, vtx_whip_on_answer, whip);
+
+    g_free(sdp);
+    gst_webrtc_session_description_free(desc);
+  }
+
+  gst_object_unref(element);
+}
+
+// Posts the offer once ICE gathering is complete, or regardless of it when the gathering timeout expired.
+static void vtx_whip_post_if_gathered(VtxWhip *whip, gboolean timed_out)
+{
+  if (!whip->pending) return;
+
+  GstWebRTCICEGatheringState state;
+  g_object_get(whip->pending, "ice-gathering-state", &state, NULL);
+  if (state != GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE && !timed_out) return;
+
+  if (state != GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE)
+  {
+    gst_println("ICE gathering still running after %d ms, posting the candidates gathered so far", WHIP_GATHER_TIMEOUT_MS);
+  }
+  vtx_whip_post_offer(whip);
+}
+
+// Stops waiting for ICE gathering.
+static gboolean vtx_whip_on_gather_timeout(gpointer user_data)
+{
+  VtxWhip *whip = user_data;
+  whip->gather_timeout_id = 0;
+  vtx_whip_post_if_gathered(whip, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+// Main-loop side of vtx_whip_on_offer.
+static gboolean vtx_whip_on_offer_idle(gpointer user_data)
+{
+  GstElement *element = user_data;
+  VtxWhip *whip = g_whip;
+  if (!whip || element != webrtc) return G_SOURCE_REMOVE;
+
+  if (whip->published || whip->pending)
+  {
+    gst_println("WHIP sessions are not renegotiated, ignoring the new offer");
+    return G_SOURCE_REMOVE;
+  }
+
+  whip->pending = gst_object_ref(element);
+  whip->gather_timeout_id = g_timeout_add(WHIP_GATHER_TIMEOUT_MS, vtx_whip_on_gather_timeout, whip);
+  vtx_whip_post_if_gathered(whip, FALSE);
+  return G_SOURCE_REMOVE;
+}
+
+// Takes the local offer of the session's webrtcbin in place of the RECEIVER_SDP_OFFER message. Called from webrtcbin's
+// thread; the exchange runs on the main loop.
+void vtx_whip_on_offer(VtxWhip *whip, GstElement *element)
+{
+  g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, vtx_whip_on_offer_idle, gst_object_ref(element), gst_object_unref);
+}
+
+// Main-loop side of vtx_whip_on_gathering_complete.
+static gboolean vtx_whip_on_gathering_idle(gpointer user_data)
+{
+  if (g_whip && g_whip->pending == user_data) vtx_whip_post_if_gathered(g_whip, FALSE);
+  return G_SOURCE_REMOVE;
+}
+
+// Posts a waiting offer now that it has every candidate.
+void vtx_whip_on_gathering_complete(VtxWhip *whip, GstElement *element)
+{
+  g_main_context_invoke_full(NULL, G_PRIORITY_DEFAULT, vtx_whip_on_gathering_idle, gst_object_ref(element), gst_object_unref);
+}
+
+// Called by vtx_cleanup_connection: deletes the server side of the ended session and publishes a new one.
+void vtx_whip_on_session_closed(VtxWhip *whip)
+{
+  if (whip->pending)
+  {
+    gst_object_unref(whip->pending);
+    whip->pending = NULL;
+  }
+  if (whip->gather_timeout_id)
+  {
+    g_source_remove(whip->gather_timeout_id);
+    whip->gather_timeout_id = 0;
+  }
+
+  vtx_whip_delete_resource(whip, FALSE);
+  whip->published = FALSE;
+  vtx_whip_schedule_retry(whip);
+}
+
+// Starts a media session from the configured params; its offer goes to the WHIP endpoint once negotiation creates it.
+static void vtx_whip_start_session(VtxWhip *whip)
+{
+  if (pipeline) return;
+
+  gst_println("----- Publish to WHIP endpoint -----");
+
+  if (whip->params.flight_controller && g_strcmp0(whip->params.flight_controller, "none") != 0)
+  {
+    vtx_msp_cleanup_global();
+    MSP *msp = g_malloc(sizeof(MSP));
+    if (vtx_msp_init(msp, whip->params.flight_controller, B115200) == 1)
+    {
+      vtx_msp_set_global(msp);
+      gst_println("Flight controller opened: %s", whip->params.flight_controller);
+    }
+    else
+    {
+      g_free(msp);
+      gst_printerrln("Failed to open flight controller: %s", whip->params.flight_controller);
+    }
+  }
+
+  gchar *pipeline_error = NULL;
+  if (!vtx_pipeline_start(&whip->params, &pipeline_error))
+  {
+    s_failures++;
+    gst_printerrln("Failed to start pipeline: %s", pipeline_error ? pipeline_error : "unknown");
+    g_free(pipeline_error);
+    vtx_cleanup_connection(NULL);
+    return;
+  }
+
+  app_state = STREAM_REQUEST_ACCEPT;
+}
+
+// Starts the first session once g_whip is set, since the offer hooks look it up.
+static gboolean vtx_whip_on_start(gpointer user_data)
+{
+  vtx_whip_start_session(user_data);
+  return G_SOURCE_REMOVE;
+}
+
+// Selects the WHIP transport: loads the media params and publishes a session as soon as the main loop runs. Returns NULL if
+// the params cannot be loaded.
+VtxWhip *vtx_whip_start(const gchar *endpoint)
+{
+  gst_println("[Config] %s: %s", WHIP_ENDPOINT_ENV, endpoint);
+
+  const gchar *path = getenv(STANDBY_MEDIA_PARAMS_ENV);
+  if (!path)
+  {
+    gst_printerrln("WHIP mode needs the media params in %s", STANDBY_MEDIA_PARAMS_ENV);
+    return NULL;
+  }
+
+  VtxWhip *whip = g_new0(VtxWhip, 1);
+  GError *error = NULL;
+  whip->parser = json_parser_new();
+  if (!json_parser_load_from_file(whip->parser, path, &error) || !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(whip->parser)) || !vtx_pipeline_parse_media_params(json_node_get_object(json_parser_get_root(whip->parser)), &whip->params))
+  {
+    gst_printerrln("Failed to load %s: %s", path, error ? error->message : "invalid media params");
+    g_clear_error(&error);
+    g_object_unref(whip->parser);
+    g_free(whip);
+    return NULL;
+  }
+
+  whip->session = vtx_soup_session_new();
+  whip->endpoint = g_strdup(endpoint);
+  whip->token = g_strdup(getenv(WHIP_TOKEN_ENV));
+
+  g_idle_add(vtx_whip_on_start, whip);
+  return whip;
+}
+
+// Deletes the published session and frees the transport.
+void vtx_whip_free(VtxWhip *whip)
+{
+  if (!whip) return;
+
+  g_idle_remove_by_data(whip);
+  if (whip->retry_id) g_source_remove(whip->retry_id);
+  if (whip->gather_timeout_id) g_source_remove(whip->gather_timeout_id);
+  if (whip->pending) gst_object_unref(whip->pending);
+
+  vtx_whip_delete_resource(whip, TRUE);
+
+  g_object_unref(whip->session);
+  g_object_unref(whip->parser);
+  g_free(whip->endpoint);
+  g_free(whip->token);
+  g_free(whip);
+}
+
+// Returns the WHIP publish counters and the duration of the last offer/answer round trip.
+JsonObject *vtx_whip_get_stats(void)
+{
+  JsonObject *o = json_object_new();
+  if (!g_whip) return o;
+
+  json_object_set_string_member(o, "endpoint", g_whip->endpoint);
+  json_object_set_boolean_member(o, "published", g_whip->resource != NULL);
+  json_object_set_int_member(o, "publishes", s_publishes);
+  json_object_set_int_member(o, "failures", s_failures);
+  if (s_last_exchange_us >= 0)
+  {
+    json_object_set_double_member(o, "last_exchange_ms", s_last_exchange_us / 1000.0);
+  }
+  else
+  {
+    json_object_set_null_member(o, "last_exchange_ms");
+  }
+
+  return o;
+}
@@ -1,9 +1,13 @@
 #include <gst/webrtc/webrtc.h>
+#include <string.h>
 
 #include "data_channel.h"
+#include "graph.h"
 #include "inspection.h"
+#include "signaling_codec.h"
 #include "unity.h"
 #include "utils.h"
+#include "whip.h"
 
 // ----- WebRTC Loopback Test Helpers -----
 
@@ -478,3 +482,225 @@ test_vtx_webrtc_loopback (void)
       TEST_FAIL_MESSAGE ("WebRTC negotiation failed");
     }
 }
+
+// Encodes a signaling message as compact JSON and as CBOR and decodes both back
+void
+test_vtx_signaling_codec (void)
+{
+  JsonObject *data = json_object_new ();
+  json_object_set_string_member (data, "sdp", "v=0\r\n\"quoted\"");
+  json_object_set_double_member (data, "ratio", 2.0);
+  json_object_set_null_member (data, "ws2Id");
+
+  VtxSignalingWriter *w = vtx_signaling_writer_acquire (VTX_SIGNALING_JSON);
+  vtx_signaling_writer_begin_object (w);
+  vtx_signaling_writer_key (w, "type");
+  vtx_signaling_writer_int (w, -7);
+  vtx_signaling_writer_key (w, "list");
+  vtx_signaling_writer_begin_array (w);
+  vtx_signaling_writer_boolean (w, TRUE);
+  vtx_signaling_writer_int (w, 100000);
+  vtx_signaling_writer_end_array (w);
+  vtx_signaling_writer_members (w, data);
+  vtx_signaling_writer_end_object (w);
+  TEST_ASSERT_EQUAL_STRING ("{\"type\":-7,\"list\":[true,100000],\"sdp\":\"v=0\\r\\n\\\"quoted\\\"\",\"ratio\":2.0,\"ws2Id\":null}", w->buf->str);
+
+  for (gint encoding = VTX_SIGNALING_JSON; encoding <= VTX_SIGNALING_CBOR; encoding++)
+    {
+      w = vtx_signaling_writer_acquire (encoding);
+      vtx_signaling_writer_begin_object (w);
+      vtx_signaling_writer_key (w, "type");
+      vtx_signaling_writer_int (w, -7);
+      vtx_signaling_writer_key (w, "list");
+      vtx_signaling_writer_begin_array (w);
+      vtx_signaling_writer_boolean (w, TRUE);
+      vtx_signaling_writer_int (w, 100000);
+      vtx_signaling_writer_end_array (w);
+      vtx_signaling_writer_members (w, data);
+      vtx_signaling_writer_end_object (w);
+
+      GBytes *bytes = g_bytes_new (w->buf->str, w->buf->len);
+      GError *error = NULL;
+      JsonNode *root = vtx_signaling_decode (bytes, encoding, &error);
+      TEST_ASSERT_NULL (error);
+      TEST_ASSERT_TRUE (JSON_NODE_HOLDS_OBJECT (root));
+
+      JsonObject *object = json_node_get_object (root);
+      TEST_ASSERT_EQUAL_INT (-7, json_object_get_int_member (object, "type"));
+      JsonArray *list = json_object_get_array_member (object, "list");
+      TEST_ASSERT_TRUE (json_array_get_boolean_element (list, 0));
+      TEST_ASSERT_EQUAL_INT (100000, json_array_get_int_element (list, 1));
+      TEST_ASSERT_EQUAL_STRING ("v=0\r\n\"quoted\"", json_object_get_string_member (object, "sdp"));
+      TEST_ASSERT_TRUE (json_object_get_double_member (object, "ratio") == 2.0);
+      TEST_ASSERT_TRUE (json_object_get_null_member (object, "ws2Id"));
+
+      json_node_unref (root);
+      g_bytes_unref (bytes);
+    }
+
+  json_object_unref (data);
+}
+
+// ----- WHIP Stand-in Server Helpers -----
+
+#define WHIP_TEST_ANSWER "v=0\r\no=- 0 0 IN IP4 127.0.0.1\r\ns=-\r\nt=0 0\r\n"
+
+typedef struct
+{
+  GMainLoop *loop;
+  gchar *answer;
+  gchar *resource;
+  gboolean failed;
+} WhipTestState;
+
+#if SOUP_CHECK_VERSION(3, 0, 0)
+static void
+whip_test_handler (SoupServer *server, SoupServerMessage *msg, const char *path, GHashTable *query, gpointer user_data)
+{
+  SoupMessageHeaders *request = soup_server_message_get_request_headers (msg);
+  if (g_strcmp0 (soup_server_message_get_method (msg), "POST") != 0 || g_strcmp0 (soup_message_headers_get_content_type (request, NULL), "application/sdp") != 0
+      || g_strcmp0 (soup_message_headers_get_one (request, "Authorization"), "Bearer test-token") != 0)
+    {
+      soup_server_message_set_status (msg, SOUP_STATUS_BAD_REQUEST, NULL);
+      return;
+    }
+
+  soup_server_message_set_status (msg, SOUP_STATUS_CREATED, NULL);
+  soup_message_headers_replace (soup_server_message_get_response_headers (msg), "Location", "/whip/session/1");
+  soup_server_message_set_response (msg, "application/sdp", SOUP_MEMORY_STATIC, WHIP_TEST_ANSWER, strlen (WHIP_TEST_ANSWER));
+}
+#else
+static void
+whip_test_handler (SoupServer *server, SoupMessage *msg, const char *path, GHashTable *query, SoupClientContext *client, gpointer user_data)
+{
+  if (msg->method != SOUP_METHOD_POST || g_strcmp0 (soup_message_headers_get_content_type (msg->request_headers, NULL), "application/sdp") != 0
+      || g_strcmp0 (soup_message_headers_get_one (msg->request_headers, "Authorization"), "Bearer test-token") != 0)
+    {
+      soup_message_set_status (msg, SOUP_STATUS_BAD_REQUEST);
+      return;
+    }
+
+  soup_message_set_status (msg, SOUP_STATUS_CREATED);
+  soup_message_headers_replace (msg->response_headers, "Location", "/whip/session/1");
+  soup_message_set_response (msg, "application/sdp", SOUP_MEMORY_STATIC, WHIP_TEST_ANSWER, strlen (WHIP_TEST_ANSWER));
+}
+#endif
+
+static void
+whip_test_on_answer (const gchar *answer, const gchar *resource, const GError *error, gpointer user_data)
+{
+  WhipTestState *state = user_data;
+  state->failed = error != NULL;
+  state->answer = g_strdup (answer);
+  state->resource = g_strdup (resource);
+  g_main_loop_quit (state->loop);
+}
+
+// Publishes an offer to a local WHIP stand-in and checks the answer and session URL come back from the single round trip
+void
+test_vtx_whip_exchange (void)
+{
+  GError *error = NULL;
+  SoupServer *server = soup_server_new (NULL, NULL);
+  soup_server_add_handler (server, "/whip", whip_test_handler, NULL, NULL);
+  TEST_ASSERT_TRUE (soup_server_listen_local (server, 0, SOUP_SERVER_LISTEN_IPV4_ONLY, &error));
+
+  GSList *uris = soup_server_get_uris (server);
+#if SOUP_CHECK_VERSION(3, 0, 0)
+  guint port = g_uri_get_port (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+#else
+  guint port = soup_uri_get_port (uris->data);
+  g_slist_free_full (uris, (GDestroyNotify) soup_uri_free);
+#endif
+
+  gchar *endpoint = g_strdup_printf ("http://127.0.0.1:%u/whip", port);
+  gchar *expected_resource = g_strdup_printf ("http://127.0.0.1:%u/whip/session/1", port);
+  WhipTestState state = { 0 };
+  state.loop = g_main_loop_new (NULL, FALSE);
+
+  SoupSession *session = soup_session_new ();
+  vtx_whip_exchange (session, endpoint, "test-token", "v=0\r\n", whip_test_on_answer, &state);
+  g_main_loop_run (state.loop);
+
+  TEST_ASSERT_FALSE (state.failed);
+  TEST_ASSERT_EQUAL_STRING (WHIP_TEST_ANSWER, state.answer);
+  TEST_ASSERT_EQUAL_STRING (expected_resource, state.resource);
+
+  // A rejected request reports an error instead of an answer
+  g_clear_pointer (&state.answer, g_free);
+  g_clear_pointer (&state.resource, g_free);
+  vtx_whip_exchange (session, endpoint, NULL, "v=0\r\n", whip_test_on_answer, &state);
+  g_main_loop_run (state.loop);
+  TEST_ASSERT_TRUE (state.failed);
+  TEST_ASSERT_NULL (state.answer);
+
+  g_object_unref (session);
+  g_main_loop_unref (state.loop);
+  g_free (state.answer);
+  g_free (state.resource);
+  g_free (endpoint);
+  g_free (expected_resource);
+  soup_server_disconnect (server);
+  g_object_unref (server);
+}
+
+// Builds a chain from a JSON graph, checks the element handles and property values, and that invalid entries are rejected
+// before any element is created
+void
+test_vtx_graph_build (void)
+{
+  gchar *error_msg = NULL;
+  JsonNode *video = json_from_string ("[{\"factory\": \"videotestsrc\", \"name\": \"src\", \"properties\": {\"num-buffers\": 1, \"pattern\": \"ball\"}},"
+                                      " {\"caps\": \"video/x-raw,width=320,height=240\"},"
+                                      " {\"factory\": \"fakesink\", \"name\": \"sink\", \"properties\": {\"sync\": false}}]",
+                                      NULL);
+  TEST_ASSERT_NOT_NULL (video);
+
+  VtxGraph *graph = vtx_graph_parse (video, NULL, &error_msg);
+  TEST_ASSERT_NOT_NULL (graph);
+
+  GstElement *pipe = gst_pipeline_new ("graph-test");
+  GstElement *video_tail = NULL;
+  GstElement *audio_tail = NULL;
+  TEST_ASSERT_TRUE (vtx_graph_build (graph, GST_BIN (pipe), &video_tail, &audio_tail, &error_msg));
+  TEST_ASSERT_NULL (audio_tail);
+  TEST_ASSERT_EQUAL_PTR (vtx_graph_get_element (graph, "sink"), video_tail);
+
+  gint num_buffers = 0;
+  gint pattern = 0;
+  GstElement *src = vtx_graph_get_element (graph, "src");
+  TEST_ASSERT_NOT_NULL (src);
+  g_object_get (src, "num-buffers", &num_buffers, "pattern", &pattern, NULL);
+  TEST_ASSERT_EQUAL_INT (1, num_buffers);
+  TEST_ASSERT_EQUAL_INT (18, pattern); // GST_VIDEO_TEST_SRC_BALL
+
+  // The linked chain negotiates the caps node and runs to EOS
+  gst_element_set_state (pipe, GST_STATE_PLAYING);
+  GstBus *bus = gst_element_get_bus (pipe);
+  GstMessage *msg = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  TEST_ASSERT_NOT_NULL (msg);
+  TEST_ASSERT_EQUAL_INT (GST_MESSAGE_EOS, GST_MESSAGE_TYPE (msg));
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipe, GST_STATE_NULL);
+  gst_object_unref (pipe);
+  vtx_graph_free (graph);
+  json_node_unref (video);
+
+  // Unknown element, unknown property and out-of-range value
+  const gchar *invalid[] = {
+    "[{\"factory\": \"nosuchelement\"}]",
+    "[{\"factory\": \"videotestsrc\", \"properties\": {\"no-such-property\": 1}}]",
+    "[{\"factory\": \"videotestsrc\", \"properties\": {\"num-buffers\": -5}}]",
+  };
+  for (guint i = 0; i < G_N_ELEMENTS (invalid); i++)
+    {
+      JsonNode *node = json_from_string (invalid[i], NULL);
+      TEST_ASSERT_NULL (vtx_graph_parse (node, NULL, &error_msg));
+      TEST_ASSERT_NOT_NULL (error_msg);
+      gst_println ("Rejected graph: %s", error_msg);
+      g_clear_pointer (&error_msg, g_free);
+      json_node_unref (node);
+    }
+}
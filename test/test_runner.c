@@ -13,6 +13,9 @@ extern void test_vtx_supported_codec_inspection (void);
 extern void test_vtx_msp_flight_controller (void);
 extern void test_vtx_encoder_pipeline (void);
 extern void test_vtx_webrtc_loopback (void);
+extern void test_vtx_signaling_codec (void);
+extern void test_vtx_whip_exchange (void);
+extern void test_vtx_graph_build (void);
 
 void
 setUp (void)
@@ -41,5 +44,8 @@ main (void)
   RUN_TEST (test_vtx_encoder_pipeline);
   RUN_TEST (test_vtx_webrtc_loopback);
   RUN_TEST (test_vtx_msp_flight_controller);
+  RUN_TEST (test_vtx_signaling_codec);
+  RUN_TEST (test_vtx_whip_exchange);
+  RUN_TEST (test_vtx_graph_build);
   return UNITY_END ();
 }